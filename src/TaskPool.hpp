@@ -71,9 +71,10 @@ public:
 					if (task != nullptr) {
 						this->processor(task);
 						busyThreads--;
+					} else {
+						// only idle threads wait, a busy thread takes the next task right away
+						std::this_thread::sleep_for(std::chrono::milliseconds(10));
 					}
-
-					std::this_thread::sleep_for(std::chrono::milliseconds(10));
 				}
 
 			});
@@ -113,6 +114,15 @@ public:
 		return noTasksLeft && noTasksInProcess;
 	}
 
+	// until the queue is empty and the tasks taken from it are finished
+	void waitTillDone() {
+
+		while (!isWorkDone()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+	}
+
 	void waitTillEmpty() {
 
 		while (true) {
@@ -0,0 +1,491 @@
+#include "arguments/Arguments.hpp"
+#include "unsuck.hpp"
+
+#include <cmath>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * @brief
+ * the part of json needed by the benchmark results, numbers are doubles
+ */
+struct JsonValue
+{
+    enum Type
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    Type type = Null;
+    double number = 0.0;
+    string text;
+    vector<JsonValue> items;
+    vector<pair<string, JsonValue>> members;
+
+    const JsonValue *get(const string &key) const
+    {
+        for (auto &[name, value] : members)
+        {
+            if (name == key)
+                return &value;
+        }
+        return nullptr;
+    }
+};
+
+struct JsonReader
+{
+    const string &text;
+    size_t at = 0;
+
+    JsonReader(const string &text) : text{text} {}
+
+    void skipSpace()
+    {
+        while (at < text.size() && isspace((unsigned char)text[at]))
+            at++;
+    }
+
+    bool parseString(string &out)
+    {
+        if (text[at] != '"')
+            return false;
+        at++;
+        while (at < text.size() && text[at] != '"')
+        {
+            char c = text[at++];
+            if (c == '\\' && at < text.size())
+            {
+                char e = text[at++];
+                switch (e)
+                {
+                case 'n':
+                    c = '\n';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                case 'u':
+                    // labels and names are ascii, other code points are kept as '?'
+                    at += 4;
+                    c = '?';
+                    break;
+                default:
+                    c = e;
+                }
+            }
+            out += c;
+        }
+        if (at >= text.size())
+            return false;
+        at++;
+        return true;
+    }
+
+    bool parse(JsonValue &value)
+    {
+        skipSpace();
+        if (at >= text.size())
+            return false;
+
+        char c = text[at];
+        if (c == '{')
+        {
+            value.type = JsonValue::Object;
+            at++;
+            skipSpace();
+            if (at < text.size() && text[at] == '}')
+            {
+                at++;
+                return true;
+            }
+            while (at < text.size())
+            {
+                skipSpace();
+                string key;
+                if (!parseString(key))
+                    return false;
+                skipSpace();
+                if (at >= text.size() || text[at] != ':')
+                    return false;
+                at++;
+                value.members.push_back({key, JsonValue()});
+                if (!parse(value.members.back().second))
+                    return false;
+                skipSpace();
+                if (at < text.size() && text[at] == ',')
+                {
+                    at++;
+                    continue;
+                }
+                if (at < text.size() && text[at] == '}')
+                {
+                    at++;
+                    return true;
+                }
+                return false;
+            }
+            return false;
+        }
+        if (c == '[')
+        {
+            value.type = JsonValue::Array;
+            at++;
+            skipSpace();
+            if (at < text.size() && text[at] == ']')
+            {
+                at++;
+                return true;
+            }
+            while (at < text.size())
+            {
+                value.items.push_back(JsonValue());
+                if (!parse(value.items.back()))
+                    return false;
+                skipSpace();
+                if (at < text.size() && text[at] == ',')
+                {
+                    at++;
+                    continue;
+                }
+                if (at < text.size() && text[at] == ']')
+                {
+                    at++;
+                    return true;
+                }
+                return false;
+            }
+            return false;
+        }
+        if (c == '"')
+        {
+            value.type = JsonValue::String;
+            return parseString(value.text);
+        }
+        if (text.compare(at, 4, "true") == 0 || text.compare(at, 5, "false") == 0)
+        {
+            value.type = JsonValue::Bool;
+            value.number = c == 't' ? 1.0 : 0.0;
+            at += c == 't' ? 4 : 5;
+            return true;
+        }
+        if (text.compare(at, 4, "null") == 0)
+        {
+            at += 4;
+            return true;
+        }
+
+        // nan and inf are written by ostream for failed benchmarks
+        const char *begin = text.c_str() + at;
+        char *end = nullptr;
+        value.type = JsonValue::Number;
+        value.number = strtod(begin, &end);
+        if (end == begin)
+            return false;
+        at += end - begin;
+        return true;
+    }
+};
+
+struct Samples
+{
+    string unit;
+    bool higher_is_better = true;
+    vector<double> values;
+
+    double mean() const
+    {
+        double sum = 0.0;
+        for (double value : values)
+            sum += value;
+        return values.empty() ? 0.0 : sum / values.size();
+    }
+
+    // a run whose measurement failed wrote nan, inf or null
+    bool failed() const
+    {
+        for (double value : values)
+        {
+            if (!isfinite(value))
+                return true;
+        }
+        return false;
+    }
+
+    // sample variance, 0 for a single run
+    double variance() const
+    {
+        if (values.size() < 2)
+            return 0.0;
+        double m = mean();
+        double sum = 0.0;
+        for (double value : values)
+            sum += (value - m) * (value - m);
+        return sum / (values.size() - 1);
+    }
+};
+
+/**
+ * @brief
+ * a set of benchmark runs, the samples of every file are merged by benchmark name. files of the same commit
+ * give more samples, like a run with --repeat
+ */
+struct ResultSet
+{
+    vector<string> labels;
+    vector<string> names;
+    map<string, Samples> samples;
+
+    bool load(const string &path)
+    {
+        ifstream in(path);
+        if (!in.is_open())
+        {
+            cout << path << " cannot be read" << endl;
+            return false;
+        }
+        stringstream ss;
+        ss << in.rdbuf();
+        string text = ss.str();
+
+        JsonValue root;
+        JsonReader reader(text);
+        const JsonValue *results = nullptr;
+        if (!reader.parse(root) || !(results = root.get("results")) || results->type != JsonValue::Array)
+        {
+            cout << path << " is not a benchmark result, run the benchmark with --json" << endl;
+            return false;
+        }
+
+        const JsonValue *label = root.get("label");
+        labels.push_back(label && !label->text.empty() ? label->text : fs::path(path).filename().string());
+
+        for (auto &result : results->items)
+        {
+            const JsonValue *name = result.get("name");
+            if (!name || name->type != JsonValue::String)
+                continue;
+
+            auto iter = samples.find(name->text);
+            if (iter == samples.end())
+            {
+                names.push_back(name->text);
+                iter = samples.insert({name->text, Samples()}).first;
+            }
+            Samples &entry = iter->second;
+            if (const JsonValue *unit = result.get("unit"))
+                entry.unit = unit->text;
+            if (const JsonValue *better = result.get("better"))
+                entry.higher_is_better = better->text != "lower";
+
+            // results written before --repeat only have the value
+            const JsonValue *values = result.get("samples");
+            const JsonValue *value = result.get("value");
+            if (values && values->type == JsonValue::Array && !values->items.empty())
+            {
+                for (auto &item : values->items)
+                    entry.values.push_back(item.type == JsonValue::Null ? NAN : item.number);
+            }
+            else if (value)
+            {
+                entry.values.push_back(value->type == JsonValue::Null ? NAN : value->number);
+            }
+        }
+        return true;
+    }
+
+    string label() const
+    {
+        string out;
+        for (auto &label : labels)
+            out += (out.empty() ? "" : "+") + label;
+        return out;
+    }
+};
+
+// two sided critical value of student's t for df degrees of freedom
+static double studentT(double confidence, double df)
+{
+    // df 1 to 30, then infinity
+    static const double t90[] = {6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812,
+                                 1.796, 1.782, 1.771, 1.761, 1.753, 1.746, 1.740, 1.734, 1.729, 1.725,
+                                 1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697, 1.645};
+    static const double t95[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042, 1.960};
+    static const double t99[] = {63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169,
+                                 3.106, 3.055, 3.012, 2.977, 2.947, 2.921, 2.898, 2.878, 2.861, 2.845,
+                                 2.831, 2.819, 2.807, 2.797, 2.787, 2.779, 2.771, 2.763, 2.756, 2.750, 2.576};
+
+    const double *table = confidence >= 0.99 ? t99 : confidence >= 0.95 ? t95 : t90;
+    // rounding df down keeps the interval conservative
+    int row = (int)floor(df);
+    if (row < 1)
+        row = 1;
+    return row > 30 ? table[30] : table[row - 1];
+}
+
+struct Comparison
+{
+    // relative change of the mean in percent, positive is better whatever the direction of the unit
+    double gain = 0.0;
+    // half width of the confidence interval of gain, -1 without repeated runs on both sides
+    double interval = -1.0;
+    bool regression = false;
+    bool improvement = false;
+};
+
+/**
+ * @brief
+ * welch's t interval of the difference of the means, relative to the base mean. a change counts when it is
+ * larger than threshold percent and, with repeated runs, its interval excludes zero
+ */
+static Comparison compare(const Samples &base, const Samples &current, double threshold, double confidence)
+{
+    Comparison c;
+    double base_mean = base.mean();
+    if (base_mean == 0.0 || !isfinite(base_mean))
+        return c;
+
+    double sign = base.higher_is_better ? 1.0 : -1.0;
+    c.gain = sign * (current.mean() - base_mean) / fabs(base_mean) * 100.0;
+
+    size_t nb = base.values.size();
+    size_t nc = current.values.size();
+    bool significant = true;
+    if (nb >= 2 && nc >= 2)
+    {
+        double vb = base.variance() / nb;
+        double vc = current.variance() / nc;
+        double se = sqrt(vb + vc);
+        double df = (vb + vc) * (vb + vc) / (vb * vb / (nb - 1) + vc * vc / (nc - 1));
+        if (!isfinite(df))
+            df = (double)(nb + nc - 2);
+        c.interval = studentT(confidence, df) * se / fabs(base_mean) * 100.0;
+        significant = fabs(c.gain) > c.interval;
+    }
+
+    c.regression = significant && c.gain < -threshold;
+    c.improvement = significant && c.gain > threshold;
+    return c;
+}
+
+static string formatValue(double value)
+{
+    double magnitude = fabs(value);
+    return formatNumber(value, magnitude >= 100.0 ? 0 : magnitude >= 1.0 ? 2 : 4);
+}
+
+int main(int argc, char **argv)
+{
+    Arguments args(argc, argv);
+    args.addArgument("help,h", "Display help information");
+    args.addArgument("base", "json results of the baseline, several files of the same commit are merged into more samples");
+    args.addArgument("new", "json results of the change, several files are merged like --base");
+    args.addArgument("threshold", "smallest change in percent that is flagged, 5 default");
+    args.addArgument("confidence", "confidence level of the intervals, [0.90, 0.95, 0.99], 0.95 default");
+    args.addArgument("filter", "only compare the benchmarks whose name contains this text, e.g. gdem/ or codec/");
+
+    if (args.has("help") || !args.has("base") || !args.has("new"))
+    {
+        cout << endl
+             << "compares two sets of benchmark results (benchmark --json, --repeat for confidence intervals)" << endl
+             << "exits with 1 if a benchmark regressed or failed, 2 if the results cannot be read" << endl
+             << endl
+             << args.usage() << endl;
+        exit(args.has("help") ? 0 : 2);
+    }
+
+    double threshold = args.get("threshold").as<double>(5.0);
+    double confidence = args.get("confidence").as<double>(0.95);
+    string filter = args.get("filter").as<string>("");
+
+    ResultSet base, current;
+    for (auto &path : args.get("base").as<vector<string>>())
+    {
+        if (!base.load(path))
+            return 2;
+    }
+    for (auto &path : args.get("new").as<vector<string>>())
+    {
+        if (!current.load(path))
+            return 2;
+    }
+
+    cout << "base: " << base.label() << endl;
+    cout << "new:  " << current.label() << endl;
+    cout << "threshold " << formatNumber(threshold, 1) << "%, " << formatNumber(confidence * 100.0, 0)
+         << "% confidence intervals, + is better" << endl
+         << endl;
+
+    cout << rightPad("benchmark", 34) << rightPad("unit", 12) << rightPad("base", 14) << rightPad("new", 14)
+         << rightPad("change", 10) << rightPad("+-", 9) << "n" << endl;
+
+    int regressions = 0;
+    int improvements = 0;
+    int failures = 0;
+    auto row = [&](const string &name, const string &unit, const string &base_value, const string &new_value,
+                   const string &change, const string &interval, const string &runs, const string &status)
+    {
+        cout << rightPad(name, 34) << rightPad(unit, 12) << rightPad(base_value, 14) << rightPad(new_value, 14)
+             << rightPad(change, 10) << rightPad(interval, 9) << rightPad(runs, 8) << status << endl;
+    };
+
+    for (auto &name : base.names)
+    {
+        if (!filter.empty() && name.find(filter) == string::npos)
+            continue;
+
+        const Samples &b = base.samples[name];
+        auto iter = current.samples.find(name);
+        if (iter == current.samples.end())
+        {
+            row(name, b.unit, formatValue(b.mean()), "-", "", "", "", "missing");
+            continue;
+        }
+
+        const Samples &n = iter->second;
+        string runs = to_string(b.values.size()) + "/" + to_string(n.values.size());
+        if (n.failed() || b.failed())
+        {
+            // a failed run of the change counts like a regression, a failed baseline only cannot be compared
+            failures += n.failed() ? 1 : 0;
+            row(name, b.unit, b.failed() ? "failed" : formatValue(b.mean()), n.failed() ? "failed" : formatValue(n.mean()),
+                "-", "-", runs, n.failed() ? "FAILED" : "base failed");
+            continue;
+        }
+
+        Comparison c = compare(b, n, threshold, confidence);
+        string status = c.regression ? "REGRESSION" : c.improvement ? "improved" : "";
+        regressions += c.regression ? 1 : 0;
+        improvements += c.improvement ? 1 : 0;
+
+        row(name, b.unit, formatValue(b.mean()), formatValue(n.mean()),
+            (c.gain >= 0.0 ? "+" : "") + formatNumber(c.gain, 1) + "%",
+            c.interval >= 0.0 ? formatNumber(c.interval, 1) + "%" : "-", runs, status);
+    }
+
+    for (auto &name : current.names)
+    {
+        if ((filter.empty() || name.find(filter) != string::npos) && !base.samples.count(name))
+        {
+            const Samples &n = current.samples[name];
+            failures += n.failed() ? 1 : 0;
+            row(name, n.unit, "-", n.failed() ? "failed" : formatValue(n.mean()), "", "", "", n.failed() ? "FAILED" : "new");
+        }
+    }
+
+    cout << endl
+         << regressions << " regressions, " << failures << " failures, " << improvements << " improvements" << endl;
+
+    return regressions + failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file fixtures.cpp
+ * @brief
+ * synthetic ASTGTM tiles for the benchmarks
+ *
+ * 用分形噪声生成与真实GDEM同尺寸、同命名、同格式的测试数据，含海洋(0)与空洞(-9999)，相邻图块边缘一致
+ *
+ */
+
+#include "fixtures.h"
+#include "unsuck.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#include <gdal_priv.h>
+#include <ogr_srs_api.h>
+
+using namespace std;
+
+static const int FIXTURE_SIZE = 3601;
+static const int16_t FIXTURE_NODATA = -9999;
+
+FixtureArea fixtureArea(int count, int lon0, int lat0)
+{
+    FixtureArea area;
+    area.lon0 = lon0;
+    area.lat0 = lat0;
+    count = max(count, 1);
+    area.cols = (int)ceil(sqrt((double)count));
+    area.rows = (count + area.cols - 1) / area.cols;
+    for (int i = 0; i < count; i++)
+        area.cells.push_back({lon0 + i % area.cols, lat0 + i / area.cols});
+    return area;
+}
+
+static inline uint32_t latticeHash(int64_t x, int64_t y, uint32_t seed)
+{
+    uint64_t h = (uint64_t)x * 0x9E3779B97F4A7C15ull ^ (uint64_t)y * 0xC2B2AE3D27D4EB4Full ^ seed;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 29;
+    return (uint32_t)h;
+}
+
+// value noise in [-1, 1] on a lattice of unit spacing
+static double valueNoise(double x, double y, uint32_t seed)
+{
+    double fx = floor(x);
+    double fy = floor(y);
+    int64_t ix = (int64_t)fx;
+    int64_t iy = (int64_t)fy;
+    double tx = x - fx;
+    double ty = y - fy;
+    tx = tx * tx * (3.0 - 2.0 * tx);
+    ty = ty * ty * (3.0 - 2.0 * ty);
+
+    auto corner = [&](int64_t cx, int64_t cy)
+    { return latticeHash(cx, cy, seed) * (2.0 / 4294967295.0) - 1.0; };
+    double top = corner(ix, iy) + (corner(ix + 1, iy) - corner(ix, iy)) * tx;
+    double bottom = corner(ix, iy + 1) + (corner(ix + 1, iy + 1) - corner(ix, iy + 1)) * tx;
+    return top + (bottom - top) * ty;
+}
+
+int16_t fixtureHeight(int64_t gx, int64_t gy, uint32_t seed)
+{
+    // voids: discs of 20 to 80 arc seconds, about one per 1/16 degree block in 40
+    const int64_t cell = 225;
+    int64_t cx = gx / cell;
+    int64_t cy = gy / cell;
+    uint32_t v = latticeHash(cx, cy, seed ^ 0x5A5A5A5Au);
+    if (v % 40 == 0)
+    {
+        double radius = 20.0 + (v >> 8) % 60;
+        double dx = gx - (cx * cell + cell / 2);
+        double dy = gy - (cy * cell + cell / 2);
+        if (dx * dx + dy * dy < radius * radius)
+            return FIXTURE_NODATA;
+    }
+
+    // fbm, the first octave has a wave length of about half a degree
+    double x = gx / 1800.0;
+    double y = gy / 1800.0;
+    double sum = 0.0;
+    double amplitude = 1.0;
+    for (int octave = 0; octave < 7; octave++)
+    {
+        sum += amplitude * valueNoise(x, y, seed + octave);
+        x *= 2.03;
+        y *= 2.03;
+        amplitude *= 0.5;
+    }
+
+    // about a fifth is below sea level and becomes ocean
+    double h = (sum + 0.25) * 2500.0;
+    if (h <= 0.0)
+        return 0;
+    return (int16_t)min(h, 8800.0);
+}
+
+static bool writeFixture(const string &path, int lon, int lat, uint32_t seed)
+{
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if (!driver)
+        return false;
+
+    char **options = nullptr;
+    options = CSLSetNameValue(options, "TILED", "YES");
+    options = CSLSetNameValue(options, "BLOCKXSIZE", "256");
+    options = CSLSetNameValue(options, "BLOCKYSIZE", "256");
+    options = CSLSetNameValue(options, "COMPRESS", "DEFLATE");
+    options = CSLSetNameValue(options, "PREDICTOR", "2");
+    options = CSLSetNameValue(options, "ZLEVEL", "1");
+
+    // written under a temporary name, an interrupted run leaves no truncated fixture behind
+    string tmp = path + ".tmp.tif";
+    GDALDataset *dataset = driver->Create(tmp.c_str(), FIXTURE_SIZE, FIXTURE_SIZE, 1, GDT_Int16, options);
+    CSLDestroy(options);
+    if (!dataset)
+        return false;
+
+    double step = 1.0 / 3600.0;
+    double geotransform[6] = {lon - 0.5 * step, step, 0.0, lat + 1.0 + 0.5 * step, 0.0, -step};
+    dataset->SetGeoTransform(geotransform);
+    dataset->SetProjection(SRS_WKT_WGS84_LAT_LONG);
+    GDALRasterBand *band = dataset->GetRasterBand(1);
+    band->SetNoDataValue(FIXTURE_NODATA);
+
+    // row 0 is at lat + 1, pixel centers are on whole arc seconds
+    int64_t gx0 = (int64_t)(lon + 180) * 3600;
+    int64_t gy0 = (int64_t)(90 - lat - 1) * 3600;
+    const int rows = 256;
+    vector<int16_t> data((size_t)FIXTURE_SIZE * rows);
+    bool ok = true;
+    for (int r0 = 0; r0 < FIXTURE_SIZE && ok; r0 += rows)
+    {
+        int n = min(rows, FIXTURE_SIZE - r0);
+        for (int r = 0; r < n; r++)
+        {
+            for (int c = 0; c < FIXTURE_SIZE; c++)
+                data[(size_t)r * FIXTURE_SIZE + c] = fixtureHeight(gx0 + c, gy0 + r0 + r, seed);
+        }
+        ok = band->RasterIO(GF_Write, 0, r0, FIXTURE_SIZE, n, data.data(), FIXTURE_SIZE, n, GDT_Int16, 0, 0) == CE_None;
+    }
+    GDALClose(dataset);
+
+    error_code ec;
+    if (ok)
+        fs::rename(tmp, path, ec);
+    if (!ok || ec)
+    {
+        fs::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+bool writeFixtures(const string &dir, const FixtureArea &area, uint32_t seed)
+{
+    GDALAllRegister();
+    fs::create_directories(dir);
+
+    int written = 0;
+    double tStart = now();
+    for (auto &[lon, lat] : area.cells)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "ASTGTM_%c%02d%c%03d_dem.tif", lat < 0 ? 'S' : 'N', abs(lat), lon < 0 ? 'W' : 'E', abs(lon));
+        string path = dir + "/" + name;
+        if (fs::exists(path))
+            continue;
+
+        if (!writeFixture(path, lon, lat, seed))
+        {
+            cout << path << " cannot be written" << endl;
+            return false;
+        }
+        written++;
+    }
+
+    if (written > 0)
+        cout << "generated " << written << " fixtures in " << formatNumber(now() - tStart, 1) << "s" << endl;
+    return true;
+}
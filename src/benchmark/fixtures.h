@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief
+ * cells of count synthetic gdem tiles, a block of about sqrt(count) x sqrt(count) degrees with its south west corner
+ * at (lon0, lat0)
+ */
+struct FixtureArea
+{
+    int lon0 = 100;
+    int lat0 = 30;
+    int cols = 0;
+    int rows = 0;
+    // (lon, lat) of the south west corner of every tile
+    std::vector<std::pair<int, int>> cells;
+
+    double west() const { return lon0; }
+    double south() const { return lat0; }
+    double east() const { return lon0 + cols; }
+    double north() const { return lat0 + rows; }
+};
+
+FixtureArea fixtureArea(int count, int lon0 = 100, int lat0 = 30);
+
+/**
+ * @brief
+ * height of the synthetic terrain at arc second (gx, gy) counted from (-180, 90): fractal (fbm) relief, ocean (0)
+ * below sea level, -9999 in a few void discs. a function of the global position, shared tile edges match
+ */
+int16_t fixtureHeight(int64_t gx, int64_t gy, uint32_t seed);
+
+/**
+ * @brief
+ * writes ASTGTM_NyyExxx_dem.tif (3601x3601 int16, 256x256 tiles, deflate, nodata -9999) of every cell of the area
+ * into dir, existing files are kept. false if one cannot be written
+ */
+bool writeFixtures(const std::string &dir, const FixtureArea &area, uint32_t seed);
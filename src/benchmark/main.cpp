@@ -0,0 +1,1024 @@
+#include "arguments/Arguments.hpp"
+#include "unsuck.hpp"
+#include "resample.h"
+#include "reduce.h"
+#include "gdem.h"
+#include "tiffprobe.h"
+#include "tilecodec.h"
+#include "TaskPool.hpp"
+#include "metrics.h"
+#include "fixtures.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <unordered_map>
+#include <iostream>
+
+#include <gdal_priv.h>
+using namespace std;
+
+struct BenchmarkResult
+{
+    string name;
+    // one value per run of --repeat
+    vector<double> samples;
+    string unit;
+    bool higher_is_better;
+
+    double mean() const
+    {
+        double sum = 0.0;
+        for (double sample : samples)
+            sum += sample;
+        return samples.empty() ? 0.0 : sum / samples.size();
+    }
+};
+
+// a JSON string literal of text
+static string jsonString(const string &text)
+{
+    string out = "\"";
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out += string("\\") + (char)c;
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        }
+        else
+            out += (char)c;
+    }
+    return out + "\"";
+}
+
+// a JSON number, null for the nan or inf of a failed measurement
+static string jsonNumber(double value)
+{
+    if (!isfinite(value))
+        return "null";
+    ostringstream ss;
+    ss.precision(9);
+    ss << value;
+    return ss.str();
+}
+
+/**
+ * @brief
+ * results of a benchmark run, written as json so that runs of different commits can be compared
+ */
+struct BenchmarkResults
+{
+    vector<BenchmarkResult> results;
+    map<string, string> config;
+
+    // a result of the same name from an earlier run gets another sample
+    void add(string name, double value, string unit, bool higher_is_better = true)
+    {
+        for (auto &result : results)
+        {
+            if (result.name == name)
+            {
+                result.samples.push_back(value);
+                return;
+            }
+        }
+        results.push_back({name, {value}, unit, higher_is_better});
+    }
+
+    bool write(const string &path, const string &label)
+    {
+        ofstream out(path);
+        if (!out.is_open())
+            return false;
+
+        out << "{\n  \"format\": \"gdem-benchmark-1\",\n  \"label\": " << jsonString(label) << ",\n  \"time\": "
+            << (int64_t)chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count()
+            << ",\n  \"cpus\": " << getCpuData().numProcessors << ",\n  \"config\": {";
+        bool first = true;
+        for (auto &[key, value] : config)
+        {
+            out << (first ? "" : ", ") << jsonString(key) << ": " << jsonString(value);
+            first = false;
+        }
+        out << "},\n  \"results\": [";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            auto &result = results[i];
+            out << (i > 0 ? "," : "") << "\n    {\"name\": " << jsonString(result.name) << ", \"value\": "
+                << jsonNumber(result.mean()) << ", \"unit\": " << jsonString(result.unit) << ", \"better\": \""
+                << (result.higher_is_better ? "higher" : "lower") << "\", \"samples\": [";
+            for (size_t j = 0; j < result.samples.size(); j++)
+                out << (j > 0 ? ", " : "") << jsonNumber(result.samples[j]);
+            out << "]}";
+        }
+        out << "\n  ]\n}\n";
+        return out.good();
+    }
+};
+
+// synthetic terrain, a function of the global pixel position so that shared block edges match
+static int16_t syntheticHeight(int64_t gx, int64_t gy)
+{
+    double x = gx * 0.002;
+    double y = gy * 0.002;
+    double h = 800.0 * sin(x) * cos(y * 0.7) + 300.0 * sin(x * 3.1 + y * 2.3) + 60.0 * cos(x * 17.0 - y * 13.0);
+    return (int16_t)(h + 1000.0);
+}
+
+struct SyntheticSource
+{
+    unordered_map<int, shared_ptr<const int16_t>> blocks;
+
+    shared_ptr<const int16_t> fetch(int bx, int by)
+    {
+        int key = by * BLOCKS_X + bx;
+        auto iter = blocks.find(key);
+        if (iter != blocks.end())
+            return iter->second;
+
+        shared_ptr<int16_t> data(new int16_t[BLOCK_WIDTH * BLOCK_WIDTH], default_delete<int16_t[]>());
+        for (int r = 0; r < BLOCK_WIDTH; r++)
+        {
+            for (int c = 0; c < BLOCK_WIDTH; c++)
+            {
+                data.get()[r * BLOCK_WIDTH + c] = syntheticHeight((int64_t)bx * BLOCK_PIXELS + c, (int64_t)by * BLOCK_PIXELS + r);
+            }
+        }
+        blocks[key] = data;
+        return data;
+    }
+};
+
+// renders a row of tiles at level z starting at (x, y) and returns tiles/s
+double benchmarkResampling(SyntheticSource &source, Resampling method, int z, int x, int y, int tiles, int tile_size)
+{
+    vector<int16_t> data(tile_size * tile_size);
+    double step = 180.0 / (1 << z);
+
+    auto render = [&](int i)
+    {
+        double west = -180.0 + (x + i) * step;
+        double north = 90.0 - y * step;
+        Resampler resampler([&](int bx, int by)
+                            { return source.fetch(bx, by); });
+        resampler.resample(method, west, north - step, west + step, north, tile_size, tile_size, data.data());
+    };
+
+    // warm up the synthetic blocks
+    for (int i = 0; i < tiles; i++)
+        render(i);
+
+    double tStart = now();
+    for (int i = 0; i < tiles; i++)
+        render(i);
+    double duration = now() - tStart;
+
+    return tiles / duration;
+}
+
+// reduces four synthetic children into a parent tile and returns parent tiles/s
+double benchmarkReduction(Reduction reduction, int tiles, int tile_size)
+{
+    vector<int16_t> child(tile_size * tile_size);
+    vector<int16_t> parent(tile_size * tile_size);
+    for (int y = 0; y < tile_size; y++)
+    {
+        for (int x = 0; x < tile_size; x++)
+        {
+            child[y * tile_size + x] = syntheticHeight(x * 3, y * 3);
+        }
+    }
+
+    double tStart = now();
+    for (int i = 0; i < tiles; i++)
+    {
+        for (int q = 0; q < 4; q++)
+            reduceQuadrant(child.data(), tile_size, tile_size, reduction, q / 2, q % 2, parent.data());
+    }
+    double duration = now() - tStart;
+
+    return tiles / duration;
+}
+
+/**
+ * @brief
+ * writes the header of a 3601x3601 int16 GeoTIFF like ASTGTM_NxxExxx_dem.tif, tiled 256x256 and uncompressed.
+ * the pixels are left as a hole in the file (sparse), only the header is real
+ */
+static void writeSyntheticTiff(const string &path, int lon, int lat)
+{
+    const uint32_t size = 3601;
+    const uint32_t tile = 256;
+    const uint32_t tiles = ((size + tile - 1) / tile) * ((size + tile - 1) / tile);
+    const uint32_t tile_bytes = tile * tile * 2;
+
+    vector<uint8_t> out;
+    auto u16 = [&](uint16_t v)
+    { out.push_back(v & 0xff); out.push_back(v >> 8); };
+    auto u32 = [&](uint32_t v)
+    { u16(v & 0xffff); u16(v >> 16); };
+    auto f64 = [&](double v)
+    { uint64_t bits; memcpy(&bits, &v, 8); u32((uint32_t)bits); u32((uint32_t)(bits >> 32)); };
+
+    struct Tag
+    {
+        uint16_t tag;
+        uint16_t type;
+        uint32_t count;
+        uint32_t value;
+    };
+
+    // extra data after the IFD: tile offsets, byte counts, scale, tiepoint, geokeys, nodata
+    const uint32_t num_tags = 16;
+    uint32_t extra = 8 + 2 + num_tags * 12 + 4;
+    uint32_t offsets_at = extra;
+    uint32_t counts_at = offsets_at + tiles * 4;
+    uint32_t scale_at = counts_at + tiles * 4;
+    uint32_t tiepoint_at = scale_at + 3 * 8;
+    uint32_t geokeys_at = tiepoint_at + 6 * 8;
+    uint32_t nodata_at = geokeys_at + 16 * 2;
+    uint32_t data_at = (nodata_at + 6 + 4095) / 4096 * 4096;
+
+    vector<Tag> tags = {
+        {256, 4, 1, size},
+        {257, 4, 1, size},
+        {258, 3, 1, 16},
+        {259, 3, 1, 1},
+        {262, 3, 1, 1},
+        {277, 3, 1, 1},
+        {284, 3, 1, 1},
+        {322, 3, 1, tile},
+        {323, 3, 1, tile},
+        {324, 4, tiles, offsets_at},
+        {325, 4, tiles, counts_at},
+        {339, 3, 1, 2},
+        {33550, 12, 3, scale_at},
+        {33922, 12, 6, tiepoint_at},
+        {34735, 3, 16, geokeys_at},
+        {42113, 2, 6, nodata_at},
+    };
+
+    out.push_back('I');
+    out.push_back('I');
+    u16(42);
+    u32(8);
+    u16(num_tags);
+    for (auto &tag : tags)
+    {
+        u16(tag.tag);
+        u16(tag.type);
+        u32(tag.count);
+        // SHORT values are left justified in the value field
+        if (tag.type == 3 && tag.count == 1)
+        {
+            u16((uint16_t)tag.value);
+            u16(0);
+        }
+        else
+        {
+            u32(tag.value);
+        }
+    }
+    u32(0);
+
+    for (uint32_t i = 0; i < tiles; i++)
+        u32(data_at + i * tile_bytes);
+    for (uint32_t i = 0; i < tiles; i++)
+        u32(tile_bytes);
+
+    double step = 1.0 / 3600.0;
+    f64(step);
+    f64(step);
+    f64(0.0);
+    for (double v : {0.0, 0.0, 0.0, lon - 0.5 * step, lat + 1.0 + 0.5 * step, 0.0})
+        f64(v);
+    // GTModelType geographic, GTRasterType area, GeographicType WGS 84
+    for (uint16_t v : {1, 1, 0, 3, 1024, 0, 1, 2, 1025, 0, 1, 1, 2048, 0, 1, 4326})
+        u16(v);
+    for (char c : string("-9999"))
+        out.push_back(c);
+    out.push_back(0);
+
+    {
+        ofstream file(path, ios::binary);
+        file.write((const char *)out.data(), out.size());
+    }
+    fs::resize_file(path, (uintmax_t)data_at + (uintmax_t)tiles * tile_bytes);
+}
+
+// opens every file of dir with probeTiff and with GDALOpen, returns files/s of both
+void benchmarkProbe(const string &dir, int files, double &probe_rate, double &gdal_rate)
+{
+    fs::create_directories(dir);
+    vector<string> paths;
+    for (int i = 0; i < files; i++)
+    {
+        int lat = i / 360 % 180 - 90;
+        int lon = i % 360 - 180;
+        char name[64];
+        snprintf(name, sizeof(name), "ASTGTM_%c%02d%c%03d_dem.tif", lat < 0 ? 'S' : 'N', abs(lat), lon < 0 ? 'W' : 'E', abs(lon));
+        string path = dir + "/" + name;
+        if (!fs::exists(path))
+            writeSyntheticTiff(path, lon, lat);
+        paths.push_back(path);
+    }
+
+    // the first pass warms the page cache for both
+    int valid = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        double tStart = now();
+        for (auto &path : paths)
+        {
+            TiffInfo info;
+            valid += probeTiff(path, info) && info.width == 3601 && info.has_geotransform ? 1 : 0;
+        }
+        probe_rate = paths.size() / (now() - tStart);
+    }
+    if (valid != 2 * files)
+        cout << "probeTiff rejected " << (2 * files - valid) << " files" << endl;
+
+    GDALAllRegister();
+    double tStart = now();
+    for (auto &path : paths)
+    {
+        GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(path.c_str(), GA_ReadOnly));
+        if (!poDataset)
+            continue;
+        double geotransform[6];
+        poDataset->GetGeoTransform(geotransform);
+        int hasNoData = 0;
+        poDataset->GetRasterBand(1)->GetNoDataValue(&hasNoData);
+        GDALClose(poDataset);
+    }
+    gdal_rate = paths.size() / (now() - tStart);
+}
+
+/**
+ * @brief
+ * ns per tile spent on scheduling: tiles of a side x side level go through a TaskPool in tasks of
+ * task_size x task_size tiles and the work per tile is trivial
+ */
+double benchmarkScheduling(int task_size, int side)
+{
+    struct Task
+    {
+        vector<pair<int, int>> tiles;
+    };
+
+    atomic<int64_t> checksum = 0;
+    size_t numThreads = getCpuData().numProcessors * 2;
+
+    double tStart = now();
+    {
+        TaskPool<Task> pool(numThreads, [&](shared_ptr<Task> task)
+                            {
+                                int64_t sum = 0;
+                                for (auto &tile : task->tiles)
+                                    sum += tile.first ^ tile.second;
+                                checksum += sum; });
+
+        for (int x0 = 0; x0 < side; x0 += task_size)
+        {
+            for (int y0 = 0; y0 < side; y0 += task_size)
+            {
+                auto task = make_shared<Task>();
+                for (int x = x0; x < min(x0 + task_size, side); x++)
+                {
+                    for (int y = y0; y < min(y0 + task_size, side); y++)
+                        task->tiles.push_back({x, y});
+                }
+                pool.addTask(task);
+            }
+        }
+        pool.waitTillDone();
+        pool.close();
+    }
+    double duration = now() - tStart;
+
+    return duration * 1e9 / ((double)side * side);
+}
+
+struct CodecTile
+{
+    int width;
+    int height;
+    vector<int16_t> data;
+};
+
+/**
+ * @brief
+ * up to count tiles of a tileset written by gdem (png or tif, NODATA already 0), synthetic tiles if dir is empty
+ */
+static vector<CodecTile> loadCodecCorpus(const string &dir, int count, int tile_size)
+{
+    vector<CodecTile> corpus;
+    if (!dir.empty() && fs::exists(dir))
+    {
+        GDALAllRegister();
+        for (auto &entry : fs::recursive_directory_iterator(dir))
+        {
+            string extension = entry.path().extension().string();
+            if ((int)corpus.size() >= count || !entry.is_regular_file() || (extension != ".png" && extension != ".tif"))
+                continue;
+
+            GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(entry.path().string().c_str(), GA_ReadOnly));
+            if (!poDataset)
+                continue;
+            CodecTile tile{poDataset->GetRasterXSize(), poDataset->GetRasterYSize(), {}};
+            tile.data.resize((size_t)tile.width * tile.height);
+            // png tiles hold the int16 bits as uint16 like PngCodec writes them, reading them as int16 would clamp
+            // the negative heights
+            GDALDataType type = extension == ".png" ? GDT_UInt16 : GDT_Int16;
+            auto code = poDataset->RasterIO(GF_Read, 0, 0, tile.width, tile.height, tile.data.data(), tile.width, tile.height,
+                                            type, 1, nullptr, 0, 0, 0);
+            GDALClose(poDataset);
+            if (code == CE_None)
+                corpus.push_back(move(tile));
+        }
+        return corpus;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        CodecTile tile{tile_size, tile_size, vector<int16_t>((size_t)tile_size * tile_size)};
+        for (int y = 0; y < tile_size; y++)
+        {
+            for (int x = 0; x < tile_size; x++)
+                tile.data[y * tile_size + x] = syntheticHeight((int64_t)i * tile_size + x, y);
+        }
+        corpus.push_back(move(tile));
+    }
+    return corpus;
+}
+
+/**
+ * @brief
+ * encodes and decodes every tile of the corpus, rates are MB/s of raw int16 heights
+ */
+static bool benchmarkCodec(const TileCodec &codec, const vector<CodecTile> &corpus,
+                           double &encode_rate, double &decode_rate, double &bytes_per_tile, int &max_error)
+{
+    vector<vector<uint8_t>> encoded(corpus.size());
+    double raw_bytes = 0;
+
+    double tStart = now();
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const CodecTile &tile = corpus[i];
+        if (!codec.encode(tile.data.data(), tile.width, tile.height, nullptr, encoded[i]))
+            return false;
+        raw_bytes += tile.data.size() * sizeof(int16_t);
+    }
+    encode_rate = raw_bytes / (now() - tStart) / (1024.0 * 1024.0);
+
+    vector<vector<int16_t>> decoded(corpus.size());
+    tStart = now();
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        const CodecTile &tile = corpus[i];
+        decoded[i].resize(tile.data.size());
+        if (!codec.decode(encoded[i].data(), encoded[i].size(), tile.width, tile.height, decoded[i].data()))
+            return false;
+    }
+    decode_rate = raw_bytes / (now() - tStart) / (1024.0 * 1024.0);
+
+    double total = 0;
+    max_error = 0;
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+        total += encoded[i].size();
+        for (size_t k = 0; k < decoded[i].size(); k++)
+            max_error = max(max_error, abs(decoded[i][k] - corpus[i].data[k]));
+    }
+    bytes_per_tile = total / max<size_t>(corpus.size(), 1);
+    return true;
+}
+
+// tiles of level z of the geographic pyramid inside the area, at most limit
+static vector<pair<int, int>> areaTiles(TileMatrixSet &tms, const FixtureArea &area, int z, size_t limit)
+{
+    vector<pair<int, int>> tiles;
+    int x0 = (int)floor((area.west() + 180.0) / 360.0 * tms.tilesX(z));
+    int y0 = (int)floor((90.0 - area.north()) / 180.0 * tms.tilesY(z));
+    for (int y = y0; y < tms.tilesY(z) && tiles.size() < limit; y++)
+    {
+        for (int x = x0; x < tms.tilesX(z) && tiles.size() < limit; x++)
+        {
+            double west, south, east, north;
+            tms.tileLonLatBounds(z, x, y, west, south, east, north);
+            if (east > area.east() + 1e-9)
+                break;
+            if (west >= area.west() - 1e-9 && south >= area.south() - 1e-9 && north <= area.north() + 1e-9)
+                tiles.push_back({x, y});
+        }
+    }
+    return tiles;
+}
+
+// random lon/lat inside the area, the same for every run
+static void randomPoints(const FixtureArea &area, size_t count, vector<double> &lon, vector<double> &lat)
+{
+    mt19937 rng(42);
+    uniform_real_distribution<double> u(0.0, 1.0);
+    lon.resize(count);
+    lat.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        lon[i] = area.west() + u(rng) * area.cols;
+        lat[i] = area.south() + u(rng) * area.rows;
+    }
+}
+
+// points/s of getElevation and of the batch getElevations, the blocks are cached by the first pass
+void benchmarkGetElevation(GdemPool &pool, State &state, const FixtureArea &area, size_t count,
+                           double &single_rate, double &batch_rate)
+{
+    vector<double> lon, lat, out(count);
+    randomPoints(area, count, lon, lat);
+
+    double sum = 0.0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        double tStart = now();
+        for (size_t i = 0; i < count; i++)
+            sum += pool.getElevation(lon[i], lat[i], state);
+        single_rate = count / (now() - tStart);
+    }
+
+    double tStart = now();
+    pool.getElevations(lon.data(), lat.data(), count, out.data(), state);
+    batch_rate = count / (now() - tStart);
+
+    if (sum == 0.0)
+        cout << "getElevation returned no heights" << endl;
+}
+
+// calls/s of contains with boxes of about a tile at max lod
+double benchmarkContains(GdemPool &pool, const FixtureArea &area, size_t count)
+{
+    vector<double> lon, lat;
+    randomPoints(area, count, lon, lat);
+
+    int found = 0;
+    double tStart = now();
+    for (size_t i = 0; i < count; i++)
+        found += pool.contains(lon[i] - 0.05, lat[i] - 0.05, lon[i] + 0.05, lat[i] + 0.05) ? 1 : 0;
+    double duration = now() - tStart;
+
+    if (found != (int)count)
+        cout << "contains missed " << (count - found) << " boxes" << endl;
+    return count / duration;
+}
+
+// tiles/s of makeElevation over the tiles, the second pass runs on a warm block cache
+double benchmarkMakeElevation(GdemPool &pool, State &state, const vector<pair<int, int>> &tiles, int z, int tile_size)
+{
+    TileMatrixSet &tms = pool.tileMatrixSet();
+    vector<int16_t> data((size_t)tile_size * tile_size);
+    double rate = 0.0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        double tStart = now();
+        for (auto &[x, y] : tiles)
+        {
+            double west, south, east, north;
+            tms.tileLonLatBounds(z, x, y, west, south, east, north);
+            pool.makeElevation(west, south, east, north, tile_size, tile_size, data.data(), state);
+        }
+        rate = tiles.size() / (now() - tStart);
+    }
+    return rate;
+}
+
+// ns per metrics::add and per metrics::Scope (two clock reads and a histogram bucket) of this thread
+void benchmarkMetrics(int64_t count, double &add_ns, double &scope_ns)
+{
+    double tStart = now();
+    for (int64_t i = 0; i < count; i++)
+        metrics::add(metrics::CACHE_HIT);
+    add_ns = (now() - tStart) * 1e9 / count;
+
+    tStart = now();
+    for (int64_t i = 0; i < count; i++)
+        metrics::Scope scope(metrics::SAMPLING);
+    scope_ns = (now() - tStart) * 1e9 / count;
+}
+
+// a counter of the metrics export of this process
+static uint64_t metricsCounter(const string &name)
+{
+    string text = metrics::json();
+    string key = "\"" + name + "\": ";
+    size_t at = text.find(key);
+    return at == string::npos ? 0 : stoull(text.substr(at + key.size()));
+}
+
+// million lookups/s of a TileCache of the default size, 90% of the keys are cached, from threads threads
+double benchmarkTileCache(int threads, int64_t lookups)
+{
+    State state;
+    TileCache cache;
+    int64_t cached = (int64_t)TileCache::DEFAULT_SIZE;
+    for (int64_t key = 0; key < cached; key++)
+        cache.insert(key, make_shared<DEMTileBlock>(0.0, 0.0), state);
+
+    double tStart = now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]()
+                             {
+                                 mt19937 rng(t);
+                                 uniform_int_distribution<int64_t> keys(0, cached * 10 / 9);
+                                 shared_ptr<DEMTileBlock> block;
+                                 for (int64_t i = 0; i < lookups / threads; i++)
+                                 {
+                                     int64_t key = keys(rng);
+                                     if (!cache.tryGet(key, block))
+                                         cache.insert(key, make_shared<DEMTileBlock>(0.0, 0.0), state);
+                                 } });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    return lookups / (now() - tStart) / 1e6;
+}
+
+/**
+ * @brief
+ * tiles/s of makeElevationImage writing the children of the parents and of makeLodImage reducing them into the
+ * parents, png tiles below dir. false if a parent without one of its children does not decode to 0 in that
+ * quadrant
+ */
+bool benchmarkLod(GdemPool &pool, State &state, const vector<pair<int, int>> &parents, int z, int tile_size,
+                  const string &dir, double &render_rate, double &lod_rate)
+{
+    fs::remove_all(dir);
+    for (auto &[x, y] : parents)
+    {
+        fs::create_directories(dir + "/" + to_string(z) + "/" + to_string(x));
+        fs::create_directories(dir + "/" + to_string(z + 1) + "/" + to_string(x * 2));
+        fs::create_directories(dir + "/" + to_string(z + 1) + "/" + to_string(x * 2 + 1));
+    }
+
+    double tStart = now();
+    for (auto &[x, y] : parents)
+    {
+        for (int q = 0; q < 4; q++)
+            pool.makeElevationImage(z + 1, x * 2 + q / 2, y * 2 + q % 2, tile_size, tile_size, "grey", "png", dir, state);
+    }
+    render_rate = parents.size() * 4 / (now() - tStart);
+
+    tStart = now();
+    for (auto &[x, y] : parents)
+        pool.makeLodImage(z, x, y, tile_size, tile_size, "grey", "png", dir, state);
+    lod_rate = parents.size() / (now() - tStart);
+
+    // the missing child leaves NODATA in its quadrant, the written parent has to hold 0 there like a void
+    bool ok = true;
+    auto tilePath = [&](int tz, int tx, int ty)
+    { return dir + "/" + to_string(tz) + "/" + to_string(tx) + "/" + to_string(ty) + ".png"; };
+    if (!parents.empty() && fs::exists(tilePath(z + 1, parents[0].first * 2, parents[0].second * 2)))
+    {
+        auto [x, y] = parents[0];
+        fs::remove(tilePath(z + 1, x * 2 + 1, y * 2 + 1));
+        fs::remove(tilePath(z, x, y));
+        pool.makeLodImage(z, x, y, tile_size, tile_size, "grey", "png", dir, state);
+
+        vector<int16_t> parent((size_t)tile_size * tile_size, NODATA);
+        string path = tilePath(z, x, y);
+        ok = fs::exists(path);
+        if (ok)
+        {
+            auto bytes = readBinaryFile(path);
+            ok = createTileCodec("png")->decode(bytes->data_u8, bytes->size, tile_size, tile_size, parent.data());
+        }
+        for (int r = tile_size / 2; r < tile_size && ok; r++)
+        {
+            for (int c = tile_size / 2; c < tile_size && ok; c++)
+                ok = parent[(size_t)r * tile_size + c] == 0;
+        }
+        if (!ok)
+            cout << "makeLodImage: the quadrant of a missing child of " << z << "/" << x << "/" << y << " is not 0" << endl;
+    }
+
+    fs::remove_all(dir);
+    return ok;
+}
+
+/**
+ * @brief
+ * runs the tiler on the fixtures, tileset and makelod up to max_lod, and returns its wall time. tiles is the count
+ * of written tiles from its metrics, -1 if the run failed
+ */
+double benchmarkEndToEnd(const string &tiler, const string &fixture_dir, const string &out_dir, int max_lod, int64_t &tiles)
+{
+    tiles = -1;
+    fs::remove_all(out_dir);
+    fs::create_directories(out_dir);
+
+    string metrics_dir = out_dir + "/metrics";
+    string command = "\"" + tiler + "\" --source \"" + fixture_dir + "\" --outdir \"" + out_dir + "/tiles\" --max_lod " +
+                     to_string(max_lod) + " --no_log --metrics \"" + metrics_dir + "\" > \"" + out_dir + "/run.log\" 2>&1";
+
+    double tStart = now();
+    int code = system(command.c_str());
+    double duration = now() - tStart;
+    if (code != 0)
+    {
+        cout << "the tiler failed, see " << out_dir << "/run.log" << endl;
+        return duration;
+    }
+
+    ifstream in(metrics_dir + "/metrics.json");
+    stringstream ss;
+    ss << in.rdbuf();
+    string text = ss.str();
+    size_t at = text.find("\"tiles_written\": ");
+    if (at != string::npos)
+        tiles = stoll(text.substr(at + 17));
+    return duration;
+}
+
+// one run of every benchmark, false if the fixtures cannot be written
+bool runBenchmarks(Arguments &args, const string &exe, BenchmarkResults &results)
+{
+    int tiles = args.get("tiles").as<int>(64);
+    int tile_size = args.get("tile_size").as<int>(256);
+
+    results.config["tiles"] = to_string(tiles);
+    results.config["tile_size"] = to_string(tile_size);
+
+    SyntheticSource source;
+
+    // (z, x, y) around 100E 30N, z=12 is the max_lod of 256px tiles, z=9 downsamples ~5x
+    struct Case
+    {
+        string name;
+        int z;
+        int x;
+        int y;
+    };
+    vector<Case> cases = {
+        {"max_lod", 12, 6599, 1365},
+        {"downsample", 9, 824, 170},
+    };
+    vector<Resampling> methods = {Resampling::Nearest, Resampling::Bilinear, Resampling::Bicubic, Resampling::Average};
+
+    cout << rightPad("case", 12) << rightPad("resampling", 12) << "tiles/s" << endl;
+    for (auto &c : cases)
+    {
+        for (auto method : methods)
+        {
+            double throughput = benchmarkResampling(source, method, c.z, c.x, c.y, tiles, tile_size);
+            cout << rightPad(c.name, 12) << rightPad(toString(method), 12) << formatNumber(throughput, 1) << endl;
+            results.add("resample/" + c.name + "/" + toString(method), throughput, "tiles/s");
+        }
+    }
+
+    cout << endl;
+    cout << rightPad("case", 12) << rightPad("reduction", 12) << "tiles/s" << endl;
+    for (auto reduction : {Reduction::Mean, Reduction::Minimum, Reduction::Maximum, Reduction::Median})
+    {
+        double throughput = benchmarkReduction(reduction, tiles * 16, tile_size);
+        cout << rightPad("makelod", 12) << rightPad(toString(reduction), 12) << formatNumber(throughput, 1) << endl;
+        results.add("reduce/" + toString(reduction), throughput, "tiles/s");
+    }
+
+    cout << endl;
+    int side = args.get("schedule_side").as<int>(1024);
+    cout << rightPad("case", 12) << rightPad("task_size", 12) << "ns/tile" << endl;
+    for (int task_size : {1, 2, 4, 8, 16})
+    {
+        double overhead = benchmarkScheduling(task_size, side);
+        cout << rightPad("schedule", 12) << rightPad(to_string(task_size) + "x" + to_string(task_size), 12) << formatNumber(overhead, 1) << endl;
+        results.add("schedule/" + to_string(task_size) + "x" + to_string(task_size), overhead, "ns/tile", false);
+    }
+
+    if (args.has("probe_dir"))
+    {
+        double probe_rate, gdal_rate;
+        int files = args.get("probe_files").as<int>(20000);
+        benchmarkProbe(args.get("probe_dir").as<string>(), files, probe_rate, gdal_rate);
+
+        cout << endl;
+        cout << rightPad("case", 12) << rightPad("open", 12) << "files/s" << endl;
+        cout << rightPad("init", 12) << rightPad("probeTiff", 12) << formatNumber(probe_rate, 1) << endl;
+        cout << rightPad("init", 12) << rightPad("GDALOpen", 12) << formatNumber(gdal_rate, 1) << endl;
+        results.add("probe/probeTiff", probe_rate, "files/s");
+        results.add("probe/GDALOpen", gdal_rate, "files/s");
+    }
+
+    {
+        auto corpus = loadCodecCorpus(args.get("codec_dir").as<string>(""), args.get("codec_tiles").as<int>(256), tile_size);
+        GDALAllRegister();
+
+        TileCodecOptions lossy;
+        lossy.max_error = args.get("lerc_max_error").as<double>(1.0);
+        TileCodecOptions zstd;
+        zstd.level = args.get("zstd_level").as<int>(0);
+        TileCodecOptions delta = zstd;
+        delta.delta = true;
+        vector<pair<string, shared_ptr<TileCodec>>> codecs = {
+            {"png", createTileCodec("png")},
+            {"tif", createTileCodec("tif")},
+            {"webp", createTileCodec("webp")},
+            {"lerc", createTileCodec("lerc")},
+            {"lerc_lossy", createTileCodec("lerc", lossy)},
+            {"bin", createTileCodec("bin", zstd)},
+            {"bin_delta", createTileCodec("bin", delta)},
+        };
+
+        cout << endl;
+        cout << "codec corpus: " << corpus.size() << " tiles" << endl;
+        cout << rightPad("codec", 12) << rightPad("encode MB/s", 14) << rightPad("decode MB/s", 14)
+             << rightPad("bytes/tile", 14) << "max error" << endl;
+        for (auto &[name, codec] : codecs)
+        {
+            double encode_rate, decode_rate, bytes_per_tile;
+            int max_error;
+            if (!codec || corpus.empty() || !benchmarkCodec(*codec, corpus, encode_rate, decode_rate, bytes_per_tile, max_error))
+            {
+                cout << rightPad(name, 12) << "not supported by this gdal build" << endl;
+                continue;
+            }
+            cout << rightPad(name, 12) << rightPad(formatNumber(encode_rate, 1), 14) << rightPad(formatNumber(decode_rate, 1), 14)
+                 << rightPad(formatNumber(bytes_per_tile, 0), 14) << max_error << endl;
+            results.add("codec/" + name + "/encode", encode_rate, "MB/s");
+            results.add("codec/" + name + "/decode", decode_rate, "MB/s");
+            results.add("codec/" + name + "/size", bytes_per_tile, "bytes/tile", false);
+        }
+    }
+
+    cout << endl;
+    cout << rightPad("case", 12) << rightPad("threads", 12) << "Mlookups/s" << endl;
+    for (int threads : {1, 4})
+    {
+        double throughput = benchmarkTileCache(threads, 4000000);
+        cout << rightPad("TileCache", 12) << rightPad(to_string(threads), 12) << formatNumber(throughput, 2) << endl;
+        results.add("tilecache/" + to_string(threads) + "_threads", throughput, "Mlookups/s");
+    }
+
+    double add_ns, scope_ns;
+    benchmarkMetrics(10000000, add_ns, scope_ns);
+    cout << endl;
+    cout << rightPad("case", 12) << rightPad("call", 12) << "ns" << endl;
+    cout << rightPad("metrics", 12) << rightPad("add", 12) << formatNumber(add_ns, 2) << endl;
+    cout << rightPad("metrics", 12) << rightPad("Scope", 12) << formatNumber(scope_ns, 2) << endl;
+    results.add("metrics/add", add_ns, "ns", false);
+    results.add("metrics/scope", scope_ns, "ns", false);
+
+    // GdemPool on synthetic ASTGTM tiles
+    string fixture_dir = args.get("fixture_dir").as<string>("benchmark_fixtures");
+    string work_dir = args.get("work_dir").as<string>("benchmark_work");
+    int fixture_count = args.get("fixtures").as<int>(4);
+    uint32_t seed = (uint32_t)args.get("seed").as<int>(1);
+    FixtureArea area = fixtureArea(fixture_count);
+    results.config["fixtures"] = to_string(area.cells.size());
+    results.config["seed"] = to_string(seed);
+
+    cout << endl;
+    if (!writeFixtures(fixture_dir, area, seed))
+        return false;
+
+    {
+        State state;
+        GdemPool pool;
+        int max_lod = 0;
+        pool.init({{fixture_dir}}, max_lod, tile_size, state);
+
+        double single_rate, batch_rate;
+        benchmarkGetElevation(pool, state, area, 1000000, single_rate, batch_rate);
+        double contains_rate = benchmarkContains(pool, area, 1000000);
+
+        cout << endl;
+        cout << rightPad("case", 16) << rightPad("call", 16) << "points/s" << endl;
+        cout << rightPad("point", 16) << rightPad("getElevation", 16) << formatNumber(single_rate, 0) << endl;
+        cout << rightPad("point", 16) << rightPad("getElevations", 16) << formatNumber(batch_rate, 0) << endl;
+        cout << rightPad("box", 16) << rightPad("contains", 16) << formatNumber(contains_rate, 0) << endl;
+        results.add("gdem/getElevation", single_rate, "points/s");
+        results.add("gdem/getElevations", batch_rate, "points/s");
+        results.add("gdem/contains", contains_rate, "calls/s");
+
+        auto max_tiles = areaTiles(pool.tileMatrixSet(), area, max_lod, tiles);
+        auto parents = areaTiles(pool.tileMatrixSet(), area, max_lod - 1, max((size_t)tiles / 4, (size_t)1));
+        uint64_t lookups = metricsCounter("cache_hits") + metricsCounter("cache_misses");
+        uint64_t misses = metricsCounter("cache_misses");
+        double make_rate = benchmarkMakeElevation(pool, state, max_tiles, max_lod, tile_size);
+        // two passes over the tiles
+        double tile_lookups = (metricsCounter("cache_hits") + metricsCounter("cache_misses") - lookups) / (2.0 * max(max_tiles.size(), (size_t)1));
+        double tile_misses = (metricsCounter("cache_misses") - misses) / (2.0 * max(max_tiles.size(), (size_t)1));
+        double render_rate, lod_rate;
+        if (!benchmarkLod(pool, state, parents, max_lod - 1, tile_size, work_dir + "/lod", render_rate, lod_rate))
+            return false;
+
+        cout << endl;
+        cout << rightPad("case", 16) << rightPad("call", 20) << "tiles/s" << endl;
+        cout << rightPad("max_lod", 16) << rightPad("makeElevation", 20) << formatNumber(make_rate, 1) << endl;
+        cout << rightPad("max_lod", 16) << rightPad("makeElevationImage", 20) << formatNumber(render_rate, 1) << endl;
+        cout << rightPad("max_lod - 1", 16) << rightPad("makeLodImage", 20) << formatNumber(lod_rate, 1) << endl;
+        results.add("gdem/makeElevation", make_rate, "tiles/s");
+        results.add("gdem/makeElevationImage", render_rate, "tiles/s");
+        results.add("gdem/makeLodImage", lod_rate, "tiles/s");
+
+        // a written tile counts its block lookups, tiles and bytes and times sampling, encode, write, its queue wait
+        // and the reads of the missed blocks
+        double metrics_ns = (tile_lookups + 2.0) * add_ns + (4.0 + tile_misses) * scope_ns;
+        double overhead = render_rate > 0.0 ? metrics_ns * render_rate / 1e9 * 100.0 : 0.0;
+        cout << endl
+             << "metrics: " << formatNumber(tile_lookups, 1) << " lookups/tile, " << formatNumber(metrics_ns, 0)
+             << " ns/tile, " << formatNumber(overhead, 3) << "% of makeElevationImage" << endl;
+        results.add("metrics/tile_overhead", overhead, "%", false);
+    }
+
+    if (!args.has("no_e2e"))
+    {
+        string tiler = args.get("tiler").as<string>((fs::path(exe).parent_path() / "gdem_tileset").string());
+        int e2e_max_lod = args.get("e2e_max_lod").as<int>(11);
+        results.config["e2e_max_lod"] = to_string(e2e_max_lod);
+
+        int64_t written;
+        double duration = benchmarkEndToEnd(tiler, fixture_dir, work_dir + "/e2e", e2e_max_lod, written);
+
+        cout << endl;
+        cout << rightPad("case", 16) << rightPad("seconds", 12) << "tiles/s" << endl;
+        if (written >= 0)
+        {
+            cout << rightPad("tileset+lod", 16) << rightPad(formatNumber(duration, 2), 12) << formatNumber(written / duration, 1) << endl;
+            results.add("e2e/seconds", duration, "s", false);
+            results.add("e2e/tiles", written / duration, "tiles/s");
+        }
+        fs::remove_all(work_dir + "/e2e");
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Arguments args(argc, argv);
+    args.addArgument("help,h", "Display help information");
+    args.addArgument("tiles", "tiles per benchmark, 64 default");
+    args.addArgument("tile_size", "tile pixel size, 256 default");
+    args.addArgument("probe_dir", "directory of synthetic gdem tifs for the header probe benchmark, created if missing");
+    args.addArgument("probe_files", "number of synthetic gdem tifs, 20000 default");
+    args.addArgument("schedule_side", "side in tiles of the level of the scheduling benchmark, 1024 default");
+    args.addArgument("codec_dir", "tileset of png/tif tiles used as the corpus of the codec benchmark, synthetic tiles if missing");
+    args.addArgument("codec_tiles", "tiles of the codec corpus, 256 default");
+    args.addArgument("lerc_max_error", "max height error in meters of the lossy lerc row, 1.0 default");
+    args.addArgument("zstd_level", "zstd level of the bin rows, 0 (zstd default) default");
+    args.addArgument("fixture_dir", "directory of the synthetic ASTGTM tifs of the GdemPool and end-to-end benchmarks, benchmark_fixtures default");
+    args.addArgument("fixtures", "number of synthetic 1x1 degree ASTGTM tifs, 4 default");
+    args.addArgument("seed", "seed of the synthetic terrain, 1 default");
+    args.addArgument("work_dir", "directory of the tiles written by the benchmarks, benchmark_work default");
+    args.addArgument("tiler", "gdem_tileset executable of the end-to-end benchmark, the one next to this benchmark default");
+    args.addArgument("e2e_max_lod", "max lod of the end-to-end tileset+makelod run, 11 default");
+    args.addArgument("no_e2e", "skip the end-to-end benchmark");
+    args.addArgument("json", "write the results to this json file, e.g. to compare commits");
+    args.addArgument("label", "label of the run in the json results, e.g. a commit");
+    args.addArgument("repeat", "runs of every benchmark, the json results keep every sample for the confidence intervals of benchcompare, 1 default");
+
+    if (args.has("help"))
+    {
+        cout << endl
+             << args.usage() << endl;
+        exit(0);
+    }
+
+    int repeat = max(args.get("repeat").as<int>(1), 1);
+    BenchmarkResults results;
+    results.config["repeat"] = to_string(repeat);
+    for (int run = 0; run < repeat; run++)
+    {
+        if (repeat > 1)
+            cout << endl
+                 << "run " << (run + 1) << "/" << repeat << endl;
+        if (!runBenchmarks(args, argv[0], results))
+            return 1;
+    }
+
+    if (args.has("json"))
+    {
+        string path = args.get("json").as<string>();
+        if (!results.write(path, args.get("label").as<string>("")))
+        {
+            cout << path << " cannot be written" << endl;
+            return 1;
+        }
+        cout << endl
+             << "results written to " << path << endl;
+    }
+
+    return 0;
+}
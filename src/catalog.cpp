@@ -0,0 +1,275 @@
+/**
+ * @file catalog.cpp
+ * @brief
+ * source catalog of a run and the tiles affected by changed sources
+ *
+ * 比较本次与上次的源文件目录(路径、大小、修改时间、哈希)，得到需要重新生成的基础层瓦片及其所有上层瓦片
+ *
+ */
+
+#include "catalog.h"
+#include "unsuck.hpp"
+#include "logger.h"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <cmath>
+#include <cstring>
+#include <execution>
+#include <algorithm>
+
+using namespace std;
+
+bool SourceCatalog::load(const string &path)
+{
+    ifstream in(path);
+    if (!in.is_open())
+        return false;
+
+    string magic;
+    in >> magic >> max_lod >> tile_size;
+    if (magic != "GDEMCAT1")
+    {
+        logger::WARN(path + " is not a source catalog.");
+        return false;
+    }
+
+    entries.clear();
+    archives.clear();
+    string line;
+    getline(in, line);
+    stringstream header(line);
+    if (!(header >> tile_matrix_set))
+        tile_matrix_set = "geographic";
+    while (getline(in, line))
+    {
+        if (line.empty())
+            continue;
+
+        vector<string> fields;
+        stringstream ss(line);
+        string field;
+        while (getline(ss, field, '\t'))
+            fields.push_back(field);
+
+        if (fields[0] == "#zip" && fields.size() == 5)
+        {
+            ZipDirectory directory;
+            directory.path = fields[1];
+            directory.size = stoull(fields[2]);
+            directory.mtime = stoll(fields[3]);
+            archives.push_back(directory);
+            continue;
+        }
+        if (fields[0] == "#member" && fields.size() == 6 && archives.size() > 0)
+        {
+            ZipMember member;
+            member.name = fields[1];
+            member.method = (uint16_t)stoi(fields[2]);
+            member.compressed_size = stoull(fields[3]);
+            member.size = stoull(fields[4]);
+            member.offset = stoull(fields[5]);
+            archives.back().members.push_back(member);
+            continue;
+        }
+
+        if (fields.size() != 9)
+        {
+            logger::WARN("invalid catalog line: " + line);
+            continue;
+        }
+
+        CatalogEntry entry;
+        entry.path = fields[0];
+        entry.layer = stoi(fields[1]);
+        entry.size = stoull(fields[2]);
+        entry.mtime = stoll(fields[3]);
+        entry.hash = stoull(fields[4], nullptr, 16);
+        entry.west = stod(fields[5]);
+        entry.south = stod(fields[6]);
+        entry.east = stod(fields[7]);
+        entry.north = stod(fields[8]);
+        entries.push_back(entry);
+    }
+
+    return true;
+}
+
+bool SourceCatalog::save(const string &path) const
+{
+    string tmp = uniqueTempPath(path);
+    {
+        ofstream out(tmp);
+        if (!out.is_open())
+        {
+            logger::ERROR(tmp + " cannot be written.");
+            return false;
+        }
+
+        out << "GDEMCAT1 " << max_lod << " " << tile_size << " " << tile_matrix_set << "\n";
+        out.precision(17);
+        for (auto &entry : entries)
+        {
+            out << entry.path << "\t" << entry.layer << "\t" << entry.size << "\t" << entry.mtime << "\t"
+                << hex << entry.hash << dec << "\t"
+                << entry.west << "\t" << entry.south << "\t" << entry.east << "\t" << entry.north << "\n";
+        }
+
+        for (auto &directory : archives)
+        {
+            out << "#zip\t" << directory.path << "\t" << directory.size << "\t" << directory.mtime << "\t"
+                << directory.members.size() << "\n";
+            for (auto &member : directory.members)
+            {
+                out << "#member\t" << member.name << "\t" << member.method << "\t" << member.compressed_size << "\t"
+                    << member.size << "\t" << member.offset << "\n";
+            }
+        }
+    }
+
+    fs::rename(tmp, path);
+    return true;
+}
+
+bool statFile(const string &path, uint64_t &size, int64_t &mtime)
+{
+    error_code ec;
+    size = fs::file_size(path, ec);
+    if (ec)
+    {
+        size = 0;
+        mtime = 0;
+        return false;
+    }
+
+    auto time = fs::last_write_time(path, ec);
+    mtime = ec ? 0 : (int64_t)time.time_since_epoch().count();
+    return true;
+}
+
+void statCatalog(vector<CatalogEntry> &entries)
+{
+    for_each(std::execution::par, entries.begin(), entries.end(), [](CatalogEntry &entry)
+             { statFile(archivePath(entry.path), entry.size, entry.mtime); });
+}
+
+/**
+ * @brief
+ * 64 bit content hash, 8 bytes per step, only used to tell whether a file changed
+ */
+static uint64_t hashFile(const string &path)
+{
+    ifstream in(archivePath(path), ios::binary);
+    if (!in.is_open())
+        return 0;
+
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    vector<char> buffer(1 << 20);
+    while (in)
+    {
+        in.read(buffer.data(), buffer.size());
+        size_t n = (size_t)in.gcount();
+
+        // the tail is zero padded to whole words
+        size_t words = (n + 7) / 8;
+        fill(buffer.begin() + n, buffer.begin() + words * 8, 0);
+        const char *p = buffer.data();
+        for (size_t i = 0; i < words; i++)
+        {
+            uint64_t word;
+            memcpy(&word, p + i * 8, 8);
+            hash = (hash ^ word) * prime;
+            hash ^= hash >> 29;
+        }
+        hash ^= n;
+    }
+
+    // 0 means not hashed
+    return hash == 0 ? 1 : hash;
+}
+
+void diffCatalog(const SourceCatalog &previous, SourceCatalog &current, vector<CatalogEntry> &changed)
+{
+    map<string, const CatalogEntry *> before;
+    for (auto &entry : previous.entries)
+        before[entry.path] = &entry;
+
+    // files whose size or mtime changed are hashed in parallel
+    vector<pair<CatalogEntry *, const CatalogEntry *>> suspects;
+    for (auto &entry : current.entries)
+    {
+        auto iter = before.find(entry.path);
+        if (iter == before.end())
+        {
+            changed.push_back(entry);
+            continue;
+        }
+
+        const CatalogEntry *old = iter->second;
+        before.erase(iter);
+
+        if (old->layer != entry.layer)
+        {
+            changed.push_back(*old);
+            changed.push_back(entry);
+        }
+        else if (old->size == entry.size && old->mtime == entry.mtime)
+        {
+            entry.hash = old->hash;
+        }
+        else
+        {
+            suspects.push_back({&entry, old});
+        }
+    }
+
+    for_each(std::execution::par, suspects.begin(), suspects.end(), [](pair<CatalogEntry *, const CatalogEntry *> &suspect)
+             { suspect.first->hash = hashFile(suspect.first->path); });
+
+    for (auto &suspect : suspects)
+    {
+        if (suspect.second->hash == 0 || suspect.first->hash != suspect.second->hash)
+        {
+            changed.push_back(*suspect.second);
+            changed.push_back(*suspect.first);
+        }
+    }
+
+    // removed sources
+    for (auto &iter : before)
+        changed.push_back(*iter.second);
+}
+
+TileList dirtyTiles(const vector<CatalogEntry> &changed, const TileMatrixSet &tms, int max_lod, double margin)
+{
+    TileList tiles(max_lod + 1);
+
+    set<pair<int, int>> base;
+    for (auto &entry : changed)
+    {
+        int x_begin, y_begin, x_end, y_end;
+        tms.tileRange(max_lod, entry.west - margin, entry.south - margin, entry.east + margin, entry.north + margin,
+                      x_begin, y_begin, x_end, y_end);
+        for (int x = x_begin; x <= x_end; x++)
+        {
+            for (int y = y_begin; y <= y_end; y++)
+                base.insert({x, y});
+        }
+    }
+    tiles[max_lod].assign(base.begin(), base.end());
+
+    for (int z = max_lod - 1; z >= 0; z--)
+    {
+        auto &level = tiles[z];
+        for (auto &tile : tiles[z + 1])
+            level.push_back({tile.first / 2, tile.second / 2});
+        // children are sorted by (x, y), parents are not in general
+        sort(level.begin(), level.end());
+        level.erase(unique(level.begin(), level.end()), level.end());
+    }
+
+    return tiles;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "ziparchive.h"
+#include "tilematrixset.h"
+
+/**
+ * @brief
+ * one source file of a run, bounds are those of the data it contributes to
+ */
+struct CatalogEntry
+{
+    std::string path;
+    int layer = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    // 0 until the content had to be compared once
+    uint64_t hash = 0;
+    double west = 0.0;
+    double south = 0.0;
+    double east = 0.0;
+    double north = 0.0;
+};
+
+/**
+ * @brief
+ * source catalog of a run, <out_dir>/catalog.txt
+ *
+ * first line: "GDEMCAT1 <max_lod> <tile_size> <tile matrix set>", catalogs without a tile matrix set are geographic
+ * then one tab separated line per source: path, layer, size, mtime, hash, west, south, east, north.
+ * the central directories of zip archives follow as "#zip", path, size, mtime, n
+ * and n lines of "#member", name, method, compressed size, size, offset
+ */
+struct SourceCatalog
+{
+    int max_lod = -1;
+    int tile_size = 0;
+    std::string tile_matrix_set = "geographic";
+    std::vector<CatalogEntry> entries;
+    std::vector<ZipDirectory> archives;
+
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+};
+
+/**
+ * @brief
+ * size and mtime of a file, false if it does not exist
+ */
+bool statFile(const std::string &path, uint64_t &size, int64_t &mtime);
+
+/**
+ * @brief
+ * fills size and mtime of the entries in parallel, zip members get those of their archive
+ */
+void statCatalog(std::vector<CatalogEntry> &entries);
+
+/**
+ * @brief
+ * bounds of every source that was added, removed, moved to another layer or whose content changed.
+ * size and mtime decide whether a file is unchanged; if they differ the content is hashed and compared with
+ * the previous hash, so that touched but identical files stay clean. hashes are carried over into current
+ */
+void diffCatalog(const SourceCatalog &previous, SourceCatalog &current,
+                 std::vector<CatalogEntry> &changed);
+
+/**
+ * @brief
+ * tiles of level z, sorted by (x, y)
+ */
+typedef std::vector<std::vector<std::pair<int, int>>> TileList;
+
+/**
+ * @brief
+ * base tiles at max_lod touched by the changed bounds and all of their ancestors up to z = 0,
+ * bounds are grown by margin degrees for the resampling kernels and the shared tile edges
+ */
+TileList dirtyTiles(const std::vector<CatalogEntry> &changed, const TileMatrixSet &tms, int max_lod, double margin);
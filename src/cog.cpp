@@ -0,0 +1,509 @@
+/**
+ * @file cog.cpp
+ * @brief
+ * streaming cloud optimized GeoTIFF writer
+ *
+ * 渲染线程把瓦片直接压缩为tiff内部瓦片并乱序追加到临时文件，最后按COG顺序(IFD在前，小概览在前)
+ * 重新排列写出；DEFLATE由zlib直接完成，ZSTD/LERC借助gdal编码单个瓦片(见tilecodec)
+ *
+ */
+
+#include "cog.h"
+#include "tiffwriter.h"
+#include "tilecodec.h"
+#include "gdem.h"
+#include "logger.h"
+#include "unsuck.hpp"
+
+#include <cstring>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#include <zlib.h>
+
+using namespace std;
+
+bool parseCogCompression(const string &name, CogCompression &out)
+{
+    if (icompare(name, "none"))
+        out = CogCompression::None;
+    else if (icompare(name, "deflate"))
+        out = CogCompression::Deflate;
+    else if (icompare(name, "zstd"))
+        out = CogCompression::Zstd;
+    else if (icompare(name, "lerc"))
+        out = CogCompression::Lerc;
+    else if (icompare(name, "lerc_deflate"))
+        out = CogCompression::LercDeflate;
+    else if (icompare(name, "lerc_zstd"))
+        out = CogCompression::LercZstd;
+    else
+        return false;
+
+    return true;
+}
+
+string toString(CogCompression compression)
+{
+    switch (compression)
+    {
+    case CogCompression::None:
+        return "none";
+    case CogCompression::Deflate:
+        return "deflate";
+    case CogCompression::Zstd:
+        return "zstd";
+    case CogCompression::Lerc:
+        return "lerc";
+    case CogCompression::LercDeflate:
+        return "lerc_deflate";
+    case CogCompression::LercZstd:
+        return "lerc_zstd";
+    }
+    return "";
+}
+
+namespace
+{
+    class Writer
+    {
+    public:
+        template <typename T>
+        void put(T value)
+        {
+            size_t offset = bytes.size();
+            bytes.resize(offset + sizeof(T));
+            memcpy(bytes.data() + offset, &value, sizeof(T));
+        }
+
+        vector<uint8_t> bytes;
+    };
+
+    uint16_t compressionTag(CogCompression compression)
+    {
+        switch (compression)
+        {
+        case CogCompression::None:
+            return 1;
+        case CogCompression::Deflate:
+            return 8;
+        case CogCompression::Zstd:
+            return 50000;
+        default:
+            return 34887;
+        }
+    }
+
+    bool isLerc(CogCompression compression)
+    {
+        return compression == CogCompression::Lerc || compression == CogCompression::LercDeflate ||
+               compression == CogCompression::LercZstd;
+    }
+
+    /**
+     * @brief
+     * the tags of an int16 tiled image, tile offsets and byte counts are passed in since they may not fit the IFD
+     */
+    vector<TiffEntry> imageEntries(uint32_t width, uint32_t height, int block_size, CogCompression compression,
+                                   bool overview, const TiffEntry &offsets, const TiffEntry &counts)
+    {
+        vector<TiffEntry> entries;
+        entries.push_back(valuesEntry<uint32_t>(254, TIFF_LONG, {overview ? 1u : 0u}));
+        entries.push_back(valuesEntry<uint32_t>(256, TIFF_LONG, {width}));
+        entries.push_back(valuesEntry<uint32_t>(257, TIFF_LONG, {height}));
+        entries.push_back(valuesEntry<uint16_t>(258, TIFF_SHORT, {16}));
+        entries.push_back(valuesEntry<uint16_t>(259, TIFF_SHORT, {compressionTag(compression)}));
+        entries.push_back(valuesEntry<uint16_t>(262, TIFF_SHORT, {1}));
+        entries.push_back(valuesEntry<uint16_t>(277, TIFF_SHORT, {1}));
+        entries.push_back(valuesEntry<uint16_t>(284, TIFF_SHORT, {1}));
+        // horizontal differencing
+        if (compression == CogCompression::Deflate || compression == CogCompression::Zstd)
+            entries.push_back(valuesEntry<uint16_t>(317, TIFF_SHORT, {2}));
+        entries.push_back(valuesEntry<uint32_t>(322, TIFF_LONG, {(uint32_t)block_size}));
+        entries.push_back(valuesEntry<uint32_t>(323, TIFF_LONG, {(uint32_t)block_size}));
+        entries.push_back(offsets);
+        entries.push_back(counts);
+        entries.push_back(valuesEntry<uint16_t>(339, TIFF_SHORT, {2}));
+        return entries;
+    }
+
+    // lerc version 4, then none/deflate/zstd on top
+    TiffEntry lercEntry(CogCompression compression)
+    {
+        uint32_t additional = compression == CogCompression::LercDeflate ? 1 : (compression == CogCompression::LercZstd ? 2 : 0);
+        return valuesEntry<uint32_t>(50674, TIFF_LONG, {4, additional});
+    }
+
+    const char *gdalCompression(CogCompression compression)
+    {
+        switch (compression)
+        {
+        case CogCompression::Zstd:
+            return "ZSTD";
+        case CogCompression::Lerc:
+            return "LERC";
+        case CogCompression::LercDeflate:
+            return "LERC_DEFLATE";
+        case CogCompression::LercZstd:
+            return "LERC_ZSTD";
+        default:
+            return "NONE";
+        }
+    }
+
+}
+
+CogWriter::CogWriter(string spill_path, const TileMatrixSet &tms, int max_lod, int block_size, CogCompression compression)
+    : spill_path{spill_path}, tms{tms}, max_lod{max_lod}, block_size{block_size}, compression{compression}
+{
+    levels.resize(max_lod + 1);
+    for (int z = 0; z <= max_lod; z++)
+    {
+        Level &level = levels[z];
+        level.tiles_x = tms.tilesX(z);
+        level.tiles_y = tms.tilesY(z);
+        level.offsets.resize((size_t)level.tiles_x * level.tiles_y, 0);
+        level.sizes.resize((size_t)level.tiles_x * level.tiles_y, 0);
+    }
+}
+
+CogWriter::~CogWriter()
+{
+    if (spill.is_open())
+    {
+        spill.close();
+        error_code ec;
+        fs::remove(spill_path, ec);
+    }
+}
+
+bool CogWriter::open()
+{
+    spill.open(spill_path, ios::in | ios::out | ios::trunc | ios::binary);
+    if (!spill.is_open())
+    {
+        logger::ERROR("cannot create " + spill_path);
+        return false;
+    }
+
+    vector<int16_t> block((size_t)block_size * block_size, 0);
+    vector<uint8_t> encoded;
+    if (!encode(block.data(), block_size, encoded) || !decode(encoded, block.data(), block_size))
+    {
+        logger::ERROR(toString(compression) + " is not supported by gdal");
+        return false;
+    }
+
+    return true;
+}
+
+bool CogWriter::hasTile(int z, int x, int y)
+{
+    lock_guard<mutex> lock(spill_mutex);
+    Level &level = levels[z];
+    return level.sizes[(size_t)y * level.tiles_x + x] > 0;
+}
+
+bool CogWriter::writeTile(int z, int x, int y, const int16_t *data, int stride)
+{
+    // compressed on the calling worker, only the append is serialized
+    vector<uint8_t> encoded;
+    if (!encode(data, stride, encoded))
+    {
+        logger::ERROR("cannot encode cog tile " + to_string(z) + "/" + to_string(x) + "/" + to_string(y));
+        return false;
+    }
+
+    lock_guard<mutex> lock(spill_mutex);
+    spill.seekp(spill_size);
+    spill.write((const char *)encoded.data(), encoded.size());
+    if (!spill.good())
+    {
+        logger::ERROR("cannot write " + spill_path);
+        return false;
+    }
+
+    Level &level = levels[z];
+    level.offsets[(size_t)y * level.tiles_x + x] = spill_size;
+    level.sizes[(size_t)y * level.tiles_x + x] = (uint32_t)encoded.size();
+    spill_size += encoded.size();
+    return true;
+}
+
+bool CogWriter::readTile(int z, int x, int y, int16_t *data, int stride)
+{
+    vector<uint8_t> encoded;
+    {
+        lock_guard<mutex> lock(spill_mutex);
+        Level &level = levels[z];
+        size_t index = (size_t)y * level.tiles_x + x;
+        if (level.sizes[index] == 0)
+            return false;
+
+        encoded.resize(level.sizes[index]);
+        spill.seekg(level.offsets[index]);
+        spill.read((char *)encoded.data(), encoded.size());
+        if (!spill.good())
+        {
+            logger::ERROR("cannot read " + spill_path);
+            spill.clear();
+            return false;
+        }
+    }
+
+    return decode(encoded, data, stride);
+}
+
+bool CogWriter::encode(const int16_t *data, int stride, vector<uint8_t> &out) const
+{
+    size_t count = (size_t)block_size * block_size;
+    vector<uint16_t> block(count);
+    for (int y = 0; y < block_size; y++)
+        memcpy(&block[(size_t)y * block_size], data + (size_t)y * stride, block_size * sizeof(int16_t));
+
+    if (compression == CogCompression::None)
+    {
+        out.resize(count * sizeof(int16_t));
+        memcpy(out.data(), block.data(), out.size());
+        return true;
+    }
+
+    if (compression == CogCompression::Deflate)
+    {
+        for (int y = 0; y < block_size; y++)
+        {
+            uint16_t *row = &block[(size_t)y * block_size];
+            for (int x = block_size - 1; x > 0; x--)
+                row[x] = (uint16_t)(row[x] - row[x - 1]);
+        }
+
+        uLongf size = compressBound((uLong)(count * sizeof(int16_t)));
+        out.resize(size);
+        if (compress2(out.data(), &size, (const Bytef *)block.data(), (uLong)(count * sizeof(int16_t)), 6) != Z_OK)
+            return false;
+        out.resize(size);
+        return true;
+    }
+
+    // gdal encodes the block as the only strip of a tiff in memory, the bytes are the same as those of a tile
+    bool predictor = compression == CogCompression::Zstd;
+    return gdalEncodeBlock((const int16_t *)block.data(), block_size, block_size, gdalCompression(compression),
+                           predictor, 0.0, out);
+}
+
+bool CogWriter::decode(const vector<uint8_t> &in, int16_t *data, int stride) const
+{
+    size_t count = (size_t)block_size * block_size;
+    vector<uint16_t> block(count);
+
+    if (compression == CogCompression::None)
+    {
+        if (in.size() != count * sizeof(int16_t))
+            return false;
+        memcpy(block.data(), in.data(), in.size());
+    }
+    else if (compression == CogCompression::Deflate)
+    {
+        uLongf size = (uLongf)(count * sizeof(int16_t));
+        if (uncompress((Bytef *)block.data(), &size, in.data(), (uLong)in.size()) != Z_OK || size != count * sizeof(int16_t))
+            return false;
+
+        for (int y = 0; y < block_size; y++)
+        {
+            uint16_t *row = &block[(size_t)y * block_size];
+            for (int x = 1; x < block_size; x++)
+                row[x] = (uint16_t)(row[x] + row[x - 1]);
+        }
+    }
+    else
+    {
+        bool predictor = compression == CogCompression::Zstd;
+        if (!gdalDecodeBlock(in.data(), in.size(), block_size, block_size, gdalCompression(compression), predictor,
+                             (int16_t *)block.data()))
+            return false;
+    }
+
+    for (int y = 0; y < block_size; y++)
+        memcpy(data + (size_t)y * stride, &block[(size_t)y * block_size], block_size * sizeof(int16_t));
+    return true;
+}
+
+bool CogWriter::writeCog(const string &path, int z_min, int z_max, State &state)
+{
+    int count = z_max - z_min + 1;
+
+    // gdal's hint that the IFDs come first and the tiles are in row major order
+    string layout = "LAYOUT=IFDS_BEFORE_DATA\nBLOCK_ORDER=ROW_MAJOR\nKNOWN_INCOMPATIBLE_EDITION=NO\n";
+    char size[64];
+    snprintf(size, sizeof(size), "GDAL_STRUCTURAL_METADATA_SIZE=%06d bytes\n", (int)layout.size());
+    string ghost = string(size) + layout;
+    // IFDs start on a word boundary
+    ghost.resize((16 + ghost.size() + 7) / 8 * 8 - 16, '\0');
+
+    // ifd i is level z_max - i
+    auto levelEntries = [&](int i, const TiffEntry &offsets, const TiffEntry &counts)
+    {
+        int z = z_max - i;
+        Level &level = levels[z];
+        auto entries = imageEntries((uint32_t)level.tiles_x * block_size, (uint32_t)level.tiles_y * block_size,
+                                    block_size, compression, i > 0, offsets, counts);
+        if (isLerc(compression))
+            entries.push_back(lercEntry(compression));
+        // GDAL_NODATA, voids and missing tiles are NODATA. gdal reads it from every IFD
+        entries.push_back(asciiEntry(42113, to_string(NODATA).c_str()));
+
+        if (i == 0)
+        {
+            // corner pixels are centered on the tile bounds
+            double west, south, east, north;
+            tms.tileBounds(z, 0, 0, west, south, east, north);
+            double res_x = (east - west) / block_size;
+            double res_y = (north - south) / block_size;
+            entries.push_back(valuesEntry<double>(33550, TIFF_DOUBLE, {res_x, res_y, 0.0}));
+            entries.push_back(valuesEntry<double>(33922, TIFF_DOUBLE, {0.0, 0.0, 0.0, west - res_x * 0.5, north + res_y * 0.5, 0.0}));
+
+            bool geographic = tms.epsg() == 4326;
+            entries.push_back(valuesEntry<uint16_t>(34735, TIFF_SHORT, {1, 1, 0, 3,
+                                                                         1024, 0, 1, (uint16_t)(geographic ? 2 : 1),
+                                                                         1025, 0, 1, 1,
+                                                                         (uint16_t)(geographic ? 2048 : 3072), 0, 1, (uint16_t)tms.epsg()}));
+        }
+        return entries;
+    };
+
+    // data of the smallest overview first
+    vector<uint64_t> level_bytes(count, 0);
+    for (int i = 0; i < count; i++)
+    {
+        for (uint32_t bytes : levels[z_max - i].sizes)
+            level_bytes[i] += bytes;
+    }
+
+    // offsets and byte counts of more than one or two tiles are written right after their IFD
+    vector<uint64_t> ifd_position(count), offsets_position(count), counts_position(count);
+    uint64_t position = 16 + ghost.size();
+    for (int i = 0; i < count; i++)
+    {
+        size_t tiles = levels[z_max - i].sizes.size();
+        ifd_position[i] = position;
+        // inline or not, the values of the arrays do not change the size of the IFD
+        position += buildTiffIfd(levelEntries(i, externalEntry(324, TIFF_LONG8, tiles, 0), externalEntry(325, TIFF_LONG, tiles, 0)), 0, 0).size();
+        offsets_position[i] = position;
+        if (tiles * 8 > 8)
+            position += tiles * 8;
+        counts_position[i] = position;
+        if (tiles * 4 > 8)
+            position += tiles * 4;
+    }
+
+    vector<uint64_t> data_position(count);
+    for (int i = count - 1; i >= 0; i--)
+    {
+        data_position[i] = position;
+        position += level_bytes[i];
+    }
+
+    // the file offset of every tile of ifd i, in row major order
+    auto tileOffsets = [&](int i, const function<void(uint64_t offset, uint32_t bytes)> &callback)
+    {
+        Level &level = levels[z_max - i];
+        uint64_t offset = data_position[i];
+        for (uint32_t bytes : level.sizes)
+        {
+            callback(bytes > 0 ? offset : 0, bytes);
+            offset += bytes;
+        }
+    };
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out.is_open())
+    {
+        logger::ERROR("cannot create " + path);
+        return false;
+    }
+
+    Writer header;
+    putTiffHeader(header.bytes, ifd_position[0]);
+    out.write((const char *)header.bytes.data(), header.bytes.size());
+    out.write(ghost.data(), ghost.size());
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t tiles = levels[z_max - i].sizes.size();
+        TiffEntry offsets = externalEntry(324, TIFF_LONG8, tiles, offsets_position[i]);
+        TiffEntry counts = externalEntry(325, TIFF_LONG, tiles, counts_position[i]);
+        if (tiles * 8 <= 8 || tiles * 4 <= 8)
+        {
+            vector<uint64_t> small_offsets;
+            vector<uint32_t> small_counts;
+            tileOffsets(i, [&](uint64_t offset, uint32_t bytes)
+                        { small_offsets.push_back(offset); small_counts.push_back(bytes); });
+            if (tiles * 8 <= 8)
+                offsets = valuesEntry<uint64_t>(324, TIFF_LONG8, small_offsets);
+            if (tiles * 4 <= 8)
+                counts = valuesEntry<uint32_t>(325, TIFF_LONG, small_counts);
+        }
+
+        auto ifd = buildTiffIfd(levelEntries(i, offsets, counts), ifd_position[i], i + 1 < count ? ifd_position[i + 1] : 0);
+        out.write((const char *)ifd.data(), ifd.size());
+
+        // streamed in chunks, a level may have millions of tiles
+        Writer chunk;
+        auto flush = [&](bool force)
+        {
+            if (force || chunk.bytes.size() >= (1 << 20))
+            {
+                out.write((const char *)chunk.bytes.data(), chunk.bytes.size());
+                chunk.bytes.clear();
+            }
+        };
+        if (tiles * 8 > 8)
+        {
+            tileOffsets(i, [&](uint64_t offset, uint32_t bytes)
+                        { chunk.put<uint64_t>(offset); flush(false); });
+            flush(true);
+        }
+        if (tiles * 4 > 8)
+        {
+            tileOffsets(i, [&](uint64_t offset, uint32_t bytes)
+                        { chunk.put<uint32_t>(bytes); flush(false); });
+            flush(true);
+        }
+    }
+
+    int64_t tiles_total = 0;
+    for (int i = 0; i < count; i++)
+        tiles_total += levels[z_max - i].sizes.size();
+    state.name = "cog";
+    state.tilesTotal = tiles_total;
+    state.tilesProcessed = 0;
+
+    // tiles in cog order, read back from wherever the workers appended them
+    vector<char> buffer;
+    lock_guard<mutex> lock(spill_mutex);
+    for (int i = count - 1; i >= 0; i--)
+    {
+        Level &level = levels[z_max - i];
+        for (size_t t = 0; t < level.sizes.size(); t++)
+        {
+            if (level.sizes[t] > 0)
+            {
+                buffer.resize(level.sizes[t]);
+                spill.seekg(level.offsets[t]);
+                spill.read(buffer.data(), buffer.size());
+                out.write(buffer.data(), buffer.size());
+            }
+            state.tilesProcessed++;
+        }
+    }
+
+    if (!spill.good() || !out.good())
+    {
+        logger::ERROR("cannot write " + path);
+        spill.clear();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+#include "state.h"
+#include "tilematrixset.h"
+
+enum class CogCompression
+{
+    None,
+    Deflate,
+    Zstd,
+    Lerc,
+    LercDeflate,
+    LercZstd
+};
+
+bool parseCogCompression(const std::string &name, CogCompression &out);
+std::string toString(CogCompression compression);
+
+/**
+ * @brief
+ * streaming cloud optimized GeoTIFF of the levels of a tile matrix set.
+ *
+ * every rendered tile is one internal tiff tile of block_size x block_size pixels (the shared last row and column
+ * are dropped). tiles are compressed by the calling worker and appended in any order to a spill file, writeCog
+ * then lays them out as a BigTIFF with all IFDs first and the tile data of the smallest overview first.
+ * level z - 1 is the 2:1 overview of level z, so the overviews are the tiles of makelod, reduced over 2x2 pixel
+ * boxes to sit on the pixel-is-area grid gdal assumes for overviews. voids stay NODATA and are declared by the
+ * GDAL_NODATA tag. only the per tile offsets are kept in memory, never a raster
+ */
+class CogWriter
+{
+public:
+    CogWriter(std::string spill_path, const TileMatrixSet &tms, int max_lod, int block_size, CogCompression compression);
+    ~CogWriter();
+
+    // creates the spill file and checks that gdal can encode the compression, false if not
+    bool open();
+
+    int blockSize() const { return block_size; }
+
+    bool hasTile(int z, int x, int y);
+    // block_size x block_size pixels of data, rows are stride pixels apart
+    bool writeTile(int z, int x, int y, const int16_t *data, int stride);
+    bool readTile(int z, int x, int y, int16_t *data, int stride);
+
+    /**
+     * @brief
+     * writes level z_max at full resolution with the levels down to z_min as overviews
+     */
+    bool writeCog(const std::string &path, int z_min, int z_max, State &state);
+
+private:
+    struct Level
+    {
+        int tiles_x = 0;
+        int tiles_y = 0;
+        // position in the spill file and compressed size of every tile, 0 bytes if the tile is missing
+        std::vector<uint64_t> offsets;
+        std::vector<uint32_t> sizes;
+    };
+
+    bool encode(const int16_t *data, int stride, std::vector<uint8_t> &out) const;
+    bool decode(const std::vector<uint8_t> &in, int16_t *data, int stride) const;
+
+    std::string spill_path;
+    const TileMatrixSet &tms;
+    int max_lod;
+    int block_size;
+    CogCompression compression;
+
+    std::vector<Level> levels;
+    std::fstream spill;
+    uint64_t spill_size = 0;
+    std::mutex spill_mutex;
+};
@@ -17,25 +17,105 @@
 #include "gdem.h"
 #include "unsuck.hpp"
 #include "logger.h"
+#include "scanner.h"
+#include "numa.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <execution>
 #include <algorithm>
+#include <set>
 
 #include <gdal_priv.h>
 
 using namespace std;
 
 GdemPool::GdemPool()
+    : block_voids(new atomic<uint8_t>[BLOCKS_X * BLOCKS_Y]())
 {
+    tile_caches.push_back(make_unique<TileCache>());
     GDALAllRegister();
-    default_projection = R"(GEOGCS["WGS 84",DATUM["WGS_1984",SPHEROID["WGS 84",6378137,298.257223563,AUTHORITY["EPSG","7030"]],AUTHORITY["EPSG","6326"]],PRIMEM["Greenwich",0,AUTHORITY["EPSG","8901"]],UNIT["degree",0.0174532925199433,AUTHORITY["EPSG","9122"]],AUTHORITY["EPSG","4326"]])";
+    tile_matrix_set = createTileMatrixSet("geographic");
 }
 
 GdemPool::~GdemPool()
 {
 }
 
-void GdemPool::init(std::vector<std::string> sources, int &max_lod, int tile_size, State &state)
+/**
+ * @brief
+ * finds the 1x1 degree cell in names like ASTGTM_N30E100_dem, ASTGTMV003_S01W072_dem or N30E100
+ */
+static bool parseCellName(const string &file_name, int &ilon, int &ilat)
+{
+    for (size_t i = 0; i + 7 <= file_name.size(); i++)
+    {
+        char lat_char = toupper(file_name[i]);
+        char lon_char = toupper(file_name[i + 3]);
+        if ((lat_char != 'N' && lat_char != 'S') || (lon_char != 'E' && lon_char != 'W'))
+            continue;
+        if (!isdigit(file_name[i + 1]) || !isdigit(file_name[i + 2]) ||
+            !isdigit(file_name[i + 4]) || !isdigit(file_name[i + 5]) || !isdigit(file_name[i + 6]))
+            continue;
+
+        ilat = ::atoi(file_name.substr(i + 1, 2).c_str());
+        ilon = ::atoi(file_name.substr(i + 4, 3).c_str());
+        if (lat_char == 'S')
+            ilat = -ilat;
+        if (lon_char == 'W')
+            ilon = -ilon;
+
+        return ilat >= -90 && ilat < 90 && ilon >= -180 && ilon < 180;
+    }
+    return false;
+}
+
+/**
+ * @brief
+ * 3601x3601 tiles of whole degrees go to the 1x1 degree fast path, the cell comes from the geotransform,
+ * or from the file name if there is none
+ */
+static bool isGdemCell(const GeoSource &source, bool georeferenced, int &ilon, int &ilat)
+{
+    if (source.width != 3601 || source.height != 3601)
+        return false;
+
+    if (!georeferenced)
+        return parseCellName(fs::path(source.path).stem().string(), ilon, ilat);
+
+    const double *gt = source.geotransform;
+    const double step = 1.0 / 3600.0;
+    if (fabs(gt[1] - step) > 1e-9 || fabs(gt[5] + step) > 1e-9)
+        return false;
+
+    // pixel centers of the first column/row lie on whole degrees
+    double west = gt[0] + 0.5 * gt[1];
+    double north = gt[3] + 0.5 * gt[5];
+    ilon = (int)lround(west);
+    ilat = (int)lround(north) - 1;
+    if (fabs(west - ilon) > 1e-6 || fabs(north - (ilat + 1)) > 1e-6)
+        return false;
+
+    return ilat >= -90 && ilat < 90 && ilon >= -180 && ilon < 180;
+}
+
+// *_num.tif of gdem are the stack counts, not elevations
+static bool isSourceName(const string &path)
+{
+    return (iEndsWith(path, ".tif") || iEndsWith(path, ".tiff") || iEndsWith(path, ".vrt") || iEndsWith(path, ".hgt")) &&
+           !iEndsWith(path, "num.tif");
+}
+
+static bool hasVoids(const int16_t *data, size_t count)
+{
+    // branch free so that it vectorizes, blocks are small
+    int voids = 0;
+    for (size_t i = 0; i < count; i++)
+        voids |= data[i] <= NODATA ? 1 : 0;
+    return voids != 0;
+}
+
+void GdemPool::init(std::vector<std::vector<std::string>> layer_sources, int &max_lod, int tile_size, State &state)
 {
     cout << endl;
     cout << "=======================================" << endl;
@@ -49,605 +129,1115 @@ void GdemPool::init(std::vector<std::string> sources, int &max_lod, int tile_siz
     state.tilesProcessed = 0;
     state.duration = 0;
 
-    double min_resolution = 1.0 / 3600.0;
-    double resolution_at_lod0 = 180.0 / (tile_size - 1.0);
-    int lod = 0;
-    double resolution = resolution_at_lod0;
-    while (resolution > min_resolution)
+    if (layer_sources.size() > 32)
     {
-        lod++;
-        resolution /= 2.0;
-    }
-
-    if (max_lod < 0 || max_lod > lod)
-    {
-        max_lod = lod;
+        logger::ERROR("at most 32 source layers are supported.");
+        exit(1);
     }
 
-    vector<string> expanded;
-    while (sources.size() > 0)
+    // layer 0 is the gdem itself, the others are fill layers (srtm, bathymetry, ...) in priority order.
+    // files are validated by the scanning threads while the scan goes on
+    layers.resize(layer_sources.size());
+    double lastReport = now();
+    int tilesProcessed = 0;
+    mutex mtx;
+    DirectoryScanner scanner(getCpuData().numProcessors * 2);
+    for (size_t i = 0; i < layer_sources.size(); i++)
     {
-        auto path = sources.back();
-        sources.pop_back();
+        SourceLayer &layer = layers[i];
+        layer.name = i == 0 ? "gdem" : "fill" + formatNumber(i);
 
-        if (fs::is_directory(path))
+        auto addSource = [&](const string &path)
         {
-            for (auto &entry : fs::directory_iterator(path))
+            state.tilesTotal++;
+
+            GeoSource source;
+            bool georeferenced = readGeoSource(path, source);
+            if (source.width == 0)
             {
-                string str = entry.path().string();
-                sources.push_back(str);
+                logger::WARN(path + " cannot be opened.");
+                return;
             }
-        }
-        else if (fs::is_regular_file(path))
-        {
-            if (iEndsWith(path, "dem.tif"))
+
+            int ilon, ilat;
+            if (isGdemCell(source, georeferenced, ilon, ilat))
             {
-                expanded.push_back(path);
+                double bmin[2] = {(double)ilon, (double)ilat};
+                double bmax[2] = {ilon + 1.0, ilat + 1.0};
+
+                ilat += 90;
+                ilon += 180;
+                int key = ilat * 360 + ilon;
+
+                lock_guard<mutex> lock(mtx);
+                layer.tile_map[key] = path;
+                cell_layers[key] |= 1u << i;
+                tile_tree.Insert(bmin, bmax, key);
+
+                tilesProcessed = tilesProcessed + 1;
+                if (now() - lastReport > 1.0)
+                {
+                    state.tilesProcessed = tilesProcessed;
+                    state.duration = now() - tStart;
+
+                    lastReport = now();
+                }
             }
-        }
-    }
+            else if (georeferenced)
+            {
+                double bmin[2] = {source.west, source.south};
+                double bmax[2] = {source.east, source.north};
 
-    state.tilesTotal = expanded.size();
-    double lastReport = now();
-    int tilesProcessed = 0;
-    mutex mtx;
-    auto parallel = std::execution::par;
-    for_each(
-        parallel, expanded.begin(), expanded.end(), [&](string path)
-        {
-            GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(path.c_str(), GA_ReadOnly));
-            if (!poDataset)
+                lock_guard<mutex> lock(mtx);
+                source.id = (int)geo_sources.size();
+                source.layer = (int)i;
+                geo_sources.push_back(source);
+                source_tree.Insert(bmin, bmax, source.id);
+
+                tilesProcessed = tilesProcessed + 1;
+            }
+            else
             {
-                logger::WARN(path + " cannot be opened.");
-                return;
+                logger::WARN(path + " is neither a gdem tile nor a georeferenced lon/lat raster");
             }
+        };
 
-            int w = poDataset->GetRasterXSize();
-            int h = poDataset->GetRasterYSize();
-            int bpp = poDataset->GetRasterCount();
-            GDALClose(poDataset);
-
-            if (w == 3601 && h == 3601)
+        scanner.scan(
+            layer_sources[i], [&](const string &path)
             {
-                string file_name = fs::path(path).stem().string();
-                size_t index1 = file_name.find('_');
-                if (index1 < 0)
+                if (isSourceName(path))
                 {
-                    logger::WARN(path + "is not a valid gdem tif");
+                    addSource(path);
                 }
-                else
+                else if (iEndsWith(path, ".zip"))
                 {
-                    char lat_char = file_name.at(index1 + 1);
-                    string lat_str = file_name.substr(index1 + 2, 2);
-                    char lon_char = file_name.at(index1 + 4);
-                    string lon_str = file_name.substr(index1 + 5, 3);
-
-                    int ilat = ::atoi(lat_str.c_str());
-                    int ilon = ::atoi(lon_str.c_str());
-                    if (lat_char == 'S')
-                        ilat = -ilat;
-                    if (lon_char == 'W')
-                        ilon = -ilon;
-
-                    double bmin[2] = {(double)ilon, (double)ilat};
-                    double bmax[2] = {ilon + 1.0, ilat + 1.0};
-
-                    ilat += 90;
-                    ilon += 180;
-                    int key = ilat * 360 + ilon;
-
-                    lock_guard<mutex> lock(mtx);
-                    tile_map[key] = path;
-                    tile_tree.Insert(bmin,bmax,key);
-                    
-                    tilesProcessed = tilesProcessed + 1;
-                    if (now() - lastReport > 1.0)
+                    // members are registered as /vsizip/ sources, the archives are never extracted
+                    ZipDirectory directory;
+                    if (!getZipDirectory(path, directory))
                     {
-                        state.tilesProcessed = tilesProcessed;
-                        state.duration = now() - tStart;
+                        logger::WARN(path + " is not a valid zip archive");
+                        return;
+                    }
 
-                        lastReport = now();
+                    for (auto &member : directory.members)
+                    {
+                        if (isSourceName(member.name))
+                            addSource(zipMemberPath(path, member.name));
                     }
-                }
-            }
-            else
-            {
-                logger::WARN(path + "is not a valid gdem tif");
-            } }
+                } });
+
+        state.values["sources(" + layer.name + ")"] = formatNumber(layer.tile_map.size());
+    }
+    state.tilesProcessed = tilesProcessed;
+
+    if (geo_sources.size() > 0)
+    {
+        state.values["sources(georeferenced)"] = formatNumber(geo_sources.size());
+    }
 
-    );
+    // the finest source decides the max lod
+    double min_resolution = 1.0 / 3600.0;
+    for (auto &source : geo_sources)
+        min_resolution = min(min_resolution, source.resolution);
+
+    // degrees of longitude per pixel at the equator
+    double resolution_at_lod0 = tile_matrix_set->lodZeroResolution(tile_size);
+    int lod = 0;
+    double resolution = resolution_at_lod0;
+    while (resolution > min_resolution)
+    {
+        lod++;
+        resolution /= 2.0;
+    }
+
+    if (max_lod < 0 || max_lod > lod)
+    {
+        max_lod = lod;
+    }
 
     double duration = now() - tStart;
     state.values["duration(init)"] = formatNumber(duration, 3);
 }
 
-double GdemPool::getElevation(double lon, double lat, State &state)
+bool GdemPool::readLayerBlock(const string &path, int ilon_block, int ilat_block, int16_t *data)
 {
-    int ilon = (int)(lon + 180.0);
-    int ilat = (int)(lat + 90.0);
-    int key = ilat * 360 + ilon;
+    GDALDataset *poDataset = openDataset(path);
+    if (!poDataset)
+    {
+        logger::ERROR(path + " cannot be opened.");
+        exit(1);
+    }
+
+    auto poBand = poDataset->GetRasterBand(1);
 
-    if (tile_map.find(key) == tile_map.end())
+    int nXBlockSize, nYBlockSize; // should be 256
+    poBand->GetBlockSize(&nXBlockSize, &nYBlockSize);
+    if (nXBlockSize < 226 || nYBlockSize < 226)
     {
-        return NODATA;
+        logger::WARN("Block size of " + path + " is less than 226.");
+    }
+
+    int xOffset = (ilon_block % 16) * 225;
+    int yOffset = (15 - (ilat_block % 16)) * 225; // ilat_block是从左下角开始的，yOffset是从图像左上角起始
+    CPLErr code;
+    {
+        metrics::Scope scope(metrics::RASTER_IO);
+        code = poBand->RasterIO(GDALRWFlag::GF_Read, xOffset, yOffset, 226, 226, data, 226, 226, GDT_Int16, 0, 0);
+    }
+    if (code != CPLErr::CE_None)
+    {
+        logger::ERROR(path + " cannot be opened.");
+        exit(1);
+    }
+
+    // fill layers may flag their voids with other values, e.g. -32768 in srtm or 0
+    int hasNoData = 0;
+    double noData = poBand->GetNoDataValue(&hasNoData);
+    closeDataset(path, poDataset);
+
+    if (hasNoData && noData > NODATA && noData <= 32767.0)
+    {
+        int16_t value = (int16_t)noData;
+        for (int i = 0; i < 226 * 226; i++)
+            data[i] = data[i] == value ? (int16_t)NODATA : data[i];
     }
 
-    int ilon_block = (int)(lon * 16.0 + 180.0 * 16.0);
-    int ilat_block = (int)(lat * 16.0 + 90.0 * 16.0);
-    int key_block = ilat_block * 360 * 16 + ilon_block;
+    return true;
+}
 
+shared_ptr<DEMTileBlock> GdemPool::getTileBlock(int key, int key_block, State &state)
+{
     shared_ptr<DEMTileBlock> pTileBlock;
-    if (!tile_cache.tryGet(key_block, pTileBlock))
+    if (blockCache().tryGet(key_block, pTileBlock))
     {
-        GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(tile_map[key].c_str(), GA_ReadOnly));
-        if (!poDataset)
+        metrics::add(metrics::CACHE_HIT);
+        return pTileBlock;
+    }
+
+    auto iter = cell_layers.find(key);
+    if (iter == cell_layers.end())
+        return nullptr;
+    uint32_t mask = iter->second;
+    metrics::add(metrics::CACHE_MISS);
+
+    int ilon_block = key_block % (360 * 16);
+    int ilat_block = key_block / (360 * 16);
+
+    pTileBlock = make_shared<DEMTileBlock>(ilon_block * 0.0625 - 180.0, ilat_block * 0.0625 - 90.0);
+    pTileBlock->data = new int16_t[226 * 226];
+    int16_t *data = pTileBlock->data;
+
+    /**
+     * each pixel comes from the first layer with valid data.
+     * block_voids remembers whether the gdem block has voids, so that a reloaded block is not scanned again
+     * and void free blocks never touch the fill layers
+     */
+    vector<int16_t> fill;
+    bool empty = true;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        if ((mask & (1u << i)) == 0)
+            continue;
+
+        const string &path = layers[i].tile_map.at(key);
+        if (empty)
+        {
+            readLayerBlock(path, ilon_block, ilat_block, data);
+            empty = false;
+        }
+        else
+        {
+            fill.resize(226 * 226);
+            readLayerBlock(path, ilon_block, ilat_block, fill.data());
+            for (int k = 0; k < 226 * 226; k++)
+                data[k] = data[k] <= NODATA ? fill[k] : data[k];
+        }
+
+        uint8_t known = i == 0 ? block_voids[key_block].load() : BLOCK_UNKNOWN;
+        if (known == BLOCK_COMPLETE)
+            break;
+        if (known == BLOCK_VOIDS)
+            continue;
+
+        bool voids = hasVoids(data, 226 * 226);
+        if (i == 0)
         {
-            logger::ERROR(tile_map[key] + " cannot be opened.");
-            exit(1);
+            // threads loading the same block race here, only the one that records the state counts it
+            uint8_t unknown = BLOCK_UNKNOWN;
+            if (block_voids[key_block].compare_exchange_strong(unknown, voids ? BLOCK_VOIDS : BLOCK_COMPLETE) && voids)
+                void_blocks++;
         }
+        if (!voids)
+            break;
+    }
+
+    if (empty)
+        fill_n(data, 226 * 226, (int16_t)NODATA);
+
+    blockCache().insert(key_block, pTileBlock, state);
+    return pTileBlock;
+}
 
-        pTileBlock = make_shared<DEMTileBlock>(ilon_block * 0.0625 - 180.0, ilat_block * 0.0625 - 90.0);
-        pTileBlock->data = new int16_t[226 * 226];
+int64_t GdemPool::voidBlocks()
+{
+    return void_blocks;
+}
+
+void GdemPool::setArchiveCache(const vector<ZipDirectory> &directories)
+{
+    lock_guard<mutex> lock(archive_mutex);
+    for (auto &directory : directories)
+        archive_cache[directory.path] = directory;
+}
 
-        auto poBand = poDataset->GetRasterBand(1);
-        auto dataType = poBand->GetRasterDataType();
+bool GdemPool::getZipDirectory(const string &path, ZipDirectory &directory)
+{
+    uint64_t size;
+    int64_t mtime;
+    if (!statFile(path, size, mtime))
+        return false;
 
-        int xSize = poBand->GetXSize();
-        int ySize = poBand->GetYSize();
-        int nXBlockSize, nYBlockSize; // should be 256
-        poBand->GetBlockSize(&nXBlockSize, &nYBlockSize);
-        if (nXBlockSize < 226 || nYBlockSize < 226)
+    {
+        lock_guard<mutex> lock(archive_mutex);
+        auto iter = archive_cache.find(path);
+        if (iter != archive_cache.end() && iter->second.size == size && iter->second.mtime == mtime)
         {
-            logger::ERROR("Block size of " + tile_map[key] + " is less than 226.");
-            exit(1);
+            directory = iter->second;
+            archives[path] = directory;
+            return true;
         }
+    }
+
+    if (!readZipDirectory(path, directory))
+        return false;
+    directory.mtime = mtime;
+
+    lock_guard<mutex> lock(archive_mutex);
+    archives[path] = directory;
+    return true;
+}
 
-        // int nXBlocks = (poBand->GetXSize() + nXBlockSize - 1) / nXBlockSize;
-        // int nYBlocks = (poBand->GetYSize() + nYBlockSize - 1) / nYBlockSize;
-
-        // int x = 0, y = 0;
-        // int16_t *pabyData = new int16_t[nXBlockSize * nYBlockSize];
-        // for (int iYBlock = 0; iYBlock < nYBlocks; iYBlock++)
-        // {
-        //     x = 0;
-        //     for (int iXBlock = 0; iXBlock < nXBlocks; iXBlock++)
-        //     {
-        //         poBand->ReadBlock(iXBlock, iYBlock, pabyData);
-
-        //         int nXValid = nXBlockSize, nYValid = nYBlockSize;
-        //         if (x + nXBlockSize > xSize)
-        //             nXValid = xSize - x;
-        //         if (y + nYBlockSize > ySize)
-        //             nYValid = ySize - y;
-
-        //         for (int iY = 0; iY < nYValid; iY++)
-        //         {
-        //             for (int iX = 0; iX < nXValid; iX++)
-        //             {
-        //                 pTile->data[(y + iY) * ySize + (x + iX)] = pabyData[iX + iY * nXBlockSize];
-        //             }
-        //         }
-        //         x += nXBlockSize;
-        //     }
-        //     y += nYBlockSize;
-        // }
-        // delete pabyData;
-        // pabyData = nullptr;
-
-        // auto code = pRasterBand->ReadBlock(3601, 3601, pTile->data);
-        // if (code != CPLErr::CE_None)
-        // {
-        //     logger::ERROR(tile_map[key] + " cannot be opened.");
-        //     exit(1);
-        // }
-
-        int xOffset = (ilon_block % 16) * 225;
-        int yOffset = (15 - (ilat_block % 16)) * 225; // ilat_block是从左下角开始的，yOffset是从图像左上角起始
-        auto code = poBand->RasterIO(GDALRWFlag::GF_Read, xOffset, yOffset, 226, 226, pTileBlock->data, 226, 226, dataType, 0, 0);
-        if (code != CPLErr::CE_None)
+void GdemPool::catalog(SourceCatalog &catalog)
+{
+    vector<CatalogEntry> &entries = catalog.entries;
+    entries.clear();
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        for (auto &iter : layers[i].tile_map)
         {
-            logger::ERROR(tile_map[key] + " cannot be opened.");
-            exit(1);
+            CatalogEntry entry;
+            entry.path = iter.second;
+            entry.layer = (int)i;
+            entry.west = iter.first % 360 - 180.0;
+            entry.south = iter.first / 360 - 90.0;
+            entry.east = entry.west + 1.0;
+            entry.north = entry.south + 1.0;
+            entries.push_back(entry);
         }
-        GDALClose(poDataset);
+    }
+
+    for (auto &source : geo_sources)
+    {
+        CatalogEntry entry;
+        entry.path = source.path;
+        entry.layer = source.layer;
+        entry.west = source.west;
+        entry.south = source.south;
+        entry.east = source.east;
+        entry.north = source.north;
+        entries.push_back(entry);
+    }
 
-        tile_cache.insert(key_block, pTileBlock, state);
+    statCatalog(entries);
+
+    catalog.archives.clear();
+    for (auto &iter : archives)
+        catalog.archives.push_back(iter.second);
+}
+
+double GdemPool::getElevation(double lon, double lat, State &state)
+{
+    int key, key_block;
+    getBlockKeys(lon, lat, key, key_block);
+
+    int16_t ele = NODATA;
+    shared_ptr<DEMTileBlock> pTileBlock = getTileBlock(key, key_block, state);
+    if (pTileBlock)
+    {
+        double unit_col = (lon - pTileBlock->west) * 16.0;
+        double unit_row = (pTileBlock->south + 0.0625 - lat) * 16.0;
+        int col = (int)(225.0 * unit_col + 0.5);
+        int row = (int)(225.0 * unit_row + 0.5);
+        ele = pTileBlock->data[row * 226 + col];
+    }
+
+    if (ele <= NODATA && geo_sources.size() > 0)
+    {
+        ele = sampleGeoSources(lon, lat, state);
+    }
+    else if (!pTileBlock)
+    {
+        return NODATA;
     }
 
-    double unit_col = (lon - pTileBlock->west) * 16.0;
-    double unit_row = (pTileBlock->south + 0.0625 - lat) * 16.0;
-    int col = (int)(225.0 * unit_col + 0.5);
-    int row = (int)(225.0 * unit_row + 0.5);
-    int16_t ele = pTileBlock->data[row * 226 + col];
     if (ele <= NODATA)
     {
-        logger::WARN("found nodata at " + tile_map[key]);
+        logger::WARN("found nodata at " + formatNumber(lon, 6) + ", " + formatNumber(lat, 6));
     }
     return ele;
 }
 
+void GdemPool::getElevations(const double *lon, const double *lat, size_t count, double *out, State &state)
+{
+    // (key_block, index), sorted so that samples of the same block are adjacent
+    vector<pair<int, uint32_t>> order(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        int key, key_block;
+        getBlockKeys(lon[i], lat[i], key, key_block);
+        order[i] = {key_block, (uint32_t)i};
+    }
+    sort(order.begin(), order.end());
+
+    size_t begin = 0;
+    while (begin < count)
+    {
+        int key_block = order[begin].first;
+        size_t end = begin + 1;
+        while (end < count && order[end].first == key_block)
+            end++;
+
+        size_t first = order[begin].second;
+        int key, unused;
+        getBlockKeys(lon[first], lat[first], key, unused);
+
+        shared_ptr<DEMTileBlock> pTileBlock = getTileBlock(key, key_block, state);
+        if (!pTileBlock)
+        {
+            for (size_t i = begin; i < end; i++)
+                out[order[i].second] = NODATA;
+        }
+        else
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                uint32_t index = order[i].second;
+                double unit_col = (lon[index] - pTileBlock->west) * 16.0;
+                double unit_row = (pTileBlock->south + 0.0625 - lat[index]) * 16.0;
+                int col = (int)(225.0 * unit_col + 0.5);
+                int row = (int)(225.0 * unit_row + 0.5);
+                out[index] = pTileBlock->data[row * 226 + col];
+            }
+        }
+
+        begin = end;
+    }
+
+    if (geo_sources.size() > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (out[i] <= NODATA)
+                out[i] = sampleGeoSources(lon[i], lat[i], state);
+        }
+    }
+}
+
+shared_ptr<const int16_t> GdemPool::getGeoSourceBlock(const GeoSource &source, int bx, int by, State &state)
+{
+    // block keys of the 1x1 degree grid are below 2^24, source blocks are keyed by (source id, block)
+    int64_t key = ((int64_t)(source.id + 1) << 32) | (int64_t)(by * source.blocksX() + bx);
+
+    shared_ptr<DEMTileBlock> pTileBlock;
+    if (blockCache().tryGet(key, pTileBlock))
+    {
+        metrics::add(metrics::CACHE_HIT);
+    }
+    else
+    {
+        metrics::add(metrics::CACHE_MISS);
+        pTileBlock = make_shared<DEMTileBlock>(source.west, source.south);
+        pTileBlock->data = new int16_t[SOURCE_BLOCK * SOURCE_BLOCK];
+        readGeoSourceBlock(source, bx, by, pTileBlock->data);
+        blockCache().insert(key, pTileBlock, state);
+    }
+
+    return shared_ptr<const int16_t>(pTileBlock, pTileBlock->data);
+}
+
+void GdemPool::findGeoSources(double west, double south, double east, double north, vector<const GeoSource *> &found)
+{
+    double bmin[2] = {west, south};
+    double bmax[2] = {east, north};
+    found.clear();
+    source_tree.Search(bmin, bmax, [&](const int &id)
+                       {
+                           found.push_back(&geo_sources[id]);
+                           return true; });
+
+    // finest first, then by layer priority
+    sort(found.begin(), found.end(), [](const GeoSource *a, const GeoSource *b)
+         { return a->resolution != b->resolution ? a->resolution < b->resolution : a->layer < b->layer; });
+}
+
+int16_t GdemPool::sampleGeoSources(double lon, double lat, State &state)
+{
+    vector<const GeoSource *> found;
+    findGeoSources(lon, lat, lon, lat, found);
+    for (auto source : found)
+    {
+        int16_t ele = sampleGeoSource(
+            *source, [&](int bx, int by)
+            { return getGeoSourceBlock(*source, bx, by, state); },
+            lon, lat);
+        if (ele > NODATA)
+            return ele;
+    }
+    return NODATA;
+}
+
+shared_ptr<const int16_t> GdemPool::getSourceBlock(int bx, int by, State &state)
+{
+    int ilat_block = BLOCKS_Y - 1 - by;
+    int key = (ilat_block / 16) * 360 + bx / 16;
+    int key_block = ilat_block * BLOCKS_X + bx;
+    shared_ptr<DEMTileBlock> pTileBlock = getTileBlock(key, key_block, state);
+    if (!pTileBlock)
+        return nullptr;
+
+    return shared_ptr<const int16_t>(pTileBlock, pTileBlock->data);
+}
+
+void GdemPool::setResampling(Resampling resampling)
+{
+    this->resampling = resampling;
+}
+
+void GdemPool::setLodReduction(Reduction reduction)
+{
+    this->lod_reduction = reduction;
+}
+
+void GdemPool::setTileStats(TileStatsIndex *index)
+{
+    this->tile_stats = index;
+}
+
+void GdemPool::setTerrain(const TerrainOptions &options)
+{
+    this->terrain_options = options;
+}
+
+void GdemPool::setCogWriter(CogWriter *writer)
+{
+    this->cog_writer = writer;
+    // the cog keeps the voids, its GDAL_NODATA tag marks them
+    this->void_value = writer ? NODATA : 0;
+}
+
+void GdemPool::setTileCodec(const TileCodecOptions &options)
+{
+    this->codec_options = options;
+}
+
+void GdemPool::setTileWriter(TileWriter writer)
+{
+    this->tile_writer = writer;
+}
+
+void GdemPool::setNumaNodes(int nodes)
+{
+    nodes = max(nodes, 1);
+    tile_caches.clear();
+    for (int node = 0; node < nodes; node++)
+        tile_caches.push_back(make_unique<TileCache>(max<uint64_t>(TileCache::DEFAULT_SIZE / nodes, 1)));
+}
+
+TileCache &GdemPool::blockCache()
+{
+    // unbound threads, e.g. of the profiles, share the cache of node 0
+    int node = max(numaNode(), 0);
+    return *tile_caches[node % tile_caches.size()];
+}
+
+void GdemPool::setTileMatrixSet(shared_ptr<TileMatrixSet> tile_matrix_set)
+{
+    this->tile_matrix_set = tile_matrix_set;
+}
+
+TileMatrixSet &GdemPool::tileMatrixSet()
+{
+    return *tile_matrix_set;
+}
+
 bool GdemPool::contains(double west, double south, double east, double north)
 {
     double bmin[2] = {west, south};
     double bmax[2] = {east, north};
 
     int n = tile_tree.Search(bmin, bmax, nullptr);
+    if (n == 0 && geo_sources.size() > 0)
+        n = source_tree.Search(bmin, bmax, nullptr);
+
     if (n > 0)
         return true;
     else
         return false;
 }
 
-void GdemPool::makeElevation(double west, double south, double east, double north, int width, int height, int16_t *data, State &state)
+void GdemPool::prefetch(double west, double south, double east, double north, State &state)
+{
+    if (!geo_sources.empty())
+        return;
+
+    int bx0 = (int)floor((west + 180.0) * 16.0) - 1;
+    int bx1 = (int)floor((east + 180.0) * 16.0) + 1;
+    int by0 = max((int)floor((90.0 - north) * 16.0) - 1, 0);
+    int by1 = min((int)floor((90.0 - south) * 16.0) + 1, BLOCKS_Y - 1);
+    // a small part of the block cache, more would evict the blocks of the tasks rendered right now
+    if ((int64_t)(bx1 - bx0 + 1) * (by1 - by0 + 1) > 1024)
+        return;
+
+    for (int by = by0; by <= by1; by++)
+    {
+        for (int bx = bx0; bx <= bx1; bx++)
+            getSourceBlock((bx % BLOCKS_X + BLOCKS_X) % BLOCKS_X, by, state);
+    }
+}
+
+double GdemPool::coverage(double west, double south, double east, double north)
+{
+    double area = (east - west) * (north - south);
+    if (area <= 0.0)
+        return 0.0;
+
+    auto overlap = [&](double w, double s, double e, double n)
+    {
+        return max(0.0, min(e, east) - max(w, west)) * max(0.0, min(n, north) - max(s, south));
+    };
+
+    double bmin[2] = {west, south};
+    double bmax[2] = {east, north};
+    double covered = 0.0;
+    // a cell is in the tree once per layer holding it
+    set<int> keys;
+    tile_tree.Search(bmin, bmax, [&](const int &key)
+                     {
+                         if (keys.insert(key).second)
+                         {
+                             double ilon = key % 360 - 180.0;
+                             double ilat = key / 360 - 90.0;
+                             covered += overlap(ilon, ilat, ilon + 1.0, ilat + 1.0);
+                         }
+                         return true; });
+    source_tree.Search(bmin, bmax, [&](const int &id)
+                       {
+                           const GeoSource &source = geo_sources[id];
+                           covered += overlap(source.west, source.south, source.east, source.north);
+                           return true; });
+
+    return min(covered / area, 1.0);
+}
+
+void GdemPool::makeElevation(double west, double south, double east, double north, int width, int height, int16_t *data,
+                             State &state, TileStats *stats)
 {
-    double xStep = (east - west) / (width - 1.0);
-    double yStep = (north - south) / (height - 1.0);
+    double yStep = height > 1 ? (north - south) / (height - 1) : 0.0;
+
+    vector<double> lat(height);
     for (int y = 0; y < height; y++)
+        lat[y] = north - y * yStep;
+
+    makeElevationRows(west, east, lat.data(), width, height, data, state, stats);
+}
+
+void GdemPool::makeElevationRows(double west, double east, const double *lat, int width, int height, int16_t *data,
+                                 State &state, TileStats *stats)
+{
+    metrics::Scope scope(metrics::SAMPLING);
+    if (geo_sources.empty())
     {
-        for (int x = 0; x < width; x++)
-        {
-            double lon = west + x * xStep;
-            double lat = north - y * yStep;
-            double ele = getElevation(lon, lat, state);
-            if (ele <= NODATA)
-                ele = 0.0;
+        Resampler resampler([&](int bx, int by)
+                            { return getSourceBlock(bx, by, state); });
+        resampler.resampleRows(resampling, west, east, lat, width, height, data);
+    }
+    else
+    {
+        double south = min(lat[0], lat[height - 1]);
+        double north = max(lat[0], lat[height - 1]);
+        makeMosaic(west, south, east, north, (size_t)width * height, data, [&](const GeoSource *source, int16_t *target)
+                   {
+                       if (source)
+                       {
+                           resampleGeoSourceRows(
+                               *source, [&](int bx, int by)
+                               { return getGeoSourceBlock(*source, bx, by, state); },
+                               resampling, west, east, lat, width, height, target);
+                       }
+                       else
+                       {
+                           Resampler resampler([&](int bx, int by)
+                                               { return getSourceBlock(bx, by, state); });
+                           resampler.resampleRows(resampling, west, east, lat, width, height, target);
+                       } });
+    }
+
+    // NODATA -> 0 in the same pass
+    TileStats local;
+    computeTileStats(data, (size_t)width * height, stats ? *stats : local, void_value);
+}
+
+void GdemPool::makeElevationPoints(const double *lon, const double *lat, int width, int height, int16_t *data,
+                                   State &state, TileStats *stats)
+{
+    metrics::Scope scope(metrics::SAMPLING);
 
-            data[y * width + x] = (int16_t)ele;
+    // points have no footprint to average over, and the georeferenced sources have no bicubic point sampler
+    static atomic<bool> warned{false};
+    bool fallback = resampling == Resampling::Average || (resampling == Resampling::Bicubic && !geo_sources.empty());
+    if (fallback && !warned.exchange(true))
+    {
+        logger::WARN("--resampling " + toString(resampling) + " is not supported by the point sampling of the " +
+                     "projected tile matrix sets" + (resampling == Resampling::Bicubic ? " on georeferenced sources" : "") +
+                     ", bilinear is used");
+    }
+
+    size_t count = (size_t)width * height;
+    if (geo_sources.empty())
+    {
+        Resampler resampler([&](int bx, int by)
+                            { return getSourceBlock(bx, by, state); });
+        resampler.resamplePoints(resampling, lon, lat, count, data);
+    }
+    else
+    {
+        double west = 180.0, south = 90.0, east = -180.0, north = -90.0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (std::isnan(lon[i]) || std::isnan(lat[i]))
+                continue;
+            west = min(west, lon[i]);
+            east = max(east, lon[i]);
+            south = min(south, lat[i]);
+            north = max(north, lat[i]);
         }
+
+        makeMosaic(west, south, east, north, count, data, [&](const GeoSource *source, int16_t *target)
+                   {
+                       if (source)
+                       {
+                           resampleGeoSourcePoints(
+                               *source, [&](int bx, int by)
+                               { return getGeoSourceBlock(*source, bx, by, state); },
+                               resampling, lon, lat, count, target);
+                       }
+                       else
+                       {
+                           Resampler resampler([&](int bx, int by)
+                                               { return getSourceBlock(bx, by, state); });
+                           resampler.resamplePoints(resampling, lon, lat, count, target);
+                       } });
     }
+
+    TileStats local;
+    computeTileStats(data, count, stats ? *stats : local, void_value);
 }
 
-void GdemPool::makeElevationImage(double west, double south, double east, double north,
-                                  int width, int height, string format, string type, string path, State &state)
+void GdemPool::makeMosaic(double west, double south, double east, double north, size_t count, int16_t *data,
+                          const function<void(const GeoSource *source, int16_t *target)> &render)
 {
-    if (fs::exists(path))
+    if (west > east)
+    {
+        fill(data, data + count, (int16_t)NODATA);
         return;
+    }
 
-    if (!contains(west, south, east, north))
-        return;
+    vector<const GeoSource *> found;
+    findGeoSources(west, south, east, north, found);
 
-    if (format == "grey")
+    // the 1x1 degree tiles compete as a source of 1 arc second in layer 0, nullptr stands for them
+    double bmin[2] = {west, south};
+    double bmax[2] = {east, north};
+    if (tile_tree.Search(bmin, bmax, nullptr) > 0)
     {
-        int16_t *data = new int16_t[width * height];
-        makeElevation(west, south, east, north, width, height, data, state);
-
-        if (icompare(type, "png"))
-        {
-            GDALDriver *pDriverMEM = GetGDALDriverManager()->GetDriverByName("MEM");
-            GDALDataset *pOutMEMDataset = pDriverMEM->Create("", width, height, 1, GDT_UInt16, NULL);
-            if (!pOutMEMDataset)
-            {
-                logger::ERROR("cannot create MEM image.");
-                return;
-            }
-            pOutMEMDataset->RasterIO(GF_Write, 0, 0, width, height, (void *)data, width, height,
-                                     GDT_UInt16, 1, nullptr, 0, 0, 0);
-
-            // 以创建复制的方式，生成png文件
-            GDALDriver *pDriverPNG = GetGDALDriverManager()->GetDriverByName("PNG");
-            // GDALDriver *pDriverPNG = GetGDALDriverManager()->GetDriverByName("JPEG");
-            GDALDataset *tile = pDriverPNG->CreateCopy(path.c_str(), pOutMEMDataset, TRUE, 0, 0, 0);
-            if (!tile)
-            {
-                logger::ERROR("cannot create PNG image.");
-                return;
-            }
+        const double gdem_resolution = 1.0 / PIXELS_PER_DEGREE;
+        auto iter = find_if(found.begin(), found.end(), [&](const GeoSource *source)
+                            { return source->resolution > gdem_resolution ||
+                                     (source->resolution == gdem_resolution && source->layer > 0); });
+        found.insert(iter, nullptr);
+    }
 
-            GDALClose(pOutMEMDataset);
-            pOutMEMDataset = nullptr;
+    if (found.empty())
+    {
+        fill(data, data + count, (int16_t)NODATA);
+        return;
+    }
 
-            GDALClose(tile);
-            tile = nullptr;
-        }
-        else if (icompare(type, "tif"))
+    // the finest source fills the tile, coarser ones only fill what is left
+    vector<int16_t> fill_data;
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        int16_t *target = data;
+        if (i > 0)
         {
-            GDALDriver *pDriverTIF = GetGDALDriverManager()->GetDriverByName("GTiff");
-            GDALDataset *pOutTIFDataset = pDriverTIF->Create(path.c_str(), width, height, 1, GDT_Int16, NULL);
-            if (!pOutTIFDataset)
-            {
-                logger::ERROR("cannot create TIF image.");
-                return;
-            }
-            pOutTIFDataset->RasterIO(GF_Write, 0, 0, width, height, (void *)data, width, height,
-                                     GDT_Int16, 1, nullptr, 0, 0, 0);
-            double xResolution = (east - west) / (width - 1);
-            double yResolution = (south - north) / (height - 1);
-            double geoTransform[6] = {
-                west - xResolution * 0.5,
-                xResolution,
-                0,
-                north - yResolution * 0.5,
-                0,
-                yResolution};
-            pOutTIFDataset->SetGeoTransform(geoTransform);
-            pOutTIFDataset->SetProjection(default_projection.c_str());
-
-            GDALClose(pOutTIFDataset);
-            pOutTIFDataset = nullptr;
+            fill_data.resize(count);
+            target = fill_data.data();
         }
-        else
+
+        render(found[i], target);
+
+        if (i > 0)
         {
-            logger::WARN("unsupported type, [png, tif] suppported.");
+            for (size_t k = 0; k < count; k++)
+                data[k] = data[k] <= NODATA ? target[k] : data[k];
         }
 
-        delete data;
-        data = nullptr;
+        if (!hasVoids(data, count))
+            break;
     }
 }
 
-void GdemPool::makeElevationImage(int z, int x, int y, int width, int height,
-                                  string format, string type, string out_dir, State &state)
+bool GdemPool::writeElevationImage(const int16_t *data, int width, int height, string type, string path,
+                                   const string &projection, double west, double south, double east, double north,
+                                   function<void()> written)
 {
-    double step = 180.0 / (1 << z);
-    double west = -180.0 + x * step;
-    double east = west + step;
-    double north = 90 - y * step;
-    double south = north - step;
+    shared_ptr<TileCodec> codec = createTileCodec(type, codec_options);
+    if (!codec)
+    {
+        logger::WARN("unsupported type, [png, tif, webp, lerc, bin] suppported.");
+        return false;
+    }
 
-    string path = out_dir + "/" + formatNumber(z) + "/" + formatNumber(x) + "/" + formatNumber(y) + "." + type;
-    makeElevationImage(west, south, east, north, width, height, format, type, path, state);
+    TileGeoreference georeference{projection, west, south, east, north};
+    vector<uint8_t> bytes;
+    bool encoded;
+    {
+        metrics::Scope scope(metrics::ENCODE);
+        encoded = codec->encode(data, width, height, &georeference, bytes);
+    }
+    if (!encoded)
+    {
+        logger::ERROR("cannot encode " + path);
+        return false;
+    }
+    return writeTileBytes(path, std::move(bytes), written);
 }
 
-void GdemPool::makeLodImage(int z, int x, int y, int width, int height,
-                            string format, string type, string out_dir, State &state)
+bool GdemPool::writeTileBytes(const string &path, vector<uint8_t> &&bytes, function<void()> written)
+{
+    if (tile_writer)
+    {
+        tile_writer(path, std::move(bytes), written);
+        return true;
+    }
+    if (!writeTileFile(path, bytes))
+        return false;
+    if (written)
+        written();
+    return true;
+}
+
+bool GdemPool::makeElevationImage(double west, double south, double east, double north,
+                                  int width, int height, string format, string type, string path, State &state, TileStats *stats)
 {
-    string path = out_dir + "/" + formatNumber(z) + "/" + formatNumber(x) + "/" + formatNumber(y) + "." + type;
     if (fs::exists(path))
-        return;
+        return false;
 
-    /**
-     *  | 00 10 |
-     *  | 01 11 |
-     */
-    string path00 = out_dir + "/" + formatNumber(z + 1) + "/" + formatNumber(x * 2) + "/" + formatNumber(y * 2) + "." + type;
-    string path01 = out_dir + "/" + formatNumber(z + 1) + "/" + formatNumber(x * 2) + "/" + formatNumber(y * 2 + 1) + "." + type;
-    string path10 = out_dir + "/" + formatNumber(z + 1) + "/" + formatNumber(x * 2 + 1) + "/" + formatNumber(y * 2) + "." + type;
-    string path11 = out_dir + "/" + formatNumber(z + 1) + "/" + formatNumber(x * 2 + 1) + "/" + formatNumber(y * 2 + 1) + "." + type;
-
-    bool exist00 = fs::exists(path00);
-    bool exist01 = fs::exists(path01);
-    bool exist10 = fs::exists(path10);
-    bool exist11 = fs::exists(path11);
-    if (!exist00 && !exist01 && !exist10 && !exist11)
-        return;
+    if (!contains(west, south, east, north))
+        return false;
 
+    bool written = false;
     if (format == "grey")
     {
         int16_t *data = new int16_t[width * height];
-        for (int i = 0; i < width * height; i++)
-            data[i] = 0;
+        makeElevation(west, south, east, north, width, height, data, state, stats);
 
-        int subwidth = (int)(width / 2 + 1);
-        int subheight = (int)(height / 2 + 1);
-        int16_t *subdata = new int16_t[subwidth * subheight];
+        written = writeElevationImage(data, width, height, type, path, createTileMatrixSet("geographic")->projection(),
+                                      west, south, east, north);
 
-        if (exist00)
-        {
-            GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(path00.c_str(), GA_ReadOnly));
-            if (!poDataset)
-            {
-                logger::WARN(path00 + " cannot be opened.");
-                logger::WARN("try to recreate " + path00);
-                fs::remove(path00);
-                makeElevationImage(z + 1, x * 2, y * 2, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path00.c_str(), GA_ReadOnly));
-            }
+        delete[] data;
+        data = nullptr;
+    }
 
-            auto code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                            subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
-            if (code != CPLErr::CE_None)
-            {
-                logger::WARN(path00 + " cannot be opened.");
-                logger::WARN("try to recreate " + path00);
-                GDALClose(poDataset);
-                fs::remove(path00);
-                makeElevationImage(z + 1, x * 2, y * 2, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path00.c_str(), GA_ReadOnly));
-                code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                           subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
-            }
+    return written;
+}
 
-            if (code != CPLErr::CE_None)
-                return;
+void GdemPool::makeElevationImage(int z, int x, int y, int width, int height,
+                                  string format, string type, string out_dir, State &state)
+{
+    trace::Sample sample;
+    trace::Span span("tile", z);
+    TileMatrixSet &tms = *tile_matrix_set;
+    bool terrain = isTerrainType(type);
+    // terrain tiles are addressed from the south (tms)
+    int path_y = terrain ? tms.tilesY(z) - 1 - y : y;
+    string path = out_dir + "/" + formatNumber(z) + "/" + formatNumber(x) + "/" + formatNumber(path_y) + "." + tileExtension(type);
+    bool cog = type == "cog";
+    if (cog ? cog_writer->hasTile(z, x, y) : fs::exists(path))
+        return;
+
+    double west, south, east, north;
+    tms.tileLonLatBounds(z, x, y, west, south, east, north);
+    if (!contains(west, south, east, north))
+        return;
+
+    if (format != "grey")
+        return;
 
-            for (int y = 0; y < subheight; y++)
+    TileStats stats;
+    // scratch of the worker thread, reused by the tiles of its supertile task
+    thread_local vector<int16_t> data;
+    data.assign((size_t)width * height, 0);
+    if (terrain)
+    {
+        // encoded straight from the rendered heights, no intermediate image
+        vector<double> lat(height);
+        tms.tileRows(z, x, y, width, height, west, east, lat.data());
+        makeElevationRows(west, east, lat.data(), width, height, data.data(), state, &stats);
+
+        vector<uint8_t> bytes;
+        bool encoded;
+        {
+            metrics::Scope scope(metrics::ENCODE);
+            if (type == "terrain")
+            {
+                double max_error = terrainGeometricError(z, tms.tilesX(0)) * terrain_options.error_scale;
+                encoded = encodeQuantizedMesh(data.data(), width, west, east, lat.data(), max_error, terrain_options, bytes);
+            }
+            else
             {
-                for (int x = 0; x < subwidth; x++)
+                // the same coverage test that decides whether the children are rendered
+                uint8_t child_mask = 0;
+                for (int q = 0; q < 4 && z < terrain_options.max_lod; q++)
                 {
-                    data[y * width + x] = subdata[y * subwidth + x];
+                    double child_west, child_south, child_east, child_north;
+                    tms.tileLonLatBounds(z + 1, x * 2 + q / 2, y * 2 + q % 2, child_west, child_south, child_east, child_north);
+                    if (contains(child_west, child_south, child_east, child_north))
+                        child_mask |= heightmapChildBit(q / 2, q % 2);
                 }
+                encoded = encodeHeightmap(data.data(), child_mask, terrain_options, bytes);
             }
-            GDALClose(poDataset);
         }
-
-        if (exist01)
+        if (!encoded)
         {
-            GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(path01.c_str(), GA_ReadOnly));
-            if (!poDataset)
-            {
-                logger::WARN(path01 + " cannot be opened.");
-                logger::WARN("try to recreate " + path01);
-                fs::remove(path01);
-                makeElevationImage(z + 1, x * 2, y * 2 + 1, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path01.c_str(), GA_ReadOnly));
-            }
+            logger::ERROR("cannot encode " + path);
+            return;
+        }
 
-            auto code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                            subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
-            if (code != CPLErr::CE_None)
-            {
-                logger::WARN(path01 + " cannot be opened.");
-                logger::WARN("try to recreate " + path01);
-                GDALClose(poDataset);
-                fs::remove(path01);
-                makeElevationImage(z + 1, x * 2, y * 2 + 1, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path01.c_str(), GA_ReadOnly));
-                code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                           subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
-            }
+        function<void()> written = nullptr;
+        if (tile_stats && tile_stats->outDir() == out_dir)
+            written = [this, z, x, y, stats]()
+            { tile_stats->put(z, x, y, stats); };
+        writeTileBytes(path, std::move(bytes), written);
+        return;
+    }
 
-            if (code != CPLErr::CE_None)
-                return;
+    if (tms.separable())
+    {
+        // per row latitudes of the tile, mercator rows are not evenly spaced in latitude
+        vector<double> lat(height);
+        tms.tileRows(z, x, y, width, height, west, east, lat.data());
+        makeElevationRows(west, east, lat.data(), width, height, data.data(), state, &stats);
+    }
+    else
+    {
+        // interpolated from the transformation grid of the tile
+        vector<double> lon((size_t)width * height), lat((size_t)width * height);
+        tms.tilePixels(z, x, y, width, height, lon.data(), lat.data());
+        makeElevationPoints(lon.data(), lat.data(), width, height, data.data(), state, &stats);
+    }
 
-            for (int y = 0; y < subheight; y++)
-            {
-                for (int x = 0; x < subwidth; x++)
-                {
-                    data[(height - subheight + y) * width + x] = subdata[y * subwidth + x];
-                }
-            }
-            GDALClose(poDataset);
+    if (cog)
+    {
+        // the shared last row and column belong to the neighbours
+        if (cog_writer->writeTile(z, x, y, data.data(), width) && tile_stats && tile_stats->outDir() == out_dir)
+            tile_stats->put(z, x, y, stats);
+        return;
+    }
+
+    tms.tileBounds(z, x, y, west, south, east, north);
+    // the stats are recorded when the tile reached the disk, a tile lost by the write pool is not indexed
+    function<void()> written = nullptr;
+    if (tile_stats && tile_stats->outDir() == out_dir)
+        written = [this, z, x, y, stats]()
+        { tile_stats->put(z, x, y, stats); };
+    writeElevationImage(data.data(), width, height, type, path, tms.projection(), west, south, east, north, written);
+}
+
+bool GdemPool::readLodChild(int z, int x, int y, int width, int height,
+                            string format, string type, string dir, int16_t *data, State &state)
+{
+    string path = dir + "/" + formatNumber(z) + "/" + formatNumber(x) + "/" + formatNumber(y) + "." + type;
+    shared_ptr<TileCodec> codec = createTileCodec(type, codec_options);
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (attempt > 0)
+        {
+            logger::WARN("try to recreate " + path);
+            fs::remove(path);
+            makeElevationImage(z, x, y, width, height, format, type, dir, state);
         }
 
-        if (exist10)
+        ifstream file(path, ios::binary);
+        if (!file.is_open())
         {
-            GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(path10.c_str(), GA_ReadOnly));
-            if (!poDataset)
-            {
-                logger::WARN(path10 + " cannot be opened.");
-                logger::WARN("try to recreate " + path10);
-                fs::remove(path10);
-                makeElevationImage(z + 1, x * 2 + 1, y * 2, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path10.c_str(), GA_ReadOnly));
-            }
+            logger::WARN(path + " cannot be opened.");
+            continue;
+        }
+        vector<uint8_t> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
 
-            auto code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                            subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
-            if (code != CPLErr::CE_None)
-            {
-                logger::WARN(path10 + " cannot be opened.");
-                logger::WARN("try to recreate " + path10);
-                GDALClose(poDataset);
-                fs::remove(path10);
-                makeElevationImage(z + 1, x * 2 + 1, y * 2, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path10.c_str(), GA_ReadOnly));
-                code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                           subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
-            }
+        // full resolution, the 2:1 reduction is done by reduceQuadrant
+        if (codec && codec->decode(bytes.data(), bytes.size(), width, height, data))
+            return true;
 
-            if (code != CPLErr::CE_None)
-                return;
+        logger::WARN(path + " cannot be read.");
+    }
 
-            for (int y = 0; y < subheight; y++)
-            {
-                for (int x = 0; x < subwidth; x++)
-                {
-                    data[y * width + width - subwidth + x] = subdata[y * subwidth + x];
-                }
-            }
-            GDALClose(poDataset);
+    return false;
+}
+
+void GdemPool::makeLodImage(int z, int x, int y, int width, int height,
+                            string format, string type, string out_dir, State &state)
+{
+    makeLodImage(z, x, y, width, height, format, type, out_dir, out_dir, lod_reduction, state);
+}
+
+void GdemPool::makeLodImage(int z, int x, int y, int width, int height, string format, string type,
+                            string out_dir, string child_dir, Reduction reduction, State &state)
+{
+    trace::Sample sample;
+    trace::Span span("lod tile", z);
+    if (type == "cog")
+    {
+        makeCogLodTile(z, x, y, width, height, out_dir, reduction);
+        return;
+    }
+
+    string path = out_dir + "/" + formatNumber(z) + "/" + formatNumber(x) + "/" + formatNumber(y) + "." + type;
+    if (fs::exists(path))
+        return;
+
+    /**
+     *  | 00 10 |
+     *  | 01 11 |
+     */
+    bool exists[2][2];
+    bool any = false;
+    for (int qx = 0; qx < 2; qx++)
+    {
+        for (int qy = 0; qy < 2; qy++)
+        {
+            string child = child_dir + "/" + formatNumber(z + 1) + "/" + formatNumber(x * 2 + qx) + "/" + formatNumber(y * 2 + qy) + "." + type;
+            exists[qx][qy] = fs::exists(child);
+            any = any || exists[qx][qy];
         }
+    }
+    if (!any)
+        return;
 
-        if (exist11)
+    if (format == "grey")
+    {
+        // scratch of the worker thread, reused by the tiles of its supertile task
+        thread_local vector<int16_t> parent, child;
+        parent.assign((size_t)width * height, NODATA);
+        child.resize((size_t)width * height);
+        int16_t *data = parent.data();
+        int16_t *subdata = child.data();
+
+        bool ok = true;
+        for (int qx = 0; qx < 2 && ok; qx++)
         {
-            GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(path11.c_str(), GA_ReadOnly));
-            if (!poDataset)
+            for (int qy = 0; qy < 2 && ok; qy++)
             {
-                logger::WARN(path11 + " cannot be opened.");
-                logger::WARN("try to recreate " + path11);
-                fs::remove(path11);
-                makeElevationImage(z + 1, x * 2 + 1, y * 2 + 1, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path11.c_str(), GA_ReadOnly));
-            }
+                if (!exists[qx][qy])
+                    continue;
 
-            auto code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                            subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
-            if (code != CPLErr::CE_None)
-            {
-                logger::WARN(path11 + " cannot be opened.");
-                logger::WARN("try to recreate " + path11);
-                GDALClose(poDataset);
-                fs::remove(path11);
-                makeElevationImage(z + 1, x * 2 + 1, y * 2 + 1, width, height, format, type, out_dir, state);
-                poDataset = static_cast<GDALDataset *>(GDALOpen(path11.c_str(), GA_ReadOnly));
-                code = poDataset->RasterIO(GDALRWFlag::GF_Read, 0, 0, width, height,
-                                           subdata, subwidth, subheight, GDT_Int16, 1, nullptr, 0, 0, 0);
+                ok = readLodChild(z + 1, x * 2 + qx, y * 2 + qy, width, height, format, type, child_dir, subdata, state);
+                if (ok)
+                    reduceQuadrant(subdata, width, height, reduction, qx, qy, data);
             }
+        }
 
-            if (code != CPLErr::CE_None)
-                return;
-
-            for (int y = 0; y < subheight; y++)
+        if (ok)
+        {
+            // parent stats are merged from the child stats, the parent is only scanned when a child was
+            // rendered without an index
+            TileStats stats;
+            bool record = tile_stats && tile_stats->outDir() == out_dir;
+            bool merged = false;
+            if (record && child_dir == out_dir)
             {
-                for (int x = 0; x < subwidth; x++)
+                TileStats children[4];
+                const TileStats *pChildren[4] = {nullptr, nullptr, nullptr, nullptr};
+                bool complete = true;
+                for (int q = 0; q < 4 && complete; q++)
+                {
+                    int qx = q / 2;
+                    int qy = q % 2;
+                    if (!exists[qx][qy])
+                        continue;
+                    complete = tile_stats->get(z + 1, x * 2 + qx, y * 2 + qy, children[q]);
+                    pChildren[q] = &children[q];
+                }
+                if (complete)
                 {
-                    data[(height - subheight + y) * width + width - subwidth + x] = subdata[y * subwidth + x];
+                    mergeTileStats(pChildren, (uint32_t)(width * height), stats);
+                    merged = true;
                 }
             }
-            GDALClose(poDataset);
-        }
-
-        delete subdata;
-        subdata = nullptr;
-
-        if (icompare(type, "png"))
-        {
-            GDALDriver *pDriverMEM = GetGDALDriverManager()->GetDriverByName("MEM");
-            GDALDataset *pOutMEMDataset = pDriverMEM->Create("", width, height, 1, GDT_UInt16, NULL);
-            if (!pOutMEMDataset)
+            // the quadrant of a missing child is NODATA, the codecs expect it replaced like a rendered tile
+            size_t count = (size_t)width * height;
+            if (record && !merged)
             {
-                logger::ERROR("cannot create MEM image.");
-                return;
+                computeTileStats(data, count, stats, void_value);
             }
-            pOutMEMDataset->RasterIO(GF_Write, 0, 0, width, height, (void *)data, width, height,
-                                     GDT_UInt16, 1, nullptr, 0, 0, 0);
-
-            // 以创建复制的方式，生成png文件
-            GDALDriver *pDriverPNG = GetGDALDriverManager()->GetDriverByName("PNG");
-            // GDALDriver *pDriverPNG = GetGDALDriverManager()->GetDriverByName("JPEG");
-            GDALDataset *tile = pDriverPNG->CreateCopy(path.c_str(), pOutMEMDataset, TRUE, 0, 0, 0);
-            if (!tile)
+            else
             {
-                logger::ERROR("cannot create PNG image.");
-                return;
+                for (size_t i = 0; i < count; i++)
+                    data[i] = data[i] <= NODATA ? void_value : data[i];
             }
 
-            GDALClose(pOutMEMDataset);
-            pOutMEMDataset = nullptr;
-
-            GDALClose(tile);
-            tile = nullptr;
-        }
-        else if (icompare(type, "tif"))
-        {
-            GDALDriver *pDriverTIF = GetGDALDriverManager()->GetDriverByName("GTiff");
-            GDALDataset *pOutTIFDataset = pDriverTIF->Create(path.c_str(), width, height, 1, GDT_Int16, NULL);
-            if (!pOutTIFDataset)
-            {
-                logger::ERROR("cannot create TIF image.");
-                return;
-            }
-            pOutTIFDataset->RasterIO(GF_Write, 0, 0, width, height, (void *)data, width, height,
-                                     GDT_Int16, 1, nullptr, 0, 0, 0);
-
-            double step = 180.0 / (1 << z);
-            double west = -180.0 + x * step;
-            double east = west + step;
-            double north = 90 - y * step;
-            double south = north - step;
-            double xResolution = (east - west) / (width - 1);
-            double yResolution = (south - north) / (height - 1);
-            double geoTransform[6] = {
-                west - xResolution * 0.5,
-                xResolution,
-                0,
-                north - yResolution * 0.5,
-                0,
-                yResolution};
-            pOutTIFDataset->SetGeoTransform(geoTransform);
-            pOutTIFDataset->SetProjection(default_projection.c_str());
-
-            GDALClose(pOutTIFDataset);
-            pOutTIFDataset = nullptr;
-        }
-        else
-        {
-            logger::ERROR("unsupported type, [png, tif] suppported.");
+            double west, south, east, north;
+            tile_matrix_set->tileBounds(z, x, y, west, south, east, north);
+            function<void()> written = nullptr;
+            if (record)
+                written = [this, z, x, y, stats]()
+                { tile_stats->put(z, x, y, stats); };
+            writeElevationImage(data, width, height, type, path, tile_matrix_set->projection(), west, south, east, north, written);
         }
+    }
+}
 
-        delete data;
-        data = nullptr;
+void GdemPool::makeCogLodTile(int z, int x, int y, int width, int height, string out_dir, Reduction reduction)
+{
+    if (cog_writer->hasTile(z, x, y))
+        return;
+
+    size_t count = (size_t)width * height;
+    vector<int16_t> data(count, NODATA);
+    vector<int16_t> child(count);
+    int block = cog_writer->blockSize();
+    bool any = false;
+    for (int q = 0; q < 4; q++)
+    {
+        int qx = q / 2;
+        int qy = q % 2;
+        if (!cog_writer->readTile(z + 1, x * 2 + qx, y * 2 + qy, child.data(), width))
+            continue;
+
+        // gdal places an overview on the pixel-is-area grid of the full resolution, so an overview pixel covers
+        // 2x2 pixels of the level below instead of being centered on one of them like the makelod tiles
+        reduceQuadrantBox(child.data(), block, width, reduction, qx, qy, data.data());
+        any = true;
     }
+    if (!any)
+        return;
+
+    TileStats stats;
+    computeTileStats(data.data(), count, stats, void_value);
+    if (cog_writer->writeTile(z, x, y, data.data(), width) && tile_stats && tile_stats->outDir() == out_dir)
+        tile_stats->put(z, x, y, stats);
 }
 
 void GdemPool::makeNullImage(int width, int height, std::string format, std::string out_dir)
@@ -4,37 +4,41 @@
 #include <map>
 #include <memory>
 #include <queue>
+#include <functional>
 
 #include "lrucache.hpp"
 #include "rtree.hpp"
 #include "state.h"
+#include "resample.h"
+#include "reduce.h"
+#include "tilestats.h"
+#include "source.h"
+#include "catalog.h"
+#include "tilematrixset.h"
+#include "quantizedmesh.h"
+#include "heightmap.h"
+#include "cog.h"
+#include "tilecodec.h"
 
-#define EARTH_RADIUS 6378137.0
-#define EARTH_LENGTH 20037508.34
+#define NODATA -9999
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-/* 3.1415926535897932384626433832795 */
-#endif
+typedef RTree<int, double, 2> DEMTree;
 
-inline void mercatorToLonlat(double x, double y, double &lon, double &lat)
+/**
+ * @brief
+ * key of the 1x1 degree gdem tile and key of the 0.0625x0.0625 block containing (lon, lat)
+ */
+inline void getBlockKeys(double lon, double lat, int &key, int &key_block)
 {
-    lon = x / EARTH_LENGTH * 180.0;
-    lat = y / EARTH_LENGTH * 180.0;
-    lat = 180.0 / M_PI * (2 * atan(exp(lat * M_PI / 180.0)) - M_PI / 2.0);
-}
+    int ilon = (int)(lon + 180.0);
+    int ilat = (int)(lat + 90.0);
+    key = ilat * 360 + ilon;
 
-inline void lonlatToMercator(double lon, double lat, double &x, double &y)
-{
-    x = lon / 180.0 * EARTH_LENGTH;
-    y = log(tan((90.0 + lat) * M_PI / 360.0)) / (M_PI / 180.0);
-    y = y * EARTH_LENGTH / 180.0;
+    int ilon_block = (int)(lon * 16.0 + 180.0 * 16.0);
+    int ilat_block = (int)(lat * 16.0 + 90.0 * 16.0);
+    key_block = ilat_block * 360 * 16 + ilon_block;
 }
 
-#define NODATA -9999
-
-typedef RTree<int, double, 2> DEMTree;
-
 /**
  * @brief
  * block scope of lon/lat is (1.0 / 16.0 = 0.0625)
@@ -53,7 +57,7 @@ struct DEMTileBlock
     {
         if (this->data)
         {
-            delete this->data;
+            delete[] this->data;
             this->data = nullptr;
         }
     }
@@ -65,12 +69,15 @@ struct DEMTileBlock
 
 struct TileCache
 {
-    TileCache(uint64_t size = 20480)
+    // blocks of the default cache, split between the caches of the numa nodes
+    static constexpr uint64_t DEFAULT_SIZE = 20480;
+
+    TileCache(uint64_t size = DEFAULT_SIZE)
         : _size{size}
     {
     }
 
-    void insert(int key, std::shared_ptr<DEMTileBlock> tile, State &state)
+    void insert(int64_t key, std::shared_ptr<DEMTileBlock> tile, State &state)
     {
         std::lock_guard<std::mutex> lock(mtx);
         auto iter = _map.find(key);
@@ -80,17 +87,20 @@ struct TileCache
         _map[key] = tile;
         _queue.push(key);
 
+        // a change, not the size, the caches of the numa nodes add up in state
         if (_queue.size() > _size)
         {
-            int eraseKey = _queue.front();
+            int64_t eraseKey = _queue.front();
             _queue.pop();
             _map.erase(eraseKey);
         }
-
-        state.cacheSize = _queue.size();
+        else
+        {
+            state.cacheSize++;
+        }
     }
 
-    bool tryGet(const int &key, std::shared_ptr<DEMTileBlock> &out)
+    bool tryGet(const int64_t &key, std::shared_ptr<DEMTileBlock> &out)
     {
         std::lock_guard<std::mutex> lock(mtx);
         auto iter = _map.find(key);
@@ -102,29 +112,89 @@ struct TileCache
     }
 
     uint64_t _size;
-    std::unordered_map<int, std::shared_ptr<DEMTileBlock>> _map;
-    std::queue<int> _queue;
+    std::unordered_map<int64_t, std::shared_ptr<DEMTileBlock>> _map;
+    std::queue<int64_t> _queue;
     std::mutex mtx;
 };
 
+/**
+ * @brief
+ * a source layer holds at most one 1x1 degree tile (3601x3601) per key
+ */
+struct SourceLayer
+{
+    std::string name;
+    std::map<int, std::string> tile_map;
+};
+
 class GdemPool
 {
 public:
     GdemPool();
     ~GdemPool();
 
-    void init(std::vector<std::string> sources, int &max_lod, int tile_size, State &state);
+    // layers are ordered by priority, layer 0 is the gdem, a pixel comes from the first layer with valid data
+    void init(std::vector<std::vector<std::string>> layer_sources, int &max_lod, int tile_size, State &state);
     double getElevation(double lon, double lat, State &state);
+    // batch version of getElevation, samples are grouped by block so that each block is fetched once
+    void getElevations(const double *lon, const double *lat, size_t count, double *out, State &state);
+
+    void setResampling(Resampling resampling);
+    void setLodReduction(Reduction reduction);
+    // stats of the tiles written to index->outDir() are recorded into index
+    void setTileStats(TileStatsIndex *index);
+    // tile pyramid of the z/x/y methods, geographic by default. set before init since it changes the max lod
+    void setTileMatrixSet(std::shared_ptr<TileMatrixSet> tile_matrix_set);
+    TileMatrixSet &tileMatrixSet();
+    // options of the terrain types, "terrain" (quantized-mesh-1.0) and "heightmap" (heightmap-1.0) tiles
+    // are encoded from the rendered heights
+    void setTerrain(const TerrainOptions &options);
+    // tiles of the "cog" type go to the writer instead of files, width and height are its block size + 1
+    void setCogWriter(CogWriter *writer);
+    // lerc max error, zstd level and delta prediction of the webp, lerc and bin tile types
+    void setTileCodec(const TileCodecOptions &options);
+    // encoded tiles are handed to writer instead of being written in place, e.g. to the write pool of a pipeline.
+    // the writer calls written, if set, once the tile is on disk. nullptr writes them again directly
+    using TileWriter = std::function<void(const std::string &path, std::vector<uint8_t> &&bytes,
+                                          std::function<void()> written)>;
+    void setTileWriter(TileWriter writer);
+    // one block cache per numa node instead of one shared cache, a thread uses the cache of its numaNode().
+    // the capacity is split between the caches. set before the passes run
+    void setNumaNodes(int nodes);
+
+    // number of gdem blocks with voids that needed the fill layers
+    int64_t voidBlocks();
+    // every source file accepted by init with its bounds, size and mtime, and the zip directories read by init
+    void catalog(SourceCatalog &catalog);
+    // zip directories of a previous run, archives with the same size and mtime are not read again
+    void setArchiveCache(const std::vector<ZipDirectory> &directories);
 
     bool contains(double west, double south, double east, double north);
-    void makeElevation(double west, double south, double east, double north, int width, int height, int16_t *data, State &state);
-    void makeElevationImage(double west, double south, double east, double north,
-                            int width, int height, std::string format, std::string type, std::string path, State &state);
+    // loads the gdem blocks of the lon/lat bounds and a block around them into the block cache, so that the
+    // renders of the bounds do not wait on the sources. large bounds and georeferenced sources are left alone
+    void prefetch(double west, double south, double east, double north, State &state);
+    // fraction of the lon/lat bounds covered by sources, 0 to 1
+    double coverage(double west, double south, double east, double north);
+    void makeElevation(double west, double south, double east, double north, int width, int height, int16_t *data,
+                       State &state, TileStats *stats = nullptr);
+    // row y is at latitude lat[y], columns are evenly spaced from west to east
+    void makeElevationRows(double west, double east, const double *lat, int width, int height, int16_t *data,
+                           State &state, TileStats *stats = nullptr);
+    // pixel i is at (lon[i], lat[i])
+    void makeElevationPoints(const double *lon, const double *lat, int width, int height, int16_t *data,
+                             State &state, TileStats *stats = nullptr);
+    // lon/lat bounds, written as EPSG:4326
+    bool makeElevationImage(double west, double south, double east, double north,
+                            int width, int height, std::string format, std::string type, std::string path, State &state,
+                            TileStats *stats = nullptr);
     void makeElevationImage(int z, int x, int y, int width, int height,
                             std::string format, std::string type, std::string out_dir, State &state);
 
     void makeLodImage(int z, int x, int y, int width, int height,
                       std::string format, std::string type, std::string out_dir, State &state);
+    // children are read from child_dir, e.g. the min/max pyramids whose base level is the tileset itself
+    void makeLodImage(int z, int x, int y, int width, int height, std::string format, std::string type,
+                      std::string out_dir, std::string child_dir, Reduction reduction, State &state);
 
     void makeNullImage(int width, int height, std::string format, std::string out_dir);
 
@@ -133,11 +203,69 @@ public:
                      std::string format, std::string type, std::string out_dir, State &state);
 
 private:
-    std::map<int, std::string> tile_map;
-    TileCache tile_cache;
+    bool getZipDirectory(const std::string &path, ZipDirectory &directory);
+    bool readLayerBlock(const std::string &path, int ilon_block, int ilat_block, int16_t *data);
+    std::shared_ptr<DEMTileBlock> getTileBlock(int key, int key_block, State &state);
+    // the block cache of the numa node of the calling thread
+    TileCache &blockCache();
+    std::shared_ptr<const int16_t> getSourceBlock(int bx, int by, State &state);
+    std::shared_ptr<const int16_t> getGeoSourceBlock(const GeoSource &source, int bx, int by, State &state);
+    // georeferenced sources intersecting the bounds, finest first
+    void findGeoSources(double west, double south, double east, double north, std::vector<const GeoSource *> &found);
+    int16_t sampleGeoSources(double lon, double lat, State &state);
+    // samples every source of the tile, finest first, until there are no voids left
+    // render samples one source (nullptr for the gdem tiles) into its target
+    void makeMosaic(double west, double south, double east, double north, size_t count, int16_t *data,
+                    const std::function<void(const GeoSource *source, int16_t *target)> &render);
+
+    // bounds are in the units of the projection (WKT). written runs once the tile is on disk, which is after the
+    // return with a tile writer, so the return value of a queued tile only says that it was encoded
+    bool writeElevationImage(const int16_t *data, int width, int height, std::string type, std::string path,
+                             const std::string &projection, double west, double south, double east, double north,
+                             std::function<void()> written = nullptr);
+    // through the tile writer if set, else a temporary file renamed into place
+    bool writeTileBytes(const std::string &path, std::vector<uint8_t> &&bytes, std::function<void()> written);
+    // the 2:1 reduction of makelod between the tiles of the cog writer
+    void makeCogLodTile(int z, int x, int y, int width, int height, std::string out_dir, Reduction reduction);
+    bool readLodChild(int z, int x, int y, int width, int height,
+                      std::string format, std::string type, std::string dir, int16_t *data, State &state);
+
+    enum BlockVoids : uint8_t
+    {
+        BLOCK_UNKNOWN = 0,
+        BLOCK_COMPLETE = 1,
+        BLOCK_VOIDS = 2
+    };
+
+    std::map<std::string, ZipDirectory> archive_cache;
+    std::map<std::string, ZipDirectory> archives;
+    std::mutex archive_mutex;
+
+    std::vector<SourceLayer> layers;
+    // bit i is set if layer i has a tile for the key
+    std::map<int, uint32_t> cell_layers;
+    // BlockVoids of the gdem layer per key_block
+    std::unique_ptr<std::atomic<uint8_t>[]> block_voids;
+    std::atomic<int64_t> void_blocks = 0;
+
+    // sources that are not 1x1 degree gdem tiles, indexed by their real bounds
+    std::vector<GeoSource> geo_sources;
+    DEMTree source_tree;
+
+    // per numa node, see setNumaNodes
+    std::vector<std::unique_ptr<TileCache>> tile_caches;
     DEMTree tile_tree;
 
-    std::string default_projection;
+    std::shared_ptr<TileMatrixSet> tile_matrix_set;
+    Resampling resampling = Resampling::Nearest;
+    Reduction lod_reduction = Reduction::Mean;
+    TileStatsIndex *tile_stats = nullptr;
+    TerrainOptions terrain_options;
+    CogWriter *cog_writer = nullptr;
+    // value of the voids in the rendered tiles
+    int16_t void_value = 0;
+    TileCodecOptions codec_options;
+    TileWriter tile_writer;
 
     std::mutex repair_mutex;
 };
\ No newline at end of file
@@ -0,0 +1,55 @@
+/**
+ * @file heightmap.cpp
+ * @brief
+ * cesium heightmap-1.0 terrain tiles
+ *
+ * 65x65的高程直接取自渲染线程内存中的瓦片，附子瓦片掩码和水体掩码，gzip后写出
+ *
+ */
+
+#include "heightmap.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+bool encodeHeightmap(const int16_t *heights, uint8_t child_mask, const TerrainOptions &options, vector<uint8_t> &out)
+{
+    const int count = HEIGHTMAP_SIZE * HEIGHTMAP_SIZE;
+    vector<uint8_t> bytes;
+    bytes.reserve(count * 2 + 2 + HEIGHTMAP_WATER_MASK_SIZE * HEIGHTMAP_WATER_MASK_SIZE);
+
+    int water = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int value = min(max((heights[i] + 1000) * 5, 0), 65535);
+        bytes.push_back((uint8_t)(value & 0xff));
+        bytes.push_back((uint8_t)(value >> 8));
+        if (heights[i] == 0)
+            water++;
+    }
+
+    bytes.push_back(child_mask);
+
+    if (water == 0 || water == count)
+    {
+        bytes.push_back(water == 0 ? 0 : 255);
+    }
+    else
+    {
+        // nearest sample, row 0 is north like the heights
+        for (int y = 0; y < HEIGHTMAP_WATER_MASK_SIZE; y++)
+        {
+            int sy = (int)lround((double)y * (HEIGHTMAP_SIZE - 1) / (HEIGHTMAP_WATER_MASK_SIZE - 1));
+            for (int x = 0; x < HEIGHTMAP_WATER_MASK_SIZE; x++)
+            {
+                int sx = (int)lround((double)x * (HEIGHTMAP_SIZE - 1) / (HEIGHTMAP_WATER_MASK_SIZE - 1));
+                bytes.push_back(heights[sy * HEIGHTMAP_SIZE + sx] == 0 ? 255 : 0);
+            }
+        }
+    }
+
+    return encodeTerrainFile(bytes, options.gzip, out);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+#include "terrain.h"
+
+#define HEIGHTMAP_SIZE 65
+#define HEIGHTMAP_WATER_MASK_SIZE 256
+
+/**
+ * @brief
+ * child mask bits of a heightmap-1.0 tile, children (2x + qx, 2y + qy) with qy = 1 to the south
+ */
+inline uint8_t heightmapChildBit(int qx, int qy)
+{
+    return (uint8_t)(1 << ((qy ? 0 : 2) + qx));
+}
+
+/**
+ * @brief
+ * encodes a heightmap-1.0 tile of 65 x 65 heights (meters, row 0 is north): (height + 1000) * 5 as uint16,
+ * the child mask and the water mask. samples at sea level (0, also the voids) are water, the mask is a single
+ * byte if the tile is all land or all water
+ */
+bool encodeHeightmap(const int16_t *heights, uint8_t child_mask, const TerrainOptions &options, std::vector<uint8_t> &out);
@@ -0,0 +1,263 @@
+/**
+ * @file jobqueue.cpp
+ * @brief
+ * lease based job queue of several worker processes in a directory
+ *
+ * 以独占方式创建租约文件领取任务，心跳定期延长租约；租约过期(进程崩溃)后由其他进程改名夺取并重新领取
+ *
+ */
+
+#include "jobqueue.h"
+#include "unsuck.hpp"
+#include "logger.h"
+
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <functional>
+
+using namespace std;
+
+double wallClock()
+{
+    return chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+JobQueue::JobQueue(string dir, string worker, double lease_seconds)
+    : dir{dir}, worker_id{worker}, lease_seconds{lease_seconds}
+{
+}
+
+bool JobQueue::open(int64_t count)
+{
+    error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir))
+    {
+        logger::ERROR("cannot create " + dir);
+        return false;
+    }
+
+    lock_guard<mutex> lock(mtx);
+    this->count = count;
+    known_done.assign(count, false);
+    known_done_count = 0;
+    cursor = count > 0 ? (int64_t)(hash<string>()(worker_id) % (uint64_t)count) : 0;
+    return true;
+}
+
+string JobQueue::leasePath(int64_t job) const
+{
+    return dir + "/" + to_string(job) + ".lease";
+}
+
+string JobQueue::donePath(int64_t job) const
+{
+    return dir + "/" + to_string(job) + ".done";
+}
+
+bool JobQueue::writeLease(const string &path, bool exclusive) const
+{
+    // "x" fails if the file exists, the create is atomic
+    FILE *file = fopen(path.c_str(), exclusive ? "wx" : "w");
+    if (!file)
+        return false;
+
+    string content = worker_id + " " + to_string(wallClock() + lease_seconds) + "\n";
+    bool ok = fwrite(content.data(), 1, content.size(), file) == content.size();
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+bool JobQueue::readLease(const string &path, string &owner, double &expiry) const
+{
+    ifstream in(path);
+    return in.is_open() && (in >> owner >> expiry);
+}
+
+bool JobQueue::done(int64_t job)
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        if (known_done[job])
+            return true;
+    }
+
+    bool exists = fs::exists(donePath(job));
+    if (exists)
+    {
+        lock_guard<mutex> lock(mtx);
+        setDone(job);
+    }
+    return exists;
+}
+
+void JobQueue::setDone(int64_t job)
+{
+    if (!known_done[job])
+    {
+        known_done[job] = true;
+        known_done_count++;
+    }
+}
+
+bool JobQueue::lease(int64_t job)
+{
+    if (done(job))
+        return false;
+
+    string path = leasePath(job);
+    if (!writeLease(path, true))
+    {
+        string owner = "?";
+        double expiry;
+        if (!readLease(path, owner, expiry))
+        {
+            // being written, or its worker died right after creating it
+            error_code ec;
+            auto age = fs::file_time_type::clock::now() - fs::last_write_time(path, ec);
+            if (ec || chrono::duration<double>(age).count() < lease_seconds)
+                return false;
+        }
+        else if (expiry > wallClock())
+        {
+            return false;
+        }
+
+        // only one worker wins the rename of an expired lease
+        string stale = path + "." + worker_id + ".stale";
+        error_code ec;
+        fs::rename(path, stale, ec);
+        if (ec)
+            return false;
+        fs::remove(stale, ec);
+        logger::WARN("lease of job " + to_string(job) + " by " + owner + " expired, leased again");
+
+        if (!writeLease(path, true))
+            return false;
+    }
+
+    // done between the check and the lease
+    if (done(job))
+    {
+        error_code ec;
+        fs::remove(path, ec);
+        return false;
+    }
+
+    lock_guard<mutex> lock(mtx);
+    held.insert(job);
+    return true;
+}
+
+int64_t JobQueue::lease()
+{
+    int64_t start;
+    {
+        lock_guard<mutex> lock(mtx);
+        start = cursor;
+    }
+
+    for (int64_t i = 0; i < count; i++)
+    {
+        int64_t job = (start + i) % count;
+        if (lease(job))
+        {
+            lock_guard<mutex> lock(mtx);
+            cursor = (job + 1) % count;
+            return job;
+        }
+    }
+    return -1;
+}
+
+void JobQueue::heartbeat()
+{
+    set<int64_t> jobs;
+    {
+        lock_guard<mutex> lock(mtx);
+        jobs = held;
+    }
+
+    for (int64_t job : jobs)
+    {
+        string path = leasePath(job);
+        string owner;
+        double expiry;
+        if (readLease(path, owner, expiry) && owner == worker_id)
+        {
+            writeLease(path, false);
+            continue;
+        }
+
+        // the job is finished anyway, it is idempotent
+        logger::WARN("lease of job " + to_string(job) + " was taken over by another worker");
+        lock_guard<mutex> lock(mtx);
+        held.erase(job);
+    }
+}
+
+void JobQueue::complete(int64_t job)
+{
+    // done first, a crash in between leaves a done job with a stale lease which is never leased again
+    ofstream out(donePath(job));
+    out << worker_id << " " << to_string(wallClock()) << "\n";
+    out.close();
+    release(job);
+
+    lock_guard<mutex> lock(mtx);
+    setDone(job);
+}
+
+void JobQueue::release(int64_t job)
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        if (held.erase(job) == 0)
+            return;
+    }
+
+    string owner;
+    double expiry;
+    error_code ec;
+    if (readLease(leasePath(job), owner, expiry) && owner == worker_id)
+        fs::remove(leasePath(job), ec);
+}
+
+int64_t JobQueue::doneCount()
+{
+    int64_t n = 0;
+    for (int64_t job = 0; job < count; job++)
+        n += done(job) ? 1 : 0;
+    return n;
+}
+
+int64_t JobQueue::listDone()
+{
+    vector<int64_t> jobs;
+    error_code ec;
+    for (fs::directory_iterator iter(dir, ec), end; !ec && iter != end; iter.increment(ec))
+    {
+        string name = iter->path().filename().string();
+        if (!iEndsWith(name, ".done"))
+            continue;
+        char *digits_end = nullptr;
+        int64_t job = strtoll(name.c_str(), &digits_end, 10);
+        if (digits_end == name.c_str() || digits_end != name.c_str() + name.size() - 5 || job < 0 || job >= count)
+            continue;
+        jobs.push_back(job);
+    }
+    if (ec)
+        logger::WARN("cannot list " + dir);
+
+    lock_guard<mutex> lock(mtx);
+    for (int64_t job : jobs)
+        setDone(job);
+    return known_done_count;
+}
+
+int64_t JobQueue::knownDoneCount()
+{
+    lock_guard<mutex> lock(mtx);
+    return known_done_count;
+}
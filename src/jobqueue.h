@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <cstdint>
+
+/**
+ * @brief
+ * queue of the jobs [0, count) shared by worker processes through a directory, e.g. on a shared filesystem.
+ *
+ * a worker leases a job by creating <dir>/<job>.lease exclusively, the file holds the worker and the expiry of the
+ * lease, heartbeat renews the expiry of all leases of the worker. a lease past its expiry (crashed worker) is
+ * renamed away by the next worker looking for a job and leased again. a finished job gets <dir>/<job>.done.
+ * jobs are delivered at least once: when a lease is taken over from a worker that was only slow both finish the
+ * job, so jobs must be idempotent. expiries are compared across hosts, their clocks have to be in sync
+ */
+class JobQueue
+{
+public:
+    JobQueue(std::string dir, std::string worker, double lease_seconds);
+
+    bool open(int64_t count);
+
+    // a job that is not done and not leased by a live worker, -1 if there is none right now
+    int64_t lease();
+    // leases this job unless it is done or leased by a live worker
+    bool lease(int64_t job);
+    // renews the leases of this worker, leases taken over by other workers are dropped
+    void heartbeat();
+    void complete(int64_t job);
+    void release(int64_t job);
+
+    bool done(int64_t job);
+    // number of done jobs, rescans the directory
+    int64_t doneCount();
+    // number of done jobs from one listing of the directory instead of a check per job
+    int64_t listDone();
+    // done jobs this worker knows of, from its own completions, its lease attempts and listDone. no file access
+    int64_t knownDoneCount();
+
+    std::string worker() const { return worker_id; }
+    double leaseSeconds() const { return lease_seconds; }
+
+private:
+    std::string leasePath(int64_t job) const;
+    std::string donePath(int64_t job) const;
+    bool writeLease(const std::string &path, bool exclusive) const;
+    // owner and expiry of a lease file, false if it cannot be read
+    bool readLease(const std::string &path, std::string &owner, double &expiry) const;
+    // with mtx held
+    void setDone(int64_t job);
+
+    std::string dir;
+    std::string worker_id;
+    double lease_seconds;
+    int64_t count = 0;
+    // jobs are tried from here on, workers start at different jobs
+    int64_t cursor = 0;
+
+    std::set<int64_t> held;
+    std::vector<bool> known_done;
+    int64_t known_done_count = 0;
+    std::mutex mtx;
+};
+
+/**
+ * @brief
+ * seconds since the epoch, comparable across hosts
+ */
+double wallClock();
@@ -3,12 +3,20 @@
 #include "arguments/Arguments.hpp"
 #include "unsuck.hpp"
 #include "threadpool.hpp"
-#include "TaskPool.hpp"
 #include "logger.h"
 #include "gdem.h"
+#include "profile.h"
 #include "state.h"
+#include "shard.h"
+#include "jobqueue.h"
+#include "pipeline.h"
+#include "numa.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <iostream>
+#include <random>
+#include <execution>
 using namespace std;
 
 struct Monitor
@@ -60,12 +68,20 @@ shared_ptr<Monitor> startMonitoring(State &state)
                                 string strRAM = formatNumber(double(ram.virtual_usedByProcess) / GB, 1) + "GB (highest " + formatNumber(double(ram.virtual_usedByProcess_max) / GB, 1) + "GB)";
                                 string strCPU = formatNumber(CPU.usage) + "%";
 
-                                string cacheSize = formatNumber(state.cacheSize);
+                                string cacheSize = formatNumber(state.cacheSize.load());
+
+                                map<string, string> stages;
+                                {
+                                    lock_guard<mutex> lock(state.mtx);
+                                    stages = state.stages;
+                                }
 
                                 stringstream ss;
                                 ss << "[" << strProgressTotal << ", " << strTime << "], "
                                    << "[" << state.name << ": " << strProgressPass << ", duration: " << strDuration << ", tilesProcessed: " << strTilesProcessed << "]"
                                    << "[RAM: " << strRAM << ", CPU: " << strCPU << ", CacheSize: " << cacheSize << "]";
+                                for (auto &[label, text] : stages)
+                                    ss << "[" << label << ": " << text << "]";
 
                                 cout << ss.str() << endl;
 
@@ -75,227 +91,671 @@ shared_ptr<Monitor> startMonitoring(State &state)
     return monitor;
 }
 
-void tileset(GdemPool &gdem_pool, State &state, int max_lod, int tile_size, string out_format, string out_type, string outdir)
+struct Heartbeat
+{
+    thread t;
+    atomic_bool stopRequested = false;
+
+    void stop()
+    {
+        stopRequested = true;
+        t.join();
+    }
+};
+
+// renews the leases of the queues a few times per lease period
+shared_ptr<Heartbeat> startHeartbeat(vector<JobQueue *> queues)
+{
+    shared_ptr<Heartbeat> heartbeat = make_shared<Heartbeat>();
+
+    heartbeat->t = thread([heartbeat, queues]()
+                          {
+                              using namespace std::chrono_literals;
+
+                              double last = now();
+                              while (!heartbeat->stopRequested)
+                              {
+                                  std::this_thread::sleep_for(100ms);
+                                  if (now() - last < queues[0]->leaseSeconds() / 4.0)
+                                      continue;
+
+                                  for (auto queue : queues)
+                                      queue->heartbeat();
+                                  last = now();
+                              } });
+
+    return heartbeat;
+}
+
+map<string, double> metricGauges(State &state)
+{
+    return {{"pass", (double)state.currentPass},
+            {"passes", (double)state.numPasses},
+            {"tiles_processed", (double)state.tilesProcessed},
+            {"tiles_total", (double)state.tilesTotal},
+            {"cache_blocks", (double)state.cacheSize}};
+}
+
+struct MetricsExport
+{
+    thread t;
+    atomic_bool stopRequested = false;
+    string dir;
+    State *state = nullptr;
+
+    // the last snapshot is written after the workers are done
+    void stop()
+    {
+        stopRequested = true;
+        t.join();
+        metrics::write(dir, metricGauges(*state));
+    }
+};
+
+// writes the metrics to dir every interval seconds
+shared_ptr<MetricsExport> startMetricsExport(State &state, string dir, double interval)
+{
+    shared_ptr<MetricsExport> metrics_export = make_shared<MetricsExport>();
+    metrics_export->dir = dir;
+    metrics_export->state = &state;
+
+    metrics_export->t = thread([metrics_export, &state, dir, interval]()
+                               {
+                                   using namespace std::chrono_literals;
+
+                                   double last = now();
+                                   while (!metrics_export->stopRequested)
+                                   {
+                                       std::this_thread::sleep_for(100ms);
+                                       if (now() - last < interval)
+                                           continue;
+
+                                       metrics::write(dir, metricGauges(state));
+                                       last = now();
+                                   } });
+
+    return metrics_export;
+}
+
+/**
+ * @brief
+ * builds levels [z_job, max_lod] below the job tile (z_job, job_x, job_y): renders the base level, then reduces the
+ * levels above it (terrain renders every level)
+ */
+void supertile(GdemPool &gdem_pool, State &state, int max_lod, int z_job, int job_x, int job_y, int tile_size,
+               string out_format, string out_type, string outdir, Reduction reduction, bool has_minmax)
+{
+    bool terrain = isTerrainType(out_type);
+    for (int z = max_lod; z >= z_job; z--)
+    {
+        int d = z - z_job;
+        vector<pair<int, int>> tiles;
+        for (int x = job_x << d; x < (job_x + 1) << d; x++)
+        {
+            fs::create_directories(outdir + "/" + formatNumber(z) + "/" + formatNumber(x));
+            if (has_minmax && z < max_lod)
+            {
+                fs::create_directories(outdir + "/min/" + formatNumber(z) + "/" + formatNumber(x));
+                fs::create_directories(outdir + "/max/" + formatNumber(z) + "/" + formatNumber(x));
+            }
+            for (int y = job_y << d; y < (job_y + 1) << d; y++)
+                tiles.push_back({x, y});
+        }
+
+        // one job is a few hundred tiles, enough for all cores
+        for_each(std::execution::par, tiles.begin(), tiles.end(), [&](const pair<int, int> &tile)
+                 {
+                     if (z == max_lod || terrain)
+                     {
+                         gdem_pool.makeElevationImage(z, tile.first, tile.second, tile_size, tile_size, out_format, out_type, outdir, state);
+                         return;
+                     }
+
+                     gdem_pool.makeLodImage(z, tile.first, tile.second, tile_size, tile_size, out_format, out_type, outdir, outdir, reduction, state);
+                     if (has_minmax)
+                     {
+                         string childdir = z + 1 == max_lod ? outdir : outdir + "/min";
+                         gdem_pool.makeLodImage(z, tile.first, tile.second, tile_size, tile_size, out_format, out_type, outdir + "/min", childdir, Reduction::Minimum, state);
+                         childdir = z + 1 == max_lod ? outdir : outdir + "/max";
+                         gdem_pool.makeLodImage(z, tile.first, tile.second, tile_size, tile_size, out_format, out_type, outdir + "/max", childdir, Reduction::Maximum, state);
+                     } });
+    }
+}
+
+/**
+ * @brief
+ * works off the supertile jobs of the queue together with the other workers. returns true if this worker leased the
+ * final job, the levels above the jobs, after all jobs were done; false if another worker finished it
+ */
+bool runQueue(GdemPool &gdem_pool, State &state, JobQueue &queue, JobQueue &final_queue,
+              const vector<pair<int, int>> &jobs, int max_lod, int z_job, int tile_size, string out_format,
+              string out_type, string outdir, Reduction reduction, bool has_minmax)
 {
     cout << endl;
     cout << "=======================================" << endl;
-    cout << "=== tileset                           " << endl;
+    cout << "=== queue                             " << endl;
     cout << "=======================================" << endl;
 
     auto tStart = now();
 
-    int64_t ztilesTotal = 2;
-    for (int z = 1; z <= max_lod; z++)
-    {
-        ztilesTotal = ztilesTotal * 4;
-    }
-
-    state.name = "tileset";
+    state.name = "queue";
     state.currentPass = 2;
-    state.tilesTotal = ztilesTotal;
-    state.tilesProcessed = 0;
+    state.tilesTotal = jobs.size();
+    state.tilesProcessed = queue.listDone();
     state.duration = 0;
 
-    struct Task
+    // the jobs done by the other workers are listed at most once per report of the monitor, a check of every
+    // job after each completion would be quadratic in the jobs on the shared filesystem
+    double last_listing = now();
+    int64_t leased = 0;
+    while (true)
     {
-        int z;
-        int x;
-        int y;
-
-        Task(int z, int x, int y)
+        int64_t job = queue.lease();
+        if (job >= 0)
         {
-            this->z = z;
-            this->x = x;
-            this->y = y;
+            supertile(gdem_pool, state, max_lod, z_job, jobs[job].first, jobs[job].second, tile_size, out_format,
+                      out_type, outdir, reduction, has_minmax);
+            queue.complete(job);
+            leased++;
+
+            if (now() - last_listing >= 1.0)
+            {
+                queue.listDone();
+                last_listing = now();
+            }
+            state.tilesProcessed = queue.knownDoneCount();
+            state.duration = now() - tStart;
+            continue;
         }
-    };
 
-    atomic_uint32_t active_tasks = 0;
-    size_t numThreads = getCpuData().numProcessors * 2;
-    int64_t tilesProcessed = 0;
-    double lastReport = now();
-    mutex mtx;
-    TaskPool<Task> pool(
-        numThreads, [&](auto task)
+        // the rest is leased by other workers, their leases expire if they crash
+        if (queue.doneCount() == (int64_t)jobs.size())
         {
-            gdem_pool.makeElevationImage(task->z, task->x, task->y, tile_size, tile_size, out_format, out_type, outdir,state);
-            active_tasks--;
+            if (final_queue.done(0))
+                break;
+            if (final_queue.lease(0))
+                break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds((int64_t)(queue.leaseSeconds() * 100)));
+    }
 
-            lock_guard<mutex> lock(mtx);
+    state.values["leased jobs"] = formatNumber(leased);
+    state.values["duration(queue)"] = formatNumber(now() - tStart, 3);
+    return !final_queue.done(0);
+}
 
-            tilesProcessed = tilesProcessed + 1;
-            if (now() - lastReport > 1.0)
-            {
-                state.tilesProcessed = tilesProcessed;
-                state.duration = now() - tStart;
+/**
+ * @brief
+ * an NxN block of tiles of one level rendered by one worker, adjacent tiles share the cached source blocks
+ */
+struct TileTask
+{
+    int z;
+    vector<pair<int, int>> tiles;
+};
 
-                lastReport = now();
-            } 
-        });
+/**
+ * @brief
+ * hands the tiles of level z in supertiles of task_size x task_size tiles to add, only the tiles of dirty[z] if
+ * dirty is given and only those of the shard if shard is given. columns without sources are passed to skip instead.
+ * the directories of the columns are created below dir unless it is empty
+ */
+void tileTasks(GdemPool &gdem_pool, int z, int task_size, const TileList *dirty, const ShardTiles *shard, string dir,
+               const function<void(shared_ptr<TileTask> task)> &add, const function<void(int64_t tiles)> &skip)
+{
+    TileMatrixSet &tms = gdem_pool.tileMatrixSet();
+    if (!dir.empty())
+        fs::create_directories(dir + "/" + formatNumber(z));
 
-    int z = max_lod;
+    if (shard && z < shard->level)
+        dirty = &shard->ancestors;
+    else if (shard)
     {
-        fs::create_directories(outdir + "/" + formatNumber(z));
-        int x_num = 2 << z;
-        int y_num = 1 << z;
-        for (int x = 0; x < x_num; x++)
+        // the block of tiles below every owned cell, cut into supertiles as they are handed out. add blocks on a full
+        // queue, so only the tasks in flight are in memory
+        int side = 1 << (z - shard->level);
+        for (auto &cell : shard->cells)
         {
-            double x_step = 360.0 / x_num;
-            if(!gdem_pool.contains(-180.0 + x * x_step, -90.0, -180.0 + x * x_step + x_step, 90.0))
+            int x_begin = cell.first * side;
+            int y_begin = cell.second * side;
+            if (!dir.empty())
             {
-                lock_guard<mutex> lock(mtx);
-
-                tilesProcessed = tilesProcessed + y_num;
-                if (now() - lastReport > 1.0)
-                {
-                    state.tilesProcessed = tilesProcessed;
-                    state.duration = now() - tStart;
-
-                    lastReport = now();
-                } 
-                continue;
+                for (int x = x_begin; x < x_begin + side; x++)
+                    fs::create_directories(dir + "/" + formatNumber(z) + "/" + formatNumber(x));
             }
 
-            fs::create_directories(outdir + "/" + formatNumber(z) + "/" + formatNumber(x));
-            for (int y = 0; y < y_num; y++)
+            for (int x0 = x_begin; x0 < x_begin + side; x0 += task_size)
             {
-                while (true)
+                for (int y0 = y_begin; y0 < y_begin + side; y0 += task_size)
                 {
-                    if (active_tasks > 10000)
+                    auto task = make_shared<TileTask>(TileTask{z, {}});
+                    for (int x = x0; x < min(x0 + task_size, x_begin + side); x++)
                     {
-                        std::this_thread::sleep_for(10ms);
-                    }
-                    else
-                    {
-                        break;
+                        for (int y = y0; y < min(y0 + task_size, y_begin + side); y++)
+                            task->tiles.push_back({x, y});
                     }
+                    add(task);
                 }
-                auto task = make_shared<Task>(z, x, y);
-                pool.addTask(task);
-                active_tasks++;
             }
         }
+        return;
+    }
+
+    if (dirty)
+    {
+        // dirty tiles are sorted by (x, y), the tiles of a block of columns are contiguous
+        auto &tiles = (*dirty)[z];
+        size_t begin = 0;
+        while (begin < tiles.size())
+        {
+            int bx = tiles[begin].first / task_size;
+            size_t end = begin;
+            map<int, shared_ptr<TileTask>> blocks;
+            for (; end < tiles.size() && tiles[end].first / task_size == bx; end++)
+            {
+                if (!dir.empty() && (end == begin || tiles[end].first != tiles[end - 1].first))
+                    fs::create_directories(dir + "/" + formatNumber(z) + "/" + formatNumber(tiles[end].first));
+
+                auto &block = blocks[tiles[end].second / task_size];
+                if (!block)
+                    block = make_shared<TileTask>(TileTask{z, {}});
+                block->tiles.push_back(tiles[end]);
+            }
+            for (auto &[by, task] : blocks)
+                add(task);
+            begin = end;
+        }
+        return;
+    }
+
+    int x_num = tms.tilesX(z);
+    int y_num = tms.tilesY(z);
+    for (int x0 = 0; x0 < x_num; x0 += task_size)
+    {
+        vector<int> columns;
+        for (int x = x0; x < min(x0 + task_size, x_num); x++)
+        {
+            double west, south, east, north;
+            tms.tileLonLatBounds(z, x, -1, west, south, east, north);
+            if (!gdem_pool.contains(west, south, east, north))
+            {
+                skip(y_num);
+                continue;
+            }
+
+            if (!dir.empty())
+                fs::create_directories(dir + "/" + formatNumber(z) + "/" + formatNumber(x));
+            columns.push_back(x);
+        }
+        if (columns.empty())
+            continue;
+
+        for (int y0 = 0; y0 < y_num; y0 += task_size)
+        {
+            auto task = make_shared<TileTask>(TileTask{z, {}});
+            for (int x : columns)
+            {
+                for (int y = y0; y < min(y0 + task_size, y_num); y++)
+                    task->tiles.push_back({x, y});
+            }
+            add(task);
+        }
+    }
+}
+
+/**
+ * @brief
+ * the pipeline of a pass, one per numa node in numa mode. supertiles go to the node of their band of columns, so the
+ * nodes render contiguous areas and their block caches hold different blocks. encoded tiles of the gdem pool go to
+ * the write pool of the node that rendered them
+ */
+struct Pipelines
+{
+    GdemPool &gdem_pool;
+    vector<unique_ptr<TilePipeline>> nodes;
+
+    Pipelines(GdemPool &gdem_pool, State &state, const PipelineOptions &options, bool files)
+        : gdem_pool{gdem_pool}
+    {
+        if (options.numa_nodes > 0)
+        {
+            auto &cpus = numaNodes();
+            size_t count = options.numa_nodes;
+            for (int node = 0; node < options.numa_nodes; node++)
+            {
+                size_t read_threads = options.read_threads == 0 ? 0 : max<size_t>(1, options.read_threads / count);
+                size_t write_threads = max<size_t>(1, options.write_threads / count);
+                nodes.push_back(make_unique<TilePipeline>(state, cpus[node % cpus.size()].size(), read_threads,
+                                                          write_threads, options.adaptive, node));
+            }
+        }
+        else
+        {
+            nodes.push_back(make_unique<TilePipeline>(state, getCpuData().numProcessors, options.read_threads,
+                                                      options.write_threads, options.adaptive));
+        }
+
+        if (files)
+        {
+            vector<TilePipeline *> targets;
+            for (auto &node : nodes)
+                targets.push_back(node.get());
+            gdem_pool.setTileWriter([targets](const string &path, vector<uint8_t> &&bytes, function<void()> written)
+                                    {
+                                        auto data = make_shared<vector<uint8_t>>(std::move(bytes));
+                                        targets[max(numaNode(), 0) % targets.size()]->write([path, data, written]()
+                                                                                             {
+                                                                                                 // a failed write is logged by writeTileFile and not recorded
+                                                                                                 if (writeTileFile(path, *data) && written)
+                                                                                                     written(); }); });
+        }
+    }
+
+    ~Pipelines()
+    {
+        wait();
+        gdem_pool.setTileWriter(nullptr);
+    }
+
+    TilePipeline &of(const TileTask &task)
+    {
+        int tiles_x = gdem_pool.tileMatrixSet().tilesX(task.z);
+        size_t node = (size_t)((int64_t)task.tiles[0].first * (int64_t)nodes.size() / max(tiles_x, 1));
+        return *nodes[min(node, nodes.size() - 1)];
+    }
+
+    void wait()
+    {
+        for (auto &node : nodes)
+            node->wait();
+    }
+
+    // tiles/s of every node over the pass
+    void report(State &state, const string &pass, double duration)
+    {
+        if (nodes.size() < 2)
+            return;
+
+        for (size_t node = 0; node < nodes.size(); node++)
+        {
+            string throughput = formatNumber(nodes[node]->tiles() / max(duration, 1e-9), 1);
+            state.values["tiles/s(" + pass + ", node " + to_string(node) + ")"] = throughput;
+            cout << pass << " node " << node << ": " << formatNumber(nodes[node]->tiles()) << " tiles, " << throughput << " tiles/s" << endl;
+        }
     }
+};
+
+/**
+ * @brief
+ * builds level max_lod of outdir, only the tiles of dirty[max_lod] if dirty is given or those of the shard if shard is
+ * given
+ */
+void tileset(GdemPool &gdem_pool, State &state, int max_lod, int tile_size, int task_size, string out_format, string out_type,
+             string outdir, const PipelineOptions &pipeline_options, const TileList *dirty = nullptr,
+             const ShardTiles *shard = nullptr)
+{
+    cout << endl;
+    cout << "=======================================" << endl;
+    cout << "=== tileset                           " << endl;
+    cout << "=======================================" << endl;
+
+    auto tStart = now();
+
+    TileMatrixSet &tms = gdem_pool.tileMatrixSet();
+    // cog tiles go to the spill file of the cog writer
+    bool files = out_type != "cog";
+    int64_t ztilesTotal = (int64_t)tms.tilesX(max_lod) * tms.tilesY(max_lod);
+
+    if (dirty)
+        ztilesTotal = (*dirty)[max_lod].size();
+    if (shard)
+        ztilesTotal = shard->count(max_lod);
+
+    state.name = "tileset";
+    state.currentPass = 2;
+    state.tilesTotal = ztilesTotal;
+    state.tilesProcessed = 0;
+    state.duration = 0;
+
+    int64_t tilesProcessed = 0;
+    double lastReport = now();
+    mutex mtx;
+    auto progress = [&](int64_t tiles)
+    {
+        lock_guard<mutex> lock(mtx);
+
+        tilesProcessed = tilesProcessed + tiles;
+        if (now() - lastReport > 1.0)
+        {
+            state.tilesProcessed = tilesProcessed;
+            state.duration = now() - tStart;
+
+            lastReport = now();
+        }
+    };
+
+    // the read stage loads the source blocks of a supertile, the render of it only finds them in the cache
+    Pipelines pipelines(gdem_pool, state, pipeline_options, files);
+    trace::nameThread("main");
+    trace::instant("level", max_lod);
 
-    pool.waitTillEmpty();
-    pool.close();
+    tileTasks(
+        gdem_pool, max_lod, task_size, dirty, shard, files ? outdir : "",
+        [&](shared_ptr<TileTask> task)
+        {
+            TilePipeline *pipeline = &pipelines.of(*task);
+            pipeline->submit(
+                [&, task]()
+                {
+                    double west = 180.0, south = 90.0, east = -180.0, north = -90.0;
+                    for (auto &tile : task->tiles)
+                    {
+                        double w, s, e, n;
+                        tms.tileLonLatBounds(task->z, tile.first, tile.second, w, s, e, n);
+                        west = min(west, w);
+                        south = min(south, s);
+                        east = max(east, e);
+                        north = max(north, n);
+                    }
+                    gdem_pool.prefetch(west, south, east, north, state);
+                },
+                [&, task, pipeline]()
+                {
+                    for (auto &tile : task->tiles)
+                        gdem_pool.makeElevationImage(task->z, tile.first, tile.second, tile_size, tile_size, out_format, out_type, outdir, state);
+
+                    pipeline->tilesDone(task->tiles.size());
+                    progress(task->tiles.size());
+                });
+        },
+        progress);
+
+    pipelines.wait();
 
     double duration = now() - tStart;
     state.values["duration(tileset)"] = formatNumber(duration, 3);
+    pipelines.report(state, "tileset", duration);
 }
 
-void makelod(GdemPool &gdem_pool, State &state, int max_lod, int tile_size, string out_format, string out_type, string outdir)
+/**
+ * @brief
+ * builds levels [0, max_lod) of outdir, children of max_lod - 1 are read from basedir.
+ * only the tiles of dirty[z] are built if dirty is given, only those of the shard if shard is given
+ */
+void makelod(GdemPool &gdem_pool, State &state, int max_lod, int tile_size, int task_size, string out_format, string out_type,
+             string outdir, string basedir, Reduction reduction, int pass, const PipelineOptions &pipeline_options,
+             const TileList *dirty = nullptr, const ShardTiles *shard = nullptr)
 {
+    string name = "makelod";
+    if (outdir != basedir)
+        name += "(" + toString(reduction) + ")";
+
     cout << endl;
     cout << "=======================================" << endl;
-    cout << "=== makelod                           " << endl;
+    cout << "=== " << name << "                           " << endl;
     cout << "=======================================" << endl;
 
     auto tStart = now();
 
-    int64_t tilesTotal = 2;
-    int64_t ztilesTotal = 2;
-    for (int z = 1; z <= max_lod - 1; z++)
+    TileMatrixSet &tms = gdem_pool.tileMatrixSet();
+    bool files = out_type != "cog";
+    int64_t tilesTotal = 0;
+    for (int z = 0; z <= max_lod - 1; z++)
+        tilesTotal += (int64_t)tms.tilesX(z) * tms.tilesY(z);
+
+    if (dirty)
+    {
+        tilesTotal = 0;
+        for (int z = 0; z <= max_lod - 1; z++)
+            tilesTotal += (*dirty)[z].size();
+    }
+    if (shard)
     {
-        ztilesTotal = ztilesTotal * 4;
-        tilesTotal += ztilesTotal;
+        tilesTotal = 0;
+        for (int z = 0; z <= max_lod - 1; z++)
+            tilesTotal += shard->count(z);
     }
 
-    state.name = "makelod";
-    state.currentPass = 3;
+    state.name = name;
+    state.currentPass = pass;
     state.tilesTotal = tilesTotal;
     state.tilesProcessed = 0;
     state.duration = 0;
 
-    struct Task
+    int64_t tilesProcessed = 0;
+    double lastReport = now();
+    mutex mtx;
+    auto progress = [&](int64_t tiles)
     {
-        int z;
-        int x;
-        int y;
+        lock_guard<mutex> lock(mtx);
 
-        Task(int z, int x, int y)
+        tilesProcessed = tilesProcessed + tiles;
+        if (now() - lastReport > 1.0)
         {
-            this->z = z;
-            this->x = x;
-            this->y = y;
+            state.tilesProcessed = tilesProcessed;
+            state.duration = now() - tStart;
+
+            lastReport = now();
         }
     };
 
-    atomic_uint32_t active_tasks = 0;
-    size_t numThreads = getCpuData().numProcessors * 2;
-    int64_t tilesProcessed = 0;
-    double lastReport = now();
-    mutex mtx;
-    TaskPool<Task> pool(
-        numThreads, [&](auto task)
-        {
-            gdem_pool.makeLodImage(task->z, task->x, task->y, tile_size, tile_size, out_format, out_type, outdir,state);
-            active_tasks--;
+    // the children are read by the reduction itself, only the writes go to their own pool
+    Pipelines pipelines(gdem_pool, state, pipeline_options, files);
 
-            lock_guard<mutex> lock(mtx);
+    for (int z = max_lod - 1; z >= 0; z--)
+    {
+        // make sure all sub tiles are written
+        pipelines.wait();
+        trace::instant("level", z);
 
-            tilesProcessed = tilesProcessed + 1;
-            if (now() - lastReport > 1.0)
+        tileTasks(
+            gdem_pool, z, task_size, dirty, shard, files ? outdir : "",
+            [&](shared_ptr<TileTask> task)
             {
-                state.tilesProcessed = tilesProcessed;
-                state.duration = now() - tStart;
+                // the bands of the nodes are the same on every level, the children of a task were built on its node
+                TilePipeline *pipeline = &pipelines.of(*task);
+                pipeline->submit(nullptr, [&, task, pipeline]()
+                                 {
+                                     string childdir = task->z + 1 == max_lod ? basedir : outdir;
+                                     for (auto &tile : task->tiles)
+                                         gdem_pool.makeLodImage(task->z, tile.first, tile.second, tile_size, tile_size, out_format, out_type, outdir, childdir, reduction, state);
+
+                                     pipeline->tilesDone(task->tiles.size());
+                                     progress(task->tiles.size()); });
+            },
+            progress);
+    }
 
-                lastReport = now();
-            } });
+    pipelines.wait();
 
-    for (int z = max_lod - 1; z >= 0; z--)
-    {
-        // make sure all sub tiles are ready
-        pool.waitTillEmpty();
-        std::this_thread::sleep_for(2s);
+    double duration = now() - tStart;
+    state.values["duration(" + name + ")"] = formatNumber(duration, 3);
+    pipelines.report(state, name, duration);
+}
 
-        fs::create_directories(outdir + "/" + formatNumber(z));
-        int x_num = 2 << z;
-        int y_num = 1 << z;
-        for (int x = 0; x < x_num; x++)
+/**
+ * @brief
+ * removes the dirty tiles of the given levels so that they are built again, terrain tiles count y from the south
+ */
+void removeTiles(const TileList &dirty, const TileMatrixSet &tms, int z_begin, int z_end, string out_type, string outdir)
+{
+    for (int z = z_begin; z < z_end; z++)
+    {
+        for (auto &tile : dirty[z])
         {
-            double x_step = 360.0 / x_num;
-            if(!gdem_pool.contains(-180.0 + x * x_step, -90.0, -180.0 + x * x_step + x_step, 90.0))
-            {
-                lock_guard<mutex> lock(mtx);
+            int y = isTerrainType(out_type) ? tms.tilesY(z) - 1 - tile.second : tile.second;
+            error_code ec;
+            fs::remove(outdir + "/" + formatNumber(z) + "/" + formatNumber(tile.first) + "/" + formatNumber(y) + "." + tileExtension(out_type), ec);
+        }
+    }
+}
 
-                tilesProcessed = tilesProcessed + y_num;
-                if (now() - lastReport > 1.0)
-                {
-                    state.tilesProcessed = tilesProcessed;
-                    state.duration = now() - tStart;
+/**
+ * @brief
+ * moves the outputs of all shards of the plan into outdir after checking their manifests against the plan,
+ * the stats of the shards are added to tile_stats
+ */
+bool mergeShards(const ShardPlan &plan, const ShardManifest &expected, string outdir, TileStatsIndex *tile_stats,
+                 State &state)
+{
+    cout << endl;
+    cout << "=======================================" << endl;
+    cout << "=== merge shards                      " << endl;
+    cout << "=======================================" << endl;
 
-                    lastReport = now();
-                } 
-                continue;
-            }
+    auto tStart = now();
 
-            fs::create_directories(outdir + "/" + formatNumber(z) + "/" + formatNumber(x));
-            for (int y = 0; y < y_num; y++)
-            {
-                while (true)
-                {
-                    if (active_tasks > 100)
-                    {
-                        std::this_thread::sleep_for(10ms);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
-                auto task = make_shared<Task>(z, x, y);
-                pool.addTask(task);
-                active_tasks++;
-            }
+    state.name = "merge shards";
+    state.currentPass = 2;
+    state.tilesTotal = plan.count;
+    state.tilesProcessed = 0;
+    state.duration = 0;
+
+    vector<ShardManifest> manifests(plan.count);
+    for (int i = 0; i < plan.count; i++)
+    {
+        string path = shardDir(outdir, i) + "/shard.txt";
+        ShardManifest &manifest = manifests[i];
+        if (!manifest.load(path))
+        {
+            logger::ERROR("shard " + to_string(i) + " has not finished, " + path + " is missing");
+            return false;
+        }
+        if (manifest.index != i || manifest.count != plan.count || manifest.max_lod != expected.max_lod ||
+            manifest.tile_size != expected.tile_size || manifest.tile_matrix_set != expected.tile_matrix_set ||
+            manifest.out_type != expected.out_type || manifest.level != plan.level ||
+            manifest.begin != plan.bounds[i] || manifest.end != plan.bounds[i + 1])
+        {
+            logger::ERROR(path + " was written with other options or sources than this merge");
+            return false;
         }
     }
 
-    pool.waitTillEmpty();
-    pool.close();
+    // combined manifest of the run, one line per shard
+    ofstream combined(outdir + "/shards.txt");
+    int64_t moved = 0;
+    for (int i = 0; i < plan.count; i++)
+    {
+        string dir = shardDir(outdir, i);
+        int64_t files = mergeShardFiles(dir, outdir);
+        if (files < 0)
+            return false;
+        moved += files;
+        if (tile_stats)
+            tile_stats->merge(dir);
+
+        ifstream manifest(dir + "/shard.txt");
+        string line;
+        getline(manifest, line);
+        combined << line << "\n";
+
+        state.tilesProcessed = i + 1;
+        state.duration = now() - tStart;
+    }
 
-    double duration = now() - tStart;
-    state.values["duration(makelod)"] = formatNumber(duration, 3);
+    state.values["merged files"] = formatNumber(moved);
+    state.values["duration(merge shards)"] = formatNumber(now() - tStart, 3);
+    return true;
 }
 
 int main(int argc, char **argv)
@@ -313,15 +773,49 @@ int main(int argc, char **argv)
 
     Arguments args(argc, argv);
     args.addArgument("help,h", "Display help information");
-    args.addArgument("source,i,", "Input file(s) or dir(s) of the gdem");
+    args.addArgument("source,i,", "Input file(s) or dir(s) of the gdem, zip archives and other lon/lat GeoTIFF/VRT DEMs of any resolution are accepted too");
+    args.addArgument("fill_source", "file(s) or dir(s) of DEMs (srtm, ...) filling the voids of the gdem, one layer per value in priority order");
     args.addArgument("outdir,o", "output directory");
     args.addArgument("no_log", "not to write log info");
     args.addArgument("max_lod", "max_lod of tileset, -1 default, -1 means use the calulated max lod by gdem size and tile_size");
     args.addArgument("tile_size", "tile pixel size, 256 default");
     args.addArgument("out_format", "output image format, grey default, [grey, rgba]");
-    args.addArgument("out_type", "output image type, png default, [png, tif]");
-    args.addArgument("mercator", "out tileset is mercator projection, nums of x is 1 at level 0, nums of y is 1 at level 0");
+    args.addArgument("out_type", "output image type, png default, [png, tif, webp, lerc, bin, terrain, heightmap, cog], webp is lossless terrain-rgb, lerc a raw lerc2 blob, bin raw int16 + zstd, terrain (quantized-mesh-1.0) and heightmap (heightmap-1.0, 65x65) write cesium terrain tiles of every level, cog writes <outdir>/gdem.tif with the lower levels as overviews");
+    args.addArgument("resampling", "resampling of the gdem, nearest default, [nearest, bilinear, bicubic, average]");
+    args.addArgument("lod_reduction", "reduction of child tiles in makelod, mean default, [mean, min, max, median]");
+    args.addArgument("minmax_pyramid", "also build min and max pyramids into <outdir>/min and <outdir>/max");
+    args.addArgument("tile_stats", "write min/max/mean/nodata of every tile to <outdir>/stats/<z>.bin");
+    args.addArgument("mercator", "out tileset is mercator projection (EPSG:3857), nums of x is 1 at level 0, nums of y is 1 at level 0");
+    args.addArgument("tile_matrix_set", "tile pyramid, geographic default, [geographic, mercator, polar_north, polar_south, utm<zone><n|s>]");
+    args.addArgument("error_bound", "max position error in pixels of the interpolated transformation grids of projected tile matrix sets, 0.125 default");
+    args.addArgument("terrain_normals", "add oct encoded vertex normals to terrain tiles");
+    args.addArgument("terrain_no_gzip", "write terrain tiles uncompressed");
+    args.addArgument("mesh_error", "scale of the max mesh error of terrain tiles relative to the geometric error of their level, 1.0 default");
+    args.addArgument("cog_compression", "compression of cog tiles, deflate default, [none, deflate, zstd, lerc, lerc_deflate, lerc_zstd]");
+    args.addArgument("cog_per_level", "write one cog per level to <outdir>/cog/<z>.tif instead of one cog with overviews");
+    args.addArgument("lerc_max_error", "max height error in meters of lerc tiles, 0 (lossless) default");
+    args.addArgument("zstd_level", "zstd level of bin tiles, 0 (zstd default) default");
+    args.addArgument("bin_delta", "store the heights of bin tiles as differences to their left neighbour");
+    args.addArgument("shard", "i/N, build shard i of N into <outdir>/shards/<i>, the base level is split into N hilbert ranges of about the same source coverage");
+    args.addArgument("merge_shards", "N, move <outdir>/shards/<0..N-1> (copied from the nodes if not on a shared filesystem) into <outdir> and build the levels spanning several shards");
+    args.addArgument("task_size", "tiles per side of the supertile tasks of tileset and makelod, 4 default");
+    args.addArgument("io_threads", "initial threads reading sources in tileset, one per core default, adapted to the tile rate at runtime");
+    args.addArgument("write_threads", "initial threads writing tiles, 2 default, adapted to their utilization at runtime");
+    args.addArgument("no_adaptive", "keep io_threads and write_threads fixed");
+    args.addArgument("numa", "one block cache and worker pools per numa node with the workers pinned to it, the nodes build contiguous bands of supertiles");
+    args.addArgument("metrics", "write counters and latency histograms to <dir>/gdem.prom (node_exporter textfile collector) and <dir>/metrics.json");
+    args.addArgument("metrics_interval", "seconds between the metric exports, 10 default");
+    args.addArgument("trace", "record a timeline of the run into this file in the chrome trace format (chrome://tracing, ui.perfetto.dev)");
+    args.addArgument("trace_sample", "record 1 in this many tiles into the trace, 1 default");
+    args.addArgument("trace_max_mb", "stop recording the trace at this size in MB, 1024 default");
+    args.addArgument("queue", "pull supertile jobs from <outdir>/queue together with the other worker processes running the same command, jobs of crashed workers are leased again");
+    args.addArgument("supertile", "base tiles per side of a queue job, 16 default");
+    args.addArgument("lease_seconds", "a queue job is leased again if its worker sent no heartbeat for this long, 60 default");
+    args.addArgument("worker_id", "name of the worker in the leases of the queue, random default");
     args.addArgument("no_tileset", "skip tileset process");
+    args.addArgument("update", "only rebuild the tiles affected by sources changed since the previous run, see <outdir>/catalog.txt");
+    args.addArgument("profile", "make elevation profiles of the polylines in the file instead of a tileset, one polyline per line as \"lon,lat lon,lat ...\"");
+    args.addArgument("profile_spacing", "ground spacing of profile samples in meters, 30 default");
 
     if (args.has("help"))
     {
@@ -370,6 +864,24 @@ int main(int argc, char **argv)
         outdir = sourcepath + "/../" + suggestedBaseName;
     }
     outdir = fs::weakly_canonical(fs::path(outdir)).string();
+
+    // a shard writes everything below its own directory, the merge moves the tiles up
+    int shard_index = 0;
+    int shard_count = 0;
+    if (args.has("shard") && !parseShard(args.get("shard").as<string>(), shard_index, shard_count))
+    {
+        cout << "--shard must be i/N with 0 <= i < N." << endl;
+        exit(1);
+    }
+    int merge_count = args.get("merge_shards").as<int>(0);
+    if (shard_count > 0 && merge_count > 0)
+    {
+        cout << "--shard and --merge_shards cannot be combined." << endl;
+        exit(1);
+    }
+    string root_dir = outdir;
+    if (shard_count > 0)
+        outdir = shardDir(root_dir, shard_index);
     fs::create_directories(outdir);
 
     if (!args.has("no_log"))
@@ -379,16 +891,202 @@ int main(int argc, char **argv)
 
     int max_lod = args.get("max_lod").as<int>(-1);
     int tile_size = args.get("tile_size").as<int>(256);
+    int task_size = max(1, args.get("task_size").as<int>(4));
+    PipelineOptions pipeline_options;
+    pipeline_options.read_threads = (size_t)max(0, args.get("io_threads").as<int>(0));
+    pipeline_options.write_threads = (size_t)max(1, args.get("write_threads").as<int>(2));
+    pipeline_options.adaptive = !args.has("no_adaptive");
+    if (args.has("numa"))
+    {
+        pipeline_options.numa_nodes = (int)numaNodes().size();
+        if (pipeline_options.numa_nodes < 2)
+            logger::WARN("numa: only one numa node found");
+    }
     string out_format = args.get("out_format").as<string>("grey");
     string out_type = args.get("out_type").as<string>("png");
     bool has_tileset = !args.has("no_tileset");
+    bool has_profile = args.has("profile");
+    bool has_update = args.has("update");
+
+    Resampling resampling = Resampling::Nearest;
+    if (args.has("resampling") && !parseResampling(args.get("resampling").as<string>(), resampling))
+    {
+        cout << "unsupported resampling, [nearest, bilinear, bicubic, average] supported." << endl;
+        exit(1);
+    }
+
+    Reduction lod_reduction = Reduction::Mean;
+    if (args.has("lod_reduction") && !parseReduction(args.get("lod_reduction").as<string>(), lod_reduction))
+    {
+        cout << "unsupported lod_reduction, [mean, min, max, median] supported." << endl;
+        exit(1);
+    }
+    bool has_minmax = args.has("minmax_pyramid");
+
+    // meshes cannot be reduced from their children, every level is meshed from the sources
+    bool has_terrain = isTerrainType(out_type);
+    if (out_type == "heightmap")
+        tile_size = HEIGHTMAP_SIZE;
+    if (has_terrain)
+    {
+        // martini needs 2^k + 1 samples per side, neighbouring tiles share their edge samples
+        if (tile_size > 1 && (tile_size & (tile_size - 1)) == 0)
+            tile_size = tile_size + 1;
+        if (tile_size < 3 || ((tile_size - 1) & (tile_size - 2)) != 0)
+        {
+            cout << "tile_size of terrain tiles must be 2^k + 1 (or 2^k)." << endl;
+            exit(1);
+        }
+        has_minmax = false;
+    }
+
+    // rendered tiles are the internal tiles of the cog without their shared last row and column
+    bool has_cog = out_type == "cog";
+    CogCompression cog_compression = CogCompression::Deflate;
+    if (has_cog)
+    {
+        if (tile_size % 16 == 0)
+            tile_size = tile_size + 1;
+        if (tile_size < 17 || (tile_size - 1) % 16 != 0)
+        {
+            cout << "tile_size of cog tiles must be a multiple of 16 (or one more)." << endl;
+            exit(1);
+        }
+        if (args.has("cog_compression") && !parseCogCompression(args.get("cog_compression").as<string>(), cog_compression))
+        {
+            cout << "unsupported cog_compression, [none, deflate, zstd, lerc, lerc_deflate, lerc_zstd] supported." << endl;
+            exit(1);
+        }
+        if (has_update)
+        {
+            cout << "--update is not supported for cog output, the tiles of a previous run are not kept." << endl;
+            exit(1);
+        }
+        has_minmax = false;
+    }
+
+    bool has_shards = shard_count > 0 || merge_count > 0;
+    if (has_shards && (has_cog || has_update || has_profile))
+    {
+        cout << "--shard and --merge_shards are not supported for cog output, --update and --profile." << endl;
+        exit(1);
+    }
+
+    bool has_queue = args.has("queue");
+    int supertile_size = args.get("supertile").as<int>(16);
+    if (has_queue && (has_cog || has_update || has_profile || has_shards || args.has("tile_stats")))
+    {
+        cout << "--queue is not supported for cog output, --update, --profile, --shard and --tile_stats." << endl;
+        exit(1);
+    }
+    if (has_queue && (supertile_size < 1 || (supertile_size & (supertile_size - 1)) != 0))
+    {
+        cout << "supertile must be a power of two." << endl;
+        exit(1);
+    }
+
+    TileCodecOptions codec_options;
+    codec_options.max_error = args.get("lerc_max_error").as<double>(0.0);
+    codec_options.level = args.get("zstd_level").as<int>(0);
+    codec_options.delta = args.has("bin_delta");
 
     State state;
-    state.numPasses = 3;
+    state.numPasses = has_profile || has_terrain ? 2 : (has_minmax ? 5 : (has_cog ? 4 : 3));
     auto monitor = startMonitoring(state);
+    shared_ptr<MetricsExport> metrics_export;
+    if (args.has("metrics"))
+        metrics_export = startMetricsExport(state, args.get("metrics").as<string>(), max(1.0, args.get("metrics_interval").as<double>(10.0)));
+    if (args.has("trace"))
+    {
+        int64_t max_mb = max(1, args.get("trace_max_mb").as<int>(1024));
+        if (!trace::start(args.get("trace").as<string>(), (uint32_t)max(1, args.get("trace_sample").as<int>(1)), max_mb * 1024 * 1024))
+            exit(1);
+    }
 
     GdemPool gdem_pool;
-    // gdem_pool.init(source, max_lod, tile_size, state);
+    gdem_pool.setResampling(resampling);
+    gdem_pool.setLodReduction(lod_reduction);
+    if (pipeline_options.numa_nodes > 0)
+        gdem_pool.setNumaNodes(pipeline_options.numa_nodes);
+    string tms_name = args.get("tile_matrix_set").as<string>(args.has("mercator") ? "mercator" : "geographic");
+    auto tms = createTileMatrixSet(tms_name);
+    if (!tms)
+    {
+        cout << "unsupported tile_matrix_set, [geographic, mercator, polar_north, polar_south, utm<zone><n|s>] supported." << endl;
+        exit(1);
+    }
+    tms->setErrorBound(args.get("error_bound").as<double>(0.125));
+    gdem_pool.setTileMatrixSet(tms);
+
+    TerrainOptions terrain_options;
+    if (has_terrain)
+    {
+        if (!tms->separable())
+        {
+            cout << "terrain tiles need the geographic or mercator tile_matrix_set." << endl;
+            exit(1);
+        }
+        terrain_options.normals = out_type == "terrain" && args.has("terrain_normals");
+        terrain_options.gzip = !args.has("terrain_no_gzip");
+        terrain_options.error_scale = args.get("mesh_error").as<double>(1.0);
+    }
+
+    shared_ptr<TileStatsIndex> tile_stats = nullptr;
+    if (args.has("tile_stats"))
+    {
+        tile_stats = make_shared<TileStatsIndex>(outdir);
+        tile_stats->load();
+        gdem_pool.setTileStats(tile_stats.get());
+    }
+
+    // the catalog of the previous run, its zip directories spare reading the archives again
+    string catalog_path = outdir + "/catalog.txt";
+    SourceCatalog previous;
+    bool has_previous = fs::exists(catalog_path) && previous.load(catalog_path);
+    if (has_previous)
+        gdem_pool.setArchiveCache(previous.archives);
+
+    vector<vector<string>> layer_sources = {source};
+    if (args.has("fill_source"))
+    {
+        for (auto &fill_source : args.get("fill_source").as<vector<string>>())
+            layer_sources.push_back({fill_source});
+    }
+    gdem_pool.init(layer_sources, max_lod, tile_size, state);
+    if (has_terrain)
+    {
+        terrain_options.max_lod = max_lod;
+        gdem_pool.setTerrain(terrain_options);
+    }
+
+    shared_ptr<CogWriter> cog_writer = nullptr;
+    if (has_cog && !has_profile)
+    {
+        cog_writer = make_shared<CogWriter>(outdir + "/cog.spill", *tms, max_lod, tile_size - 1, cog_compression);
+        if (!cog_writer->open())
+            exit(1);
+        gdem_pool.setCogWriter(cog_writer.get());
+    }
+
+    gdem_pool.setTileCodec(codec_options);
+    if (!has_terrain && !has_cog && !has_profile)
+    {
+        // the gdal build may lack the webp driver or the zstd compressor, better to know before the first tile
+        auto codec = createTileCodec(out_type, codec_options);
+        vector<int16_t> probe(16 * 16, 0);
+        vector<uint8_t> encoded;
+        if (!codec)
+        {
+            cout << "unsupported out_type, [png, tif, webp, lerc, bin, terrain, heightmap, cog] supported." << endl;
+            exit(1);
+        }
+        if (!codec->encode(probe.data(), 16, 16, nullptr, encoded) ||
+            !codec->decode(encoded.data(), encoded.size(), 16, 16, probe.data()))
+        {
+            cout << out_type << " tiles are not supported by this gdal build." << endl;
+            exit(1);
+        }
+    }
 
     // gdem_pool.repairImage(11, 837, 416, tile_size, tile_size, out_format, out_type, outdir, state);
     // return 0;
@@ -403,17 +1101,254 @@ int main(int argc, char **argv)
     // gdem_pool.makeElevationImage(12, 1674, 820, tile_size, tile_size, out_format, out_type, outdir, state);
     //return 0;
 
-    gdem_pool.makeNullImage(256, 256, "rgba", "E:\\");
-    return 0;
+    if (has_profile)
+    {
+        auto polylines = readPolylines(args.get("profile").as<string>());
+        double spacing = args.get("profile_spacing").as<double>(30.0);
+
+        ofstream out(outdir + "/profile.csv");
+        out << "id,distance,lon,lat,elevation" << endl;
+
+        ProfileEngine engine(gdem_pool);
+        size_t numThreads = getCpuData().numProcessors * 2;
+        engine.makeProfiles(
+            polylines, spacing, numThreads, [&](size_t id, ElevationProfile &profile)
+            {
+                stringstream ss;
+                ss << std::fixed << std::setprecision(7);
+                for (size_t i = 0; i < profile.distance.size(); i++)
+                {
+                    ss << id << "," << formatNumber(profile.distance[i], 2) << "," << profile.lon[i] << "," << profile.lat[i] << ","
+                       << formatNumber(profile.elevation[i]) << "\n";
+                }
+                out << ss.str();
+                out.flush(); },
+            state);
+    }
+    else
+    {
+        SourceCatalog catalog;
+        gdem_pool.catalog(catalog);
+        catalog.max_lod = max_lod;
+        catalog.tile_size = tile_size;
+        catalog.tile_matrix_set = tms->name();
+
+        shared_ptr<TileList> dirty = nullptr;
+        shared_ptr<ShardTiles> shard_tiles = nullptr;
+        shared_ptr<JobQueue> job_queue = nullptr;
+        shared_ptr<JobQueue> final_queue = nullptr;
+        shared_ptr<Heartbeat> heartbeat = nullptr;
+        // the same sources and options give the same plan on every node
+        shared_ptr<ShardPlan> plan = nullptr;
+        ShardManifest manifest;
+        if (has_shards)
+        {
+            auto coverage = [&](double west, double south, double east, double north)
+            { return gdem_pool.coverage(west, south, east, north); };
+            plan = make_shared<ShardPlan>(planShards(*tms, max_lod, max(shard_count, merge_count), coverage));
+            manifest.count = plan->count;
+            manifest.max_lod = max_lod;
+            manifest.tile_size = tile_size;
+            manifest.tile_matrix_set = tms->name();
+            manifest.out_type = out_type;
+            manifest.level = plan->level;
+        }
+
+        if (shard_count > 0)
+        {
+            // the tiles of the shard take the place of the dirty tiles of an update
+            shard_tiles = make_shared<ShardTiles>(plan->shardTiles(shard_index, has_terrain));
+            manifest.index = shard_index;
+            manifest.begin = plan->bounds[shard_index];
+            manifest.end = plan->bounds[shard_index + 1];
+            manifest.weight = plan->weight(shard_index);
+            for (int z = 0; z <= max_lod; z++)
+                manifest.tiles.push_back(shard_tiles->count(z));
+            state.values["shard"] = to_string(shard_index) + "/" + to_string(shard_count);
+            state.values["shard base tiles"] = formatNumber(manifest.tiles[max_lod]);
+        }
+        else if (merge_count > 0)
+        {
+            if (!mergeShards(*plan, manifest, root_dir, tile_stats.get(), state))
+                exit(1);
+            dirty = make_shared<TileList>(plan->mergeTiles());
+            has_tileset = false;
+        }
+        else if (has_queue)
+        {
+            // a job is the tile of level z_job above supertile x supertile base tiles
+            int z_job = max_lod;
+            for (int n = supertile_size; n > 1 && z_job > 0; n /= 2)
+                z_job--;
+
+            // the same sources give the same jobs on every worker, ordered along a hilbert curve for the caches
+            int order = 0;
+            while ((1 << order) < max(tms->tilesX(z_job), tms->tilesY(z_job)))
+                order++;
+            vector<pair<uint64_t, pair<int, int>>> ordered;
+            for (int x = 0; x < tms->tilesX(z_job); x++)
+            {
+                for (int y = 0; y < tms->tilesY(z_job); y++)
+                {
+                    double west, south, east, north;
+                    tms->tileLonLatBounds(z_job, x, y, west, south, east, north);
+                    if (gdem_pool.contains(west, south, east, north))
+                        ordered.push_back({hilbertIndex(order, x, y), {x, y}});
+                }
+            }
+            sort(ordered.begin(), ordered.end());
+            vector<pair<int, int>> jobs;
+            for (auto &job : ordered)
+                jobs.push_back(job.second);
 
-    if (has_tileset)
-        tileset(gdem_pool, state, max_lod, tile_size, out_format, out_type, outdir);
+            string worker_id = args.get("worker_id").as<string>("");
+            if (worker_id.empty())
+            {
+                random_device device;
+                stringstream ss;
+                ss << hex << device() << device();
+                worker_id = ss.str();
+            }
+            double lease_seconds = args.get("lease_seconds").as<double>(60.0);
+            job_queue = make_shared<JobQueue>(outdir + "/queue/jobs", worker_id, lease_seconds);
+            final_queue = make_shared<JobQueue>(outdir + "/queue/final", worker_id, lease_seconds);
+            if (!job_queue->open(jobs.size()) || !final_queue->open(1))
+                exit(1);
+            heartbeat = startHeartbeat({job_queue.get(), final_queue.get()});
+            state.values["worker"] = worker_id;
+
+            if (!runQueue(gdem_pool, state, *job_queue, *final_queue, jobs, max_lod, z_job, tile_size, out_format,
+                          out_type, outdir, lod_reduction, has_minmax))
+            {
+                heartbeat->stop();
+                monitor->stop();
+                if (metrics_export)
+                    metrics_export->stop();
+                trace::stop();
+                cout << endl
+                     << "all jobs of " << outdir << "/queue are done" << endl;
+                return 0;
+            }
+
+            // the levels above the jobs, their tiles are taken through the dirty tile list
+            dirty = make_shared<TileList>(max_lod + 1);
+            for (int z = 0; z < z_job; z++)
+            {
+                for (auto &job : jobs)
+                    (*dirty)[z].push_back({job.first >> (z_job - z), job.second >> (z_job - z)});
+                sort((*dirty)[z].begin(), (*dirty)[z].end());
+                (*dirty)[z].erase(unique((*dirty)[z].begin(), (*dirty)[z].end()), (*dirty)[z].end());
+            }
+        }
+        else if (has_update && !has_previous)
+        {
+            logger::WARN("no catalog of a previous run in " + outdir + ", building all tiles");
+        }
+        else if (has_update)
+        {
+            if (previous.max_lod != max_lod || previous.tile_size != tile_size || previous.tile_matrix_set != tms->name())
+            {
+                logger::ERROR("max_lod, tile_size or tile_matrix_set differ from the previous run, remove " + outdir + " to rebuild it");
+                exit(1);
+            }
+
+            vector<CatalogEntry> changed;
+            diffCatalog(previous, catalog, changed);
+
+            // resampling kernels reach 2 source pixels, tiles share their edge pixels
+            double margin = 2.0 / 3600.0 + tms->lodZeroResolution(tile_size) / (1 << max_lod);
+            dirty = make_shared<TileList>(dirtyTiles(changed, *tms, max_lod, margin));
+
+            removeTiles(*dirty, *tms, 0, max_lod + 1, out_type, outdir);
+            if (has_minmax)
+            {
+                removeTiles(*dirty, *tms, 0, max_lod, out_type, outdir + "/min");
+                removeTiles(*dirty, *tms, 0, max_lod, out_type, outdir + "/max");
+            }
+
+            int64_t dirtyTotal = 0;
+            for (auto &level : *dirty)
+                dirtyTotal += level.size();
+            state.values["changed sources"] = formatNumber(changed.size());
+            state.values["dirty tiles"] = formatNumber(dirtyTotal);
+        }
+
+        if (has_terrain)
+        {
+            for (int z = max_lod; z >= 0 && has_tileset; z--)
+                tileset(gdem_pool, state, z, tile_size, task_size, out_format, out_type, outdir, pipeline_options, dirty.get(), shard_tiles.get());
+        }
+        if (has_terrain && shard_count == 0)
+        {
+
+            // the same coverage test that decides whether a tile is rendered
+            auto available = terrainAvailability(*tms, max_lod, [&](double west, double south, double east, double north)
+                                                 { return gdem_pool.contains(west, south, east, north); });
+            vector<string> extensions;
+            if (terrain_options.normals)
+                extensions.push_back("octvertexnormals");
+            if (out_type == "heightmap")
+                extensions.push_back("watermask");
+            writeTerrainLayer(outdir, out_type == "terrain" ? "quantized-mesh-1.0" : "heightmap-1.0",
+                              tms->name() == "mercator" ? "EPSG:3857" : "EPSG:4326", max_lod, extensions, available);
+        }
+        else if (has_tileset)
+        {
+            tileset(gdem_pool, state, max_lod, tile_size, task_size, out_format, out_type, outdir, pipeline_options, dirty.get(), shard_tiles.get());
+        }
+        if (layer_sources.size() > 1)
+            state.values["void blocks filled"] = formatNumber(gdem_pool.voidBlocks());
+
+        if (tile_stats)
+            tile_stats->save();
+
+        if (!has_terrain)
+            makelod(gdem_pool, state, max_lod, tile_size, task_size, out_format, out_type, outdir, outdir, lod_reduction, 3, pipeline_options, dirty.get(), shard_tiles.get());
+
+        if (tile_stats)
+            tile_stats->save();
+
+        if (has_minmax)
+        {
+            makelod(gdem_pool, state, max_lod, tile_size, task_size, out_format, out_type, outdir + "/min", outdir, Reduction::Minimum, 4, pipeline_options, dirty.get(), shard_tiles.get());
+            makelod(gdem_pool, state, max_lod, tile_size, task_size, out_format, out_type, outdir + "/max", outdir, Reduction::Maximum, 5, pipeline_options, dirty.get(), shard_tiles.get());
+        }
 
-    makelod(gdem_pool, state, max_lod, tile_size, out_format, out_type, outdir);
+        if (cog_writer)
+        {
+            state.currentPass = 4;
+            if (args.has("cog_per_level"))
+            {
+                fs::create_directories(outdir + "/cog");
+                for (int z = 0; z <= max_lod; z++)
+                    cog_writer->writeCog(outdir + "/cog/" + formatNumber(z) + ".tif", z, z, state);
+            }
+            else
+            {
+                cog_writer->writeCog(outdir + "/gdem.tif", 0, max_lod, state);
+            }
+        }
+
+        if (!has_terrain && !has_cog && shard_count == 0)
+            gdem_pool.makeNullImage(tile_size, tile_size, out_format, outdir);
+        if (tms->exactRows() > 0)
+            state.values["exactly transformed rows"] = formatNumber(tms->exactRows());
 
-    gdem_pool.makeNullImage(tile_size, tile_size, out_format, outdir);
+        // written last, an interrupted run is diffed against the catalog of the run before
+        catalog.save(catalog_path);
+        if (shard_count > 0)
+            manifest.save(outdir + "/shard.txt");
+        if (final_queue)
+        {
+            final_queue->complete(0);
+            heartbeat->stop();
+        }
+    }
 
     monitor->stop();
+    if (metrics_export)
+        metrics_export->stop();
+    trace::stop();
 
     double duration = now() - tStart;
 
@@ -0,0 +1,247 @@
+/**
+ * @file metrics.cpp
+ * @brief
+ * per thread metric shards and their prometheus/json export
+ *
+ * 每个线程只写自己的分片(relaxed读写，无锁、无原子加)，导出时汇总所有分片；直方图按纳秒的2的幂分桶
+ *
+ */
+
+#include "metrics.h"
+#include "logger.h"
+#include "unsuck.hpp"
+#include "trace.h"
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+
+using namespace std;
+
+namespace metrics
+{
+    // le 2^10 ns (1us) ... le 2^34 ns (17s), +Inf
+    static const int BUCKETS = 26;
+    static const int FIRST_SHIFT = 10;
+
+    static const char *counter_names[COUNTER_COUNT] = {"cache_hits", "cache_misses", "tiles_written", "bytes_written"};
+    static const char *timer_names[TIMER_COUNT] = {"source_open", "raster_io", "sampling", "encode", "write", "queue_wait"};
+    static const char *span_names[TIMER_COUNT] = {"GDALOpen", "RasterIO", "makeElevation", "encode", "write", "queue wait"};
+
+    struct alignas(64) Shard
+    {
+        atomic<uint64_t> counters[COUNTER_COUNT] = {};
+        atomic<uint64_t> buckets[TIMER_COUNT][BUCKETS] = {};
+        atomic<uint64_t> sum_ns[TIMER_COUNT] = {};
+    };
+
+    // shards outlive their threads, the counts of finished threads stay in the totals
+    static mutex registry_mutex;
+    static vector<unique_ptr<Shard>> registry;
+
+    static Shard &shard()
+    {
+        thread_local Shard *local = nullptr;
+        if (!local)
+        {
+            lock_guard<mutex> lock(registry_mutex);
+            registry.push_back(make_unique<Shard>());
+            local = registry.back().get();
+        }
+        return *local;
+    }
+
+    // only the owner thread writes, a plain load and store is enough
+    static inline void bump(atomic<uint64_t> &value, uint64_t n)
+    {
+        value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    void add(Counter counter, uint64_t n)
+    {
+        bump(shard().counters[counter], n);
+    }
+
+    void record(Timer timer, int64_t ns)
+    {
+        uint64_t value = ns > 0 ? (uint64_t)ns : 0;
+        int bucket = 0;
+        for (uint64_t v = value >> FIRST_SHIFT; v > 0 && bucket < BUCKETS - 1; v >>= 1)
+            bucket++;
+
+        Shard &local = shard();
+        bump(local.buckets[timer][bucket], 1);
+        bump(local.sum_ns[timer], value);
+    }
+
+    void record(Timer timer, int64_t start_ns, int64_t end_ns)
+    {
+        record(timer, end_ns - start_ns);
+        if (trace::enabled())
+            trace::span(span_names[timer], start_ns, end_ns);
+    }
+
+    struct Totals
+    {
+        uint64_t counters[COUNTER_COUNT] = {};
+        uint64_t buckets[TIMER_COUNT][BUCKETS] = {};
+        uint64_t sum_ns[TIMER_COUNT] = {};
+    };
+
+    static Totals totals()
+    {
+        Totals sum;
+        lock_guard<mutex> lock(registry_mutex);
+        for (auto &shard : registry)
+        {
+            for (int c = 0; c < COUNTER_COUNT; c++)
+                sum.counters[c] += shard->counters[c].load(memory_order_relaxed);
+            for (int t = 0; t < TIMER_COUNT; t++)
+            {
+                for (int b = 0; b < BUCKETS; b++)
+                    sum.buckets[t][b] += shard->buckets[t][b].load(memory_order_relaxed);
+                sum.sum_ns[t] += shard->sum_ns[t].load(memory_order_relaxed);
+            }
+        }
+        return sum;
+    }
+
+    static double bucketSeconds(int bucket)
+    {
+        return (double)(1ull << (FIRST_SHIFT + bucket)) * 1e-9;
+    }
+
+    static uint64_t count(const Totals &sum, int timer)
+    {
+        uint64_t n = 0;
+        for (int b = 0; b < BUCKETS; b++)
+            n += sum.buckets[timer][b];
+        return n;
+    }
+
+    // upper bound of the bucket holding quantile q, -1 for +Inf
+    static double quantile(const Totals &sum, int timer, double q)
+    {
+        uint64_t n = count(sum, timer);
+        uint64_t rank = (uint64_t)(q * n);
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS - 1; b++)
+        {
+            seen += sum.buckets[timer][b];
+            if (seen > rank)
+                return bucketSeconds(b);
+        }
+        return -1.0;
+    }
+
+    string prometheus(const map<string, double> &gauges)
+    {
+        Totals sum = totals();
+        stringstream ss;
+        ss << setprecision(9);
+
+        for (int c = 0; c < COUNTER_COUNT; c++)
+        {
+            string name = string("gdem_") + counter_names[c] + "_total";
+            ss << "# TYPE " << name << " counter\n";
+            ss << name << " " << sum.counters[c] << "\n";
+        }
+
+        for (int t = 0; t < TIMER_COUNT; t++)
+        {
+            string name = string("gdem_") + timer_names[t] + "_seconds";
+            ss << "# TYPE " << name << " histogram\n";
+            uint64_t cumulative = 0;
+            for (int b = 0; b < BUCKETS - 1; b++)
+            {
+                cumulative += sum.buckets[t][b];
+                ss << name << "_bucket{le=\"" << bucketSeconds(b) << "\"} " << cumulative << "\n";
+            }
+            cumulative += sum.buckets[t][BUCKETS - 1];
+            ss << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+            ss << name << "_sum " << sum.sum_ns[t] * 1e-9 << "\n";
+            ss << name << "_count " << cumulative << "\n";
+        }
+
+        for (auto &[key, value] : gauges)
+        {
+            string name = "gdem_" + key;
+            ss << "# TYPE " << name << " gauge\n";
+            ss << name << " " << value << "\n";
+        }
+        return ss.str();
+    }
+
+    string json(const map<string, double> &gauges)
+    {
+        Totals sum = totals();
+        stringstream ss;
+        ss << setprecision(9);
+
+        ss << "{\n  \"counters\": {";
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            ss << (c > 0 ? ", " : "") << "\"" << counter_names[c] << "\": " << sum.counters[c];
+        ss << "},\n  \"histograms\": {";
+        for (int t = 0; t < TIMER_COUNT; t++)
+        {
+            uint64_t n = count(sum, t);
+            ss << (t > 0 ? "," : "") << "\n    \"" << timer_names[t] << "\": {\"count\": " << n
+               << ", \"sum_seconds\": " << sum.sum_ns[t] * 1e-9
+               << ", \"mean_seconds\": " << (n > 0 ? sum.sum_ns[t] * 1e-9 / n : 0.0)
+               << ", \"p50_seconds\": " << quantile(sum, t, 0.5)
+               << ", \"p90_seconds\": " << quantile(sum, t, 0.9)
+               << ", \"p99_seconds\": " << quantile(sum, t, 0.99) << ", \"buckets\": [";
+            for (int b = 0; b < BUCKETS; b++)
+                ss << (b > 0 ? ", " : "") << sum.buckets[t][b];
+            ss << "]}";
+        }
+        ss << "\n  },\n  \"gauges\": {";
+        bool first = true;
+        for (auto &[key, value] : gauges)
+        {
+            ss << (first ? "" : ", ") << "\"" << key << "\": " << value;
+            first = false;
+        }
+        ss << "}\n}\n";
+        return ss.str();
+    }
+
+    // scrapers never see a half written file
+    static bool writeFile(const string &path, const string &content)
+    {
+        string tmp = uniqueTempPath(path);
+        error_code ec;
+        {
+            ofstream out(tmp);
+            out << content;
+            if (!out.good())
+            {
+                logger::WARN("cannot write " + path);
+                out.close();
+                filesystem::remove(tmp, ec);
+                return false;
+            }
+        }
+        filesystem::rename(tmp, path, ec);
+        if (ec)
+        {
+            logger::WARN("cannot write " + path);
+            filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    bool write(const string &dir, const map<string, double> &gauges)
+    {
+        error_code ec;
+        filesystem::create_directories(dir, ec);
+        bool ok = writeFile(dir + "/gdem.prom", prometheus(gauges));
+        return writeFile(dir + "/metrics.json", json(gauges)) && ok;
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <map>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * @brief
+ * counters and latency histograms of the hot paths. every thread updates its own shard without locks or atomic
+ * read-modify-writes, exports sum the shards. histogram buckets are powers of two of nanoseconds from 1us to 17s
+ */
+namespace metrics
+{
+    enum Counter
+    {
+        CACHE_HIT = 0,
+        CACHE_MISS,
+        TILES_WRITTEN,
+        BYTES_WRITTEN,
+        COUNTER_COUNT
+    };
+
+    enum Timer
+    {
+        SOURCE_OPEN = 0,
+        RASTER_IO,
+        // resampling of a tile, with the loads of the blocks not in the cache
+        SAMPLING,
+        ENCODE,
+        WRITE,
+        // from submit to the start of a pipeline task
+        QUEUE_WAIT,
+        TIMER_COUNT
+    };
+
+    inline int64_t nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void add(Counter counter, uint64_t n = 1);
+    void record(Timer timer, int64_t ns);
+    // also a span of the trace if one is recorded
+    void record(Timer timer, int64_t start_ns, int64_t end_ns);
+
+    // records the lifetime of the scope
+    struct Scope
+    {
+        Timer timer;
+        int64_t start;
+
+        Scope(Timer timer) : timer{timer}, start{nowNs()} {}
+        ~Scope() { record(timer, start, nowNs()); }
+    };
+
+    // prometheus text format, gauges are exported as gdem_<name>
+    std::string prometheus(const std::map<std::string, double> &gauges = {});
+    // counters, histograms with p50/p90/p99 upper bounds and gauges
+    std::string json(const std::map<std::string, double> &gauges = {});
+    // <dir>/gdem.prom for the textfile collector of node_exporter and <dir>/metrics.json, written atomically
+    bool write(const std::string &dir, const std::map<std::string, double> &gauges = {});
+}
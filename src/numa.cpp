@@ -0,0 +1,123 @@
+/**
+ * @file numa.cpp
+ * @brief
+ * numa nodes from sysfs and pinning of threads to them
+ *
+ * 从/sys/devices/system/node读取各节点的cpu列表，用线程亲和性把线程绑定到节点，不依赖libnuma
+ *
+ */
+
+#include "numa.h"
+#include "logger.h"
+
+#include <thread>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+static thread_local int bound_node = -1;
+
+// "0-15,32-47"
+static vector<int> parseCpuList(const string &text)
+{
+    vector<int> cpus;
+    stringstream ss(text);
+    string range;
+    while (getline(ss, range, ','))
+    {
+        try
+        {
+            size_t dash = range.find('-');
+            int first = stoi(range.substr(0, dash));
+            int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        catch (...)
+        {
+        }
+    }
+    return cpus;
+}
+
+const vector<vector<int>> &numaNodes()
+{
+    static const vector<vector<int>> nodes = []()
+    {
+        vector<vector<int>> found;
+#if defined(__linux__)
+        // node ids may be sparse (node0, node2), every nodeN entry is read in the order of the ids
+        vector<int> ids;
+        error_code ec;
+        for (auto &entry : filesystem::directory_iterator("/sys/devices/system/node", ec))
+        {
+            string name = entry.path().filename().string();
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                all_of(name.begin() + 4, name.end(), [](char c)
+                       { return isdigit((unsigned char)c); }))
+                ids.push_back(stoi(name.substr(4)));
+        }
+        sort(ids.begin(), ids.end());
+
+        for (int id : ids)
+        {
+            ifstream in("/sys/devices/system/node/node" + to_string(id) + "/cpulist");
+            if (!in.is_open())
+                continue;
+
+            string text;
+            getline(in, text);
+            vector<int> cpus = parseCpuList(text);
+            // memory only nodes have no cpus to run on
+            if (!cpus.empty())
+                found.push_back(cpus);
+        }
+#endif
+        if (found.empty())
+        {
+            found.emplace_back();
+            for (int cpu = 0; cpu < (int)max(1u, thread::hardware_concurrency()); cpu++)
+                found.back().push_back(cpu);
+        }
+        return found;
+    }();
+    return nodes;
+}
+
+void bindToNumaNode(int node)
+{
+    if (bound_node == node)
+        return;
+    bound_node = node;
+
+#if defined(__linux__)
+    auto &nodes = numaNodes();
+    if (node < 0 || node >= (int)nodes.size())
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : nodes[node])
+    {
+        // CPU_SET has no bounds check
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        logger::WARN("cannot bind a thread to numa node " + to_string(node));
+#endif
+}
+
+int numaNode()
+{
+    return bound_node;
+}
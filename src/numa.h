@@ -0,0 +1,22 @@
+#pragma once
+#include <vector>
+
+/**
+ * @brief
+ * cpus of every numa node with cpus, in the order of the node ids. one node with all cpus if the platform reports no
+ * nodes (or is not linux)
+ */
+const std::vector<std::vector<int>> &numaNodes();
+
+/**
+ * @brief
+ * pins the calling thread to the cpus of the node and makes it the numaNode of the thread, memory the thread touches
+ * first is then allocated on that node. cheap when the thread is bound to the node already
+ */
+void bindToNumaNode(int node);
+
+/**
+ * @brief
+ * node the calling thread is bound to, -1 if it is not bound
+ */
+int numaNode();
@@ -0,0 +1,186 @@
+/**
+ * @file pipeline.cpp
+ * @brief
+ * read, compute and write pools of the tile passes with an adaptive size of the I/O pools
+ *
+ * 读取源数据、计算(重采样/编码)、写出瓦片分别使用独立的线程池；控制器按瓦片吞吐率爬山调整读取线程数，按利用率调整写出线程数
+ *
+ */
+
+#include "pipeline.h"
+#include "unsuck.hpp"
+#include "numa.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <chrono>
+#include <sstream>
+
+using namespace std;
+
+using metrics::nowNs;
+
+TilePipeline::TilePipeline(State &state, size_t compute_threads, size_t read_threads, size_t write_threads, bool adaptive,
+                           int node)
+    : state{state}, adaptive{adaptive}, node{node}, label{node >= 0 ? "node " + to_string(node) : "pipeline"}
+{
+    const char *names[3] = {"read", "compute", "write"};
+    compute_threads = max<size_t>(compute_threads, 1);
+    if (read_threads == 0)
+        read_threads = compute_threads;
+    size_t threads[3] = {read_threads, compute_threads, max<size_t>(write_threads, 1)};
+    for (int i = 0; i < 3; i++)
+    {
+        stages[i].name = names[i];
+        stages[i].threads = threads[i];
+        stages[i].pool = make_unique<progschj::ThreadPool>(threads[i]);
+        // a few tasks ahead per thread, the producer blocks beyond
+        stages[i].pool->set_queue_size_limit(threads[i] * 4);
+    }
+    max_io_threads = max<size_t>(compute_threads * 4, read_threads);
+
+    controller = thread([this]()
+                        { control(); });
+}
+
+TilePipeline::~TilePipeline()
+{
+    wait();
+    stop_requested = true;
+    controller.join();
+
+    lock_guard<mutex> lock(state.mtx);
+    state.stages.erase(label);
+}
+
+void TilePipeline::run(Stage &stage, const function<void()> &task, int64_t queued)
+{
+    if (node >= 0)
+        bindToNumaNode(node);
+
+    trace::nameThread(stage.name.c_str());
+
+    int64_t start = nowNs();
+    metrics::record(metrics::QUEUE_WAIT, queued, start);
+    task();
+    stage.busy_ns += nowNs() - start;
+}
+
+void TilePipeline::submit(function<void()> read, function<void()> compute)
+{
+    int64_t queued = nowNs();
+    if (!read)
+    {
+        stages[COMPUTE].pool->enqueue([this, compute, queued]()
+                                      { run(stages[COMPUTE], compute, queued); });
+        return;
+    }
+
+    stages[READ].pool->enqueue([this, read, compute, queued]()
+                               {
+                                   run(stages[READ], read, queued);
+                                   int64_t read_done = nowNs();
+                                   stages[COMPUTE].pool->enqueue([this, compute, read_done]()
+                                                                 { run(stages[COMPUTE], compute, read_done); }); });
+}
+
+void TilePipeline::write(function<void()> write)
+{
+    int64_t queued = nowNs();
+    stages[WRITE].pool->enqueue([this, write, queued]()
+                                { run(stages[WRITE], write, queued); });
+}
+
+void TilePipeline::tilesDone(int64_t tiles)
+{
+    tiles_done += tiles;
+}
+
+void TilePipeline::wait()
+{
+    // a stage only feeds the next one, so they drain in order
+    for (auto &stage : stages)
+        stage.pool->wait_until_nothing_in_flight();
+}
+
+string TilePipeline::status()
+{
+    stringstream ss;
+    ss << formatNumber(rate.load()) << " tiles/s, ";
+    for (int i = 0; i < 3; i++)
+    {
+        Stage &stage = stages[i];
+        ss << (i > 0 ? ", " : "") << stage.name << ": " << stage.threads << " (" << formatNumber(stage.utilization * 100.0) << "%)";
+    }
+    return ss.str();
+}
+
+void TilePipeline::control()
+{
+    const double interval = 2.0;
+    int64_t last = nowNs();
+    while (!stop_requested)
+    {
+        this_thread::sleep_for(chrono::milliseconds(100));
+        int64_t current = nowNs();
+        double elapsed = (current - last) * 1e-9;
+        if (elapsed < interval)
+            continue;
+        last = current;
+
+        for (auto &stage : stages)
+        {
+            int64_t busy = stage.busy_ns;
+            stage.utilization = min(1.0, (busy - stage.last_busy_ns) * 1e-9 / (elapsed * stage.threads));
+            stage.last_busy_ns = busy;
+        }
+
+        int64_t tiles = tiles_done;
+        rate = (tiles - last_tiles) / elapsed;
+        last_tiles = tiles;
+
+        // idle between passes, nothing to learn from
+        if (adaptive && rate > 0.0)
+            adapt();
+
+        string text = status();
+        lock_guard<mutex> lock(state.mtx);
+        state.stages[label] = text;
+    }
+}
+
+void TilePipeline::adapt()
+{
+    // hill climbing on the read pool: a step that lowered the rate is undone and the direction turned
+    Stage &read = stages[READ];
+    if (rate < last_rate * 0.97)
+        direction = -direction;
+    last_rate = rate;
+
+    size_t step = max<size_t>(1, read.threads / 4);
+    size_t threads = read.threads;
+    if (direction > 0)
+        threads = min(max_io_threads, threads + step);
+    else
+        threads = threads > step ? threads - step : 1;
+    if (threads != read.threads)
+    {
+        read.threads = threads;
+        read.pool->set_pool_size(threads);
+        read.pool->set_queue_size_limit(threads * 4);
+    }
+
+    // the write pool grows while it is saturated and shrinks while mostly idle
+    Stage &write = stages[WRITE];
+    threads = write.threads;
+    if (write.utilization > 0.9 && threads < max_io_threads)
+        threads++;
+    else if (write.utilization < 0.3 && threads > 1)
+        threads--;
+    if (threads != write.threads)
+    {
+        write.threads = threads;
+        write.pool->set_pool_size(threads);
+        write.pool->set_queue_size_limit(threads * 4);
+    }
+}
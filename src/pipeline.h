@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#include "threadpool.hpp"
+#include "state.h"
+
+struct PipelineOptions
+{
+    // 0 is one per core
+    size_t read_threads = 0;
+    size_t write_threads = 2;
+    bool adaptive = true;
+    // one pipeline per numa node with its workers pinned to the node, 0 is off
+    int numa_nodes = 0;
+};
+
+/**
+ * @brief
+ * three stage pipeline of tile tasks: source reads, compute (resampling, reduction, encoding) and output writes run in
+ * separate pools, so that threads blocked on file I/O do not take the cores of the compute pool.
+ *
+ * the compute pool has one thread per core. with adaptive set a controller resizes the I/O pools every interval:
+ * the read pool hill-climbs on tiles/s (keeps its direction while the rate grows, turns when it drops), the write
+ * pool follows its utilization. pool sizes, stage utilization and tiles/s are published to State::stages for the monitor.
+ *
+ * with a node given every worker binds itself to that numa node, so the blocks it reads are allocated (first touch)
+ * and cached (GdemPool::setNumaNodes) on the node that renders them
+ */
+class TilePipeline
+{
+public:
+    TilePipeline(State &state, size_t compute_threads, size_t read_threads, size_t write_threads, bool adaptive,
+                 int node = -1);
+    ~TilePipeline();
+
+    // read runs in the read pool, then compute in the compute pool. blocks while the queue of the first stage is
+    // full. without read the task goes to the compute pool right away
+    void submit(std::function<void()> read, std::function<void()> compute);
+    // called by compute tasks, blocks while the write queue is full
+    void write(std::function<void()> write);
+    // tiles finished, the rate the controller climbs on
+    void tilesDone(int64_t tiles);
+    // until every submitted task and the writes it caused are finished
+    void wait();
+
+    std::string status();
+    int64_t tiles() const { return tiles_done; }
+
+private:
+    enum StageIndex
+    {
+        READ = 0,
+        COMPUTE = 1,
+        WRITE = 2
+    };
+
+    struct Stage
+    {
+        std::string name;
+        std::unique_ptr<progschj::ThreadPool> pool;
+        std::atomic<size_t> threads = 0;
+        std::atomic<int64_t> busy_ns = 0;
+        // utilization of the last interval
+        double utilization = 0.0;
+        int64_t last_busy_ns = 0;
+    };
+
+    // queued is when the task was handed to the stage
+    void run(Stage &stage, const std::function<void()> &task, int64_t queued);
+    void control();
+    void adapt();
+
+    State &state;
+    bool adaptive;
+    int node;
+    std::string label;
+    Stage stages[3];
+
+    size_t max_io_threads;
+    std::atomic<int64_t> tiles_done = 0;
+    int64_t last_tiles = 0;
+    std::atomic<double> rate = 0.0;
+    double last_rate = 0.0;
+    int direction = 1;
+
+    std::thread controller;
+    std::atomic_bool stop_requested = false;
+};
@@ -0,0 +1,262 @@
+/**
+ * @file profile.cpp
+ * @brief
+ * elevation profile and line of sight
+ *
+ * 折线的每一段按大圆加密到固定的地面间距，采样点交给GdemPool::getElevations批量取值，
+ * 同一个0.0625x0.0625小块内的采样点只查询一次缓存
+ *
+ */
+
+#include "profile.h"
+#include "TaskPool.hpp"
+#include "unsuck.hpp"
+#include "logger.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// standard atmospheric refraction coefficient
+#define REFRACTION_COEFFICIENT 0.13
+
+static inline void toUnitVector(double lon, double lat, double v[3])
+{
+    double rlon = lon * M_PI / 180.0;
+    double rlat = lat * M_PI / 180.0;
+    v[0] = cos(rlat) * cos(rlon);
+    v[1] = cos(rlat) * sin(rlon);
+    v[2] = sin(rlat);
+}
+
+// central angle between two points, haversine formula
+static inline double centralAngle(LonLat a, LonLat b)
+{
+    double rlat1 = a.lat * M_PI / 180.0;
+    double rlat2 = b.lat * M_PI / 180.0;
+    double dlat = rlat2 - rlat1;
+    double dlon = (b.lon - a.lon) * M_PI / 180.0;
+    double h = sin(dlat / 2.0) * sin(dlat / 2.0) + cos(rlat1) * cos(rlat2) * sin(dlon / 2.0) * sin(dlon / 2.0);
+    return 2.0 * asin(min(1.0, sqrt(h)));
+}
+
+ProfileEngine::ProfileEngine(GdemPool &gdem_pool)
+    : gdem_pool{gdem_pool}
+{
+}
+
+void ProfileEngine::densify(const vector<LonLat> &polyline, double spacing, ElevationProfile &out)
+{
+    out.clear();
+    if (polyline.empty())
+        return;
+
+    double distance = 0.0;
+    for (size_t i = 0; i + 1 < polyline.size(); i++)
+    {
+        LonLat a = polyline[i];
+        LonLat b = polyline[i + 1];
+
+        double angle = centralAngle(a, b);
+        double length = angle * EARTH_RADIUS;
+        int n = max(1, (int)ceil(length / spacing));
+
+        double va[3], vb[3];
+        toUnitVector(a.lon, a.lat, va);
+        toUnitVector(b.lon, b.lat, vb);
+        double sin_angle = sin(angle);
+
+        for (int k = 0; k < n; k++)
+        {
+            double t = double(k) / n;
+            double lon = a.lon;
+            double lat = a.lat;
+            if (k > 0)
+            {
+                if (sin_angle < 1e-12)
+                {
+                    lon = a.lon + (b.lon - a.lon) * t;
+                    lat = a.lat + (b.lat - a.lat) * t;
+                }
+                else
+                {
+                    double wa = sin((1.0 - t) * angle) / sin_angle;
+                    double wb = sin(t * angle) / sin_angle;
+                    double x = wa * va[0] + wb * vb[0];
+                    double y = wa * va[1] + wb * vb[1];
+                    double z = wa * va[2] + wb * vb[2];
+                    lon = atan2(y, x) * 180.0 / M_PI;
+                    lat = atan2(z, sqrt(x * x + y * y)) * 180.0 / M_PI;
+                }
+            }
+
+            out.lon.push_back(lon);
+            out.lat.push_back(lat);
+            out.distance.push_back(distance + length * t);
+        }
+        distance += length;
+    }
+
+    out.lon.push_back(polyline.back().lon);
+    out.lat.push_back(polyline.back().lat);
+    out.distance.push_back(distance);
+}
+
+void ProfileEngine::makeProfile(const vector<LonLat> &polyline, double spacing, ElevationProfile &out, State &state)
+{
+    densify(polyline, spacing, out);
+
+    out.elevation.resize(out.lon.size());
+    gdem_pool.getElevations(out.lon.data(), out.lat.data(), out.lon.size(), out.elevation.data(), state);
+}
+
+bool ProfileEngine::lineOfSight(LonLat from, double from_height, LonLat to, double to_height, double spacing,
+                                State &state, double *blocked_distance)
+{
+    ElevationProfile profile;
+    makeProfile({from, to}, spacing, profile, state);
+
+    size_t n = profile.elevation.size();
+    double *terrain = profile.elevation.data();
+    const double *distance = profile.distance.data();
+    for (size_t i = 0; i < n; i++)
+        terrain[i] = terrain[i] <= NODATA ? 0.0 : terrain[i];
+
+    double total = profile.distance.back();
+    if (n < 3 || total <= 0.0)
+        return true;
+
+    double h0 = terrain[0] + from_height;
+    double h1 = terrain[n - 1] + to_height;
+    double slope = (h1 - h0) / total;
+    double inv_2r = (1.0 - REFRACTION_COEFFICIENT) / (2.0 * EARTH_RADIUS);
+
+    // clearance of the sight line above terrain plus earth bulge, branch free so that it vectorizes
+    vector<double> clearance(n);
+    double *c = clearance.data();
+    for (size_t i = 0; i < n; i++)
+    {
+        double d = distance[i];
+        c[i] = h0 + slope * d - terrain[i] - d * (total - d) * inv_2r;
+    }
+
+    double min_clearance = 0.0;
+    for (size_t i = 1; i < n - 1; i++)
+        min_clearance = min(min_clearance, c[i]);
+
+    if (min_clearance >= 0.0)
+        return true;
+
+    if (blocked_distance)
+    {
+        for (size_t i = 1; i < n - 1; i++)
+        {
+            if (c[i] < 0.0)
+            {
+                *blocked_distance = distance[i];
+                break;
+            }
+        }
+    }
+    return false;
+}
+
+void ProfileEngine::makeProfiles(const vector<vector<LonLat>> &polylines, double spacing, size_t numThreads,
+                                 function<void(size_t, ElevationProfile &)> consumer, State &state)
+{
+    cout << endl;
+    cout << "=======================================" << endl;
+    cout << "=== profile                           " << endl;
+    cout << "=======================================" << endl;
+
+    auto tStart = now();
+
+    state.name = "profile";
+    state.currentPass = 2;
+    state.tilesTotal = polylines.size();
+    state.tilesProcessed = 0;
+    state.duration = 0;
+
+    struct Task
+    {
+        size_t index;
+
+        Task(size_t index)
+        {
+            this->index = index;
+        }
+    };
+
+    int64_t tilesProcessed = 0;
+    double lastReport = now();
+    mutex mtx;
+    TaskPool<Task> pool(
+        numThreads, [&](auto task)
+        {
+            ElevationProfile profile;
+            makeProfile(polylines[task->index], spacing, profile, state);
+
+            lock_guard<mutex> lock(mtx);
+            consumer(task->index, profile);
+
+            tilesProcessed = tilesProcessed + 1;
+            if (now() - lastReport > 1.0)
+            {
+                state.tilesProcessed = tilesProcessed;
+                state.duration = now() - tStart;
+
+                lastReport = now();
+            } });
+
+    for (size_t i = 0; i < polylines.size(); i++)
+    {
+        pool.addTask(make_shared<Task>(i));
+    }
+
+    pool.waitTillEmpty();
+    pool.close();
+
+    state.tilesProcessed = tilesProcessed;
+    double duration = now() - tStart;
+    state.values["duration(profile)"] = formatNumber(duration, 3);
+}
+
+vector<vector<LonLat>> readPolylines(string path)
+{
+    // one polyline per line, vertices as "lon,lat" separated by whitespace
+    vector<vector<LonLat>> polylines;
+
+    ifstream in(path);
+    if (!in)
+    {
+        logger::ERROR(path + " cannot be opened.");
+        return polylines;
+    }
+
+    string line;
+    while (getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        vector<LonLat> polyline;
+        stringstream ss(line);
+        string token;
+        while (ss >> token)
+        {
+            size_t comma = token.find(',');
+            if (comma == string::npos)
+            {
+                logger::WARN("invalid vertex " + token + " in " + path);
+                continue;
+            }
+            polyline.push_back({atof(token.substr(0, comma).c_str()), atof(token.substr(comma + 1).c_str())});
+        }
+
+        if (polyline.size() >= 2)
+            polylines.push_back(polyline);
+    }
+
+    return polylines;
+}
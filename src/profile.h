@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "gdem.h"
+#include "state.h"
+
+struct LonLat
+{
+    double lon;
+    double lat;
+};
+
+/**
+ * @brief
+ * samples along a polyline, distance is the ground distance in meters from the first vertex
+ */
+struct ElevationProfile
+{
+    std::vector<double> lon;
+    std::vector<double> lat;
+    std::vector<double> distance;
+    std::vector<double> elevation;
+
+    void clear()
+    {
+        lon.clear();
+        lat.clear();
+        distance.clear();
+        elevation.clear();
+    }
+};
+
+/**
+ * @brief
+ * elevation profiles and line of sight over polylines,
+ * segments are densified along the great circle at a fixed ground spacing
+ */
+class ProfileEngine
+{
+public:
+    ProfileEngine(GdemPool &gdem_pool);
+
+    void densify(const std::vector<LonLat> &polyline, double spacing, ElevationProfile &out);
+    void makeProfile(const std::vector<LonLat> &polyline, double spacing, ElevationProfile &out, State &state);
+
+    /**
+     * @brief
+     * observer and target heights are relative to the terrain,
+     * earth curvature and standard refraction (k = 0.13) are taken into account
+     * @return true if the target is visible, blocked_distance is set to the first obstruction otherwise
+     */
+    bool lineOfSight(LonLat from, double from_height, LonLat to, double to_height, double spacing,
+                     State &state, double *blocked_distance = nullptr);
+
+    /**
+     * @brief
+     * profiles are computed on numThreads workers, consumer is called (serialized) as soon as a profile is ready
+     */
+    void makeProfiles(const std::vector<std::vector<LonLat>> &polylines, double spacing, size_t numThreads,
+                      std::function<void(size_t, ElevationProfile &)> consumer, State &state);
+
+private:
+    GdemPool &gdem_pool;
+};
+
+std::vector<std::vector<LonLat>> readPolylines(std::string path);
@@ -0,0 +1,418 @@
+/**
+ * @file quantizedmesh.cpp
+ * @brief
+ * quantized-mesh-1.0 terrain tiles built with martini (RTIN)
+ *
+ * 在渲染线程中直接由内存中的int16高程网格构建直角三角不规则网(误差金字塔一次遍历得到)，
+ * 按cesium的quantized-mesh-1.0格式编码(边缘顶点、可选八面体法线)，gzip后写出，不再生成中间图片
+ *
+ */
+
+#include "quantizedmesh.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+
+static const double WGS84_A = 6378137.0;
+static const double WGS84_B = 6356752.3142451793;
+static const double WGS84_E2 = 6.69437999014e-3;
+static const int QUANTIZED_MAX = 32767;
+
+Martini::Martini(int grid_size)
+    : grid_size{grid_size}
+{
+    int tile_size = grid_size - 1;
+    num_triangles = tile_size * tile_size * 2 - 2;
+    num_parent_triangles = num_triangles - tile_size * tile_size;
+
+    // triangle i is node i + 2 of the implicit binary tree, its bits are the path from one of the two roots
+    coords.resize((size_t)num_triangles * 4);
+    for (int i = 0; i < num_triangles; i++)
+    {
+        int id = i + 2;
+        int ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+        if (id & 1)
+        {
+            bx = by = cx = tile_size;
+        }
+        else
+        {
+            ax = ay = cy = tile_size;
+        }
+
+        while ((id >>= 1) > 1)
+        {
+            int mx = (ax + bx) >> 1;
+            int my = (ay + by) >> 1;
+            if (id & 1)
+            {
+                bx = ax;
+                by = ay;
+                ax = cx;
+                ay = cy;
+            }
+            else
+            {
+                ax = bx;
+                ay = by;
+                bx = cx;
+                by = cy;
+            }
+            cx = mx;
+            cy = my;
+        }
+
+        uint16_t *c = &coords[(size_t)i * 4];
+        c[0] = (uint16_t)ax;
+        c[1] = (uint16_t)ay;
+        c[2] = (uint16_t)bx;
+        c[3] = (uint16_t)by;
+    }
+}
+
+const Martini &Martini::get(int grid_size)
+{
+    static mutex mtx;
+    static map<int, unique_ptr<Martini>> instances;
+
+    lock_guard<mutex> lock(mtx);
+    auto &instance = instances[grid_size];
+    if (!instance)
+        instance = make_unique<Martini>(grid_size);
+    return *instance;
+}
+
+void Martini::errors(const int16_t *heights, vector<float> &errors) const
+{
+    int g = grid_size;
+    errors.assign((size_t)g * g, 0.0f);
+
+    // children come after their parents, so walking backwards sees the children's errors first
+    for (int i = num_triangles - 1; i >= 0; i--)
+    {
+        const uint16_t *c = &coords[(size_t)i * 4];
+        int ax = c[0], ay = c[1], bx = c[2], by = c[3];
+        int mx = (ax + bx) >> 1;
+        int my = (ay + by) >> 1;
+        int cx = mx + my - ay;
+        int cy = my + ax - mx;
+
+        float interpolated = (heights[ay * g + ax] + heights[by * g + bx]) * 0.5f;
+        int middle = my * g + mx;
+        float error = fabs(interpolated - heights[middle]);
+        errors[middle] = max(errors[middle], error);
+
+        if (i < num_parent_triangles)
+        {
+            int left = ((ay + cy) >> 1) * g + ((ax + cx) >> 1);
+            int right = ((by + cy) >> 1) * g + ((bx + cx) >> 1);
+            errors[middle] = max(errors[middle], max(errors[left], errors[right]));
+        }
+    }
+}
+
+void Martini::mesh(const vector<float> &errors, float max_error, vector<uint32_t> &vertices, vector<uint32_t> &triangles) const
+{
+    int g = grid_size;
+    int tile_size = g - 1;
+    vertices.clear();
+    triangles.clear();
+
+    // grid index -> vertex + 1
+    vector<uint32_t> index((size_t)g * g, 0);
+    auto vertex = [&](int x, int y)
+    {
+        uint32_t &i = index[(size_t)y * g + x];
+        if (i == 0)
+        {
+            vertices.push_back((uint32_t)(y * g + x));
+            i = (uint32_t)vertices.size();
+        }
+        return i - 1;
+    };
+
+    function<void(int, int, int, int, int, int)> process = [&](int ax, int ay, int bx, int by, int cx, int cy)
+    {
+        int mx = (ax + bx) >> 1;
+        int my = (ay + by) >> 1;
+        if (abs(ax - cx) + abs(ay - cy) > 1 && errors[my * g + mx] > max_error)
+        {
+            process(cx, cy, ax, ay, mx, my);
+            process(bx, by, cx, cy, mx, my);
+        }
+        else
+        {
+            // counter clockwise once rows are flipped to point north
+            uint32_t a = vertex(ax, ay);
+            uint32_t b = vertex(bx, by);
+            uint32_t c = vertex(cx, cy);
+            triangles.insert(triangles.end(), {a, b, c});
+        }
+    };
+
+    process(0, 0, tile_size, tile_size, tile_size, 0);
+    process(tile_size, tile_size, 0, 0, 0, tile_size);
+}
+
+double terrainGeometricError(int z, int x_num0)
+{
+    // cesium's default for heightmaps of 65 samples, a screen space error of 2 pixels refines
+    double level_zero = WGS84_A * 2.0 * M_PI * 0.25 / (65.0 * x_num0);
+    return level_zero / (1 << z);
+}
+
+namespace
+{
+    struct Vec3
+    {
+        double x, y, z;
+
+        Vec3 operator+(const Vec3 &o) const { return {x + o.x, y + o.y, z + o.z}; }
+        Vec3 operator-(const Vec3 &o) const { return {x - o.x, y - o.y, z - o.z}; }
+        Vec3 operator*(double s) const { return {x * s, y * s, z * s}; }
+        double dot(const Vec3 &o) const { return x * o.x + y * o.y + z * o.z; }
+        Vec3 cross(const Vec3 &o) const { return {y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x}; }
+        double length() const { return sqrt(dot(*this)); }
+        Vec3 normalized() const
+        {
+            double l = length();
+            return l > 0.0 ? *this * (1.0 / l) : *this;
+        }
+    };
+
+    class Writer
+    {
+    public:
+        template <typename T>
+        void put(T value)
+        {
+            size_t offset = bytes.size();
+            bytes.resize(offset + sizeof(T));
+            memcpy(bytes.data() + offset, &value, sizeof(T));
+        }
+
+        void align(size_t alignment)
+        {
+            while (bytes.size() % alignment)
+                bytes.push_back(0);
+        }
+
+        vector<uint8_t> bytes;
+    };
+}
+
+static Vec3 toEcef(double lon, double lat, double height)
+{
+    double lambda = lon * M_PI / 180.0;
+    double phi = lat * M_PI / 180.0;
+    double sin_phi = sin(phi);
+    double n = WGS84_A / sqrt(1.0 - WGS84_E2 * sin_phi * sin_phi);
+    return {(n + height) * cos(phi) * cos(lambda),
+            (n + height) * cos(phi) * sin(lambda),
+            (n * (1.0 - WGS84_E2) + height) * sin_phi};
+}
+
+// cesium's EllipsoidalOccluder.computeHorizonCullingPointFromPoints, in ellipsoid scaled space
+static Vec3 horizonOcclusionPoint(const vector<Vec3> &points, const Vec3 &center)
+{
+    Vec3 radii = {WGS84_A, WGS84_A, WGS84_B};
+    auto scale = [&](const Vec3 &p)
+    { return Vec3{p.x / radii.x, p.y / radii.y, p.z / radii.z}; };
+
+    Vec3 direction = scale(center).normalized();
+    double max_magnitude = 0.0;
+    for (auto &point : points)
+    {
+        Vec3 scaled = scale(point);
+        double magnitude_squared = scaled.dot(scaled);
+        double magnitude = sqrt(magnitude_squared);
+        Vec3 point_direction = scaled * (1.0 / magnitude);
+
+        magnitude_squared = max(1.0, magnitude_squared);
+        magnitude = max(1.0, magnitude);
+
+        double cos_alpha = point_direction.dot(direction);
+        double sin_alpha = point_direction.cross(direction).length();
+        double cos_beta = 1.0 / magnitude;
+        double sin_beta = sqrt(magnitude_squared - 1.0) * cos_beta;
+        double denominator = cos_alpha * cos_beta - sin_alpha * sin_beta;
+        if (denominator > 0.0)
+            max_magnitude = max(max_magnitude, 1.0 / denominator);
+    }
+
+    return direction * max_magnitude;
+}
+
+static uint8_t toSNorm(double value)
+{
+    return (uint8_t)lround((min(max(value, -1.0), 1.0) * 0.5 + 0.5) * 255.0);
+}
+
+// cesium's AttributeCompression.octEncode
+static void octEncode(const Vec3 &normal, uint8_t &x, uint8_t &y)
+{
+    double sum = fabs(normal.x) + fabs(normal.y) + fabs(normal.z);
+    double ox = normal.x / sum;
+    double oy = normal.y / sum;
+    if (normal.z < 0.0)
+    {
+        double px = ox;
+        double py = oy;
+        ox = (1.0 - fabs(py)) * (px < 0.0 ? -1.0 : 1.0);
+        oy = (1.0 - fabs(px)) * (py < 0.0 ? -1.0 : 1.0);
+    }
+    x = toSNorm(ox);
+    y = toSNorm(oy);
+}
+
+static void putZigZag(Writer &writer, const vector<int> &values)
+{
+    int previous = 0;
+    for (int value : values)
+    {
+        int delta = value - previous;
+        writer.put<uint16_t>((uint16_t)((delta << 1) ^ (delta >> 31)));
+        previous = value;
+    }
+}
+
+bool encodeQuantizedMesh(const int16_t *heights, int grid_size, double west, double east, const double *lat,
+                         double max_error, const TerrainOptions &options, vector<uint8_t> &out)
+{
+    const Martini &martini = Martini::get(grid_size);
+    vector<float> errors;
+    martini.errors(heights, errors);
+
+    vector<uint32_t> vertices, triangles;
+    martini.mesh(errors, (float)max_error, vertices, triangles);
+
+    int g = grid_size;
+    double south = lat[g - 1];
+    double north = lat[0];
+
+    int16_t min_height = 32767, max_height = -32768;
+    for (uint32_t v : vertices)
+    {
+        min_height = min(min_height, heights[v]);
+        max_height = max(max_height, heights[v]);
+    }
+    double height_range = max(1.0, (double)max_height - min_height);
+
+    size_t n = vertices.size();
+    vector<int> us(n), vs(n), hs(n);
+    vector<Vec3> points(n);
+    Vec3 lo = {1e300, 1e300, 1e300}, hi = {-1e300, -1e300, -1e300};
+    for (size_t i = 0; i < n; i++)
+    {
+        int x = vertices[i] % g;
+        int y = vertices[i] / g;
+        double lon = west + (east - west) * x / (g - 1);
+        us[i] = (int)lround((double)x * QUANTIZED_MAX / (g - 1));
+        vs[i] = (int)lround((lat[y] - south) / (north - south) * QUANTIZED_MAX);
+        hs[i] = (int)lround((heights[vertices[i]] - min_height) / height_range * QUANTIZED_MAX);
+
+        points[i] = toEcef(lon, lat[y], heights[vertices[i]]);
+        lo = {min(lo.x, points[i].x), min(lo.y, points[i].y), min(lo.z, points[i].z)};
+        hi = {max(hi.x, points[i].x), max(hi.y, points[i].y), max(hi.z, points[i].z)};
+    }
+
+    Vec3 center = (lo + hi) * 0.5;
+    double radius = 0.0;
+    for (auto &point : points)
+        radius = max(radius, (point - center).length());
+    Vec3 occlusion = horizonOcclusionPoint(points, center);
+
+    Writer writer;
+    writer.put<double>(center.x);
+    writer.put<double>(center.y);
+    writer.put<double>(center.z);
+    writer.put<float>((float)min_height);
+    writer.put<float>((float)max_height);
+    writer.put<double>(center.x);
+    writer.put<double>(center.y);
+    writer.put<double>(center.z);
+    writer.put<double>(radius);
+    writer.put<double>(occlusion.x);
+    writer.put<double>(occlusion.y);
+    writer.put<double>(occlusion.z);
+
+    writer.put<uint32_t>((uint32_t)n);
+    putZigZag(writer, us);
+    putZigZag(writer, vs);
+    putZigZag(writer, hs);
+
+    // vertices are numbered by first use, so the high water mark code of an index is never negative
+    bool wide = n > 65536;
+    auto putIndex = [&](uint32_t value)
+    {
+        if (wide)
+            writer.put<uint32_t>(value);
+        else
+            writer.put<uint16_t>((uint16_t)value);
+    };
+
+    writer.align(wide ? 4 : 2);
+    writer.put<uint32_t>((uint32_t)(triangles.size() / 3));
+    uint32_t highest = 0;
+    for (uint32_t index : triangles)
+    {
+        uint32_t code = highest - index;
+        putIndex(code);
+        if (code == 0)
+            highest++;
+    }
+
+    // west, south, east, north
+    vector<uint32_t> edges[4];
+    for (size_t i = 0; i < n; i++)
+    {
+        if (us[i] == 0)
+            edges[0].push_back((uint32_t)i);
+        if (vs[i] == 0)
+            edges[1].push_back((uint32_t)i);
+        if (us[i] == QUANTIZED_MAX)
+            edges[2].push_back((uint32_t)i);
+        if (vs[i] == QUANTIZED_MAX)
+            edges[3].push_back((uint32_t)i);
+    }
+    for (auto &edge : edges)
+    {
+        writer.put<uint32_t>((uint32_t)edge.size());
+        for (uint32_t index : edge)
+            putIndex(index);
+    }
+
+    if (options.normals)
+    {
+        // area weighted face normals
+        vector<Vec3> normals(n, Vec3{0.0, 0.0, 0.0});
+        for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+        {
+            uint32_t a = triangles[t], b = triangles[t + 1], c = triangles[t + 2];
+            Vec3 face = (points[b] - points[a]).cross(points[c] - points[a]);
+            normals[a] = normals[a] + face;
+            normals[b] = normals[b] + face;
+            normals[c] = normals[c] + face;
+        }
+
+        writer.put<uint8_t>(1);
+        writer.put<uint32_t>((uint32_t)(n * 2));
+        for (size_t i = 0; i < n; i++)
+        {
+            Vec3 normal = normals[i].length() > 0.0 ? normals[i].normalized() : points[i].normalized();
+            uint8_t x, y;
+            octEncode(normal, x, y);
+            writer.put<uint8_t>(x);
+            writer.put<uint8_t>(y);
+        }
+    }
+
+    return encodeTerrainFile(writer.bytes, options.gzip, out);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "terrain.h"
+
+/**
+ * @brief
+ * right triangulated irregular network of a (2^k + 1)^2 grid (martini).
+ * the error pyramid is built bottom up in one pass over all triangles, a mesh for any max error is then
+ * extracted by descending the implicit binary triangle tree
+ */
+class Martini
+{
+public:
+    explicit Martini(int grid_size);
+
+    int gridSize() const { return grid_size; }
+
+    // max height error of every grid point introduced by a split, grid_size^2 values
+    void errors(const int16_t *heights, std::vector<float> &errors) const;
+
+    /**
+     * @brief
+     * triangles whose errors are all <= max_error. vertices are grid indices in the order of their first use,
+     * triangles index into vertices
+     */
+    void mesh(const std::vector<float> &errors, float max_error,
+              std::vector<uint32_t> &vertices, std::vector<uint32_t> &triangles) const;
+
+    // the martini of a grid size, built once per process
+    static const Martini &get(int grid_size);
+
+private:
+    int grid_size;
+    int num_triangles;
+    int num_parent_triangles;
+    // ax, ay, bx, by of every triangle, the right angle vertex c follows from them
+    std::vector<uint16_t> coords;
+};
+
+/**
+ * @brief
+ * geometric error cesium assumes for tiles of level z, x_num0 tiles at level 0
+ */
+double terrainGeometricError(int z, int x_num0);
+
+/**
+ * @brief
+ * encodes a quantized-mesh-1.0 tile of the grid_size x grid_size heights (meters, row 0 is north).
+ * columns are evenly spaced from west to east, row y is at latitude lat[y]. edge vertex lists let the client build
+ * the skirts, u/v are linear in lon/lat like cesium expects for both tiling schemes
+ */
+bool encodeQuantizedMesh(const int16_t *heights, int grid_size, double west, double east, const double *lat,
+                         double max_error, const TerrainOptions &options, std::vector<uint8_t> &out);
@@ -0,0 +1,313 @@
+/**
+ * @file reduce.cpp
+ * @brief
+ * NODATA aware 2:1 reduction kernels of makelod
+ *
+ * 先对子图的3行做纵向合并(SSE2)，再做横向3抽头合并，最后按步长2取出父图像素
+ *
+ */
+
+#include "reduce.h"
+#include "gdem.h"
+#include "unsuck.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define REDUCE_SSE2
+#endif
+
+using namespace std;
+
+static const int16_t MIN_SENTINEL = numeric_limits<int16_t>::max();
+static const int16_t MAX_SENTINEL = numeric_limits<int16_t>::min();
+
+bool parseReduction(const string &name, Reduction &out)
+{
+    if (icompare(name, "mean") || icompare(name, "average"))
+        out = Reduction::Mean;
+    else if (icompare(name, "min"))
+        out = Reduction::Minimum;
+    else if (icompare(name, "max"))
+        out = Reduction::Maximum;
+    else if (icompare(name, "median"))
+        out = Reduction::Median;
+    else
+        return false;
+
+    return true;
+}
+
+string toString(Reduction reduction)
+{
+    switch (reduction)
+    {
+    case Reduction::Mean:
+        return "mean";
+    case Reduction::Minimum:
+        return "min";
+    case Reduction::Maximum:
+        return "max";
+    case Reduction::Median:
+        return "median";
+    }
+    return "";
+}
+
+// out[i] = min (or max) of the valid values of a[i], b[i], c[i], sentinel if none is valid
+template <bool IS_MIN>
+static void verticalMinMax(const int16_t *a, const int16_t *b, const int16_t *c, int count, int16_t *out)
+{
+    const int16_t sentinel = IS_MIN ? MIN_SENTINEL : MAX_SENTINEL;
+    int i = 0;
+
+#ifdef REDUCE_SSE2
+    const __m128i nodata = _mm_set1_epi16(NODATA);
+    const __m128i fill = _mm_set1_epi16(sentinel);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i vc = _mm_loadu_si128((const __m128i *)(c + i));
+
+        __m128i ma = _mm_cmpgt_epi16(va, nodata);
+        __m128i mb = _mm_cmpgt_epi16(vb, nodata);
+        __m128i mc = _mm_cmpgt_epi16(vc, nodata);
+        va = _mm_or_si128(_mm_and_si128(ma, va), _mm_andnot_si128(ma, fill));
+        vb = _mm_or_si128(_mm_and_si128(mb, vb), _mm_andnot_si128(mb, fill));
+        vc = _mm_or_si128(_mm_and_si128(mc, vc), _mm_andnot_si128(mc, fill));
+
+        __m128i r = IS_MIN ? _mm_min_epi16(_mm_min_epi16(va, vb), vc) : _mm_max_epi16(_mm_max_epi16(va, vb), vc);
+        _mm_storeu_si128((__m128i *)(out + i), r);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        int16_t va = a[i] > NODATA ? a[i] : sentinel;
+        int16_t vb = b[i] > NODATA ? b[i] : sentinel;
+        int16_t vc = c[i] > NODATA ? c[i] : sentinel;
+        out[i] = IS_MIN ? min(min(va, vb), vc) : max(max(va, vb), vc);
+    }
+}
+
+// out[i] = min (or max) of v[i], v[i + 1], v[i + 2]
+template <bool IS_MIN>
+static void horizontalMinMax(const int16_t *v, int count, int16_t *out)
+{
+    int i = 0;
+
+#ifdef REDUCE_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(v + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(v + i + 1));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(v + i + 2));
+        __m128i r = IS_MIN ? _mm_min_epi16(_mm_min_epi16(v0, v1), v2) : _mm_max_epi16(_mm_max_epi16(v0, v1), v2);
+        _mm_storeu_si128((__m128i *)(out + i), r);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        out[i] = IS_MIN ? min(min(v[i], v[i + 1]), v[i + 2]) : max(max(v[i], v[i + 1]), v[i + 2]);
+    }
+}
+
+// weighted sum and weight of the valid values of a[i], b[i], c[i] with weights (1, 2, 1)
+static void verticalMean(const int16_t *a, const int16_t *b, const int16_t *c, int count, int32_t *sum, int32_t *weight)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int32_t ma = a[i] > NODATA ? 1 : 0;
+        int32_t mb = b[i] > NODATA ? 2 : 0;
+        int32_t mc = c[i] > NODATA ? 1 : 0;
+        sum[i] = ma * a[i] + mb * b[i] + mc * c[i];
+        weight[i] = ma + mb + mc;
+    }
+}
+
+static void horizontalMean(const int32_t *sum, const int32_t *weight, int count, int32_t *out_sum, int32_t *out_weight)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out_sum[i] = sum[i] + 2 * sum[i + 1] + sum[i + 2];
+        out_weight[i] = weight[i] + 2 * weight[i + 1] + weight[i + 2];
+    }
+}
+
+// parent pixels [begin, end) of the quadrant and the child pixel each of them is centered on is 2j - offset
+static void quadrantRange(int size, int q, int &begin, int &end, int &offset)
+{
+    int split = (size - 1) / 2 + 1;
+    if (q == 0)
+    {
+        begin = 0;
+        end = split;
+        offset = 0;
+    }
+    else
+    {
+        begin = split;
+        end = size;
+        offset = size - 1;
+    }
+}
+
+void reduceQuadrant(const int16_t *child, int width, int height, Reduction reduction, int qx, int qy, int16_t *parent)
+{
+    int x_begin, x_end, x_offset;
+    int y_begin, y_end, y_offset;
+    quadrantRange(width, qx, x_begin, x_end, x_offset);
+    quadrantRange(height, qy, y_begin, y_end, y_offset);
+
+    // vertically reduced rows are padded by one replicated column on both sides
+    vector<int16_t> vertical(width + 2);
+    vector<int16_t> horizontal(width);
+    vector<int32_t> vsum(width + 2), vweight(width + 2);
+    vector<int32_t> hsum(width), hweight(width);
+    int16_t window[9];
+
+    for (int j = y_begin; j < y_end; j++)
+    {
+        int cy = 2 * j - y_offset;
+        const int16_t *a = child + (int64_t)max(cy - 1, 0) * width;
+        const int16_t *b = child + (int64_t)cy * width;
+        const int16_t *c = child + (int64_t)min(cy + 1, height - 1) * width;
+        int16_t *out = parent + (int64_t)j * width;
+
+        switch (reduction)
+        {
+        case Reduction::Minimum:
+        case Reduction::Maximum:
+        {
+            bool is_min = reduction == Reduction::Minimum;
+            if (is_min)
+                verticalMinMax<true>(a, b, c, width, vertical.data() + 1);
+            else
+                verticalMinMax<false>(a, b, c, width, vertical.data() + 1);
+            vertical[0] = vertical[1];
+            vertical[width + 1] = vertical[width];
+
+            if (is_min)
+                horizontalMinMax<true>(vertical.data(), width, horizontal.data());
+            else
+                horizontalMinMax<false>(vertical.data(), width, horizontal.data());
+
+            int16_t sentinel = is_min ? MIN_SENTINEL : MAX_SENTINEL;
+            for (int i = x_begin; i < x_end; i++)
+            {
+                int16_t value = horizontal[2 * i - x_offset];
+                out[i] = value == sentinel ? (int16_t)NODATA : value;
+            }
+            break;
+        }
+        case Reduction::Mean:
+        {
+            verticalMean(a, b, c, width, vsum.data() + 1, vweight.data() + 1);
+            vsum[0] = vsum[1];
+            vweight[0] = vweight[1];
+            vsum[width + 1] = vsum[width];
+            vweight[width + 1] = vweight[width];
+
+            horizontalMean(vsum.data(), vweight.data(), width, hsum.data(), hweight.data());
+
+            for (int i = x_begin; i < x_end; i++)
+            {
+                int k = 2 * i - x_offset;
+                int32_t w = hweight[k];
+                if (w == 0)
+                {
+                    out[i] = NODATA;
+                    continue;
+                }
+                int32_t s = hsum[k];
+                // round half away from zero
+                out[i] = (int16_t)(s >= 0 ? (s + w / 2) / w : -((-s + w / 2) / w));
+            }
+            break;
+        }
+        case Reduction::Median:
+        {
+            const int16_t *rows[3] = {a, b, c};
+            for (int i = x_begin; i < x_end; i++)
+            {
+                int cx = 2 * i - x_offset;
+                int cols[3] = {max(cx - 1, 0), cx, min(cx + 1, width - 1)};
+                int n = 0;
+                for (int r = 0; r < 3; r++)
+                {
+                    for (int k = 0; k < 3; k++)
+                    {
+                        int16_t value = rows[r][cols[k]];
+                        if (value > NODATA)
+                            window[n++] = value;
+                    }
+                }
+
+                if (n == 0)
+                {
+                    out[i] = NODATA;
+                    continue;
+                }
+                nth_element(window, window + n / 2, window + n);
+                out[i] = window[n / 2];
+            }
+            break;
+        }
+        }
+    }
+}
+
+void reduceQuadrantBox(const int16_t *child, int block, int stride, Reduction reduction, int qx, int qy, int16_t *parent)
+{
+    int half = block / 2;
+    int16_t *origin = parent + (int64_t)qy * half * stride + qx * half;
+    for (int j = 0; j < half; j++)
+    {
+        const int16_t *a = child + (int64_t)(2 * j) * stride;
+        const int16_t *b = a + stride;
+        int16_t *out = origin + (int64_t)j * stride;
+        for (int i = 0; i < half; i++)
+        {
+            int16_t window[4] = {a[2 * i], a[2 * i + 1], b[2 * i], b[2 * i + 1]};
+            int n = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                if (window[k] > NODATA)
+                    window[n++] = window[k];
+            }
+            if (n == 0)
+            {
+                out[i] = NODATA;
+                continue;
+            }
+
+            switch (reduction)
+            {
+            case Reduction::Minimum:
+                out[i] = *min_element(window, window + n);
+                break;
+            case Reduction::Maximum:
+                out[i] = *max_element(window, window + n);
+                break;
+            case Reduction::Mean:
+            {
+                int32_t s = 0;
+                for (int k = 0; k < n; k++)
+                    s += window[k];
+                // round half away from zero
+                out[i] = (int16_t)(s >= 0 ? (s + n / 2) / n : -((-s + n / 2) / n));
+                break;
+            }
+            case Reduction::Median:
+                nth_element(window, window + n / 2, window + n);
+                out[i] = window[n / 2];
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+enum class Reduction
+{
+    Mean,
+    Minimum,
+    Maximum,
+    Median
+};
+
+bool parseReduction(const std::string &name, Reduction &out);
+std::string toString(Reduction reduction);
+
+/**
+ * @brief
+ * 2:1 reduction of one child tile into its quadrant of the parent tile, child and parent are width x height.
+ *
+ * corner pixels of a tile are centered on its bounds, so parent pixel j sits exactly on child pixel 2j
+ * (left/top child) or 2j - (width - 1) (right/bottom child). every parent pixel is reduced from the 3x3
+ * child pixels around that center, with tent weights (1, 2, 1) for the mean. values <= NODATA are ignored,
+ * a parent pixel without any valid child pixel becomes NODATA.
+ *
+ * @param qx 0 for the left child, 1 for the right child
+ * @param qy 0 for the top child, 1 for the bottom child
+ */
+void reduceQuadrant(const int16_t *child, int width, int height, Reduction reduction, int qx, int qy, int16_t *parent);
+
+/**
+ * @brief
+ * 2:1 reduction for pixel-is-area grids, e.g. the overviews of a GeoTIFF: parent pixel j covers child pixels
+ * 2j and 2j + 1 of each axis. child and parent are block x block pixels, rows are stride pixels apart, block is
+ * even. values <= NODATA are ignored, a parent pixel without any valid child pixel becomes NODATA.
+ *
+ * @param qx 0 for the left child, 1 for the right child
+ * @param qy 0 for the top child, 1 for the bottom child
+ */
+void reduceQuadrantBox(const int16_t *child, int block, int stride, Reduction reduction, int qx, int qy, int16_t *parent);
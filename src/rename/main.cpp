@@ -1,44 +1,48 @@
 #include "unsuck.hpp"
+#include "scanner.h"
 
 #include <iostream>
 using namespace std;
 
+// removes "'" from the names, directories are renamed before they are listed
 void rename(std::string path)
 {
-    if(fs::is_directory(path)) 
+    auto strip = [](std::string &path)
     {
-        if(path.find("'") != -1)
-        {
-            string newPath = stringReplaceAll(path, "'", "");
-            fs::rename(path, newPath);
-            path = newPath;
-        }
-        
-        for (auto &entry : fs::directory_iterator(path))
+        size_t slash = path.find_last_of("/\\");
+        size_t begin = slash == string::npos ? 0 : slash + 1;
+        if (path.find("'", begin) == string::npos)
+            return;
+
+        string newPath = path.substr(0, begin) + stringReplaceAll(path.substr(begin), "'", "");
+        fs::rename(path, newPath);
+        path = newPath;
+    };
+
+    DirectoryScanner scanner(getCpuData().numProcessors * 2);
+    scanner.scan(
+        {path}, [&](const std::string &file)
         {
-            string str = entry.path().string();
-            rename(str);
-        }
-    } 
-    else if (fs::is_regular_file(path))
-    {
-        if(path.find("'") != -1)
+            string str = file;
+            strip(str); },
+        [&](std::string &dir)
         {
-            string newPath = stringReplaceAll(path, "'", "");
-            fs::rename(path, newPath);
-        }
-    }
+            strip(dir);
+            return true; });
+
+    cout << "directories:           " << formatNumber(scanner.directoriesScanned()) << endl;
+    cout << "files:                 " << formatNumber(scanner.filesFound()) << endl;
 }
 
 int main(int argc, char **argv)
 {
     double tStart = now();
 
-    rename("D:\\GDEM_TIF_tileset_0-12");
+    rename(argc > 1 ? argv[1] : "D:\\GDEM_TIF_tileset_0-12");
 
     double duration = now() - tStart;
 
     cout << "duration:              " << formatNumber(duration, 3) << "s" << endl;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,505 @@
+/**
+ * @file resample.cpp
+ * @brief
+ * nearest, bilinear, bicubic and area average kernels over gdem blocks
+ *
+ * 每个输出行先按列所在的小块划分成若干段(span)，每段把需要的源数据行拷贝到一个扩展行中
+ * (小块左边多一列，右边多两列)，这样跨0.0625度边界的采样不需要在内层循环里判断
+ *
+ */
+
+#include "resample.h"
+#include "gdem.h"
+#include "unsuck.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+static const int64_t GLOBAL_WIDTH = (int64_t)BLOCKS_X * BLOCK_PIXELS;
+static const int64_t GLOBAL_HEIGHT = (int64_t)BLOCKS_Y * BLOCK_PIXELS;
+
+static inline int64_t wrapX(int64_t gx)
+{
+    return ((gx % GLOBAL_WIDTH) + GLOBAL_WIDTH) % GLOBAL_WIDTH;
+}
+
+static inline int64_t clampY(int64_t gy)
+{
+    return min(max(gy, (int64_t)0), GLOBAL_HEIGHT);
+}
+
+static inline int16_t toInt16(float value)
+{
+    value = floor(value + 0.5f);
+    return (int16_t)min(max(value, -32768.0f), 32767.0f);
+}
+
+static inline int16_t roundToInt16(float value)
+{
+    value = min(max(value, -32768.0f), 32767.0f);
+    return (int16_t)(int)(value + (value >= 0.0f ? 0.5f : -0.5f));
+}
+
+// NODATA taps get a zero weight, the remaining weights are renormalized
+static void blendBilinear(const float *v00, const float *v10, const float *v01, const float *v11,
+                          const float *tx, float ty, int count, int16_t *out)
+{
+    for (int x = 0; x < count; x++)
+    {
+        float t = tx[x];
+        float w00 = v00[x] > NODATA ? (1.0f - t) * (1.0f - ty) : 0.0f;
+        float w10 = v10[x] > NODATA ? t * (1.0f - ty) : 0.0f;
+        float w01 = v01[x] > NODATA ? (1.0f - t) * ty : 0.0f;
+        float w11 = v11[x] > NODATA ? t * ty : 0.0f;
+        float weight = w00 + w10 + w01 + w11;
+        float sum = w00 * v00[x] + w10 * v10[x] + w01 * v01[x] + w11 * v11[x];
+        out[x] = weight > 0.0f ? roundToInt16(sum / max(weight, 1e-6f)) : (int16_t)NODATA;
+    }
+}
+
+// Keys cubic convolution, a = -0.5
+static inline void cubicWeights(float t, float w[4])
+{
+    w[0] = ((-0.5f * t + 1.0f) * t - 0.5f) * t;
+    w[1] = (1.5f * t - 2.5f) * t * t + 1.0f;
+    w[2] = ((-1.5f * t + 2.0f) * t + 0.5f) * t;
+    w[3] = (0.5f * t - 0.5f) * t * t;
+}
+
+bool parseResampling(const string &name, Resampling &out)
+{
+    if (icompare(name, "nearest"))
+        out = Resampling::Nearest;
+    else if (icompare(name, "bilinear"))
+        out = Resampling::Bilinear;
+    else if (icompare(name, "bicubic") || icompare(name, "cubic"))
+        out = Resampling::Bicubic;
+    else if (icompare(name, "average"))
+        out = Resampling::Average;
+    else
+        return false;
+
+    return true;
+}
+
+string toString(Resampling resampling)
+{
+    switch (resampling)
+    {
+    case Resampling::Nearest:
+        return "nearest";
+    case Resampling::Bilinear:
+        return "bilinear";
+    case Resampling::Bicubic:
+        return "bicubic";
+    case Resampling::Average:
+        return "average";
+    }
+    return "";
+}
+
+Resampler::Resampler(BlockFetcher fetcher)
+    : fetcher{fetcher}
+{
+}
+
+const int16_t *Resampler::block(int bx, int by)
+{
+    int key = by * BLOCKS_X + bx;
+    auto iter = blocks.find(key);
+    if (iter != blocks.end())
+        return iter->second.get();
+
+    auto data = fetcher(bx, by);
+    blocks[key] = data;
+    return data.get();
+}
+
+int16_t Resampler::pixel(int64_t gx, int64_t gy)
+{
+    gx = wrapX(gx);
+    gy = clampY(gy);
+    int bx = (int)(gx / BLOCK_PIXELS);
+    int by = min((int)(gy / BLOCK_PIXELS), BLOCKS_Y - 1);
+
+    const int16_t *data = block(bx, by);
+    if (!data)
+        return NODATA;
+
+    return data[(gy - by * BLOCK_PIXELS) * BLOCK_WIDTH + (gx - bx * BLOCK_PIXELS)];
+}
+
+void Resampler::fetchRow(int64_t gy, int bx, int16_t *row)
+{
+    gy = clampY(gy);
+    int by = min((int)(gy / BLOCK_PIXELS), BLOCKS_Y - 1);
+
+    const int16_t *data = block(bx, by);
+    if (data)
+        memcpy(row + 1, data + (gy - by * BLOCK_PIXELS) * BLOCK_WIDTH, BLOCK_WIDTH * sizeof(int16_t));
+    else
+        fill(row + 1, row + 1 + BLOCK_WIDTH, (int16_t)NODATA);
+
+    int64_t gx = (int64_t)bx * BLOCK_PIXELS;
+    row[0] = pixel(gx - 1, gy);
+    row[BLOCK_WIDTH + 1] = pixel(gx + BLOCK_WIDTH, gy);
+    row[BLOCK_WIDTH + 2] = pixel(gx + BLOCK_WIDTH + 1, gy);
+}
+
+void Resampler::fetchRange(int64_t gy, int64_t gx_begin, int64_t count, int16_t *row)
+{
+    gy = clampY(gy);
+    int by = min((int)(gy / BLOCK_PIXELS), BLOCKS_Y - 1);
+    int64_t offset = (gy - by * BLOCK_PIXELS) * BLOCK_WIDTH;
+
+    int64_t done = 0;
+    while (done < count)
+    {
+        int64_t gx = wrapX(gx_begin + done);
+        int bx = (int)(gx / BLOCK_PIXELS);
+        int64_t col = gx - (int64_t)bx * BLOCK_PIXELS;
+        int64_t n = min(count - done, BLOCK_PIXELS - col);
+
+        const int16_t *data = block(bx, by);
+        if (data)
+            memcpy(row + done, data + offset + col, n * sizeof(int16_t));
+        else
+            fill(row + done, row + done + n, (int16_t)NODATA);
+
+        done += n;
+    }
+}
+
+void Resampler::makeSpans(const vector<double> &gx, vector<Span> &spans)
+{
+    spans.clear();
+    for (int x = 0; x < (int)gx.size(); x++)
+    {
+        int bx = (int)(wrapX((int64_t)floor(gx[x])) / BLOCK_PIXELS);
+        if (spans.empty() || spans.back().bx != bx)
+            spans.push_back({bx, x, x + 1});
+        else
+            spans.back().end = x + 1;
+    }
+}
+
+void Resampler::resample(Resampling method, double west, double south, double east, double north,
+                         int width, int height, int16_t *data)
+{
+    double yStep = (north - south) / (height - 1.0);
+
+    vector<double> lat(height);
+    for (int y = 0; y < height; y++)
+        lat[y] = north - y * yStep;
+
+    resampleRows(method, west, east, lat.data(), width, height, data);
+}
+
+void Resampler::resampleRows(Resampling method, double west, double east, const double *lat,
+                             int width, int height, int16_t *data)
+{
+    double xStep = (east - west) / (width - 1.0);
+
+    vector<double> gx(width);
+    vector<double> gy(height);
+    for (int x = 0; x < width; x++)
+        gx[x] = (west + x * xStep + 180.0) * PIXELS_PER_DEGREE;
+    for (int y = 0; y < height; y++)
+        gy[y] = (90.0 - lat[y]) * PIXELS_PER_DEGREE;
+
+    // rows need not be evenly spaced, the footprint of a row reaches half way to its neighbours
+    double footprint_x = xStep * PIXELS_PER_DEGREE;
+    vector<double> footprint_y(height);
+    double max_footprint_y = 0.0;
+    for (int y = 0; y < height; y++)
+    {
+        int y0 = max(y - 1, 0);
+        int y1 = min(y + 1, height - 1);
+        footprint_y[y] = y1 > y0 ? (gy[y1] - gy[y0]) / (y1 - y0) : 0.0;
+        max_footprint_y = max(max_footprint_y, footprint_y[y]);
+    }
+
+    switch (method)
+    {
+    case Resampling::Nearest:
+        nearest(gx, gy, width, height, data);
+        break;
+    case Resampling::Bilinear:
+        bilinear(gx, gy, width, height, data);
+        break;
+    case Resampling::Bicubic:
+        bicubic(gx, gy, width, height, data);
+        break;
+    case Resampling::Average:
+        // a pixel footprint smaller than the source pixel is an upsampling, average makes no sense there
+        if (footprint_x <= 1.0 && max_footprint_y <= 1.0)
+            bilinear(gx, gy, width, height, data);
+        else
+            average(gx, gy, footprint_x, footprint_y, width, height, data);
+        break;
+    }
+}
+
+void Resampler::resamplePoints(Resampling method, const double *lon, const double *lat, size_t count, int16_t *data)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (std::isnan(lon[i]) || std::isnan(lat[i]))
+        {
+            data[i] = NODATA;
+            continue;
+        }
+
+        double gx = (lon[i] + 180.0) * PIXELS_PER_DEGREE;
+        double gy = (90.0 - lat[i]) * PIXELS_PER_DEGREE;
+        if (method == Resampling::Nearest)
+        {
+            data[i] = pixel((int64_t)floor(gx + 0.5), (int64_t)floor(gy + 0.5));
+            continue;
+        }
+
+        double fx = floor(gx);
+        double fy = floor(gy);
+        int64_t ix = (int64_t)fx;
+        int64_t iy = (int64_t)fy;
+        float tx = (float)(gx - fx);
+        float ty = (float)(gy - fy);
+
+        if (method == Resampling::Bicubic)
+        {
+            float wx[4], wy[4];
+            cubicWeights(tx, wx);
+            cubicWeights(ty, wy);
+            float sum = 0.0f;
+            int16_t lowest = 0;
+            for (int k = 0; k < 4; k++)
+            {
+                for (int j = 0; j < 4; j++)
+                {
+                    int16_t v = pixel(ix - 1 + j, iy - 1 + k);
+                    sum += wy[k] * wx[j] * v;
+                    lowest = min(lowest, v);
+                }
+            }
+            if (lowest > NODATA)
+            {
+                data[i] = toInt16(sum);
+                continue;
+            }
+        }
+
+        float v00 = pixel(ix, iy), v10 = pixel(ix + 1, iy), v01 = pixel(ix, iy + 1), v11 = pixel(ix + 1, iy + 1);
+        blendBilinear(&v00, &v10, &v01, &v11, &tx, ty, 1, data + i);
+    }
+}
+
+void Resampler::nearest(const vector<double> &gx, const vector<double> &gy, int width, int height, int16_t *data)
+{
+    vector<Span> spans;
+    makeSpans(gx, spans);
+
+    // index into the extended row
+    vector<int> index(width);
+    for (const Span &span : spans)
+    {
+        int64_t origin = (int64_t)span.bx * BLOCK_PIXELS - 1;
+        for (int x = span.begin; x < span.end; x++)
+        {
+            double f = floor(gx[x]);
+            index[x] = (int)(wrapX((int64_t)f) - origin) + (gx[x] - f >= 0.5 ? 1 : 0);
+        }
+    }
+
+    int16_t row[EXTENDED_WIDTH];
+    for (int y = 0; y < height; y++)
+    {
+        int64_t iy = (int64_t)floor(gy[y] + 0.5);
+        int16_t *out = data + (int64_t)y * width;
+        for (const Span &span : spans)
+        {
+            fetchRow(iy, span.bx, row);
+            for (int x = span.begin; x < span.end; x++)
+                out[x] = row[index[x]];
+        }
+    }
+}
+
+void Resampler::bilinear(const vector<double> &gx, const vector<double> &gy, int width, int height, int16_t *data)
+{
+    vector<Span> spans;
+    makeSpans(gx, spans);
+
+    vector<int> index(width);
+    vector<float> tx(width);
+    for (const Span &span : spans)
+    {
+        int64_t origin = (int64_t)span.bx * BLOCK_PIXELS - 1;
+        for (int x = span.begin; x < span.end; x++)
+        {
+            double f = floor(gx[x]);
+            index[x] = (int)(wrapX((int64_t)f) - origin);
+            tx[x] = (float)(gx[x] - f);
+        }
+    }
+
+    int16_t row0[EXTENDED_WIDTH];
+    int16_t row1[EXTENDED_WIDTH];
+    vector<float> taps(width * 4);
+    float *v00 = taps.data(), *v10 = v00 + width, *v01 = v10 + width, *v11 = v01 + width;
+    for (int y = 0; y < height; y++)
+    {
+        double fy = floor(gy[y]);
+        int64_t iy = (int64_t)fy;
+        float ty = (float)(gy[y] - fy);
+
+        // gather the taps of all spans, the blend below runs over contiguous arrays and vectorizes
+        for (const Span &span : spans)
+        {
+            fetchRow(iy, span.bx, row0);
+            fetchRow(iy + 1, span.bx, row1);
+
+            for (int x = span.begin; x < span.end; x++)
+            {
+                int i = index[x];
+                v00[x] = row0[i];
+                v10[x] = row0[i + 1];
+                v01[x] = row1[i];
+                v11[x] = row1[i + 1];
+            }
+        }
+
+        blendBilinear(v00, v10, v01, v11, tx.data(), ty, width, data + (int64_t)y * width);
+    }
+}
+
+void Resampler::bicubic(const vector<double> &gx, const vector<double> &gy, int width, int height, int16_t *data)
+{
+    vector<Span> spans;
+    makeSpans(gx, spans);
+
+    vector<int> index(width);
+    vector<float> tx(width);
+    vector<float> wx(width * 4);
+    for (const Span &span : spans)
+    {
+        int64_t origin = (int64_t)span.bx * BLOCK_PIXELS - 1;
+        for (int x = span.begin; x < span.end; x++)
+        {
+            double f = floor(gx[x]);
+            index[x] = (int)(wrapX((int64_t)f) - origin);
+            tx[x] = (float)(gx[x] - f);
+            cubicWeights(tx[x], &wx[x * 4]);
+        }
+    }
+
+    int16_t rows[4][EXTENDED_WIDTH];
+    for (int y = 0; y < height; y++)
+    {
+        double fy = floor(gy[y]);
+        int64_t iy = (int64_t)fy;
+        float ty = (float)(gy[y] - fy);
+        float wy[4];
+        cubicWeights(ty, wy);
+        int16_t *out = data + (int64_t)y * width;
+
+        for (const Span &span : spans)
+        {
+            for (int k = 0; k < 4; k++)
+                fetchRow(iy - 1 + k, span.bx, rows[k]);
+
+            for (int x = span.begin; x < span.end; x++)
+            {
+                int i = index[x];
+                const float *w = &wx[x * 4];
+                float sum = 0.0f;
+                int16_t lowest = 0;
+                for (int k = 0; k < 4; k++)
+                {
+                    const int16_t *r = rows[k];
+                    float h = w[0] * r[i - 1] + w[1] * r[i] + w[2] * r[i + 1] + w[3] * r[i + 2];
+                    sum += wy[k] * h;
+                    lowest = min(lowest, min(min(r[i - 1], r[i]), min(r[i + 1], r[i + 2])));
+                }
+
+                if (lowest > NODATA)
+                {
+                    out[x] = toInt16(sum);
+                    continue;
+                }
+
+                // voids inside the 4x4 support, use the valid samples of the bilinear neighbourhood
+                float t = tx[x];
+                float v00 = rows[1][i], v10 = rows[1][i + 1], v01 = rows[2][i], v11 = rows[2][i + 1];
+                float w00 = v00 > NODATA ? (1.0f - t) * (1.0f - ty) : 0.0f;
+                float w10 = v10 > NODATA ? t * (1.0f - ty) : 0.0f;
+                float w01 = v01 > NODATA ? (1.0f - t) * ty : 0.0f;
+                float w11 = v11 > NODATA ? t * ty : 0.0f;
+                float weight = w00 + w10 + w01 + w11;
+                out[x] = weight > 0.0f ? toInt16((w00 * v00 + w10 * v10 + w01 * v01 + w11 * v11) / weight) : (int16_t)NODATA;
+            }
+        }
+    }
+}
+
+void Resampler::average(const vector<double> &gx, const vector<double> &gy, double footprint_x,
+                        const vector<double> &footprint_y, int width, int height, int16_t *data)
+{
+    // source columns [c0, c1] whose centers fall into the footprint of each output column
+    vector<int64_t> c0(width);
+    vector<int64_t> c1(width);
+    for (int x = 0; x < width; x++)
+    {
+        c0[x] = (int64_t)ceil(gx[x] - footprint_x * 0.5);
+        c1[x] = (int64_t)floor(gx[x] + footprint_x * 0.5);
+        if (c1[x] < c0[x])
+            c0[x] = c1[x] = (int64_t)floor(gx[x] + 0.5);
+    }
+    int64_t cmin = *min_element(c0.begin(), c0.end());
+    int64_t cmax = *max_element(c1.begin(), c1.end());
+    int64_t count = cmax - cmin + 1;
+
+    vector<int16_t> row(count);
+    vector<int64_t> psum(count + 1);
+    vector<int32_t> pcount(count + 1);
+    vector<int64_t> sum(width);
+    vector<int32_t> valid(width);
+
+    for (int y = 0; y < height; y++)
+    {
+        int64_t r0 = (int64_t)ceil(gy[y] - footprint_y[y] * 0.5);
+        int64_t r1 = (int64_t)floor(gy[y] + footprint_y[y] * 0.5);
+        if (r1 < r0)
+            r0 = r1 = (int64_t)floor(gy[y] + 0.5);
+
+        fill(sum.begin(), sum.end(), 0);
+        fill(valid.begin(), valid.end(), 0);
+        for (int64_t r = r0; r <= r1; r++)
+        {
+            fetchRange(r, cmin, count, row.data());
+
+            psum[0] = 0;
+            pcount[0] = 0;
+            for (int64_t i = 0; i < count; i++)
+            {
+                bool ok = row[i] > NODATA;
+                psum[i + 1] = psum[i] + (ok ? row[i] : 0);
+                pcount[i + 1] = pcount[i] + (ok ? 1 : 0);
+            }
+
+            for (int x = 0; x < width; x++)
+            {
+                int64_t a = c0[x] - cmin;
+                int64_t b = c1[x] - cmin + 1;
+                sum[x] += psum[b] - psum[a];
+                valid[x] += pcount[b] - pcount[a];
+            }
+        }
+
+        int16_t *out = data + (int64_t)y * width;
+        for (int x = 0; x < width; x++)
+            out[x] = valid[x] > 0 ? toInt16((float)((double)sum[x] / valid[x])) : (int16_t)NODATA;
+    }
+}
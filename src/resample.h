@@ -0,0 +1,82 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+
+/**
+ * @brief
+ * global pixel grid of gdem, 3600 pixels per degree, origin at (-180, 90), y grows southwards.
+ * a block covers 225x225 pixels and stores 226x226 samples, the last row/column is shared with the neighbour
+ */
+#define PIXELS_PER_DEGREE 3600.0
+#define BLOCK_PIXELS 225
+#define BLOCK_WIDTH 226
+#define BLOCKS_X (360 * 16)
+#define BLOCKS_Y (180 * 16)
+
+enum class Resampling
+{
+    Nearest,
+    Bilinear,
+    Bicubic,
+    Average
+};
+
+bool parseResampling(const std::string &name, Resampling &out);
+std::string toString(Resampling resampling);
+
+/**
+ * @brief
+ * returns the 226x226 samples of block (bx, by), by is counted from the north, nullptr if there is no data
+ */
+typedef std::function<std::shared_ptr<const int16_t>(int bx, int by)> BlockFetcher;
+
+/**
+ * @brief
+ * resamples the gdem grid into a width x height image whose corner pixels are centered on the bounds.
+ * output columns are split into spans that fall into the same block column; for every span the tap rows
+ * are copied into an extended row (one column before and two after the block) so that the kernels never
+ * have to look at the neighbouring blocks themselves
+ */
+class Resampler
+{
+public:
+    Resampler(BlockFetcher fetcher);
+
+    void resample(Resampling method, double west, double south, double east, double north,
+                  int width, int height, int16_t *data);
+    // columns are evenly spaced from west to east, row y is at latitude lat[y] (e.g. mercator rows)
+    void resampleRows(Resampling method, double west, double east, const double *lat,
+                      int width, int height, int16_t *data);
+    // count arbitrary points, e.g. the pixels of a projected tile. average falls back to bilinear, NAN points are NODATA
+    void resamplePoints(Resampling method, const double *lon, const double *lat, size_t count, int16_t *data);
+
+    static const int EXTENDED_WIDTH = BLOCK_WIDTH + 3;
+
+private:
+    struct Span
+    {
+        int bx;
+        int begin;
+        int end;
+    };
+
+    int16_t pixel(int64_t gx, int64_t gy);
+    const int16_t *block(int bx, int by);
+    void fetchRow(int64_t gy, int bx, int16_t *row);
+    void fetchRange(int64_t gy, int64_t gx_begin, int64_t count, int16_t *row);
+
+    void makeSpans(const std::vector<double> &gx, std::vector<Span> &spans);
+
+    void nearest(const std::vector<double> &gx, const std::vector<double> &gy, int width, int height, int16_t *data);
+    void bilinear(const std::vector<double> &gx, const std::vector<double> &gy, int width, int height, int16_t *data);
+    void bicubic(const std::vector<double> &gx, const std::vector<double> &gy, int width, int height, int16_t *data);
+    void average(const std::vector<double> &gx, const std::vector<double> &gy, double footprint_x,
+                 const std::vector<double> &footprint_y, int width, int height, int16_t *data);
+
+    BlockFetcher fetcher;
+    std::unordered_map<int, std::shared_ptr<const int16_t>> blocks;
+};
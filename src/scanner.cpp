@@ -0,0 +1,192 @@
+/**
+ * @file scanner.cpp
+ * @brief
+ * parallel directory scanner with work stealing
+ *
+ * 多线程遍历目录树，每个线程有自己的目录队列，空闲时从其它线程窃取；Linux下用getdents64一次读取大量目录项
+ *
+ */
+
+#include "scanner.h"
+#include "unsuck.hpp"
+
+#include <thread>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#define SCANNER_GETDENTS
+#endif
+
+using namespace std;
+
+DirectoryScanner::DirectoryScanner(size_t numThreads)
+    : numThreads(max<size_t>(numThreads, 1))
+{
+}
+
+void DirectoryScanner::push(size_t index, string path)
+{
+    pending++;
+    lock_guard<mutex> lock(queues[index]->mtx);
+    queues[index]->directories.push_back(std::move(path));
+}
+
+bool DirectoryScanner::pop(size_t index, string &path)
+{
+    {
+        Queue &own = *queues[index];
+        lock_guard<mutex> lock(own.mtx);
+        if (!own.directories.empty())
+        {
+            path = std::move(own.directories.back());
+            own.directories.pop_back();
+            return true;
+        }
+    }
+
+    // the oldest directories of the others are closest to the roots, they carry the most work
+    for (size_t k = 1; k < numThreads; k++)
+    {
+        Queue &victim = *queues[(index + k) % numThreads];
+        lock_guard<mutex> lock(victim.mtx);
+        if (!victim.directories.empty())
+        {
+            path = std::move(victim.directories.front());
+            victim.directories.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DirectoryScanner::listDirectory(size_t index, const string &path, const FileConsumer &consumer,
+                                     const DirectoryFilter &filter)
+{
+    // entries are collected first, so that the consumer may rename them without disturbing the listing
+    vector<string> subdirs;
+    vector<string> found;
+
+#ifdef SCANNER_GETDENTS
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    vector<char> buffer(64 * 1024);
+    while (true)
+    {
+        long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (n <= 0)
+            break;
+
+        // struct linux_dirent64: u64 d_ino, s64 d_off, u16 d_reclen, u8 d_type, char d_name[]
+        for (long offset = 0; offset < n;)
+        {
+            const char *record = buffer.data() + offset;
+            uint16_t reclen;
+            memcpy(&reclen, record + 16, sizeof(reclen));
+            unsigned char type = (unsigned char)record[18];
+            const char *name = record + 19;
+            offset += reclen;
+
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                continue;
+
+            // some network file systems do not fill d_type. links to files are followed, links to
+            // directories are not, they could form cycles
+            if (type == DT_UNKNOWN || type == DT_LNK)
+            {
+                struct stat st;
+                if (fstatat(fd, name, &st, 0) != 0)
+                    continue;
+                if (S_ISREG(st.st_mode))
+                    type = DT_REG;
+                else if (S_ISDIR(st.st_mode) && type == DT_UNKNOWN)
+                    type = DT_DIR;
+                else
+                    continue;
+            }
+
+            if (type == DT_DIR)
+                subdirs.push_back(path + "/" + name);
+            else if (type == DT_REG)
+                found.push_back(path + "/" + name);
+        }
+    }
+    close(fd);
+#else
+    error_code ec;
+    for (auto &entry : fs::directory_iterator(path, ec))
+    {
+        if (entry.is_directory(ec) && !entry.is_symlink(ec))
+            subdirs.push_back(entry.path().string());
+        else if (entry.is_regular_file(ec))
+            found.push_back(entry.path().string());
+    }
+#endif
+
+    directories++;
+
+    for (auto &subdir : subdirs)
+    {
+        if (!filter || filter(subdir))
+            push(index, std::move(subdir));
+    }
+
+    files += found.size();
+    for (auto &file : found)
+        consumer(file);
+}
+
+void DirectoryScanner::scan(const vector<string> &roots, FileConsumer consumer, DirectoryFilter filter)
+{
+    queues.clear();
+    for (size_t i = 0; i < numThreads; i++)
+        queues.push_back(make_unique<Queue>());
+    pending = 0;
+
+    size_t next = 0;
+    for (auto root : roots)
+    {
+        if (fs::is_directory(root))
+        {
+            if (!filter || filter(root))
+                push(next++ % numThreads, root);
+        }
+        else if (fs::is_regular_file(root))
+        {
+            files++;
+            consumer(root);
+        }
+    }
+
+    vector<thread> threads;
+    for (size_t i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back([this, i, &consumer, &filter]()
+                             {
+                                 using namespace std::chrono_literals;
+
+                                 string path;
+                                 while (pending > 0)
+                                 {
+                                     if (!pop(i, path))
+                                     {
+                                         std::this_thread::sleep_for(100us);
+                                         continue;
+                                     }
+
+                                     listDirectory(i, path, consumer, filter);
+                                     pending--;
+                                 } });
+    }
+
+    for (auto &t : threads)
+        t.join();
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+/**
+ * @brief
+ * parallel tree walker. every thread owns a queue of directories, it lists the newest one itself (depth first)
+ * and steals the oldest one of another thread when its own queue is empty. files are handed to the consumer
+ * as soon as their directory has been listed, so that the consumer overlaps with the scan.
+ * on linux directories are listed with getdents64, elsewhere with std::filesystem
+ */
+class DirectoryScanner
+{
+public:
+    // called concurrently from the scanning threads
+    typedef std::function<void(const std::string &path)> FileConsumer;
+    // called before a directory is listed, may change the path (e.g. after renaming it), false skips it
+    typedef std::function<bool(std::string &path)> DirectoryFilter;
+
+    DirectoryScanner(size_t numThreads);
+
+    // roots may be files or directories, returns after every file has been consumed
+    void scan(const std::vector<std::string> &roots, FileConsumer consumer, DirectoryFilter filter = nullptr);
+
+    uint64_t directoriesScanned() const { return directories; }
+    uint64_t filesFound() const { return files; }
+
+private:
+    struct Queue
+    {
+        std::deque<std::string> directories;
+        std::mutex mtx;
+    };
+
+    bool pop(size_t index, std::string &path);
+    void push(size_t index, std::string path);
+    void listDirectory(size_t index, const std::string &path, const FileConsumer &consumer, const DirectoryFilter &filter);
+
+    size_t numThreads;
+    std::vector<std::unique_ptr<Queue>> queues;
+    // directories queued or being listed
+    std::atomic<int64_t> pending = 0;
+    std::atomic<uint64_t> directories = 0;
+    std::atomic<uint64_t> files = 0;
+};
@@ -0,0 +1,335 @@
+/**
+ * @file shard.cpp
+ * @brief
+ * deterministic split of a run into shards along a hilbert curve, shard manifests and the merge of shard outputs
+ *
+ * 规划层的格网按希尔伯特曲线排序，以数据覆盖率为权重切成N段连续区间；上层瓦片对应曲线上的一段连续区间，
+ * 归属于其第一个子瓦片所在的分片，跨分片的瓦片在所有分片完成后由合并步骤生成
+ *
+ */
+
+#include "shard.h"
+#include "unsuck.hpp"
+#include "logger.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+uint64_t hilbertIndex(int order, uint32_t x, uint32_t y)
+{
+    uint64_t n = 1ull << order;
+    uint64_t d = 0;
+    for (uint64_t s = n / 2; s > 0; s /= 2)
+    {
+        uint64_t rx = (x & s) > 0 ? 1 : 0;
+        uint64_t ry = (y & s) > 0 ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+
+        // rotate the quadrant so that the curve of the next level is in its base orientation
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = (uint32_t)(n - 1 - x);
+                y = (uint32_t)(n - 1 - y);
+            }
+            swap(x, y);
+        }
+    }
+    return d;
+}
+
+bool parseShard(const string &text, int &index, int &count)
+{
+    size_t slash = text.find('/');
+    if (slash == string::npos)
+        return false;
+
+    try
+    {
+        index = stoi(text.substr(0, slash));
+        count = stoi(text.substr(slash + 1));
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return count > 0 && index >= 0 && index < count;
+}
+
+int ShardPlan::shardOf(uint64_t hilbert) const
+{
+    int shard = (int)(upper_bound(bounds.begin(), bounds.end(), hilbert) - bounds.begin()) - 1;
+    return max(0, min(shard, count - 1));
+}
+
+void ShardPlan::cellRange(int z, int x, int y, uint64_t &begin, uint64_t &size) const
+{
+    if (z >= level)
+    {
+        int d = z - level;
+        begin = hilbertIndex(order, (uint32_t)(x >> d), (uint32_t)(y >> d));
+        size = 1;
+        return;
+    }
+
+    // an aligned block of 2^d x 2^d cells is an aligned range of 4^d indices on the curve
+    int d = level - z;
+    size = 1ull << (2 * d);
+    begin = hilbertIndex(order, (uint32_t)x << d, (uint32_t)y << d) & ~(size - 1);
+}
+
+int ShardPlan::owner(int z, int x, int y) const
+{
+    uint64_t begin, size;
+    cellRange(z, x, y, begin, size);
+    return shardOf(begin);
+}
+
+bool ShardPlan::pure(int z, int x, int y) const
+{
+    uint64_t begin, size;
+    cellRange(z, x, y, begin, size);
+    return shardOf(begin) == shardOf(begin + size - 1);
+}
+
+double ShardPlan::weight(int shard) const
+{
+    double sum = 0.0;
+    for (auto &cell : cells)
+    {
+        if (shardOf(cell.hilbert) == shard)
+            sum += cell.weight;
+    }
+    return sum;
+}
+
+int64_t ShardTiles::count(int z) const
+{
+    if (z < level)
+        return z < (int)ancestors.size() ? (int64_t)ancestors[z].size() : 0;
+    return (int64_t)cells.size() << (2 * (z - level));
+}
+
+ShardTiles ShardPlan::shardTiles(int shard, bool independent) const
+{
+    ShardTiles tiles;
+    tiles.level = level;
+    for (auto &cell : cells)
+    {
+        if (shardOf(cell.hilbert) == shard)
+            tiles.cells.push_back({cell.x, cell.y});
+    }
+    sort(tiles.cells.begin(), tiles.cells.end());
+
+    // the ancestors of the covered cells of every shard, a shard may own an ancestor of cells it does not own
+    tiles.ancestors.resize(level);
+    for (int z = 0; z < level; z++)
+    {
+        int d = level - z;
+        auto &level_tiles = tiles.ancestors[z];
+        for (auto &cell : cells)
+        {
+            int x = cell.x >> d;
+            int y = cell.y >> d;
+            if (owner(z, x, y) == shard && (independent || pure(z, x, y)))
+                level_tiles.push_back({x, y});
+        }
+        sort(level_tiles.begin(), level_tiles.end());
+        level_tiles.erase(unique(level_tiles.begin(), level_tiles.end()), level_tiles.end());
+    }
+    return tiles;
+}
+
+TileList ShardPlan::mergeTiles() const
+{
+    TileList tiles(max_lod + 1);
+    for (int z = 0; z < level; z++)
+    {
+        int d = level - z;
+        for (auto &cell : cells)
+        {
+            int x = cell.x >> d;
+            int y = cell.y >> d;
+            if (!pure(z, x, y))
+                tiles[z].push_back({x, y});
+        }
+        sort(tiles[z].begin(), tiles[z].end());
+        tiles[z].erase(unique(tiles[z].begin(), tiles[z].end()), tiles[z].end());
+    }
+    return tiles;
+}
+
+ShardPlan planShards(const TileMatrixSet &tms, int max_lod, int count,
+                     const function<double(double west, double south, double east, double north)> &coverage)
+{
+    ShardPlan plan;
+    plan.count = count;
+    plan.max_lod = max_lod;
+
+    // enough cells that the cuts balance well, few enough levels above them for the merge
+    plan.level = max_lod;
+    for (int z = 0; z <= max_lod; z++)
+    {
+        if ((int64_t)tms.tilesX(z) * tms.tilesY(z) >= 1024 * (int64_t)count)
+        {
+            plan.level = z;
+            break;
+        }
+    }
+
+    int side = max(tms.tilesX(plan.level), tms.tilesY(plan.level));
+    while ((1 << plan.order) < side)
+        plan.order++;
+
+    for (int x = 0; x < tms.tilesX(plan.level); x++)
+    {
+        for (int y = 0; y < tms.tilesY(plan.level); y++)
+        {
+            double west, south, east, north;
+            tms.tileLonLatBounds(plan.level, x, y, west, south, east, north);
+            double weight = coverage(west, south, east, north);
+            if (weight > 0.0)
+                plan.cells.push_back({x, y, hilbertIndex(plan.order, x, y), weight});
+        }
+    }
+    sort(plan.cells.begin(), plan.cells.end(), [](const ShardPlan::Cell &a, const ShardPlan::Cell &b)
+         { return a.hilbert < b.hilbert; });
+
+    double total = 0.0;
+    for (auto &cell : plan.cells)
+        total += cell.weight;
+
+    // shard k starts at the first cell whose middle is past k / count of the total weight
+    uint64_t end = 1ull << (2 * plan.order);
+    plan.bounds.assign(count + 1, end);
+    plan.bounds[0] = 0;
+    double prefix = 0.0;
+    size_t i = 0;
+    for (int k = 1; k < count; k++)
+    {
+        double target = total * k / count;
+        while (i < plan.cells.size() && prefix + plan.cells[i].weight * 0.5 < target)
+            prefix += plan.cells[i++].weight;
+        plan.bounds[k] = i < plan.cells.size() ? plan.cells[i].hilbert : end;
+    }
+
+    return plan;
+}
+
+bool ShardManifest::load(const string &path)
+{
+    ifstream in(path);
+    if (!in.is_open())
+        return false;
+
+    string magic;
+    in >> magic >> index >> count >> max_lod >> tile_size >> tile_matrix_set >> out_type >> level >> begin >> end >> weight;
+    if (magic != "GDEMSHARD1" || !in)
+    {
+        logger::WARN(path + " is not a shard manifest.");
+        return false;
+    }
+
+    tiles.assign(max_lod + 1, 0);
+    int z;
+    int64_t n;
+    while (in >> z >> n)
+    {
+        if (z >= 0 && z <= max_lod)
+            tiles[z] = n;
+    }
+    return true;
+}
+
+bool ShardManifest::save(const string &path) const
+{
+    string tmp = uniqueTempPath(path);
+    {
+        ofstream out(tmp);
+        if (!out.is_open())
+        {
+            logger::ERROR(tmp + " cannot be written.");
+            return false;
+        }
+
+        out.precision(17);
+        out << "GDEMSHARD1 " << index << " " << count << " " << max_lod << " " << tile_size << " " << tile_matrix_set
+            << " " << out_type << " " << level << " " << begin << " " << end << " " << weight << "\n";
+        for (size_t z = 0; z < tiles.size(); z++)
+            out << z << "\t" << tiles[z] << "\n";
+    }
+
+    error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec)
+    {
+        logger::ERROR(path + " cannot be written.");
+        return false;
+    }
+    return true;
+}
+
+string shardDir(const string &out_dir, int index)
+{
+    return out_dir + "/shards/" + to_string(index);
+}
+
+int64_t mergeShardFiles(const string &shard_dir, const string &out_dir)
+{
+    if (!fs::is_directory(shard_dir))
+        return -1;
+
+    // collected first, the tree is changed by the moves
+    vector<fs::path> files;
+    for (auto &entry : fs::directory_iterator(shard_dir))
+    {
+        string name = entry.path().filename().string();
+        if (name == "shard.txt" || name == "catalog.txt" || name == "log.txt" || name == "stats")
+            continue;
+
+        if (entry.is_regular_file())
+        {
+            files.push_back(entry.path());
+            continue;
+        }
+        for (auto &child : fs::recursive_directory_iterator(entry.path()))
+        {
+            if (child.is_regular_file())
+                files.push_back(child.path());
+        }
+    }
+
+    int64_t moved = 0;
+    fs::path last_parent;
+    for (auto &file : files)
+    {
+        fs::path target = fs::path(out_dir) / fs::relative(file, shard_dir);
+        if (target.parent_path() != last_parent)
+        {
+            fs::create_directories(target.parent_path());
+            last_parent = target.parent_path();
+        }
+
+        error_code ec;
+        fs::rename(file, target, ec);
+        if (ec)
+        {
+            // across filesystems
+            ec.clear();
+            fs::copy_file(file, target, fs::copy_options::overwrite_existing, ec);
+            if (ec)
+            {
+                logger::ERROR(file.string() + " cannot be moved to " + target.string());
+                return -1;
+            }
+            fs::remove(file, ec);
+        }
+        moved++;
+    }
+
+    return moved;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "catalog.h"
+#include "tilematrixset.h"
+
+/**
+ * @brief
+ * position of (x, y) on the hilbert curve filling a 2^order x 2^order grid
+ */
+uint64_t hilbertIndex(int order, uint32_t x, uint32_t y);
+
+/**
+ * @brief
+ * "i/N" of --shard, false unless 0 <= i < N
+ */
+bool parseShard(const std::string &text, int &index, int &count);
+
+/**
+ * @brief
+ * tiles of one shard. the levels above the planning level are listed, the levels from it down are the descendants
+ * of the owned cells and are only expanded per supertile, a planet shard has 10^8 tiles and more at max lod
+ */
+struct ShardTiles
+{
+    // of the plan
+    int level = 0;
+    // levels above level, sorted by (x, y)
+    TileList ancestors;
+    // owned covered cells of level, sorted by (x, y)
+    std::vector<std::pair<int, int>> cells;
+
+    int64_t count(int z) const;
+};
+
+/**
+ * @brief
+ * deterministic split of a tile pyramid into count shards.
+ *
+ * the cells of the planning level are ordered along a hilbert curve and cut into count contiguous ranges of about
+ * the same weight, the weight of a cell is the fraction of it covered by sources. a tile below the planning level
+ * belongs to the shard of its cell; a tile above it covers an aligned block of cells, which is a contiguous range
+ * of the curve, and belongs to the shard owning the first cell of that range, i.e. its first child. such a tile is
+ * pure if the whole range is owned by one shard; only pure tiles can be reduced by a shard, the others are built
+ * by the merge after all shards finished
+ */
+class ShardPlan
+{
+public:
+    struct Cell
+    {
+        int x;
+        int y;
+        uint64_t hilbert;
+        double weight;
+    };
+
+    int count = 1;
+    int max_lod = 0;
+    // cells of this level are the unit of the split
+    int level = 0;
+    // of the hilbert curve covering the cells of level
+    int order = 0;
+    // shard i owns the hilbert indices [bounds[i], bounds[i + 1])
+    std::vector<uint64_t> bounds;
+    // covered cells sorted by hilbert index
+    std::vector<Cell> cells;
+
+    int shardOf(uint64_t hilbert) const;
+    int owner(int z, int x, int y) const;
+    bool pure(int z, int x, int y) const;
+    double weight(int shard) const;
+
+    /**
+     * @brief
+     * tiles built by the shard. with independent levels (terrain) every level is rendered from the sources and the
+     * shard builds all tiles it owns above the planning level, otherwise only the pure ones
+     */
+    ShardTiles shardTiles(int shard, bool independent) const;
+    // tiles above the planning level spanning several shards, built by the merge
+    TileList mergeTiles() const;
+
+private:
+    // first hilbert index of the block of cells below (z, x, y) and the number of indices in it
+    void cellRange(int z, int x, int y, uint64_t &begin, uint64_t &size) const;
+};
+
+/**
+ * @brief
+ * splits levels [0, max_lod] into count shards, coverage is the fraction of the lon/lat bounds with sources
+ */
+ShardPlan planShards(const TileMatrixSet &tms, int max_lod, int count,
+                     const std::function<double(double west, double south, double east, double north)> &coverage);
+
+/**
+ * @brief
+ * <out_dir>/shards/<index>/shard.txt, written when a shard finished
+ *
+ * one line: "GDEMSHARD1 <index> <count> <max_lod> <tile_size> <tile matrix set> <out_type> <plan level>
+ * <hilbert begin> <hilbert end> <weight>", then one tab separated line per level: z, number of tiles
+ */
+struct ShardManifest
+{
+    int index = 0;
+    int count = 1;
+    int max_lod = 0;
+    int tile_size = 0;
+    std::string tile_matrix_set;
+    std::string out_type;
+    int level = 0;
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    double weight = 0.0;
+    std::vector<int64_t> tiles;
+
+    bool load(const std::string &path);
+    bool save(const std::string &path) const;
+};
+
+std::string shardDir(const std::string &out_dir, int index);
+
+/**
+ * @brief
+ * moves the tiles and pyramids of a shard directory into out_dir, copies them if a rename is not possible
+ * (another filesystem). manifest, catalog, log and stats stay behind. returns the number of files moved, -1 on error
+ */
+int64_t mergeShardFiles(const std::string &shard_dir, const std::string &out_dir);
@@ -0,0 +1,353 @@
+/**
+ * @file source.cpp
+ * @brief
+ * generic georeferenced sources, read through their geotransform in SOURCE_BLOCK blocks
+ *
+ * 任意分辨率和范围的DEM(GeoTIFF/VRT)，按地理变换参数计算像素位置，按块读取并缓存
+ *
+ */
+
+#include "source.h"
+#include "gdem.h"
+#include "logger.h"
+#include "tiffprobe.h"
+#include "unsuck.hpp"
+#include "metrics.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include <gdal_priv.h>
+
+using namespace std;
+
+// bounds and resolution from the geotransform, false if the raster is not north up lon/lat
+static bool finishGeoSource(GeoSource &source)
+{
+    const double *gt = source.geotransform;
+    if (gt[2] != 0.0 || gt[4] != 0.0 || gt[1] <= 0.0 || gt[5] >= 0.0)
+        return false;
+
+    source.west = gt[0];
+    source.north = gt[3];
+    source.east = gt[0] + source.width * gt[1];
+    source.south = gt[3] + source.height * gt[5];
+    source.resolution = max(gt[1], -gt[5]);
+
+    return source.west >= -180.5 && source.east <= 180.5 && source.south >= -90.5 && source.north <= 90.5;
+}
+
+bool readGeoSource(const string &path, GeoSource &source)
+{
+    source.path = path;
+
+    // GeoTIFFs are read from their header, gdal is only opened for other formats or TIFFs without georeferencing
+    TiffInfo info;
+    if ((iEndsWith(path, ".tif") || iEndsWith(path, ".tiff")) && probeTiff(path, info) && info.has_geotransform)
+    {
+        source.width = info.width;
+        source.height = info.height;
+        memcpy(source.geotransform, info.geotransform, sizeof(source.geotransform));
+        source.has_nodata = info.has_nodata;
+        source.nodata = info.nodata;
+        return finishGeoSource(source);
+    }
+
+    GDALDataset *poDataset = static_cast<GDALDataset *>(GDALOpen(path.c_str(), GA_ReadOnly));
+    if (!poDataset)
+        return false;
+
+    source.width = poDataset->GetRasterXSize();
+    source.height = poDataset->GetRasterYSize();
+    bool georeferenced = poDataset->GetGeoTransform(source.geotransform) == CE_None;
+
+    int hasNoData = 0;
+    auto poBand = poDataset->GetRasterBand(1);
+    if (poBand)
+        source.nodata = poBand->GetNoDataValue(&hasNoData);
+    source.has_nodata = hasNoData != 0;
+    GDALClose(poDataset);
+
+    if (!georeferenced || !poBand)
+        return false;
+
+    return finishGeoSource(source);
+}
+
+namespace
+{
+    /**
+     * @brief
+     * datasets of the zip members a thread has read lately. gdal decompresses a member as a stream, a new handle
+     * would start over at the beginning of the member, a kept one seeks from its last position
+     */
+    GDALDataset *gdalOpen(const string &path)
+    {
+        metrics::Scope scope(metrics::SOURCE_OPEN);
+        return static_cast<GDALDataset *>(GDALOpen(path.c_str(), GA_ReadOnly));
+    }
+
+    class ArchiveDatasets
+    {
+    public:
+        ~ArchiveDatasets()
+        {
+            for (auto &entry : datasets)
+                GDALClose(entry.second);
+        }
+
+        GDALDataset *open(const string &path)
+        {
+            for (size_t i = 0; i < datasets.size(); i++)
+            {
+                if (datasets[i].first == path)
+                {
+                    // most recent at the back
+                    auto entry = datasets[i];
+                    datasets.erase(datasets.begin() + i);
+                    datasets.push_back(entry);
+                    return entry.second;
+                }
+            }
+
+            GDALDataset *poDataset = gdalOpen(path);
+            if (!poDataset)
+                return nullptr;
+
+            if (datasets.size() >= CAPACITY)
+            {
+                GDALClose(datasets.front().second);
+                datasets.erase(datasets.begin());
+            }
+            datasets.push_back({path, poDataset});
+            return poDataset;
+        }
+
+    private:
+        static const size_t CAPACITY = 8;
+        vector<pair<string, GDALDataset *>> datasets;
+    };
+
+    thread_local ArchiveDatasets archive_datasets;
+
+    bool isArchived(const string &path)
+    {
+        return path.rfind("/vsizip/", 0) == 0;
+    }
+}
+
+GDALDataset *openDataset(const string &path)
+{
+    if (isArchived(path))
+        return archive_datasets.open(path);
+
+    return gdalOpen(path);
+}
+
+void closeDataset(const string &path, GDALDataset *dataset)
+{
+    if (!isArchived(path))
+        GDALClose(dataset);
+}
+
+bool readGeoSourceBlock(const GeoSource &source, int bx, int by, int16_t *data)
+{
+    fill(data, data + SOURCE_BLOCK * SOURCE_BLOCK, (int16_t)NODATA);
+
+    GDALDataset *poDataset = openDataset(source.path);
+    if (!poDataset)
+    {
+        logger::ERROR(source.path + " cannot be opened.");
+        return false;
+    }
+
+    // blocks on the right and bottom edges are partial
+    int xOffset = bx * SOURCE_BLOCK;
+    int yOffset = by * SOURCE_BLOCK;
+    int xSize = min(SOURCE_BLOCK, source.width - xOffset);
+    int ySize = min(SOURCE_BLOCK, source.height - yOffset);
+
+    auto poBand = poDataset->GetRasterBand(1);
+    CPLErr code;
+    {
+        metrics::Scope scope(metrics::RASTER_IO);
+        code = poBand->RasterIO(GDALRWFlag::GF_Read, xOffset, yOffset, xSize, ySize, data, xSize, ySize, GDT_Int16,
+                                sizeof(int16_t), SOURCE_BLOCK * sizeof(int16_t));
+    }
+    closeDataset(source.path, poDataset);
+
+    if (code != CPLErr::CE_None)
+    {
+        logger::ERROR(source.path + " cannot be read.");
+        fill(data, data + SOURCE_BLOCK * SOURCE_BLOCK, (int16_t)NODATA);
+        return false;
+    }
+
+    if (source.has_nodata && source.nodata > NODATA && source.nodata <= 32767.0)
+    {
+        int16_t value = (int16_t)source.nodata;
+        for (int i = 0; i < SOURCE_BLOCK * SOURCE_BLOCK; i++)
+            data[i] = data[i] == value ? (int16_t)NODATA : data[i];
+    }
+
+    return true;
+}
+
+namespace
+{
+    /**
+     * @brief
+     * pixel access for one tile, keeps the blocks it has fetched so that the shared cache is locked once per block
+     */
+    class SourceReader
+    {
+    public:
+        SourceReader(const GeoSource &source, const SourceBlockFetcher &fetcher)
+            : source(source), fetcher(fetcher)
+        {
+        }
+
+        int16_t pixel(int64_t px, int64_t py)
+        {
+            px = min<int64_t>(max<int64_t>(px, 0), source.width - 1);
+            py = min<int64_t>(max<int64_t>(py, 0), source.height - 1);
+
+            int bx = (int)(px / SOURCE_BLOCK);
+            int by = (int)(py / SOURCE_BLOCK);
+            int key = by * source.blocksX() + bx;
+            if (key != last_key)
+            {
+                auto iter = blocks.find(key);
+                if (iter == blocks.end())
+                    iter = blocks.emplace(key, fetcher(bx, by)).first;
+                last_key = key;
+                last = iter->second.get();
+            }
+
+            if (!last)
+                return NODATA;
+            return last[(py - (int64_t)by * SOURCE_BLOCK) * SOURCE_BLOCK + (px - (int64_t)bx * SOURCE_BLOCK)];
+        }
+
+    private:
+        const GeoSource &source;
+        const SourceBlockFetcher &fetcher;
+        unordered_map<int, shared_ptr<const int16_t>> blocks;
+        int last_key = -1;
+        const int16_t *last = nullptr;
+    };
+}
+
+// pixel center coordinates of lon and lat, false if it is outside of the raster
+static bool toPixelX(const GeoSource &source, double lon, double &px)
+{
+    px = (lon - source.geotransform[0]) / source.geotransform[1] - 0.5;
+    return px >= -0.5 && px <= source.width - 0.5;
+}
+
+static bool toPixelY(const GeoSource &source, double lat, double &py)
+{
+    py = (lat - source.geotransform[3]) / source.geotransform[5] - 0.5;
+    return py >= -0.5 && py <= source.height - 0.5;
+}
+
+static int16_t bilinear(SourceReader &reader, double px, double py)
+{
+    int64_t x0 = (int64_t)floor(px);
+    int64_t y0 = (int64_t)floor(py);
+    double fx = px - x0;
+    double fy = py - y0;
+
+    int16_t taps[4] = {reader.pixel(x0, y0), reader.pixel(x0 + 1, y0), reader.pixel(x0, y0 + 1), reader.pixel(x0 + 1, y0 + 1)};
+    double weights[4] = {(1.0 - fx) * (1.0 - fy), fx * (1.0 - fy), (1.0 - fx) * fy, fx * fy};
+
+    double sum = 0.0;
+    double weight = 0.0;
+    for (int i = 0; i < 4; i++)
+    {
+        double valid = taps[i] > NODATA ? 1.0 : 0.0;
+        sum += valid * weights[i] * taps[i];
+        weight += valid * weights[i];
+    }
+
+    if (weight <= 0.0)
+        return NODATA;
+    return (int16_t)lround(sum / weight);
+}
+
+void resampleGeoSource(const GeoSource &source, const SourceBlockFetcher &fetcher, Resampling method,
+                       double west, double south, double east, double north, int width, int height, int16_t *data)
+{
+    double yStep = height > 1 ? (north - south) / (height - 1) : 0.0;
+
+    vector<double> lat(height);
+    for (int y = 0; y < height; y++)
+        lat[y] = north - y * yStep;
+
+    resampleGeoSourceRows(source, fetcher, method, west, east, lat.data(), width, height, data);
+}
+
+void resampleGeoSourceRows(const GeoSource &source, const SourceBlockFetcher &fetcher, Resampling method,
+                           double west, double east, const double *lat, int width, int height, int16_t *data)
+{
+    SourceReader reader(source, fetcher);
+
+    double xStep = width > 1 ? (east - west) / (width - 1) : 0.0;
+
+    vector<double> px(width);
+    vector<uint8_t> inside_x(width);
+    for (int x = 0; x < width; x++)
+        inside_x[x] = toPixelX(source, west + x * xStep, px[x]) ? 1 : 0;
+
+    for (int y = 0; y < height; y++)
+    {
+        double py;
+        bool inside_y = toPixelY(source, lat[y], py);
+        int16_t *out = data + (int64_t)y * width;
+        if (!inside_y)
+        {
+            fill(out, out + width, (int16_t)NODATA);
+            continue;
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            if (!inside_x[x])
+                out[x] = NODATA;
+            else if (method == Resampling::Nearest)
+                out[x] = reader.pixel((int64_t)floor(px[x] + 0.5), (int64_t)floor(py + 0.5));
+            else
+                out[x] = bilinear(reader, px[x], py);
+        }
+    }
+}
+
+void resampleGeoSourcePoints(const GeoSource &source, const SourceBlockFetcher &fetcher, Resampling method,
+                             const double *lon, const double *lat, size_t count, int16_t *data)
+{
+    SourceReader reader(source, fetcher);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        double px, py;
+        if (!toPixelX(source, lon[i], px) || !toPixelY(source, lat[i], py))
+            data[i] = NODATA;
+        else if (method == Resampling::Nearest)
+            data[i] = reader.pixel((int64_t)floor(px + 0.5), (int64_t)floor(py + 0.5));
+        else
+            data[i] = bilinear(reader, px, py);
+    }
+}
+
+int16_t sampleGeoSource(const GeoSource &source, const SourceBlockFetcher &fetcher, double lon, double lat)
+{
+    double px, py;
+    if (!toPixelX(source, lon, px) || !toPixelY(source, lat, py))
+        return NODATA;
+
+    SourceReader reader(source, fetcher);
+    return reader.pixel((int64_t)floor(px + 0.5), (int64_t)floor(py + 0.5));
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "resample.h"
+
+class GDALDataset;
+
+/**
+ * @brief
+ * sources that are not 1x1 degree gdem tiles are read in blocks of SOURCE_BLOCK x SOURCE_BLOCK pixels
+ */
+#define SOURCE_BLOCK 256
+
+/**
+ * @brief
+ * a north up raster in lon/lat (GeoTIFF, VRT, ...) of any resolution and extent, described by its geotransform
+ */
+struct GeoSource
+{
+    int id = -1;
+    int layer = 0;
+    std::string path;
+    int width = 0;
+    int height = 0;
+    double geotransform[6] = {0.0, 1.0, 0.0, 0.0, 0.0, -1.0};
+    // bounds of the pixel edges
+    double west = 0.0;
+    double south = 0.0;
+    double east = 0.0;
+    double north = 0.0;
+    // degrees per pixel, the larger of x and y
+    double resolution = 0.0;
+    bool has_nodata = false;
+    double nodata = 0.0;
+
+    int blocksX() const { return (width + SOURCE_BLOCK - 1) / SOURCE_BLOCK; }
+    int blocksY() const { return (height + SOURCE_BLOCK - 1) / SOURCE_BLOCK; }
+};
+
+/**
+ * @brief
+ * reads size, geotransform and nodata of the first band, false if the file cannot be opened or is not north up
+ */
+bool readGeoSource(const std::string &path, GeoSource &source);
+
+/**
+ * @brief
+ * reads block (bx, by) of the source into data (SOURCE_BLOCK x SOURCE_BLOCK), pixels outside of the raster
+ * and the nodata value of the band become NODATA
+ */
+bool readGeoSourceBlock(const GeoSource &source, int bx, int by, int16_t *data);
+
+/**
+ * @brief
+ * opens a source read only. members of zip archives (/vsizip/) are kept open per thread, closeDataset only
+ * closes plain files
+ */
+GDALDataset *openDataset(const std::string &path);
+void closeDataset(const std::string &path, GDALDataset *dataset);
+
+typedef std::function<std::shared_ptr<const int16_t>(int bx, int by)> SourceBlockFetcher;
+
+/**
+ * @brief
+ * samples the source into a width x height image whose corner pixels are centered on the bounds.
+ * pixels outside of the source are NODATA. bicubic and average fall back to bilinear
+ */
+void resampleGeoSource(const GeoSource &source, const SourceBlockFetcher &fetcher, Resampling method,
+                       double west, double south, double east, double north, int width, int height, int16_t *data);
+
+/**
+ * @brief
+ * like resampleGeoSource, but row y is at latitude lat[y]
+ */
+void resampleGeoSourceRows(const GeoSource &source, const SourceBlockFetcher &fetcher, Resampling method,
+                           double west, double east, const double *lat, int width, int height, int16_t *data);
+
+/**
+ * @brief
+ * samples the source at count arbitrary points, e.g. the pixels of a projected tile. nearest or bilinear, the other
+ * methods fall back to bilinear. NAN points are NODATA
+ */
+void resampleGeoSourcePoints(const GeoSource &source, const SourceBlockFetcher &fetcher, Resampling method,
+                             const double *lon, const double *lat, size_t count, int16_t *data);
+
+/**
+ * @brief
+ * nearest sample of the source at (lon, lat), NODATA outside of the source
+ */
+int16_t sampleGeoSource(const GeoSource &source, const SourceBlockFetcher &fetcher, double lon, double lat);
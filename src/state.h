@@ -14,7 +14,9 @@ struct State
     double duration = 0.0;
     std::map<string, string> values;
 
-    int64_t cacheSize = 0;
+    atomic_int64_t cacheSize = 0;
+    // threads and utilization of the stages per pipeline, guarded by mtx
+    std::map<string, string> stages;
 
     int numPasses = 0;
     int currentPass = 0; // starts with index 1! interval: [1,  numPasses]
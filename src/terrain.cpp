@@ -0,0 +1,147 @@
+/**
+ * @file terrain.cpp
+ * @brief
+ * shared parts of the cesium terrain types: gzip, layer.json and its available ranges
+ *
+ * available由数据源覆盖索引(R树)逐层求得，同一列中连续的y合并为区间，相邻列区间相同时再合并为矩形
+ *
+ */
+
+#include "terrain.h"
+#include "logger.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <zlib.h>
+
+using namespace std;
+
+static bool gzipBytes(const vector<uint8_t> &in, vector<uint8_t> &out)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 16 + 15: gzip header instead of zlib
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&stream, (uLong)in.size()) + 32);
+    stream.next_in = (Bytef *)in.data();
+    stream.avail_in = (uInt)in.size();
+    stream.next_out = out.data();
+    stream.avail_out = (uInt)out.size();
+    int code = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return code == Z_STREAM_END;
+}
+
+bool encodeTerrainFile(const vector<uint8_t> &tile, bool gzip, vector<uint8_t> &out)
+{
+    if (gzip)
+        return gzipBytes(tile, out);
+    out = tile;
+    return true;
+}
+
+vector<vector<TileRect>> terrainAvailability(
+    const TileMatrixSet &tms, int max_lod,
+    const function<bool(double west, double south, double east, double north)> &covered)
+{
+    vector<vector<TileRect>> available(max_lod + 1);
+    for (int z = 0; z <= max_lod; z++)
+    {
+        int x_num = tms.tilesX(z);
+        int y_num = tms.tilesY(z);
+
+        // rectangles still growing to the east, one per run of the previous column
+        vector<TileRect> open;
+        vector<pair<int, int>> runs;
+        for (int x = 0; x <= x_num; x++)
+        {
+            vector<pair<int, int>> column;
+            double west, south, east, north;
+            if (x < x_num)
+                tms.tileLonLatBounds(z, x, -1, west, south, east, north);
+            if (x < x_num && covered(west, south, east, north))
+            {
+                // from the south so that the runs are in tms y
+                for (int y = 0; y < y_num; y++)
+                {
+                    tms.tileLonLatBounds(z, x, y_num - 1 - y, west, south, east, north);
+                    if (!covered(west, south, east, north))
+                        continue;
+                    if (!column.empty() && column.back().second == y - 1)
+                        column.back().second = y;
+                    else
+                        column.push_back({y, y});
+                }
+            }
+
+            if (column == runs)
+            {
+                for (auto &rect : open)
+                    rect.end_x = x;
+                continue;
+            }
+
+            available[z].insert(available[z].end(), open.begin(), open.end());
+            open.clear();
+            for (auto &run : column)
+                open.push_back({x, run.first, x, run.second});
+            runs = column;
+        }
+    }
+
+    return available;
+}
+
+bool writeTerrainLayer(const string &out_dir, const string &format, const string &projection,
+                       int max_lod, const vector<string> &extensions,
+                       const vector<vector<TileRect>> &available)
+{
+    stringstream ss;
+    ss << "{\n"
+       << "  \"tilejson\": \"2.1.0\",\n"
+       << "  \"name\": \"gdem\",\n"
+       << "  \"version\": \"1.0.0\",\n"
+       << "  \"format\": \"" << format << "\",\n"
+       << "  \"scheme\": \"tms\",\n"
+       << "  \"tiles\": [\"{z}/{x}/{y}.terrain?v={version}\"],\n"
+       << "  \"projection\": \"" << projection << "\",\n"
+       << "  \"bounds\": [-180, -90, 180, 90],\n"
+       << "  \"minzoom\": 0,\n"
+       << "  \"maxzoom\": " << max_lod << ",\n";
+    if (!extensions.empty())
+    {
+        ss << "  \"extensions\": [";
+        for (size_t i = 0; i < extensions.size(); i++)
+            ss << (i > 0 ? ", " : "") << "\"" << extensions[i] << "\"";
+        ss << "],\n";
+    }
+
+    ss << "  \"available\": [\n";
+    for (size_t z = 0; z < available.size(); z++)
+    {
+        ss << "    [";
+        for (size_t i = 0; i < available[z].size(); i++)
+        {
+            auto &rect = available[z][i];
+            ss << (i > 0 ? ", " : "") << "{\"startX\": " << rect.start_x << ", \"startY\": " << rect.start_y
+               << ", \"endX\": " << rect.end_x << ", \"endY\": " << rect.end_y << "}";
+        }
+        ss << "]" << (z + 1 < available.size() ? "," : "") << "\n";
+    }
+    ss << "  ]\n"
+       << "}\n";
+
+    ofstream file(out_dir + "/layer.json");
+    if (!file.is_open())
+    {
+        logger::ERROR("cannot create " + out_dir + "/layer.json");
+        return false;
+    }
+    file << ss.str();
+    return file.good();
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "tilematrixset.h"
+
+/**
+ * @brief
+ * options of the cesium terrain types, "terrain" (quantized-mesh-1.0) and "heightmap" (heightmap-1.0)
+ */
+struct TerrainOptions
+{
+    // quantized mesh extension 1, oct encoded per vertex normals
+    bool normals = false;
+    bool gzip = true;
+    // scales the max mesh error of a tile, the geometric error cesium assumes for the level
+    double error_scale = 1.0;
+    // heightmap child masks announce no children below max_lod
+    int max_lod = 0;
+};
+
+inline bool isTerrainType(const std::string &type)
+{
+    return type == "terrain" || type == "heightmap";
+}
+
+// file extension of a tile type, both terrain types are .terrain
+inline std::string tileExtension(const std::string &type)
+{
+    return isTerrainType(type) ? "terrain" : type;
+}
+
+/**
+ * @brief
+ * the bytes of a .terrain file, the tile gzip compressed if asked to. written like the other tile types
+ */
+bool encodeTerrainFile(const std::vector<uint8_t> &tile, bool gzip, std::vector<uint8_t> &out);
+
+/**
+ * @brief
+ * inclusive tile range of a level, y counted from the south (tms)
+ */
+struct TileRect
+{
+    int start_x;
+    int start_y;
+    int end_x;
+    int end_y;
+};
+
+/**
+ * @brief
+ * available tiles of levels [0, max_lod] as rectangles, covered tells whether the lon/lat bounds hold any source.
+ * runs of y in a column are merged with the same runs of the neighbouring columns
+ */
+std::vector<std::vector<TileRect>> terrainAvailability(
+    const TileMatrixSet &tms, int max_lod,
+    const std::function<bool(double west, double south, double east, double north)> &covered);
+
+/**
+ * @brief
+ * <out_dir>/layer.json of a terrain tileset, format is "quantized-mesh-1.0" or "heightmap-1.0"
+ */
+bool writeTerrainLayer(const std::string &out_dir, const std::string &format, const std::string &projection,
+                       int max_lod, const std::vector<std::string> &extensions,
+                       const std::vector<std::vector<TileRect>> &available);
@@ -0,0 +1,388 @@
+/**
+ * @file tiffprobe.cpp
+ * @brief
+ * header only TIFF/BigTIFF probe
+ *
+ * 只读取文件头(一次pread)解析第一个IFD，得到尺寸、分块、压缩、地理变换和NODATA，不经过GDAL的驱动探测
+ *
+ */
+
+#include "tiffprobe.h"
+
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+
+#if defined(_WIN32)
+#define TIFFPROBE_STREAM
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+enum TiffTag
+{
+    TAG_IMAGE_WIDTH = 256,
+    TAG_IMAGE_LENGTH = 257,
+    TAG_BITS_PER_SAMPLE = 258,
+    TAG_COMPRESSION = 259,
+    TAG_SAMPLES_PER_PIXEL = 277,
+    TAG_TILE_WIDTH = 322,
+    TAG_TILE_LENGTH = 323,
+    TAG_ROWS_PER_STRIP = 278,
+    TAG_SAMPLE_FORMAT = 339,
+    TAG_MODEL_PIXEL_SCALE = 33550,
+    TAG_MODEL_TIEPOINT = 33922,
+    TAG_MODEL_TRANSFORMATION = 34264,
+    TAG_GEO_KEY_DIRECTORY = 34735,
+    TAG_GDAL_NODATA = 42113
+};
+
+static const uint16_t GT_RASTER_TYPE_GEO_KEY = 1025;
+static const uint16_t RASTER_PIXEL_IS_POINT = 2;
+
+static const size_t PROBE_SIZE = 16 * 1024;
+
+namespace
+{
+    class TiffReader
+    {
+    public:
+        ~TiffReader()
+        {
+#ifdef TIFFPROBE_STREAM
+            in.close();
+#else
+            if (fd >= 0)
+                close(fd);
+#endif
+        }
+
+        bool open(const string &path)
+        {
+#ifdef TIFFPROBE_STREAM
+            in.open(path, ios::binary);
+            if (!in.is_open())
+                return false;
+#else
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return false;
+#endif
+            head.resize(PROBE_SIZE);
+            size_t n = readAt(0, head.data(), head.size());
+            head.resize(n);
+            return n >= 8;
+        }
+
+        // bytes [offset, offset + size), from the head if possible
+        bool bytes(uint64_t offset, size_t size, vector<uint8_t> &out)
+        {
+            out.resize(size);
+            // offset comes from the file, offset + size may wrap
+            if (offset <= head.size() && size <= head.size() - offset)
+            {
+                memcpy(out.data(), head.data() + offset, size);
+                return true;
+            }
+            return readAt(offset, out.data(), size) == size;
+        }
+
+        uint16_t u16(const uint8_t *p) const
+        {
+            return little ? (uint16_t)(p[0] | p[1] << 8) : (uint16_t)(p[1] | p[0] << 8);
+        }
+
+        uint32_t u32(const uint8_t *p) const
+        {
+            return little ? (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24
+                          : (uint32_t)p[3] | (uint32_t)p[2] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[0] << 24;
+        }
+
+        uint64_t u64(const uint8_t *p) const
+        {
+            uint64_t lo = u32(p);
+            uint64_t hi = u32(p + 4);
+            return little ? lo | hi << 32 : hi | lo << 32;
+        }
+
+        double f64(const uint8_t *p) const
+        {
+            uint64_t bits = u64(p);
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        vector<uint8_t> head;
+        bool little = true;
+
+    private:
+        size_t readAt(uint64_t offset, uint8_t *data, size_t size)
+        {
+#ifdef TIFFPROBE_STREAM
+            in.clear();
+            in.seekg(offset);
+            in.read((char *)data, size);
+            return (size_t)in.gcount();
+#else
+            size_t done = 0;
+            while (done < size)
+            {
+                ssize_t n = pread(fd, data + done, size - done, (off_t)(offset + done));
+                if (n <= 0)
+                    break;
+                done += (size_t)n;
+            }
+            return done;
+#endif
+        }
+
+#ifdef TIFFPROBE_STREAM
+        ifstream in;
+#else
+        int fd = -1;
+#endif
+    };
+
+    struct Entry
+    {
+        uint16_t tag;
+        uint16_t type;
+        uint64_t count;
+        // the value field of the entry, holds the value itself if it fits
+        const uint8_t *value;
+    };
+}
+
+static size_t typeSize(uint16_t type)
+{
+    switch (type)
+    {
+    case 1:  // BYTE
+    case 2:  // ASCII
+    case 6:  // SBYTE
+    case 7:  // UNDEFINED
+        return 1;
+    case 3:  // SHORT
+    case 8:  // SSHORT
+        return 2;
+    case 4:  // LONG
+    case 9:  // SLONG
+    case 11: // FLOAT
+    case 13: // IFD
+        return 4;
+    case 5:  // RATIONAL
+    case 10: // SRATIONAL
+    case 12: // DOUBLE
+    case 16: // LONG8
+    case 17: // SLONG8
+    case 18: // IFD8
+        return 8;
+    }
+    return 0;
+}
+
+static uint64_t entryInteger(const TiffReader &reader, const Entry &entry)
+{
+    switch (entry.type)
+    {
+    case 3:
+        return reader.u16(entry.value);
+    case 4:
+        return reader.u32(entry.value);
+    case 16:
+        return reader.u64(entry.value);
+    }
+    return 0;
+}
+
+bool probeTiff(const string &path, TiffInfo &info)
+{
+    TiffReader reader;
+    if (!reader.open(path))
+        return false;
+
+    const uint8_t *h = reader.head.data();
+    if (h[0] == 'I' && h[1] == 'I')
+        reader.little = true;
+    else if (h[0] == 'M' && h[1] == 'M')
+        reader.little = false;
+    else
+        return false;
+
+    uint16_t version = reader.u16(h + 2);
+    uint64_t ifd_offset;
+    if (version == 42)
+    {
+        ifd_offset = reader.u32(h + 4);
+    }
+    else if (version == 43 && reader.head.size() >= 16)
+    {
+        info.big_tiff = true;
+        ifd_offset = reader.u64(h + 8);
+    }
+    else
+    {
+        return false;
+    }
+
+    size_t count_size = info.big_tiff ? 8 : 2;
+    size_t entry_size = info.big_tiff ? 20 : 12;
+    size_t value_size = info.big_tiff ? 8 : 4;
+
+    vector<uint8_t> buffer;
+    if (!reader.bytes(ifd_offset, count_size, buffer))
+        return false;
+    uint64_t count = info.big_tiff ? reader.u64(buffer.data()) : reader.u16(buffer.data());
+    if (count == 0 || count > 4096)
+        return false;
+
+    vector<uint8_t> ifd;
+    if (!reader.bytes(ifd_offset + count_size, (size_t)count * entry_size, ifd))
+        return false;
+
+    vector<Entry> entries((size_t)count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *p = ifd.data() + i * entry_size;
+        entries[i].tag = reader.u16(p);
+        entries[i].type = reader.u16(p + 2);
+        entries[i].count = info.big_tiff ? reader.u64(p + 4) : reader.u32(p + 4);
+        entries[i].value = p + (info.big_tiff ? 12 : 8);
+    }
+
+    // values that do not fit into the entry live at the offset stored in the entry
+    auto values = [&](const Entry &entry, vector<uint8_t> &out)
+    {
+        size_t size = typeSize(entry.type) * (size_t)entry.count;
+        if (size == 0 || size > (1 << 20))
+            return false;
+        if (size <= value_size)
+        {
+            out.assign(entry.value, entry.value + size);
+            return true;
+        }
+        uint64_t offset = info.big_tiff ? reader.u64(entry.value) : reader.u32(entry.value);
+        return reader.bytes(offset, size, out);
+    };
+
+    vector<double> scale, tiepoint, transformation;
+    bool pixel_is_point = false;
+    vector<uint8_t> data;
+    for (auto &entry : entries)
+    {
+        switch (entry.tag)
+        {
+        case TAG_IMAGE_WIDTH:
+            info.width = (int)entryInteger(reader, entry);
+            break;
+        case TAG_IMAGE_LENGTH:
+            info.height = (int)entryInteger(reader, entry);
+            break;
+        case TAG_BITS_PER_SAMPLE:
+            info.bits_per_sample = (int)entryInteger(reader, entry);
+            break;
+        case TAG_COMPRESSION:
+            info.compression = (int)entryInteger(reader, entry);
+            break;
+        case TAG_SAMPLES_PER_PIXEL:
+            info.samples = (int)entryInteger(reader, entry);
+            break;
+        case TAG_SAMPLE_FORMAT:
+            info.sample_format = (int)entryInteger(reader, entry);
+            break;
+        case TAG_TILE_WIDTH:
+            info.tiled = true;
+            info.block_width = (int)entryInteger(reader, entry);
+            break;
+        case TAG_TILE_LENGTH:
+            info.tiled = true;
+            info.block_height = (int)entryInteger(reader, entry);
+            break;
+        case TAG_ROWS_PER_STRIP:
+            if (!info.tiled)
+                info.block_height = (int)entryInteger(reader, entry);
+            break;
+        case TAG_MODEL_PIXEL_SCALE:
+        case TAG_MODEL_TIEPOINT:
+        case TAG_MODEL_TRANSFORMATION:
+        {
+            if (entry.type != 12 || !values(entry, data))
+                break;
+            auto &target = entry.tag == TAG_MODEL_PIXEL_SCALE ? scale : (entry.tag == TAG_MODEL_TIEPOINT ? tiepoint : transformation);
+            target.resize((size_t)entry.count);
+            for (size_t i = 0; i < entry.count; i++)
+                target[i] = reader.f64(data.data() + i * 8);
+            break;
+        }
+        case TAG_GEO_KEY_DIRECTORY:
+        {
+            // header (version, revision, minor, number of keys), then keys of (id, location, count, value)
+            if (entry.type != 3 || !values(entry, data) || entry.count < 4)
+                break;
+            uint16_t keys = reader.u16(data.data() + 6);
+            for (size_t k = 0; k < keys && (k + 2) * 8 <= data.size(); k++)
+            {
+                const uint8_t *key = data.data() + (k + 1) * 8;
+                if (reader.u16(key) == GT_RASTER_TYPE_GEO_KEY && reader.u16(key + 2) == 0)
+                    pixel_is_point = reader.u16(key + 6) == RASTER_PIXEL_IS_POINT;
+            }
+            break;
+        }
+        case TAG_GDAL_NODATA:
+        {
+            if (entry.type != 2 || !values(entry, data))
+                break;
+            string text(data.begin(), data.end());
+            text = text.c_str();
+            char *end = nullptr;
+            double value = strtod(text.c_str(), &end);
+            if (end != text.c_str())
+            {
+                info.has_nodata = true;
+                info.nodata = value;
+            }
+            break;
+        }
+        }
+    }
+
+    if (!info.tiled && info.block_width == 0)
+        info.block_width = info.width;
+    if (info.width <= 0 || info.height <= 0)
+        return false;
+
+    double *gt = info.geotransform;
+    if (scale.size() >= 2 && tiepoint.size() >= 6)
+    {
+        gt[1] = scale[0];
+        gt[5] = -scale[1];
+        gt[2] = gt[4] = 0.0;
+        gt[0] = tiepoint[3] - tiepoint[0] * gt[1];
+        gt[3] = tiepoint[4] - tiepoint[1] * gt[5];
+        info.has_geotransform = true;
+    }
+    else if (transformation.size() >= 16)
+    {
+        gt[0] = transformation[3];
+        gt[1] = transformation[0];
+        gt[2] = transformation[1];
+        gt[3] = transformation[7];
+        gt[4] = transformation[4];
+        gt[5] = transformation[5];
+        info.has_geotransform = true;
+    }
+
+    // like gdal, PixelIsPoint rasters are shifted by half a pixel so that the geotransform refers to pixel corners
+    if (info.has_geotransform && pixel_is_point)
+    {
+        gt[0] -= 0.5 * gt[1] + 0.5 * gt[2];
+        gt[3] -= 0.5 * gt[4] + 0.5 * gt[5];
+    }
+
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+/**
+ * @brief
+ * what init needs to know about a (Geo)TIFF, read from the header without GDAL
+ */
+struct TiffInfo
+{
+    bool big_tiff = false;
+    int width = 0;
+    int height = 0;
+    int samples = 1;
+    int bits_per_sample = 0;
+    // 1 unsigned, 2 signed, 3 float
+    int sample_format = 1;
+    // 1 none, 5 lzw, 8 deflate, ...
+    int compression = 1;
+    bool tiled = false;
+    int block_width = 0;
+    int block_height = 0;
+
+    bool has_geotransform = false;
+    double geotransform[6] = {0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+    bool has_nodata = false;
+    double nodata = 0.0;
+};
+
+/**
+ * @brief
+ * parses the first IFD of a TIFF or BigTIFF. the first 16 KB are read with one pread, which holds the IFD
+ * of files written by GDAL; IFDs or tag values further into the file cost one more read each.
+ * false if the file is not a TIFF or the IFD is broken
+ */
+bool probeTiff(const std::string &path, TiffInfo &info);
@@ -0,0 +1,71 @@
+/**
+ * @file tiffwriter.cpp
+ * @brief
+ * BigTIFF IFDs for the cog writer and the tile codecs
+ *
+ * 只负责IFD与文件头的字节布局，像素编码由调用者完成
+ *
+ */
+
+#include "tiffwriter.h"
+
+#include <algorithm>
+
+using namespace std;
+
+template <typename T>
+static void put(vector<uint8_t> &out, T value)
+{
+    size_t offset = out.size();
+    out.resize(offset + sizeof(T));
+    memcpy(out.data() + offset, &value, sizeof(T));
+}
+
+vector<uint8_t> buildTiffIfd(vector<TiffEntry> entries, uint64_t position, uint64_t next)
+{
+    sort(entries.begin(), entries.end(), [](const TiffEntry &a, const TiffEntry &b)
+         { return a.tag < b.tag; });
+
+    vector<uint8_t> out;
+    vector<uint8_t> extra;
+    uint64_t extra_position = position + 8 + 20 * entries.size() + 8;
+
+    put<uint64_t>(out, entries.size());
+    for (auto &entry : entries)
+    {
+        put<uint16_t>(out, entry.tag);
+        put<uint16_t>(out, entry.type);
+        put<uint64_t>(out, entry.count);
+        if (entry.value.empty())
+        {
+            put<uint64_t>(out, entry.external);
+        }
+        else if (entry.value.size() <= 8)
+        {
+            uint8_t inline_value[8] = {0};
+            memcpy(inline_value, entry.value.data(), entry.value.size());
+            out.insert(out.end(), inline_value, inline_value + 8);
+        }
+        else
+        {
+            put<uint64_t>(out, extra_position + extra.size());
+            extra.insert(extra.end(), entry.value.begin(), entry.value.end());
+            if (extra.size() % 2)
+                extra.push_back(0);
+        }
+    }
+    put<uint64_t>(out, next);
+
+    out.insert(out.end(), extra.begin(), extra.end());
+    return out;
+}
+
+void putTiffHeader(vector<uint8_t> &out, uint64_t first_ifd)
+{
+    put<uint8_t>(out, 'I');
+    put<uint8_t>(out, 'I');
+    put<uint16_t>(out, 43);
+    put<uint16_t>(out, 8);
+    put<uint16_t>(out, 0);
+    put<uint64_t>(out, first_ifd);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+enum TiffType : uint16_t
+{
+    TIFF_ASCII = 2,
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4,
+    TIFF_DOUBLE = 12,
+    TIFF_LONG8 = 16
+};
+
+/**
+ * @brief
+ * one tag of a BigTIFF IFD
+ */
+struct TiffEntry
+{
+    uint16_t tag;
+    uint16_t type;
+    uint64_t count;
+    // the values, empty if they are written elsewhere at external
+    std::vector<uint8_t> value;
+    uint64_t external = 0;
+};
+
+template <typename T>
+TiffEntry valuesEntry(uint16_t tag, uint16_t type, const std::vector<T> &values)
+{
+    TiffEntry entry{tag, type, values.size(), {}, 0};
+    entry.value.resize(values.size() * sizeof(T));
+    memcpy(entry.value.data(), values.data(), entry.value.size());
+    return entry;
+}
+
+// nul terminated string
+inline TiffEntry asciiEntry(uint16_t tag, const char *text)
+{
+    std::vector<char> chars(text, text + strlen(text) + 1);
+    return valuesEntry<char>(tag, TIFF_ASCII, chars);
+}
+
+inline TiffEntry externalEntry(uint16_t tag, uint16_t type, uint64_t count, uint64_t position)
+{
+    return TiffEntry{tag, type, count, {}, position};
+}
+
+/**
+ * @brief
+ * BigTIFF IFD at position, values that do not fit the 8 bytes of an entry follow the IFD
+ */
+std::vector<uint8_t> buildTiffIfd(std::vector<TiffEntry> entries, uint64_t position, uint64_t next);
+
+// little endian BigTIFF header, 16 bytes
+void putTiffHeader(std::vector<uint8_t> &out, uint64_t first_ifd);
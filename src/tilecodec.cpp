@@ -0,0 +1,478 @@
+/**
+ * @file tilecodec.cpp
+ * @brief
+ * tile codecs behind one interface: png, tif, lossless webp, lerc and int16 + zstd
+ *
+ * 图片格式与lerc借助gdal在/vsimem中编解码，bin格式直接用gdal内置的zstd压缩器，不引入新的依赖
+ *
+ */
+
+#include "tilecodec.h"
+#include "tiffwriter.h"
+#include "logger.h"
+#include "metrics.h"
+#include "unsuck.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <filesystem>
+#include <cmath>
+#include <algorithm>
+
+#include "gdal_priv.h"
+#include "cpl_compressor.h"
+
+using namespace std;
+
+TileCodec::~TileCodec()
+{
+}
+
+static string memFileName(const string &extension)
+{
+    static atomic<int64_t> counter = 0;
+    return "/vsimem/tile_codec_" + to_string(counter++) + "." + extension;
+}
+
+// the bytes of a /vsimem file, which is removed
+static bool takeMemFile(const string &name, vector<uint8_t> &out)
+{
+    vsi_l_offset size = 0;
+    GByte *buffer = VSIGetMemFileBuffer(name.c_str(), &size, FALSE);
+    bool ok = buffer != nullptr;
+    if (ok)
+        out.assign(buffer, buffer + size);
+    VSIUnlink(name.c_str());
+    return ok;
+}
+
+// opens bytes as a dataset, the caller closes it and unlinks name
+static GDALDataset *openMemFile(const string &name, const uint8_t *in, size_t size)
+{
+    VSIFCloseL(VSIFileFromMemBuffer(name.c_str(), const_cast<GByte *>(in), size, FALSE));
+    return static_cast<GDALDataset *>(GDALOpen(name.c_str(), GA_ReadOnly));
+}
+
+// a copy of source written by the driver into out
+static bool createCopy(const char *driver_name, GDALDataset *source, char **options, const string &extension,
+                       vector<uint8_t> &out)
+{
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName(driver_name);
+    if (!driver)
+        return false;
+
+    string name = memFileName(extension);
+    GDALDataset *copy = driver->CreateCopy(name.c_str(), source, TRUE, options, nullptr, nullptr);
+    if (!copy)
+    {
+        VSIUnlink(name.c_str());
+        return false;
+    }
+    GDALClose(copy);
+    return takeMemFile(name, out);
+}
+
+static uint16_t compressionTag(const string &compress, uint32_t &lerc_additional)
+{
+    lerc_additional = 0;
+    if (compress == "DEFLATE")
+        return 8;
+    if (compress == "ZSTD")
+        return 50000;
+    if (compress.compare(0, 4, "LERC") == 0)
+    {
+        lerc_additional = compress == "LERC_DEFLATE" ? 1 : (compress == "LERC_ZSTD" ? 2 : 0);
+        return 34887;
+    }
+    return 1;
+}
+
+bool gdalEncodeBlock(const int16_t *data, int width, int height, const string &compress, bool predictor,
+                     double max_error, vector<uint8_t> &out)
+{
+    string name = memFileName("tif");
+    char **options = nullptr;
+    options = CSLSetNameValue(options, "BLOCKYSIZE", to_string(height).c_str());
+    options = CSLSetNameValue(options, "COMPRESS", compress.c_str());
+    if (predictor)
+        options = CSLSetNameValue(options, "PREDICTOR", "2");
+    if (compress.compare(0, 4, "LERC") == 0)
+        options = CSLSetNameValue(options, "MAX_Z_ERROR", to_string(max_error).c_str());
+
+    GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    GDALDataset *dataset = driver->Create(name.c_str(), width, height, 1, GDT_Int16, options);
+    CSLDestroy(options);
+    if (!dataset)
+        return false;
+
+    CPLErr code = dataset->RasterIO(GF_Write, 0, 0, width, height, (void *)data, width, height,
+                                    GDT_Int16, 1, nullptr, 0, 0, 0);
+    GDALClose(dataset);
+
+    bool encoded = false;
+    dataset = static_cast<GDALDataset *>(GDALOpen(name.c_str(), GA_ReadOnly));
+    if (code == CE_None && dataset)
+    {
+        const char *offset = dataset->GetRasterBand(1)->GetMetadataItem("BLOCK_OFFSET_0_0", "TIFF");
+        const char *length = dataset->GetRasterBand(1)->GetMetadataItem("BLOCK_SIZE_0_0", "TIFF");
+        vsi_l_offset file_size = 0;
+        GByte *buffer = VSIGetMemFileBuffer(name.c_str(), &file_size, FALSE);
+        if (offset && length && buffer && (vsi_l_offset)(atoll(offset) + atoll(length)) <= file_size)
+        {
+            out.assign(buffer + atoll(offset), buffer + atoll(offset) + atoll(length));
+            encoded = true;
+        }
+    }
+    if (dataset)
+        GDALClose(dataset);
+    VSIUnlink(name.c_str());
+
+    return encoded;
+}
+
+bool gdalDecodeBlock(const uint8_t *in, size_t size, int width, int height, const string &compress, bool predictor,
+                     int16_t *data)
+{
+    uint32_t lerc_additional;
+    uint16_t compression = compressionTag(compress, lerc_additional);
+
+    auto entries = [&](uint64_t data_position)
+    {
+        vector<TiffEntry> e;
+        e.push_back(valuesEntry<uint32_t>(256, TIFF_LONG, {(uint32_t)width}));
+        e.push_back(valuesEntry<uint32_t>(257, TIFF_LONG, {(uint32_t)height}));
+        e.push_back(valuesEntry<uint16_t>(258, TIFF_SHORT, {16}));
+        e.push_back(valuesEntry<uint16_t>(259, TIFF_SHORT, {compression}));
+        e.push_back(valuesEntry<uint16_t>(262, TIFF_SHORT, {1}));
+        e.push_back(valuesEntry<uint64_t>(273, TIFF_LONG8, {data_position}));
+        e.push_back(valuesEntry<uint16_t>(277, TIFF_SHORT, {1}));
+        e.push_back(valuesEntry<uint32_t>(278, TIFF_LONG, {(uint32_t)height}));
+        e.push_back(valuesEntry<uint64_t>(279, TIFF_LONG8, {(uint64_t)size}));
+        e.push_back(valuesEntry<uint16_t>(284, TIFF_SHORT, {1}));
+        if (predictor)
+            e.push_back(valuesEntry<uint16_t>(317, TIFF_SHORT, {2}));
+        e.push_back(valuesEntry<uint16_t>(339, TIFF_SHORT, {2}));
+        // lerc version 4, then none/deflate/zstd on top
+        if (compression == 34887)
+            e.push_back(valuesEntry<uint32_t>(50674, TIFF_LONG, {4, lerc_additional}));
+        return e;
+    };
+
+    uint64_t ifd_position = 16;
+    uint64_t data_position = ifd_position + buildTiffIfd(entries(0), ifd_position, 0).size();
+
+    vector<uint8_t> wrapper;
+    putTiffHeader(wrapper, ifd_position);
+    auto ifd = buildTiffIfd(entries(data_position), ifd_position, 0);
+    wrapper.insert(wrapper.end(), ifd.begin(), ifd.end());
+    wrapper.insert(wrapper.end(), in, in + size);
+
+    string name = memFileName("tif");
+    GDALDataset *dataset = openMemFile(name, wrapper.data(), wrapper.size());
+    CPLErr code = CE_Failure;
+    if (dataset)
+    {
+        code = dataset->RasterIO(GF_Read, 0, 0, width, height, data, width, height, GDT_Int16, 1, nullptr, 0, 0, 0);
+        GDALClose(dataset);
+    }
+    VSIUnlink(name.c_str());
+    return code == CE_None;
+}
+
+namespace
+{
+    // 16 bit grey, int16 heights are stored as their uint16 bits like before
+    class PngCodec : public TileCodec
+    {
+    public:
+        string name() const override { return "png"; }
+        string extension() const override { return "png"; }
+
+        bool encode(const int16_t *data, int width, int height, const TileGeoreference *georeference,
+                    vector<uint8_t> &out) const override
+        {
+            GDALDriver *mem = GetGDALDriverManager()->GetDriverByName("MEM");
+            GDALDataset *source = mem->Create("", width, height, 1, GDT_UInt16, nullptr);
+            if (!source)
+                return false;
+            source->RasterIO(GF_Write, 0, 0, width, height, (void *)data, width, height, GDT_UInt16, 1, nullptr, 0, 0, 0);
+
+            bool ok = createCopy("PNG", source, nullptr, "png", out);
+            GDALClose(source);
+            return ok;
+        }
+
+        bool decode(const uint8_t *in, size_t size, int width, int height, int16_t *data) const override
+        {
+            string name = memFileName("png");
+            GDALDataset *dataset = openMemFile(name, in, size);
+            CPLErr code = CE_Failure;
+            if (dataset)
+            {
+                code = dataset->RasterIO(GF_Read, 0, 0, width, height, data, width, height, GDT_UInt16, 1, nullptr, 0, 0, 0);
+                GDALClose(dataset);
+            }
+            VSIUnlink(name.c_str());
+            return code == CE_None;
+        }
+    };
+
+    class TifCodec : public TileCodec
+    {
+    public:
+        string name() const override { return "tif"; }
+        string extension() const override { return "tif"; }
+
+        bool encode(const int16_t *data, int width, int height, const TileGeoreference *georeference,
+                    vector<uint8_t> &out) const override
+        {
+            string name = memFileName("tif");
+            GDALDriver *driver = GetGDALDriverManager()->GetDriverByName("GTiff");
+            GDALDataset *dataset = driver->Create(name.c_str(), width, height, 1, GDT_Int16, nullptr);
+            if (!dataset)
+                return false;
+
+            dataset->RasterIO(GF_Write, 0, 0, width, height, (void *)data, width, height, GDT_Int16, 1, nullptr, 0, 0, 0);
+            if (georeference)
+            {
+                double xResolution = (georeference->east - georeference->west) / (width - 1);
+                double yResolution = (georeference->south - georeference->north) / (height - 1);
+                double geoTransform[6] = {
+                    georeference->west - xResolution * 0.5,
+                    xResolution,
+                    0,
+                    georeference->north - yResolution * 0.5,
+                    0,
+                    yResolution};
+                dataset->SetGeoTransform(geoTransform);
+                dataset->SetProjection(georeference->projection.c_str());
+            }
+            GDALClose(dataset);
+            return takeMemFile(name, out);
+        }
+
+        bool decode(const uint8_t *in, size_t size, int width, int height, int16_t *data) const override
+        {
+            string name = memFileName("tif");
+            GDALDataset *dataset = openMemFile(name, in, size);
+            CPLErr code = CE_Failure;
+            if (dataset)
+            {
+                code = dataset->RasterIO(GF_Read, 0, 0, width, height, data, width, height, GDT_Int16, 1, nullptr, 0, 0, 0);
+                GDALClose(dataset);
+            }
+            VSIUnlink(name.c_str());
+            return code == CE_None;
+        }
+    };
+
+    class WebpCodec : public TileCodec
+    {
+    public:
+        string name() const override { return "webp"; }
+        string extension() const override { return "webp"; }
+
+        bool encode(const int16_t *data, int width, int height, const TileGeoreference *georeference,
+                    vector<uint8_t> &out) const override
+        {
+            size_t count = (size_t)width * height;
+            vector<uint8_t> rgba(count * 4);
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t value = (uint32_t)max((data[i] + 10000) * 10, 0);
+                rgba[i] = (uint8_t)(value >> 16);
+                rgba[count + i] = (uint8_t)(value >> 8);
+                rgba[count * 2 + i] = (uint8_t)value;
+                rgba[count * 3 + i] = 255;
+            }
+
+            GDALDriver *mem = GetGDALDriverManager()->GetDriverByName("MEM");
+            GDALDataset *source = mem->Create("", width, height, 4, GDT_Byte, nullptr);
+            if (!source)
+                return false;
+            source->RasterIO(GF_Write, 0, 0, width, height, rgba.data(), width, height, GDT_Byte, 4, nullptr, 0, 0, 0);
+
+            char **options = CSLSetNameValue(nullptr, "LOSSLESS", "YES");
+            bool ok = createCopy("WEBP", source, options, "webp", out);
+            CSLDestroy(options);
+            GDALClose(source);
+            return ok;
+        }
+
+        bool decode(const uint8_t *in, size_t size, int width, int height, int16_t *data) const override
+        {
+            size_t count = (size_t)width * height;
+            vector<uint8_t> rgb(count * 3);
+            string name = memFileName("webp");
+            GDALDataset *dataset = openMemFile(name, in, size);
+            CPLErr code = CE_Failure;
+            if (dataset && dataset->GetRasterCount() >= 3)
+            {
+                int bands[3] = {1, 2, 3};
+                code = dataset->RasterIO(GF_Read, 0, 0, width, height, rgb.data(), width, height, GDT_Byte, 3, bands, 0, 0, 0);
+            }
+            if (dataset)
+                GDALClose(dataset);
+            VSIUnlink(name.c_str());
+            if (code != CE_None)
+                return false;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                uint32_t value = ((uint32_t)rgb[i] << 16) | ((uint32_t)rgb[count + i] << 8) | rgb[count * 2 + i];
+                data[i] = (int16_t)lround(value * 0.1 - 10000.0);
+            }
+            return true;
+        }
+    };
+
+    class LercCodec : public TileCodec
+    {
+    public:
+        explicit LercCodec(double max_error)
+            : max_error{max_error}
+        {
+        }
+
+        string name() const override { return "lerc"; }
+        string extension() const override { return "lerc"; }
+
+        bool encode(const int16_t *data, int width, int height, const TileGeoreference *georeference,
+                    vector<uint8_t> &out) const override
+        {
+            return gdalEncodeBlock(data, width, height, "LERC", false, max_error, out);
+        }
+
+        bool decode(const uint8_t *in, size_t size, int width, int height, int16_t *data) const override
+        {
+            return gdalDecodeBlock(in, size, width, height, "LERC", false, data);
+        }
+
+    private:
+        double max_error;
+    };
+
+    // raw little endian int16, optionally horizontally differenced, compressed by gdal's zstd compressor
+    class BinCodec : public TileCodec
+    {
+    public:
+        BinCodec(int level, bool delta)
+            : level{level}, delta{delta}
+        {
+        }
+
+        string name() const override { return delta ? "bin(delta)" : "bin"; }
+        string extension() const override { return "bin"; }
+
+        bool encode(const int16_t *data, int width, int height, const TileGeoreference *georeference,
+                    vector<uint8_t> &out) const override
+        {
+            const CPLCompressor *compressor = CPLGetCompressor("zstd");
+            if (!compressor)
+                return false;
+
+            size_t count = (size_t)width * height;
+            vector<uint16_t> values((const uint16_t *)data, (const uint16_t *)data + count);
+            if (delta)
+            {
+                for (int y = 0; y < height; y++)
+                {
+                    uint16_t *row = &values[(size_t)y * width];
+                    for (int x = width - 1; x > 0; x--)
+                        row[x] = (uint16_t)(row[x] - row[x - 1]);
+                }
+            }
+
+            char **options = nullptr;
+            if (level > 0)
+                options = CSLSetNameValue(options, "LEVEL", to_string(level).c_str());
+
+            // sized by the compressor, freed with VSIFree
+            void *output = nullptr;
+            size_t output_size = 0;
+            bool ok = compressor->pfnFunc(values.data(), count * sizeof(uint16_t), &output, &output_size, options,
+                                          compressor->user_data);
+            CSLDestroy(options);
+            if (ok)
+                out.assign((uint8_t *)output, (uint8_t *)output + output_size);
+            VSIFree(output);
+            return ok;
+        }
+
+        bool decode(const uint8_t *in, size_t size, int width, int height, int16_t *data) const override
+        {
+            const CPLCompressor *decompressor = CPLGetDecompressor("zstd");
+            if (!decompressor)
+                return false;
+
+            size_t count = (size_t)width * height;
+            void *output = data;
+            size_t output_size = count * sizeof(int16_t);
+            if (!decompressor->pfnFunc(in, size, &output, &output_size, nullptr, decompressor->user_data) ||
+                output_size != count * sizeof(int16_t))
+                return false;
+
+            if (delta)
+            {
+                uint16_t *values = (uint16_t *)data;
+                for (int y = 0; y < height; y++)
+                {
+                    uint16_t *row = &values[(size_t)y * width];
+                    for (int x = 1; x < width; x++)
+                        row[x] = (uint16_t)(row[x] + row[x - 1]);
+                }
+            }
+            return true;
+        }
+
+    private:
+        int level;
+        bool delta;
+    };
+}
+
+shared_ptr<TileCodec> createTileCodec(const string &type, const TileCodecOptions &options)
+{
+    if (type == "png")
+        return make_shared<PngCodec>();
+    if (type == "tif")
+        return make_shared<TifCodec>();
+    if (type == "webp")
+        return make_shared<WebpCodec>();
+    if (type == "lerc")
+        return make_shared<LercCodec>(options.max_error);
+    if (type == "bin")
+        return make_shared<BinCodec>(options.level, options.delta);
+    return nullptr;
+}
+
+bool writeTileFile(const string &path, const vector<uint8_t> &bytes)
+{
+    metrics::Scope scope(metrics::WRITE);
+    // a lease taken over from a slow worker may have two processes write the same tile, each writes its own
+    // temporary file and the rename publishes a complete tile either way
+    string tmp = uniqueTempPath(path);
+    error_code ec;
+    {
+        ofstream file(tmp, ios::binary);
+        file.write((const char *)bytes.data(), bytes.size());
+        if (!file.good())
+        {
+            logger::ERROR("cannot write " + path);
+            file.close();
+            filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    filesystem::rename(tmp, path, ec);
+    if (ec)
+    {
+        logger::ERROR("cannot write " + path);
+        filesystem::remove(tmp, ec);
+        return false;
+    }
+
+    metrics::add(metrics::TILES_WRITTEN);
+    metrics::add(metrics::BYTES_WRITTEN, bytes.size());
+    return true;
+}
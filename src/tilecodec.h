@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+/**
+ * @brief
+ * options of the tile codecs, each codec reads the ones it knows
+ */
+struct TileCodecOptions
+{
+    // lerc, max height error in meters, 0 is lossless
+    double max_error = 0.0;
+    // bin, zstd level, 0 is the zstd default
+    int level = 0;
+    // bin, heights are stored as differences to their left neighbour
+    bool delta = false;
+};
+
+/**
+ * @brief
+ * where a tile is, for the formats that carry a georeference (tif). bounds are the pixel centers of the corner
+ * pixels, in the units of the projection (WKT)
+ */
+struct TileGeoreference
+{
+    std::string projection;
+    double west = 0.0;
+    double south = 0.0;
+    double east = 0.0;
+    double north = 0.0;
+};
+
+/**
+ * @brief
+ * encodes a tile of int16 heights (NODATA already replaced) into the bytes of its file and back
+ */
+class TileCodec
+{
+public:
+    virtual ~TileCodec();
+
+    virtual std::string name() const = 0;
+    virtual std::string extension() const = 0;
+    // georeference may be nullptr
+    virtual bool encode(const int16_t *data, int width, int height, const TileGeoreference *georeference,
+                        std::vector<uint8_t> &out) const = 0;
+    virtual bool decode(const uint8_t *in, size_t size, int width, int height, int16_t *data) const = 0;
+};
+
+/**
+ * @brief
+ * png (16 bit grey), tif (GeoTIFF), webp (lossless, terrain-rgb: height = -10000 + (r * 65536 + g * 256 + b) * 0.1),
+ * lerc (a raw lerc2 blob), bin (raw little endian int16 + zstd). nullptr for other types
+ */
+std::shared_ptr<TileCodec> createTileCodec(const std::string &type, const TileCodecOptions &options = TileCodecOptions());
+
+/**
+ * @brief
+ * compresses one width x height int16 block with gdal's GTiff driver and returns the bytes of its only strip.
+ * compress is a GTiff COMPRESS value (ZSTD, LERC, LERC_DEFLATE, ...), predictor is horizontal differencing
+ */
+bool gdalEncodeBlock(const int16_t *data, int width, int height, const std::string &compress, bool predictor,
+                     double max_error, std::vector<uint8_t> &out);
+
+/**
+ * @brief
+ * decodes a block of gdalEncodeBlock by wrapping it into a one strip tiff
+ */
+bool gdalDecodeBlock(const uint8_t *in, size_t size, int width, int height, const std::string &compress, bool predictor,
+                     int16_t *data);
+
+/**
+ * @brief
+ * writes a temporary file of its own (uniqueTempPath) and renames it into place, a crash never leaves a truncated
+ * tile that would be skipped as done
+ */
+bool writeTileFile(const std::string &path, const std::vector<uint8_t> &bytes);
@@ -0,0 +1,585 @@
+/**
+ * @file tilematrixset.cpp
+ * @brief
+ * tile pyramids over geographic, web mercator, polar stereographic and utm crs
+ *
+ * 瓦片行列号与坐标范围的换算。经纬度和墨卡托可按行列分离计算；极地立体投影和UTM每个瓦片只精确变换一个粗网格的
+ * 节点，像素坐标由双线性插值得到，网格密度按(z, 行)缓存，保证插值误差不超过设定的像素误差
+ *
+ */
+
+#include "tilematrixset.h"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include <ogr_spatialref.h>
+
+using namespace std;
+
+static const double MAX_MERCATOR_LATITUDE = 85.0511287798066;
+static const double METERS_PER_DEGREE = EARTH_RADIUS * M_PI / 180.0;
+static const int MAX_GRID_CELLS = 64;
+
+// points the transformation failed for
+static const double INVALID = numeric_limits<double>::quiet_NaN();
+
+static inline double wrapLon(double lon)
+{
+    while (lon >= 180.0)
+        lon -= 360.0;
+    while (lon < -180.0)
+        lon += 360.0;
+    return lon;
+}
+
+TileMatrixSet::TileMatrixSet(double west, double south, double east, double north, int cols0, int rows0,
+                             double meters_per_unit)
+    : west{west}, south{south}, east{east}, north{north}, cols0{cols0}, rows0{rows0}, meters_per_unit{meters_per_unit}
+{
+}
+
+TileMatrixSet::~TileMatrixSet()
+{
+}
+
+void TileMatrixSet::tileBounds(int z, int x, int y, double &west, double &south, double &east, double &north) const
+{
+    double x_step = (this->east - this->west) / tilesX(z);
+    double y_step = (this->north - this->south) / tilesY(z);
+    west = this->west + x * x_step;
+    east = west + x_step;
+    north = this->north - y * y_step;
+    south = north - y_step;
+}
+
+void TileMatrixSet::tileLonLatBounds(int z, int x, int y, double &west, double &south, double &east, double &north) const
+{
+    double w, s, e, n;
+    tileBounds(z, x, max(y, 0), w, s, e, n);
+    if (y < 0)
+    {
+        s = this->south;
+        n = this->north;
+    }
+
+    if (separable())
+    {
+        double xs[2] = {w, e};
+        double ys[2] = {s, n};
+        double lons[2], lats[2];
+        toLonLat(2, xs, ys, lons, lats);
+        west = lons[0];
+        south = lats[0];
+        east = lons[1];
+        north = lats[1];
+        return;
+    }
+
+    // the edges of the rectangle, the extremes of lon/lat lie on them unless a pole is inside
+    const int n_edge = 32;
+    vector<double> xs, ys;
+    for (int i = 0; i <= n_edge; i++)
+    {
+        double t = (double)i / n_edge;
+        xs.insert(xs.end(), {w + t * (e - w), w + t * (e - w), w, e});
+        ys.insert(ys.end(), {s, n, s + t * (n - s), s + t * (n - s)});
+    }
+    vector<double> lons(xs.size()), lats(xs.size());
+    toLonLat(xs.size(), xs.data(), ys.data(), lons.data(), lats.data());
+
+    west = south = 1e9;
+    east = north = -1e9;
+    for (size_t i = 0; i < lons.size(); i++)
+    {
+        if (std::isnan(lons[i]) || std::isnan(lats[i]))
+            continue;
+        west = min(west, lons[i]);
+        east = max(east, lons[i]);
+        south = min(south, lats[i]);
+        north = max(north, lats[i]);
+    }
+
+    double pole_lon[2] = {0.0, 0.0};
+    double pole_lat[2] = {90.0, -90.0};
+    double pole_x[2], pole_y[2];
+    fromLonLat(2, pole_lon, pole_lat, pole_x, pole_y);
+    for (int i = 0; i < 2; i++)
+    {
+        if (pole_x[i] >= w && pole_x[i] <= e && pole_y[i] >= s && pole_y[i] <= n)
+        {
+            west = -180.0;
+            east = 180.0;
+            (i == 0 ? north : south) = pole_lat[i];
+        }
+    }
+
+    // crossing the antimeridian, a narrower range would need two rectangles
+    if (east - west > 180.0)
+    {
+        west = -180.0;
+        east = 180.0;
+    }
+}
+
+void TileMatrixSet::tileRows(int z, int x, int y, int width, int height, double &west, double &east, double *lat) const
+{
+    double south, north;
+    tileBounds(z, x, y, west, south, east, north);
+
+    double yStep = height > 1 ? (north - south) / (height - 1) : 0.0;
+    vector<double> xs(height, 0.5 * (west + east));
+    vector<double> ys(height);
+    for (int r = 0; r < height; r++)
+        ys[r] = north - r * yStep;
+    vector<double> lons(height);
+    toLonLat(height, xs.data(), ys.data(), lons.data(), lat);
+
+    double xe[2] = {west, east};
+    double ye[2] = {ys[0], ys[0]};
+    double lone[2], late[2];
+    toLonLat(2, xe, ye, lone, late);
+    west = lone[0];
+    east = lone[1];
+}
+
+void TileMatrixSet::tilePixels(int z, int x, int y, int width, int height, double *lon, double *lat)
+{
+    if (separable())
+    {
+        double west, east;
+        vector<double> lats(height);
+        tileRows(z, x, y, width, height, west, east, lats.data());
+        double xStep = width > 1 ? (east - west) / (width - 1) : 0.0;
+        for (int r = 0; r < height; r++)
+        {
+            for (int c = 0; c < width; c++)
+            {
+                lon[(size_t)r * width + c] = west + c * xStep;
+                lat[(size_t)r * width + c] = lats[r];
+            }
+        }
+        return;
+    }
+
+    int cells = gridCells(z, y, width, height);
+    if (cells > 0)
+    {
+        interpolateGrid(z, x, y, width, height, cells, lon, lat);
+        return;
+    }
+
+    double west, south, east, north;
+    tileBounds(z, x, y, west, south, east, north);
+    double xStep = width > 1 ? (east - west) / (width - 1) : 0.0;
+    double yStep = height > 1 ? (north - south) / (height - 1) : 0.0;
+    vector<double> xs((size_t)width * height), ys((size_t)width * height);
+    for (int r = 0; r < height; r++)
+    {
+        for (int c = 0; c < width; c++)
+        {
+            xs[(size_t)r * width + c] = west + c * xStep;
+            ys[(size_t)r * width + c] = north - r * yStep;
+        }
+    }
+    toLonLat(xs.size(), xs.data(), ys.data(), lon, lat);
+}
+
+void TileMatrixSet::gridCorners(int z, int x, int y, int cells, vector<double> &cell_lon, vector<double> &cell_lat) const
+{
+    double west, south, east, north;
+    tileBounds(z, x, y, west, south, east, north);
+
+    // exact positions of the grid nodes
+    int nodes = cells + 1;
+    vector<double> xs(nodes * nodes), ys(nodes * nodes);
+    for (int j = 0; j < nodes; j++)
+    {
+        for (int i = 0; i < nodes; i++)
+        {
+            xs[j * nodes + i] = west + (east - west) * i / cells;
+            ys[j * nodes + i] = north - (north - south) * j / cells;
+        }
+    }
+    vector<double> node_lon(nodes * nodes), node_lat(nodes * nodes);
+    toLonLat(xs.size(), xs.data(), ys.data(), node_lon.data(), node_lat.data());
+
+    // corner longitudes of every cell, unwrapped against its first corner
+    cell_lon.resize(cells * cells * 4);
+    cell_lat.resize(cells * cells * 4);
+    for (int j = 0; j < cells; j++)
+    {
+        for (int i = 0; i < cells; i++)
+        {
+            int corners[4] = {j * nodes + i, j * nodes + i + 1, (j + 1) * nodes + i, (j + 1) * nodes + i + 1};
+            double *cl = &cell_lon[(j * cells + i) * 4];
+            double *ct = &cell_lat[(j * cells + i) * 4];
+            for (int k = 0; k < 4; k++)
+            {
+                double value = node_lon[corners[k]];
+                if (k > 0 && value - cl[0] > 180.0)
+                    value -= 360.0;
+                else if (k > 0 && cl[0] - value > 180.0)
+                    value += 360.0;
+                cl[k] = value;
+                ct[k] = node_lat[corners[k]];
+            }
+        }
+    }
+}
+
+void TileMatrixSet::interpolateGrid(int z, int x, int y, int width, int height, int cells, double *lon, double *lat) const
+{
+    vector<double> cell_lon, cell_lat;
+    gridCorners(z, x, y, cells, cell_lon, cell_lat);
+
+    vector<int> cx(width);
+    vector<double> tx(width);
+    for (int c = 0; c < width; c++)
+    {
+        double f = width > 1 ? (double)c * cells / (width - 1) : 0.0;
+        cx[c] = min((int)f, cells - 1);
+        tx[c] = f - cx[c];
+    }
+
+    for (int r = 0; r < height; r++)
+    {
+        double f = height > 1 ? (double)r * cells / (height - 1) : 0.0;
+        int cy = min((int)f, cells - 1);
+        double ty = f - cy;
+        for (int c = 0; c < width; c++)
+        {
+            const double *cl = &cell_lon[(cy * cells + cx[c]) * 4];
+            const double *ct = &cell_lat[(cy * cells + cx[c]) * 4];
+            double t = tx[c];
+            double w00 = (1.0 - t) * (1.0 - ty), w10 = t * (1.0 - ty), w01 = (1.0 - t) * ty, w11 = t * ty;
+            size_t k = (size_t)r * width + c;
+            // a failed corner makes the pixel NAN, i.e. NODATA
+            lon[k] = wrapLon(w00 * cl[0] + w10 * cl[1] + w01 * cl[2] + w11 * cl[3]);
+            lat[k] = w00 * ct[0] + w10 * ct[1] + w01 * ct[2] + w11 * ct[3];
+        }
+    }
+}
+
+double TileMatrixSet::gridError(int z, int x, int y, int width, int height, int cells) const
+{
+    // bilinear interpolation is worst half way between the nodes: in the middle of the edges for conformal
+    // projections, whose curvatures along x and y cancel in the middle of a cell
+    vector<double> cell_lon, cell_lat;
+    gridCorners(z, x, y, cells, cell_lon, cell_lat);
+
+    double west, south, east, north;
+    tileBounds(z, x, y, west, south, east, north);
+
+    const double tests[5][2] = {{0.5, 0.0}, {0.0, 0.5}, {0.5, 0.5}, {1.0, 0.5}, {0.5, 1.0}};
+    vector<double> xs, ys, a_lons, a_lats;
+    for (int j = 0; j < cells; j++)
+    {
+        for (int i = 0; i < cells; i++)
+        {
+            const double *cl = &cell_lon[(j * cells + i) * 4];
+            const double *ct = &cell_lat[(j * cells + i) * 4];
+            for (auto &test : tests)
+            {
+                double t = test[0], u = test[1];
+                double w00 = (1.0 - t) * (1.0 - u), w10 = t * (1.0 - u), w01 = (1.0 - t) * u, w11 = t * u;
+                xs.push_back(west + (east - west) * (i + t) / cells);
+                ys.push_back(north - (north - south) * (j + u) / cells);
+                a_lons.push_back(w00 * cl[0] + w10 * cl[1] + w01 * cl[2] + w11 * cl[3]);
+                a_lats.push_back(w00 * ct[0] + w10 * ct[1] + w01 * ct[2] + w11 * ct[3]);
+            }
+        }
+    }
+    vector<double> exact_lon(xs.size()), exact_lat(xs.size());
+    toLonLat(xs.size(), xs.data(), ys.data(), exact_lon.data(), exact_lat.data());
+
+    double pixel_meters = max(east - west, north - south) / (min(width, height) - 1) * meters_per_unit;
+    double error = 0.0;
+    for (size_t i = 0; i < xs.size(); i++)
+    {
+        double a_lon = a_lons[i], a_lat = a_lats[i];
+        if (std::isnan(a_lon) || std::isnan(a_lat) || std::isnan(exact_lon[i]) || std::isnan(exact_lat[i]))
+            continue;
+        double dlon = wrapLon(a_lon - exact_lon[i]);
+        double dx = dlon * METERS_PER_DEGREE * cos(exact_lat[i] * M_PI / 180.0);
+        double dy = (a_lat - exact_lat[i]) * METERS_PER_DEGREE;
+        error = max(error, sqrt(dx * dx + dy * dy) / pixel_meters);
+    }
+    return error;
+}
+
+int TileMatrixSet::gridCells(int z, int y, int width, int height)
+{
+    int64_t key = (int64_t)z << 32 | (uint32_t)y;
+    {
+        lock_guard<mutex> lock(grid_mutex);
+        auto iter = grid_cells.find(key);
+        if (iter != grid_cells.end())
+            return iter->second;
+    }
+
+    // up to 33 tiles spread over the row, the distortion changes smoothly along it.
+    // they have to meet half the bound so that the tiles in between stay below it
+    int x_num = tilesX(z);
+    int samples = min(x_num, 32);
+    vector<int> columns;
+    for (int i = 0; i <= samples; i++)
+        columns.push_back(min(x_num - 1, (int)((int64_t)i * x_num / samples)));
+    columns.erase(unique(columns.begin(), columns.end()), columns.end());
+
+    int cells = 0;
+    for (int n = 1; n <= MAX_GRID_CELLS && n < min(width, height) - 1; n *= 2)
+    {
+        double error = 0.0;
+        for (int x : columns)
+            error = max(error, gridError(z, x, y, width, height, n));
+        if (error <= error_bound * 0.5)
+        {
+            cells = n;
+            break;
+        }
+    }
+    if (cells == 0)
+        exact_rows++;
+
+    lock_guard<mutex> lock(grid_mutex);
+    grid_cells[key] = cells;
+    return cells;
+}
+
+void TileMatrixSet::tileRange(int z, double west, double south, double east, double north,
+                              int &x_begin, int &y_begin, int &x_end, int &y_end) const
+{
+    // the corners are enough if columns are meridians and rows parallels
+    const int n = separable() ? 1 : 16;
+    vector<double> lons, lats;
+    for (int j = 0; j <= n; j++)
+    {
+        for (int i = 0; i <= n; i++)
+        {
+            lons.push_back(west + (east - west) * i / n);
+            lats.push_back(south + (north - south) * j / n);
+        }
+    }
+    vector<double> xs(lons.size()), ys(lons.size());
+    fromLonLat(lons.size(), lons.data(), lats.data(), xs.data(), ys.data());
+
+    double x0 = 1e300, y0 = 1e300, x1 = -1e300, y1 = -1e300;
+    for (size_t i = 0; i < xs.size(); i++)
+    {
+        if (std::isnan(xs[i]) || std::isnan(ys[i]))
+            continue;
+        x0 = min(x0, xs[i]);
+        x1 = max(x1, xs[i]);
+        y0 = min(y0, ys[i]);
+        y1 = max(y1, ys[i]);
+    }
+
+    int x_num = tilesX(z);
+    int y_num = tilesY(z);
+    if (x0 > x1)
+    {
+        x_begin = y_begin = 0;
+        x_end = y_end = -1;
+        return;
+    }
+
+    double x_step = (this->east - this->west) / x_num;
+    double y_step = (this->north - this->south) / y_num;
+    x_begin = (int)max(0.0, floor((x0 - this->west) / x_step));
+    x_end = (int)min(x_num - 1.0, floor((x1 - this->west) / x_step));
+    y_begin = (int)max(0.0, floor((this->north - y1) / y_step));
+    y_end = (int)min(y_num - 1.0, floor((this->north - y0) / y_step));
+}
+
+double TileMatrixSet::lodZeroResolution(int tile_size) const
+{
+    double width = (east - west) / cols0;
+    return width * meters_per_unit / METERS_PER_DEGREE / (tile_size - 1.0);
+}
+
+namespace
+{
+    class GeographicMatrixSet : public TileMatrixSet
+    {
+    public:
+        GeographicMatrixSet()
+            : TileMatrixSet(-180.0, -90.0, 180.0, 90.0, 2, 1, METERS_PER_DEGREE)
+        {
+        }
+
+        string name() const override { return "geographic"; }
+        int epsg() const override { return 4326; }
+
+        string projection() const override
+        {
+            return R"(GEOGCS["WGS 84",DATUM["WGS_1984",SPHEROID["WGS 84",6378137,298.257223563,AUTHORITY["EPSG","7030"]],AUTHORITY["EPSG","6326"]],PRIMEM["Greenwich",0,AUTHORITY["EPSG","8901"]],UNIT["degree",0.0174532925199433,AUTHORITY["EPSG","9122"]],AUTHORITY["EPSG","4326"]])";
+        }
+
+        bool separable() const override { return true; }
+
+        void toLonLat(size_t count, const double *x, const double *y, double *lon, double *lat) const override
+        {
+            copy(x, x + count, lon);
+            copy(y, y + count, lat);
+        }
+
+        void fromLonLat(size_t count, const double *lon, const double *lat, double *x, double *y) const override
+        {
+            copy(lon, lon + count, x);
+            copy(lat, lat + count, y);
+        }
+    };
+
+    class MercatorMatrixSet : public TileMatrixSet
+    {
+    public:
+        MercatorMatrixSet()
+            : TileMatrixSet(-EARTH_LENGTH, -EARTH_LENGTH, EARTH_LENGTH, EARTH_LENGTH, 1, 1, 1.0)
+        {
+        }
+
+        string name() const override { return "mercator"; }
+        int epsg() const override { return 3857; }
+
+        string projection() const override
+        {
+            return R"(PROJCS["WGS 84 / Pseudo-Mercator",GEOGCS["WGS 84",DATUM["WGS_1984",SPHEROID["WGS 84",6378137,298.257223563,AUTHORITY["EPSG","7030"]],AUTHORITY["EPSG","6326"]],PRIMEM["Greenwich",0,AUTHORITY["EPSG","8901"]],UNIT["degree",0.0174532925199433,AUTHORITY["EPSG","9122"]],AUTHORITY["EPSG","4326"]],PROJECTION["Mercator_1SP"],PARAMETER["central_meridian",0],PARAMETER["scale_factor",1],PARAMETER["false_easting",0],PARAMETER["false_northing",0],UNIT["metre",1,AUTHORITY["EPSG","9001"]],AXIS["Easting",EAST],AXIS["Northing",NORTH],EXTENSION["PROJ4","+proj=merc +a=6378137 +b=6378137 +lat_ts=0 +lon_0=0 +x_0=0 +y_0=0 +k=1 +units=m +nadgrids=@null +wktext +no_defs"],AUTHORITY["EPSG","3857"]])";
+        }
+
+        bool separable() const override { return true; }
+
+        void toLonLat(size_t count, const double *x, const double *y, double *lon, double *lat) const override
+        {
+            for (size_t i = 0; i < count; i++)
+                mercatorToLonlat(x[i], y[i], lon[i], lat[i]);
+        }
+
+        void fromLonLat(size_t count, const double *lon, const double *lat, double *x, double *y) const override
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                double clamped = min(max(lat[i], -MAX_MERCATOR_LATITUDE), MAX_MERCATOR_LATITUDE);
+                lonlatToMercator(lon[i], clamped, x[i], y[i]);
+            }
+        }
+    };
+
+    /**
+     * @brief
+     * any crs known to gdal by its epsg code, transformed with a coordinate transformation per thread
+     */
+    class ProjectedMatrixSet : public TileMatrixSet
+    {
+    public:
+        ProjectedMatrixSet(string name, int epsg, double west, double south, double east, double north)
+            : TileMatrixSet(west, south, east, north, 1, 1, 1.0), set_name{name}, set_epsg{epsg}
+        {
+            crs.importFromEPSG(epsg);
+            crs.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+            wgs84.importFromEPSG(4326);
+            wgs84.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+
+            char *text = nullptr;
+            crs.exportToWkt(&text);
+            wkt = text ? text : "";
+            CPLFree(text);
+        }
+
+        // the extent around (center_x, center_y) reaching the projection of (lon, lat)
+        void fitExtent(double center_x, double center_y, double lon, double lat)
+        {
+            double x, y;
+            fromLonLat(1, &lon, &lat, &x, &y);
+            double half = max(fabs(x - center_x), fabs(y - center_y));
+            west = center_x - half;
+            east = center_x + half;
+            south = center_y - half;
+            north = center_y + half;
+        }
+
+        string name() const override { return set_name; }
+        string projection() const override { return wkt; }
+        int epsg() const override { return set_epsg; }
+
+        void toLonLat(size_t count, const double *x, const double *y, double *lon, double *lat) const override
+        {
+            transform(true, count, x, y, lon, lat);
+        }
+
+        void fromLonLat(size_t count, const double *lon, const double *lat, double *x, double *y) const override
+        {
+            transform(false, count, lon, lat, x, y);
+        }
+
+    private:
+        void transform(bool inverse, size_t count, const double *in_x, const double *in_y, double *out_x, double *out_y) const
+        {
+            // transformations are not thread safe, every thread keeps its own pair per set
+            struct Transforms
+            {
+                unique_ptr<OGRCoordinateTransformation> forward;
+                unique_ptr<OGRCoordinateTransformation> inverse;
+            };
+            thread_local unordered_map<const ProjectedMatrixSet *, Transforms> cache;
+
+            auto &transforms = cache[this];
+            if (!transforms.forward)
+            {
+                lock_guard<mutex> lock(create_mutex);
+                transforms.forward.reset(OGRCreateCoordinateTransformation(&wgs84, &crs));
+                transforms.inverse.reset(OGRCreateCoordinateTransformation(&crs, &wgs84));
+            }
+
+            OGRCoordinateTransformation *ct = inverse ? transforms.inverse.get() : transforms.forward.get();
+            copy(in_x, in_x + count, out_x);
+            copy(in_y, in_y + count, out_y);
+            vector<int> success(count, 0);
+            if (!ct || !ct->Transform((int)count, out_x, out_y, nullptr, success.data()))
+                fill(success.begin(), success.end(), 0);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (!success[i])
+                    out_x[i] = out_y[i] = INVALID;
+            }
+        }
+
+        string set_name;
+        int set_epsg;
+        string wkt;
+        OGRSpatialReference crs;
+        OGRSpatialReference wgs84;
+        mutable mutex create_mutex;
+    };
+}
+
+shared_ptr<TileMatrixSet> createTileMatrixSet(const string &name)
+{
+    if (name == "geographic")
+        return make_shared<GeographicMatrixSet>();
+    if (name == "mercator")
+        return make_shared<MercatorMatrixSet>();
+
+    // a square around the pole reaching the equator
+    if (name == "polar_north" || name == "polar_south")
+    {
+        bool is_north = name == "polar_north";
+        auto set = make_shared<ProjectedMatrixSet>(name, is_north ? 3995 : 3031, -1.0, -1.0, 1.0, 1.0);
+        set->fitExtent(0.0, 0.0, 0.0, 0.0);
+        return set;
+    }
+
+    // utm<zone><n|s>, a 10000 km square on the central meridian from the equator (north) or the south pole (south)
+    if (name.size() >= 5 && name.compare(0, 3, "utm") == 0 && (name.back() == 'n' || name.back() == 's'))
+    {
+        int zone = atoi(name.substr(3, name.size() - 4).c_str());
+        if (zone < 1 || zone > 60)
+            return nullptr;
+        int epsg = (name.back() == 'n' ? 32600 : 32700) + zone;
+        return make_shared<ProjectedMatrixSet>(name, epsg, 500000.0 - 5000000.0, 0.0, 500000.0 + 5000000.0, 10000000.0);
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+
+#define EARTH_RADIUS 6378137.0
+#define EARTH_LENGTH 20037508.34
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+/* 3.1415926535897932384626433832795 */
+#endif
+
+inline void mercatorToLonlat(double x, double y, double &lon, double &lat)
+{
+    lon = x / EARTH_LENGTH * 180.0;
+    lat = y / EARTH_LENGTH * 180.0;
+    lat = 180.0 / M_PI * (2 * atan(exp(lat * M_PI / 180.0)) - M_PI / 2.0);
+}
+
+inline void lonlatToMercator(double lon, double lat, double &x, double &y)
+{
+    x = lon / 180.0 * EARTH_LENGTH;
+    y = log(tan((90.0 + lat) * M_PI / 360.0)) / (M_PI / 180.0);
+    y = y * EARTH_LENGTH / 180.0;
+}
+
+/**
+ * @brief
+ * a tile pyramid over a crs: the extent is split into cols0 x rows0 tiles at level 0, every level doubles both.
+ * tiles share their edge pixels, the corner pixels are centered on the tile bounds.
+ *
+ * crs coordinates are turned into lon/lat by toLonLat. separable sets (geographic, mercator) have meridians as
+ * columns and parallels as rows, their pixels come from tileRows. the others (polar stereographic, utm) go through
+ * tilePixels, which interpolates a coarse per tile transformation grid; the grid density of each (z, row) is chosen
+ * once so that the interpolation error stays below the error bound
+ */
+class TileMatrixSet
+{
+public:
+    virtual ~TileMatrixSet();
+
+    virtual std::string name() const = 0;
+    // WKT of the crs
+    virtual std::string projection() const = 0;
+    virtual int epsg() const = 0;
+    virtual bool separable() const { return false; }
+
+    // count points of crs coordinates to lon/lat, NAN where the transformation fails
+    virtual void toLonLat(size_t count, const double *x, const double *y, double *lon, double *lat) const = 0;
+    virtual void fromLonLat(size_t count, const double *lon, const double *lat, double *x, double *y) const = 0;
+
+    int tilesX(int z) const { return cols0 << z; }
+    int tilesY(int z) const { return rows0 << z; }
+
+    /**
+     * @brief
+     * bounds of tile (z, x, y) in crs units
+     */
+    void tileBounds(int z, int x, int y, double &west, double &south, double &east, double &north) const;
+
+    /**
+     * @brief
+     * lon/lat bounds of tile (z, x, y), the column x of level z if y < 0
+     */
+    void tileLonLatBounds(int z, int x, int y, double &west, double &south, double &east, double &north) const;
+
+    /**
+     * @brief
+     * separable sets only: longitudes of the first and last column and latitude of each of the height rows
+     */
+    void tileRows(int z, int x, int y, int width, int height, double &west, double &east, double *lat) const;
+
+    /**
+     * @brief
+     * lon/lat of every pixel of tile (z, x, y), row by row
+     */
+    void tilePixels(int z, int x, int y, int width, int height, double *lon, double *lat);
+
+    /**
+     * @brief
+     * tiles of level z touched by the lon/lat bounds, clamped to the level
+     */
+    void tileRange(int z, double west, double south, double east, double north,
+                   int &x_begin, int &y_begin, int &x_end, int &y_end) const;
+
+    /**
+     * @brief
+     * degrees per pixel of a level 0 tile, decides the max lod together with the finest source
+     */
+    double lodZeroResolution(int tile_size) const;
+
+    /**
+     * @brief
+     * max distance between the interpolated and the exact position of a pixel, in output pixels
+     */
+    void setErrorBound(double pixels) { error_bound = pixels; }
+    // rows whose distortion could not be met by the grid and were transformed pixel by pixel
+    int64_t exactRows() const { return exact_rows; }
+
+protected:
+    TileMatrixSet(double west, double south, double east, double north, int cols0, int rows0, double meters_per_unit);
+
+    // transformation grid cells per tile side of row y of level z, 0 if every pixel is transformed
+    int gridCells(int z, int y, int width, int height);
+    void gridCorners(int z, int x, int y, int cells, std::vector<double> &cell_lon, std::vector<double> &cell_lat) const;
+    void interpolateGrid(int z, int x, int y, int width, int height, int cells, double *lon, double *lat) const;
+    double gridError(int z, int x, int y, int width, int height, int cells) const;
+
+    double west;
+    double south;
+    double east;
+    double north;
+    int cols0;
+    int rows0;
+    double meters_per_unit;
+    double error_bound = 0.125;
+
+    std::unordered_map<int64_t, int> grid_cells;
+    std::mutex grid_mutex;
+    std::atomic<int64_t> exact_rows = 0;
+};
+
+/**
+ * @brief
+ * geographic, mercator, polar_north (EPSG:3995), polar_south (EPSG:3031), utm<zone><n|s> (EPSG:326zz/327zz),
+ * nullptr for other names
+ */
+std::shared_ptr<TileMatrixSet> createTileMatrixSet(const std::string &name);
@@ -0,0 +1,280 @@
+/**
+ * @file tilestats.cpp
+ * @brief
+ * per tile min/max/mean/nodata statistics
+ *
+ * 基础层的统计在编码前把NODATA置0的同一遍循环里完成(SSE2)，上层瓦片的统计由子瓦片的统计合并得到
+ *
+ */
+
+#include "tilestats.h"
+#include "gdem.h"
+#include "unsuck.hpp"
+#include "logger.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TILESTATS_SSE2
+#endif
+
+using namespace std;
+
+void computeTileStats(int16_t *data, size_t count, TileStats &stats, int16_t fill)
+{
+    int16_t vmin = numeric_limits<int16_t>::max();
+    int16_t vmax = numeric_limits<int16_t>::min();
+    int64_t sum = 0;
+    uint64_t nodata = 0;
+    size_t i = 0;
+
+#ifdef TILESTATS_SSE2
+    const __m128i vnodata = _mm_set1_epi16(NODATA);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i vfill = _mm_set1_epi16(fill);
+    __m128i mins = _mm_set1_epi16(numeric_limits<int16_t>::max());
+    __m128i maxs = _mm_set1_epi16(numeric_limits<int16_t>::min());
+
+    // the 32 bit sums and 16 bit nodata counters are drained before they can overflow
+    const size_t batch = 8 * 4096;
+    while (i + 8 <= count)
+    {
+        __m128i sums = _mm_setzero_si128();
+        __m128i invalid = _mm_setzero_si128();
+        size_t end = min(count - (count - i) % 8, i + batch);
+        for (; i < end; i += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+            __m128i valid = _mm_cmpgt_epi16(v, vnodata);
+            __m128i masked = _mm_and_si128(valid, v);
+
+            mins = _mm_min_epi16(mins, _mm_or_si128(masked, _mm_andnot_si128(valid, _mm_set1_epi16(numeric_limits<int16_t>::max()))));
+            maxs = _mm_max_epi16(maxs, _mm_or_si128(masked, _mm_andnot_si128(valid, _mm_set1_epi16(numeric_limits<int16_t>::min()))));
+            sums = _mm_add_epi32(sums, _mm_madd_epi16(masked, ones));
+            invalid = _mm_sub_epi16(invalid, _mm_cmpeq_epi16(valid, _mm_setzero_si128()));
+
+            _mm_storeu_si128((__m128i *)(data + i), _mm_or_si128(masked, _mm_andnot_si128(valid, vfill)));
+        }
+
+        int32_t s[4];
+        int16_t n[8];
+        _mm_storeu_si128((__m128i *)s, sums);
+        _mm_storeu_si128((__m128i *)n, invalid);
+        sum += (int64_t)s[0] + s[1] + s[2] + s[3];
+        for (int k = 0; k < 8; k++)
+            nodata += (uint16_t)n[k];
+    }
+
+    int16_t lanes[8];
+    _mm_storeu_si128((__m128i *)lanes, mins);
+    for (int k = 0; k < 8; k++)
+        vmin = min(vmin, lanes[k]);
+    _mm_storeu_si128((__m128i *)lanes, maxs);
+    for (int k = 0; k < 8; k++)
+        vmax = max(vmax, lanes[k]);
+#endif
+
+    for (; i < count; i++)
+    {
+        int16_t v = data[i];
+        if (v <= NODATA)
+        {
+            data[i] = fill;
+            nodata++;
+            continue;
+        }
+        vmin = min(vmin, v);
+        vmax = max(vmax, v);
+        sum += v;
+    }
+
+    uint64_t valid = count - nodata;
+    stats.nodata = (uint32_t)nodata;
+    stats.min = valid > 0 ? vmin : 0;
+    stats.max = valid > 0 ? vmax : 0;
+    stats.mean = valid > 0 ? (float)((double)sum / valid) : 0.0f;
+}
+
+void mergeTileStats(const TileStats *children[4], uint32_t count, TileStats &stats)
+{
+    int16_t vmin = numeric_limits<int16_t>::max();
+    int16_t vmax = numeric_limits<int16_t>::min();
+    double sum = 0.0;
+    uint64_t valid = 0;
+    uint64_t nodata = 0;
+
+    // every child covers a quarter of the parent
+    for (int i = 0; i < 4; i++)
+    {
+        const TileStats *child = children[i];
+        if (!child)
+        {
+            nodata += count;
+            continue;
+        }
+
+        nodata += child->nodata;
+        uint64_t child_valid = count - min(child->nodata, count);
+        if (child_valid == 0)
+            continue;
+
+        vmin = min(vmin, child->min);
+        vmax = max(vmax, child->max);
+        sum += (double)child->mean * child_valid;
+        valid += child_valid;
+    }
+
+    stats.nodata = (uint32_t)min<uint64_t>(nodata / 4, count);
+    stats.min = valid > 0 ? vmin : 0;
+    stats.max = valid > 0 ? vmax : 0;
+    stats.mean = valid > 0 ? (float)(sum / valid) : 0.0f;
+}
+
+TileStatsIndex::TileStatsIndex(string out_dir)
+    : out_dir{out_dir}
+{
+}
+
+string TileStatsIndex::outDir() const
+{
+    return out_dir;
+}
+
+uint64_t TileStatsIndex::recordKey(const Record &record)
+{
+    return ((uint64_t)record.x << 32) | record.y;
+}
+
+void TileStatsIndex::sortLevel(Level &level)
+{
+    if (level.sorted)
+        return;
+
+    // stable, so that the latest record of a tile wins
+    stable_sort(level.records.begin(), level.records.end(), [](const Record &a, const Record &b)
+                { return recordKey(a) < recordKey(b); });
+
+    vector<Record> unique;
+    unique.reserve(level.records.size());
+    for (auto &record : level.records)
+    {
+        if (!unique.empty() && recordKey(unique.back()) == recordKey(record))
+            unique.back() = record;
+        else
+            unique.push_back(record);
+    }
+    level.records.swap(unique);
+    level.sorted = true;
+}
+
+void TileStatsIndex::put(int z, int x, int y, const TileStats &stats)
+{
+    Record record{(uint32_t)x, (uint32_t)y, stats.min, stats.max, stats.mean, stats.nodata};
+
+    lock_guard<mutex> lock(mtx);
+    Level &level = levels[z];
+    if (level.sorted && !level.records.empty() && recordKey(level.records.back()) >= recordKey(record))
+        level.sorted = false;
+    level.records.push_back(record);
+}
+
+bool TileStatsIndex::get(int z, int x, int y, TileStats &stats)
+{
+    lock_guard<mutex> lock(mtx);
+    auto iter = levels.find(z);
+    if (iter == levels.end())
+        return false;
+
+    Level &level = iter->second;
+    sortLevel(level);
+
+    Record key{};
+    key.x = (uint32_t)x;
+    key.y = (uint32_t)y;
+    auto found = lower_bound(level.records.begin(), level.records.end(), key, [](const Record &a, const Record &b)
+                             { return recordKey(a) < recordKey(b); });
+    if (found == level.records.end() || recordKey(*found) != recordKey(key))
+        return false;
+
+    stats.min = found->min;
+    stats.max = found->max;
+    stats.mean = found->mean;
+    stats.nodata = found->nodata;
+    return true;
+}
+
+void TileStatsIndex::load()
+{
+    loadDir(out_dir + "/stats");
+}
+
+void TileStatsIndex::merge(const string &other_dir)
+{
+    loadDir(other_dir + "/stats");
+}
+
+void TileStatsIndex::loadDir(const string &dir)
+{
+    if (!fs::is_directory(dir))
+        return;
+
+    lock_guard<mutex> lock(mtx);
+    for (auto &entry : fs::directory_iterator(dir))
+    {
+        string path = entry.path().string();
+        if (!iEndsWith(path, ".bin"))
+            continue;
+
+        auto buffer = readBinaryFile(path);
+        if (buffer->size < 16 || memcmp(buffer->data, "GTS1", 4) != 0)
+        {
+            logger::WARN(path + " is not a valid stats index.");
+            continue;
+        }
+
+        int32_t z;
+        uint64_t n;
+        memcpy(&z, buffer->data_u8 + 4, 4);
+        memcpy(&n, buffer->data_u8 + 8, 8);
+        if (buffer->size < (int64_t)(16 + n * sizeof(Record)))
+        {
+            logger::WARN(path + " is truncated.");
+            continue;
+        }
+
+        Level &level = levels[z];
+        size_t offset = level.records.size();
+        level.records.resize(offset + n);
+        memcpy(level.records.data() + offset, buffer->data_u8 + 16, n * sizeof(Record));
+        level.sorted = offset == 0;
+    }
+}
+
+void TileStatsIndex::save()
+{
+    string dir = out_dir + "/stats";
+    fs::create_directories(dir);
+
+    lock_guard<mutex> lock(mtx);
+    for (auto &[z, level] : levels)
+    {
+        sortLevel(level);
+
+        uint64_t n = level.records.size();
+        Buffer buffer(16 + n * sizeof(Record));
+        memcpy(buffer.data_u8, "GTS1", 4);
+        int32_t iz = z;
+        memcpy(buffer.data_u8 + 4, &iz, 4);
+        memcpy(buffer.data_u8 + 8, &n, 8);
+        if (n > 0)
+            memcpy(buffer.data_u8 + 16, level.records.data(), n * sizeof(Record));
+
+        // write to a temporary file first, a crash must not leave a truncated index behind
+        string path = dir + "/" + formatNumber(z) + ".bin";
+        string tmp = uniqueTempPath(path);
+        writeBinaryFile(tmp, buffer);
+        fs::rename(tmp, path);
+    }
+}
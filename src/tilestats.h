@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+/**
+ * @brief
+ * elevation statistics of a tile, min/max/mean are over the valid pixels only
+ */
+struct TileStats
+{
+    int16_t min = 0;
+    int16_t max = 0;
+    float mean = 0.0f;
+    uint32_t nodata = 0;
+};
+
+/**
+ * @brief
+ * one pass over the tile before encoding: computes the stats and replaces values <= NODATA by fill, 0 for the image
+ * types and NODATA for the cog, whose GDAL_NODATA tag marks the voids
+ */
+void computeTileStats(int16_t *data, size_t count, TileStats &stats, int16_t fill = 0);
+
+/**
+ * @brief
+ * stats of a parent tile from the stats of its (up to) four children, no pixels are scanned.
+ * children[qx * 2 + qy] is nullptr for missing children, count is the number of pixels of a tile
+ */
+void mergeTileStats(const TileStats *children[4], uint32_t count, TileStats &stats);
+
+/**
+ * @brief
+ * per level binary index of tile stats, <out_dir>/stats/<z>.bin
+ *
+ * | "GTS1" | int32 z | uint64 n | n records sorted by (x, y) |
+ * record: uint32 x, uint32 y, int16 min, int16 max, float mean, uint32 nodata (20 bytes, little endian)
+ */
+class TileStatsIndex
+{
+public:
+    TileStatsIndex(std::string out_dir);
+
+    std::string outDir() const;
+
+    void put(int z, int x, int y, const TileStats &stats);
+    bool get(int z, int x, int y, TileStats &stats);
+
+    // loads the levels written by a previous run, so that skipped tiles keep their stats
+    void load();
+    // adds the levels written to another out_dir, e.g. by a shard
+    void merge(const std::string &other_dir);
+    void save();
+
+private:
+#pragma pack(push, 1)
+    struct Record
+    {
+        uint32_t x;
+        uint32_t y;
+        int16_t min;
+        int16_t max;
+        float mean;
+        uint32_t nodata;
+    };
+#pragma pack(pop)
+
+    struct Level
+    {
+        std::vector<Record> records;
+        bool sorted = true;
+    };
+
+    static uint64_t recordKey(const Record &record);
+    void sortLevel(Level &level);
+    void loadDir(const std::string &dir);
+
+    std::string out_dir;
+    std::map<int, Level> levels;
+    std::mutex mtx;
+};
@@ -0,0 +1,271 @@
+/**
+ * @file trace.cpp
+ * @brief
+ * per thread ring buffers of trace events and their background flush into a chrome trace file
+ *
+ * 每个线程一个单生产者单消费者环形缓冲，记录时无锁；后台线程定期取出事件写入json数组，按瓦片抽样控制文件大小
+ *
+ */
+
+#include "trace.h"
+#include "metrics.h"
+#include "logger.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <cstdio>
+
+using namespace std;
+
+namespace trace
+{
+    struct Event
+    {
+        const char *name;
+        int64_t start;
+        int64_t duration;
+        int32_t arg;
+        // 'X' span, 'i' instant
+        char phase;
+    };
+
+    struct Ring
+    {
+        static const uint64_t CAPACITY = 8192;
+
+        Event events[CAPACITY];
+        // head is written by the owner thread, tail by the flush thread
+        atomic<uint64_t> head = 0;
+        atomic<uint64_t> tail = 0;
+        atomic<uint64_t> dropped = 0;
+        int tid = 0;
+        string name = "worker";
+    };
+
+    static atomic_bool active = false;
+    static uint32_t sample_every = 1;
+    static int64_t max_bytes = 0;
+    static int64_t origin = 0;
+    static atomic<uint64_t> tile_counter = 0;
+
+    // rings outlive their threads, they are drained after the thread is gone
+    static mutex registry_mutex;
+    static vector<unique_ptr<Ring>> registry;
+
+    static FILE *file = nullptr;
+    static int64_t bytes_written = 0;
+    static bool first_event = true;
+    static thread flusher;
+    static atomic_bool stop_requested = false;
+
+    static thread_local Ring *local_ring = nullptr;
+    static thread_local int sample_depth = 0;
+    static thread_local bool sample_on = false;
+    // per name, so that spans of different kinds alternating on a thread are sampled alike
+    static thread_local unordered_map<const char *, uint32_t> event_counters;
+
+    static Ring &ring()
+    {
+        if (!local_ring)
+        {
+            lock_guard<mutex> lock(registry_mutex);
+            registry.push_back(make_unique<Ring>());
+            local_ring = registry.back().get();
+            local_ring->tid = (int)registry.size();
+        }
+        return *local_ring;
+    }
+
+    static void push(const Event &event)
+    {
+        Ring &r = ring();
+        uint64_t head = r.head.load(memory_order_relaxed);
+        if (head - r.tail.load(memory_order_acquire) >= Ring::CAPACITY)
+        {
+            r.dropped.store(r.dropped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            return;
+        }
+        r.events[head % Ring::CAPACITY] = event;
+        r.head.store(head + 1, memory_order_release);
+    }
+
+    static bool sampled(const char *name)
+    {
+        if (sample_depth > 0)
+            return sample_on;
+        return event_counters[name]++ % sample_every == 0;
+    }
+
+    static void writeText(const string &text)
+    {
+        if (bytes_written + (int64_t)text.size() > max_bytes)
+        {
+            if (bytes_written <= max_bytes)
+                logger::WARN("trace: size limit reached, no more events are recorded");
+            // marks the limit as reported
+            bytes_written = max_bytes + 1;
+            return;
+        }
+        fwrite(text.data(), 1, text.size(), file);
+        bytes_written += text.size();
+    }
+
+    static void writeEvent(const Ring &r, const Event &event)
+    {
+        char line[256];
+        double ts = (event.start - origin) * 1e-3;
+        int n;
+        if (event.phase == 'X')
+        {
+            n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                         first_event ? "" : ",\n", event.name, r.tid, ts, event.duration * 1e-3);
+        }
+        else
+        {
+            n = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+                         first_event ? "" : ",\n", event.name, r.tid, ts);
+        }
+        string text(line, min(n, (int)sizeof(line) - 1));
+        if (event.arg >= 0)
+            text += ",\"args\":{\"z\":" + to_string(event.arg) + "}";
+        text += "}";
+
+        writeText(text);
+        first_event = false;
+    }
+
+    static void drain()
+    {
+        vector<Ring *> rings;
+        {
+            lock_guard<mutex> lock(registry_mutex);
+            for (auto &r : registry)
+                rings.push_back(r.get());
+        }
+
+        for (Ring *r : rings)
+        {
+            uint64_t tail = r->tail.load(memory_order_relaxed);
+            uint64_t head = r->head.load(memory_order_acquire);
+            for (uint64_t i = tail; i < head; i++)
+                writeEvent(*r, r->events[i % Ring::CAPACITY]);
+            r->tail.store(head, memory_order_release);
+        }
+        fflush(file);
+    }
+
+    bool start(const string &path, uint32_t sample, int64_t max_size)
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            logger::ERROR("cannot write " + path);
+            return false;
+        }
+
+        sample_every = max<uint32_t>(sample, 1);
+        max_bytes = max_size;
+        origin = metrics::nowNs();
+        writeText("[\n");
+
+        stop_requested = false;
+        flusher = thread([]()
+                         {
+                             while (!stop_requested)
+                             {
+                                 this_thread::sleep_for(chrono::milliseconds(200));
+                                 drain();
+                             } });
+
+        active = true;
+        return true;
+    }
+
+    void stop()
+    {
+        if (!active)
+            return;
+
+        active = false;
+        stop_requested = true;
+        flusher.join();
+        drain();
+
+        // the thread names are written past the size limit, they make the file readable
+        bytes_written = min(bytes_written, max_bytes);
+        max_bytes = INT64_MAX;
+
+        uint64_t dropped = 0;
+        lock_guard<mutex> lock(registry_mutex);
+        for (auto &r : registry)
+        {
+            dropped += r->dropped;
+            writeText(string(first_event ? "" : ",\n") + "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" +
+                      to_string(r->tid) + ",\"args\":{\"name\":\"" + r->name + " " + to_string(r->tid) + "\"}}");
+            first_event = false;
+        }
+        writeText("\n]\n");
+        fclose(file);
+        file = nullptr;
+
+        if (dropped > 0)
+            logger::WARN("trace: " + to_string(dropped) + " events dropped, the flush fell behind");
+    }
+
+    bool enabled()
+    {
+        return active.load(memory_order_relaxed);
+    }
+
+    void nameThread(const char *name)
+    {
+        if (!enabled())
+            return;
+
+        Ring &r = ring();
+        if (r.name == name)
+            return;
+        lock_guard<mutex> lock(registry_mutex);
+        r.name = name;
+    }
+
+    void span(const char *name, int64_t start_ns, int64_t end_ns, int arg)
+    {
+        if (!enabled() || !sampled(name))
+            return;
+        push(Event{name, start_ns, end_ns - start_ns, arg, 'X'});
+    }
+
+    void instant(const char *name, int arg)
+    {
+        if (!enabled())
+            return;
+        push(Event{name, metrics::nowNs(), 0, arg, 'i'});
+    }
+
+    Sample::Sample()
+    {
+        if (sample_depth++ == 0)
+            sample_on = enabled() && tile_counter.fetch_add(1, memory_order_relaxed) % sample_every == 0;
+    }
+
+    Sample::~Sample()
+    {
+        sample_depth--;
+    }
+
+    Span::Span(const char *name, int arg)
+        : name{name}, arg{arg}, start{enabled() ? metrics::nowNs() : 0}
+    {
+    }
+
+    Span::~Span()
+    {
+        if (start > 0)
+            span(name, start, metrics::nowNs(), arg);
+    }
+}
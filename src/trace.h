@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+/**
+ * @brief
+ * timeline of a run in the chrome trace event format (chrome://tracing, ui.perfetto.dev).
+ *
+ * spans go into a ring buffer of the recording thread without locks, a background thread drains the rings into the
+ * file, events of a full ring are dropped and counted. only 1 in sample_every tiles is recorded: a Sample decides for
+ * the spans of its scope, spans outside of one (queue waits, writes) are sampled per event. the file is a json array
+ * that is closed by stop, the viewers load it without the closing bracket as well, e.g. after a crash. recording
+ * stops at max_bytes
+ */
+namespace trace
+{
+    bool start(const std::string &path, uint32_t sample_every, int64_t max_bytes);
+    void stop();
+    bool enabled();
+
+    // name of the calling thread on the timeline
+    void nameThread(const char *name);
+    // names are string literals, arg is shown as z if >= 0
+    void span(const char *name, int64_t start_ns, int64_t end_ns, int arg = -1);
+    void instant(const char *name, int arg = -1);
+
+    // a tile: all or none of its spans are recorded
+    struct Sample
+    {
+        Sample();
+        ~Sample();
+    };
+
+    struct Span
+    {
+        const char *name;
+        int arg;
+        int64_t start;
+
+        Span(const char *name, int arg = -1);
+        ~Span();
+    };
+}
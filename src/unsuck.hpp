@@ -71,6 +71,10 @@ void printMemoryReport();
 
 void launchMemoryChecker(int64_t maxMB, double checkInterval);
 
+// a temporary name next to path that no other thread, process or host writing the same path uses, for
+// write-then-rename
+string uniqueTempPath(const string &path);
+
 class punct_facet : public std::numpunct<char>
 {
 protected:
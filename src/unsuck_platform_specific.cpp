@@ -357,4 +357,25 @@ CpuData getCpuData() {
 }
 
 
-#endif
\ No newline at end of file
+#endif
+
+#ifdef _WIN32
+	#include <process.h>
+	#define UNSUCK_GETPID _getpid
+#else
+	#include <unistd.h>
+	#define UNSUCK_GETPID getpid
+#endif
+
+#include <atomic>
+#include <random>
+
+string uniqueTempPath(const string &path) {
+	// pids repeat across the hosts sharing a directory, the random token does not
+	static const uint64_t token = ((uint64_t)std::random_device{}() << 32) ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+	static std::atomic<uint64_t> counter{0};
+
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%d-%016llx-%llu.tmp", (int)UNSUCK_GETPID(), (unsigned long long)token, (unsigned long long)counter++);
+	return path + suffix;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file ziparchive.cpp
+ * @brief
+ * zip central directory reader
+ *
+ * 直接读取GDEM分发的zip包的中央目录，成员通过/vsizip/注册为数据源，无需先解压
+ *
+ */
+
+#include "ziparchive.h"
+#include "unsuck.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+static const uint32_t EOCD_SIGNATURE = 0x06054b50;
+static const uint32_t EOCD64_LOCATOR_SIGNATURE = 0x07064b50;
+static const uint32_t EOCD64_SIGNATURE = 0x06064b50;
+static const uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+
+static const size_t EOCD_SIZE = 22;
+static const size_t EOCD64_LOCATOR_SIZE = 20;
+static const size_t EOCD64_SIZE = 56;
+static const size_t CENTRAL_HEADER_SIZE = 46;
+static const size_t MAX_COMMENT = 0xffff;
+
+static uint16_t le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t le64(const uint8_t *p)
+{
+    return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+static bool readAt(ifstream &in, uint64_t offset, size_t size, vector<uint8_t> &out)
+{
+    out.resize(size);
+    in.clear();
+    in.seekg(offset);
+    in.read((char *)out.data(), size);
+    return (size_t)in.gcount() == size;
+}
+
+bool readZipDirectory(const string &path, ZipDirectory &directory)
+{
+    error_code ec;
+    uint64_t file_size = fs::file_size(path, ec);
+    if (ec || file_size < EOCD_SIZE)
+        return false;
+
+    ifstream in(path, ios::binary);
+    if (!in.is_open())
+        return false;
+
+    // the end of central directory record is followed by a comment of up to 64 KB, the zip64 locator precedes it
+    size_t tail_size = (size_t)min<uint64_t>(file_size, EOCD_SIZE + MAX_COMMENT + EOCD64_LOCATOR_SIZE);
+    uint64_t tail_offset = file_size - tail_size;
+    vector<uint8_t> tail;
+    if (!readAt(in, tail_offset, tail_size, tail))
+        return false;
+
+    int64_t eocd = -1;
+    for (int64_t i = (int64_t)tail_size - EOCD_SIZE; i >= 0; i--)
+    {
+        if (le32(tail.data() + i) == EOCD_SIGNATURE)
+        {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0)
+        return false;
+
+    const uint8_t *p = tail.data() + eocd;
+    uint64_t entries = le16(p + 10);
+    uint64_t cd_size = le32(p + 12);
+    uint64_t cd_offset = le32(p + 16);
+
+    if (entries == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff)
+    {
+        if (eocd < (int64_t)EOCD64_LOCATOR_SIZE)
+            return false;
+        const uint8_t *locator = p - EOCD64_LOCATOR_SIZE;
+        if (le32(locator) != EOCD64_LOCATOR_SIGNATURE)
+            return false;
+
+        vector<uint8_t> eocd64;
+        if (!readAt(in, le64(locator + 8), EOCD64_SIZE, eocd64) || le32(eocd64.data()) != EOCD64_SIGNATURE)
+            return false;
+        entries = le64(eocd64.data() + 32);
+        cd_size = le64(eocd64.data() + 40);
+        cd_offset = le64(eocd64.data() + 48);
+    }
+
+    if (cd_offset + cd_size > file_size)
+        return false;
+
+    vector<uint8_t> cd;
+    if (!readAt(in, cd_offset, (size_t)cd_size, cd))
+        return false;
+
+    directory.path = path;
+    directory.size = file_size;
+    directory.members.clear();
+    size_t pos = 0;
+    for (uint64_t i = 0; i < entries; i++)
+    {
+        if (pos + CENTRAL_HEADER_SIZE > cd.size() || le32(cd.data() + pos) != CENTRAL_HEADER_SIGNATURE)
+            return false;
+
+        const uint8_t *h = cd.data() + pos;
+        uint16_t name_length = le16(h + 28);
+        uint16_t extra_length = le16(h + 30);
+        uint16_t comment_length = le16(h + 32);
+        if (pos + CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length > cd.size())
+            return false;
+
+        ZipMember member;
+        member.method = le16(h + 10);
+        member.compressed_size = le32(h + 20);
+        member.size = le32(h + 24);
+        member.offset = le32(h + 42);
+        member.name.assign((const char *)h + CENTRAL_HEADER_SIZE, name_length);
+
+        // zip64 extra field: the 64 bit values of the fields set to 0xffffffff, in this order
+        const uint8_t *extra = h + CENTRAL_HEADER_SIZE + name_length;
+        for (size_t e = 0; e + 4 <= extra_length;)
+        {
+            uint16_t id = le16(extra + e);
+            uint16_t length = le16(extra + e + 2);
+            // a field past the extra data of the header, e + 4 <= extra_length so this does not wrap
+            if (length > extra_length - (e + 4))
+                return false;
+            if (id == 0x0001)
+            {
+                const uint8_t *value = extra + e + 4;
+                const uint8_t *end = value + length;
+                if (member.size == 0xffffffff && value + 8 <= end)
+                {
+                    member.size = le64(value);
+                    value += 8;
+                }
+                if (member.compressed_size == 0xffffffff && value + 8 <= end)
+                {
+                    member.compressed_size = le64(value);
+                    value += 8;
+                }
+                if (member.offset == 0xffffffff && value + 8 <= end)
+                    member.offset = le64(value);
+            }
+            e += 4 + length;
+        }
+
+        // directories end with a slash
+        if (!member.name.empty() && member.name.back() != '/')
+            directory.members.push_back(member);
+
+        pos += CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+    }
+
+    return true;
+}
+
+string zipMemberPath(const string &archive, const string &member)
+{
+    return "/vsizip/" + archive + "/" + member;
+}
+
+string archivePath(const string &path)
+{
+    if (path.rfind("/vsizip/", 0) != 0)
+        return path;
+
+    // "/vsizip/<archive>.zip/<member>"
+    string rest = path.substr(8);
+    size_t end = rest.find(".zip/");
+    if (end == string::npos)
+        end = rest.find(".ZIP/");
+    return end == string::npos ? rest : rest.substr(0, end + 4);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief
+ * a file of a zip archive as listed by the central directory
+ */
+struct ZipMember
+{
+    std::string name;
+    // 0 stored, 8 deflate
+    uint16_t method = 0;
+    uint64_t compressed_size = 0;
+    uint64_t size = 0;
+    // offset of the local file header
+    uint64_t offset = 0;
+};
+
+/**
+ * @brief
+ * central directory of a zip archive, size and mtime tell whether a cached directory is still valid
+ */
+struct ZipDirectory
+{
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::vector<ZipMember> members;
+};
+
+/**
+ * @brief
+ * reads the central directory (zip64 included) with two reads: the tail holding the end of central directory
+ * record and the central directory itself. members are not decompressed
+ */
+bool readZipDirectory(const std::string &path, ZipDirectory &directory);
+
+/**
+ * @brief
+ * gdal path of a member, reads of it are positioned in the archive and decompressed by gdal
+ */
+std::string zipMemberPath(const std::string &archive, const std::string &member);
+
+/**
+ * @brief
+ * the file on disk behind a source path, the archive for zip members
+ */
+std::string archivePath(const std::string &path);